@@ -3,8 +3,8 @@
  */
 
 #include <math.h>
-#include <syslog.h>
 
+#include "../../log/log.h"
 #include "common.h"
 
 int8_t fd_76 = 0;
@@ -23,14 +23,14 @@ int8_t bme_init(struct bme280_dev* dev, struct identifier* id, uint8_t addr) {
   uint8_t settings_sel = 0;
 
   if (configure_mux()) {
-    syslog(LOG_CRIT, "Failed to configure demux switching.\n");
+    SIMAR_LOG(LOG_CRIT, "Failed to configure demux switching.\n");
     return BUS_FAIL;
   }
 
   int8_t* fd = addr == 0x76 ? &fd_76 : &fd_77;
 
   if (i2c_open(fd, addr)) {
-    syslog(LOG_CRIT, "Failed to open bus");
+    SIMAR_LOG(LOG_CRIT, "Failed to open bus");
     return BUS_FAIL;
   }
 
@@ -44,7 +44,7 @@ int8_t bme_init(struct bme280_dev* dev, struct identifier* id, uint8_t addr) {
   direct_mux(id->mux_id);
 
   if (id->ext_mux_id >= 0)
-    direct_ext_mux(id->ext_mux_id);
+    direct_ext_mux(id->ext_mux_id, id->ext_addr);
 
   rslt = bme280_init(dev);
   if (rslt != BME280_OK)
@@ -62,6 +62,44 @@ int8_t bme_init(struct bme280_dev* dev, struct identifier* id, uint8_t addr) {
   return rslt;
 }
 
+/**
+ * @brief Directs the multiplexers to the sensor's channel
+ * @param[in] dev BME280/BMP280 device
+ */
+static void direct(const struct bme280_dev* dev) {
+  const struct identifier* id = dev->intf_ptr;
+
+  direct_mux(id->mux_id);
+
+  if (id->ext_mux_id >= 0)
+    direct_ext_mux(id->ext_mux_id, id->ext_addr);
+}
+
+/**
+ * @brief Puts the sensor to sleep, after which it only converts when forced (bme_force)
+ * @param[in] dev BME280/BMP280 device
+ * @retval 0 OK
+ * @retval -2 Communication failure
+ */
+int8_t bme_sleep(struct bme280_dev* dev) {
+  direct(dev);
+  return bme280_set_sensor_mode(BME280_SLEEP_MODE, dev);
+}
+
+/**
+ * @brief Starts a single conversion of a sleeping sensor, which goes back to sleep once done
+ *
+ * @details The readout can be fetched with bme_read after bme280_cal_meas_delay() ms.
+ *
+ * @param[in] dev BME280/BMP280 device
+ * @retval 0 OK
+ * @retval -2 Communication failure
+ */
+int8_t bme_force(struct bme280_dev* dev) {
+  direct(dev);
+  return bme280_set_sensor_mode(BME280_FORCED_MODE, dev);
+}
+
 /**
  * @brief Reads sensor data
  * @param[in] dev BME280/BMP280 device
@@ -72,13 +110,7 @@ int8_t bme_init(struct bme280_dev* dev, struct identifier* id, uint8_t addr) {
 int8_t bme_read(struct bme280_dev* dev, struct bme280_data* comp_data) {
   int8_t rslt = BME280_OK;
 
-  struct identifier id;
-  id = *((struct identifier*)dev->intf_ptr);
-
-  direct_mux(id.mux_id);
-
-  if (id.ext_mux_id >= 0)
-    direct_ext_mux(id.ext_mux_id);
+  direct(dev);
 
   rslt = bme280_get_sensor_data(BME280_ALL, comp_data, dev);
   comp_data->pressure *= 0.01;
@@ -12,6 +12,8 @@
 #define MAX_NAME_LEN 16
 
 int8_t bme_read(struct bme280_dev* dev, struct bme280_data* comp_data);
+int8_t bme_sleep(struct bme280_dev* dev);
+int8_t bme_force(struct bme280_dev* dev);
 int8_t bme_init(struct bme280_dev* dev, struct identifier* id, uint8_t address);
 
 /*!
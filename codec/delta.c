@@ -0,0 +1,142 @@
+/*! @file delta.c
+ * @brief Delta encoding of sample batches (zigzag varints)
+ */
+
+#include "delta.h"
+
+#include <math.h>
+
+/**
+ * @brief Appends a signed number as a zigzag varint (7 bits per byte, low bits first)
+ * @param[out] buf Output
+ * @param[in] value Number
+ * @returns Bytes written
+ */
+static size_t put_varint(uint8_t* buf, int64_t value) {
+  uint64_t u = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  size_t len = 0;
+
+  while (u >= 0x80) {
+    buf[len++] = (u & 0x7f) | 0x80;
+    u >>= 7;
+  }
+  buf[len++] = u;
+
+  return len;
+}
+
+/**
+ * @brief Reads a zigzag varint
+ * @param[in, out] d Decoder
+ * @param[out] value Number
+ * @retval 0 OK
+ * @retval -1 Truncated or longer than 64 bits
+ */
+static int8_t get_varint(struct delta_decoder* d, int64_t* value) {
+  uint64_t u = 0;
+
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (d->pos >= d->len)
+      return -1;
+
+    uint8_t byte = d->buf[d->pos++];
+    u |= (uint64_t)(byte & 0x7f) << shift;
+
+    if (!(byte & 0x80)) {
+      *value = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int8_t delta_init(struct delta_encoder* e, uint8_t* buf, size_t size, uint8_t channels) {
+  if (channels < 1 || channels > DELTA_MAX_CHANNELS || size < DELTA_HEADER + DELTA_MAX_SAMPLE)
+    return -1;
+
+  e->buf = buf;
+  e->size = size;
+  e->channels = channels;
+  delta_reset(e);
+
+  return 0;
+}
+
+void delta_reset(struct delta_encoder* e) {
+  e->buf[0] = DELTA_VERSION;
+  e->buf[1] = e->channels;
+  e->len = DELTA_HEADER;
+  e->count = 0;
+  e->time = 0;
+  e->interval = 0;
+
+  for (int i = 0; i < e->channels; i++)
+    e->values[i] = 0;
+}
+
+int8_t delta_add(struct delta_encoder* e, int64_t time, const double* values) {
+  if (e->len + DELTA_MAX_SAMPLE > e->size || e->count == UINT16_MAX)
+    return -1;
+
+  // The first sample is relative to 0, so it holds absolute values
+  int64_t interval = e->count > 0 ? time - e->time : time;
+  e->len += put_varint(e->buf + e->len, interval - e->interval);
+  e->interval = e->count > 0 ? interval : 0;
+  e->time = time;
+
+  for (int i = 0; i < e->channels; i++) {
+    int64_t value = llround(values[i] * DELTA_SCALE);
+
+    e->len += put_varint(e->buf + e->len, value - e->values[i]);
+    e->values[i] = value;
+  }
+
+  e->count++;
+  return 0;
+}
+
+int8_t delta_decoder_init(struct delta_decoder* d, const uint8_t* buf, size_t len) {
+  if (len < DELTA_HEADER || buf[0] != DELTA_VERSION || buf[1] < 1 || buf[1] > DELTA_MAX_CHANNELS)
+    return -1;
+
+  d->buf = buf;
+  d->len = len;
+  d->pos = DELTA_HEADER;
+  d->channels = buf[1];
+  d->count = 0;
+  d->time = 0;
+  d->interval = 0;
+
+  for (int i = 0; i < d->channels; i++)
+    d->values[i] = 0;
+
+  return 0;
+}
+
+int8_t delta_next(struct delta_decoder* d, int64_t* time, double* values) {
+  int64_t change;
+
+  if (d->pos == d->len)
+    return 0;
+
+  if (get_varint(d, &change))
+    return -1;
+
+  // Mirrors delta_add: the first sample carries the absolute time
+  int64_t interval = d->interval + change;
+  d->time = d->count > 0 ? d->time + interval : interval;
+  d->interval = d->count > 0 ? interval : 0;
+
+  for (int i = 0; i < d->channels; i++) {
+    if (get_varint(d, &change))
+      return -1;
+
+    d->values[i] += change;
+    values[i] = (double)d->values[i] / DELTA_SCALE;
+  }
+
+  *time = d->time;
+  d->count++;
+  return 1;
+}
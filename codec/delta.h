@@ -0,0 +1,112 @@
+/*! @file delta.h
+ * @brief Declarations for the delta encoding of sample batches
+ */
+
+/*!
+ * @defgroup codec Encoding
+ * @brief Compact encodings of sample batches for links where every byte costs airtime
+ */
+
+#ifndef CODEC_DELTA_H
+#define CODEC_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_VERSION 1
+#define DELTA_MAX_CHANNELS 8
+// Values are kept as fixed point with this many units per unit (thousandths, as published)
+#define DELTA_SCALE 1000
+// Header: version and channels
+#define DELTA_HEADER 2
+// Largest encoded sample: a 64 bit time and 64 bit values, as varints
+#define DELTA_MAX_SAMPLE (10 * (1 + DELTA_MAX_CHANNELS))
+
+/*!
+ * @brief Batch being encoded
+ *
+ * @details Every sample is a time (ms) and up to DELTA_MAX_CHANNELS values. Times are stored as
+ * the change of the interval to the previous sample (0 for a steady period), and values as the
+ * change to the previous value of their channel, both zigzag mapped to unsigned varints. A
+ * sensor sampled every 750 ms whose values drift slowly thus takes about one byte per field:
+ * one for the time and one or two per value, against some 50 bytes per value as `SET` commands.
+ */
+struct delta_encoder {
+  uint8_t* buf;
+  size_t size;
+  size_t len;
+  uint8_t channels;
+  uint16_t count;
+  int64_t time;
+  int64_t interval;
+  int64_t values[DELTA_MAX_CHANNELS];
+};
+
+/*!
+ * @brief Position in an encoded batch
+ */
+struct delta_decoder {
+  const uint8_t* buf;
+  size_t len;
+  size_t pos;
+  uint8_t channels;
+  uint16_t count;
+  int64_t time;
+  int64_t interval;
+  int64_t values[DELTA_MAX_CHANNELS];
+};
+
+/**
+ * \ingroup codec
+ * @brief Starts an empty batch
+ * @param[out] e Encoder
+ * @param[in] buf Buffer for the encoded batch
+ * @param[in] size Buffer size
+ * @param[in] channels Values per sample (1 to DELTA_MAX_CHANNELS)
+ * @retval 0 OK
+ * @retval -1 Invalid channels, or the buffer cannot hold a single sample
+ */
+int8_t delta_init(struct delta_encoder* e, uint8_t* buf, size_t size, uint8_t channels);
+
+/**
+ * \ingroup codec
+ * @brief Empties the batch, after it was sent
+ * @param[in, out] e Encoder
+ */
+void delta_reset(struct delta_encoder* e);
+
+/**
+ * \ingroup codec
+ * @brief Adds a sample to the batch
+ * @param[in, out] e Encoder
+ * @param[in] time Time (Unix, ms)
+ * @param[in] values Values, one per channel (rounded to 1 / DELTA_SCALE)
+ * @retval 0 OK
+ * @retval -1 The batch is full and must be sent first
+ */
+int8_t delta_add(struct delta_encoder* e, int64_t time, const double* values);
+
+/**
+ * \ingroup codec
+ * @brief Starts reading an encoded batch
+ * @param[out] d Decoder
+ * @param[in] buf Encoded batch
+ * @param[in] len Length
+ * @retval 0 OK
+ * @retval -1 Unknown version or invalid header
+ */
+int8_t delta_decoder_init(struct delta_decoder* d, const uint8_t* buf, size_t len);
+
+/**
+ * \ingroup codec
+ * @brief Reads the next sample of a batch
+ * @param[in, out] d Decoder
+ * @param[out] time Time (Unix, ms)
+ * @param[out] values Values, one per channel
+ * @retval 1 Sample read
+ * @retval 0 End of the batch
+ * @retval -1 Truncated or corrupt batch
+ */
+int8_t delta_next(struct delta_decoder* d, int64_t* time, double* values);
+
+#endif
@@ -0,0 +1,93 @@
+/*! @file debounce.c
+ * @brief Debouncing of digital inputs (k-of-n sub-sample voting and per channel integration)
+ */
+
+#include "debounce.h"
+
+#include <string.h>
+
+#include "../utils/json/config.h"
+
+int8_t debounce_load_config(struct debounce_config* cfg, const char* path) {
+  cJSON *json, *leak, *item;
+
+  *cfg = (struct debounce_config){
+      .subsamples = 5, .votes = 3, .interval = 0.002, .confirm = 2, .clear = 5};
+
+  json = config_load(path);
+
+  leak = cJSON_GetObjectItemCaseSensitive(json, "leak");
+
+  if (!cJSON_IsObject(leak)) {
+    cJSON_Delete(json);
+    return -1;
+  }
+
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(leak, "subsamples")) &&
+      item->valueint >= 1 && item->valueint <= DEBOUNCE_MAX_SUBSAMPLES)
+    cfg->subsamples = item->valueint;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(leak, "votes")) &&
+      item->valueint >= 1)
+    cfg->votes = item->valueint;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(leak, "subsample_interval")))
+    cfg->interval = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(leak, "confirm")))
+    cfg->confirm = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(leak, "clear")))
+    cfg->clear = item->valuedouble;
+
+  // A majority of a smaller burst than configured
+  if (cfg->votes > cfg->subsamples)
+    cfg->votes = cfg->subsamples / 2 + 1;
+
+  cJSON_Delete(json);
+  return 0;
+}
+
+void debounce_init(struct debounce* d, const struct debounce_config* cfg) {
+  memset(d, 0, sizeof(*d));
+  d->cfg = *cfg;
+}
+
+uint8_t debounce_vote(const struct debounce* d, const uint8_t* subsamples) {
+  uint8_t count[DEBOUNCE_CHANNELS] = {0}, vote = 0;
+
+  for (int s = 0; s < d->cfg.subsamples; s++)
+    for (int i = 0; i < DEBOUNCE_CHANNELS; i++)
+      count[i] += subsamples[s] >> i & 1;
+
+  for (int i = 0; i < DEBOUNCE_CHANNELS; i++)
+    if (count[i] >= d->cfg.votes)
+      vote |= 1 << i;
+
+  return vote;
+}
+
+uint8_t debounce_update(struct debounce* d, uint8_t vote, double dt) {
+  uint8_t changed = 0;
+
+  if (!d->primed) {
+    d->state = d->last_vote = vote;
+    d->primed = 1;
+    return 0xFF;
+  }
+
+  for (int i = 0; i < DEBOUNCE_CHANNELS; i++) {
+    uint8_t state = d->state >> i & 1, now = vote >> i & 1, last = d->last_vote >> i & 1;
+
+    // Only the time between two scans that agree with each other counts, towards their side
+    if (now == last && now == state)
+      d->integrator[i] = d->integrator[i] > dt ? d->integrator[i] - dt : 0;
+    else if (now == last)
+      d->integrator[i] += dt;
+
+    if (now != state && d->integrator[i] >= (state ? d->cfg.clear : d->cfg.confirm)) {
+      d->state ^= 1 << i;
+      d->integrator[i] = 0;
+      changed |= 1 << i;
+    }
+  }
+
+  d->last_vote = vote;
+  return changed;
+}
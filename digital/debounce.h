@@ -0,0 +1,92 @@
+/*! @file debounce.h
+ * @brief Declarations for debouncing of digital inputs
+ */
+
+/*!
+ * @defgroup digital Digital
+ * @brief Digital interface board input processing
+ */
+
+#ifndef DIGITAL_DEBOUNCE_H
+#define DIGITAL_DEBOUNCE_H
+
+#include <stdint.h>
+
+#define DEBOUNCE_CONFIG "/opt/device.json"
+#define DEBOUNCE_CHANNELS 8
+#define DEBOUNCE_MAX_SUBSAMPLES 16
+
+/*!
+ * @brief Debouncing parameters, read from the "leak" object of the device configuration
+ */
+struct debounce_config {
+  uint8_t subsamples;
+  uint8_t votes;
+  double interval;
+  double confirm;
+  double clear;
+};
+
+/*!
+ * @brief Debouncer of a bank of digital inputs
+ *
+ * @details Each scan takes a burst of sub-samples, and a channel reads as set if it is set in at
+ * least `votes` of them, which filters contact bounce and short glitches. The scan votes are then
+ * integrated per channel: the time between consecutive scans that both disagree with the confirmed
+ * state is added up, the time between scans that both agree with it is taken off again, and the
+ * state only flips once the total reaches the confirmation (set) or clear time.
+ */
+struct debounce {
+  struct debounce_config cfg;
+  uint8_t state;
+  uint8_t last_vote;
+  uint8_t primed;
+  double integrator[DEBOUNCE_CHANNELS];
+};
+
+/**
+ * \ingroup digital
+ * @brief Reads the debouncing parameters from the device configuration
+ *
+ * @details Example: `"leak": {"subsamples": 5, "votes": 3, "subsample_interval": 0.002,
+ * "confirm": 2, "clear": 5}` (times in seconds). Missing entries keep their defaults.
+ *
+ * @param[out] cfg Debouncing parameters
+ * @param[in] path Configuration file
+ * @retval 0 Configuration read
+ * @retval -1 No "leak" object, defaults are used
+ */
+int8_t debounce_load_config(struct debounce_config* cfg, const char* path);
+
+/**
+ * \ingroup digital
+ * @brief Initializes a debouncer
+ * @param[out] d Debouncer
+ * @param[in] cfg Debouncing parameters
+ */
+void debounce_init(struct debounce* d, const struct debounce_config* cfg);
+
+/**
+ * \ingroup digital
+ * @brief Votes a burst of sub-samples
+ * @param[in] d Debouncer
+ * @param[in] subsamples Sub-samples (one bit per channel)
+ * @returns Channels set in at least `votes` sub-samples
+ */
+uint8_t debounce_vote(const struct debounce* d, const uint8_t* subsamples);
+
+/**
+ * \ingroup digital
+ * @brief Integrates a scan vote
+ *
+ * @details The first scan is taken as the confirmed state as is, and reported as a change on every
+ * channel so it gets published.
+ *
+ * @param[in, out] d Debouncer
+ * @param[in] vote Scan vote (see debounce_vote)
+ * @param[in] dt Time since the previous scan (s)
+ * @returns Channels whose confirmed state changed
+ */
+uint8_t debounce_update(struct debounce* d, uint8_t vote, double dt);
+
+#endif
@@ -0,0 +1,109 @@
+/*! @file decimate.c
+ * @brief FIR decimation of sampled streams
+ */
+
+#include "decimate.h"
+
+#include <math.h>
+#include <string.h>
+
+// GCC vector extensions: NEON on the AM335x (with -mfpu=neon), SSE on x86, plain code elsewhere
+typedef float lanes __attribute__((vector_size(DECIMATE_LANES * sizeof(float))));
+// Same, for loads from the delay line, which are not aligned to the vector size
+typedef float lanes_unaligned
+    __attribute__((vector_size(DECIMATE_LANES * sizeof(float)), aligned(sizeof(float))));
+
+int8_t decimate_init(struct decimator* d,
+                     uint16_t factor,
+                     uint16_t taps,
+                     double cutoff,
+                     enum decimate_mode mode) {
+  uint16_t padded = (taps + DECIMATE_LANES - 1) / DECIMATE_LANES * DECIMATE_LANES;
+  double fc = cutoff / factor, sum = 0;
+
+  if (factor < 1 || factor > DECIMATE_MAX_FACTOR || taps < 1 || padded > DECIMATE_MAX_TAPS ||
+      !(cutoff > 0 && cutoff <= 0.5))
+    return -1;
+
+  memset(d, 0, sizeof(*d));
+  d->mode = mode;
+  d->taps = padded;
+  d->factor = factor;
+
+  for (int k = 0; k < taps; k++) {
+    double t = k - (taps - 1) / 2.0;
+    double sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+    double w = taps == 1 ? 1
+                         : 0.42 - 0.5 * cos(2 * M_PI * k / (taps - 1)) +
+                               0.08 * cos(4 * M_PI * k / (taps - 1));
+
+    d->coeffs[k] = sinc * w;
+    sum += d->coeffs[k];
+  }
+
+  // The padding taps stay at zero
+  for (int k = 0; k < taps; k++)
+    d->coeffs[k] /= sum;
+
+  return 0;
+}
+
+void decimate_reset(struct decimator* d) {
+  memset(d->history, 0, sizeof(d->history));
+  d->pos = 0;
+  d->phase = 0;
+}
+
+/**
+ * @brief Dot product of the coefficients and the latest samples
+ * @param[in] coeffs Coefficients (aligned to the vector size)
+ * @param[in] x Latest samples, newest first
+ * @param[in] taps Length, a multiple of DECIMATE_LANES
+ * @returns Filter output
+ */
+static float dot(const float* coeffs, const float* x, uint16_t taps) {
+  lanes acc = {0};
+
+  for (uint16_t k = 0; k < taps; k += DECIMATE_LANES)
+    acc += *(const lanes*)(coeffs + k) * *(const lanes_unaligned*)(x + k);
+
+  float sum = 0;
+  for (int i = 0; i < DECIMATE_LANES; i++)
+    sum += acc[i];
+
+  return sum;
+}
+
+uint32_t decimate_block(struct decimator* d, const float* in, uint32_t amount, float* out) {
+  uint32_t produced = 0;
+
+  for (uint32_t i = 0; i < amount; i++) {
+    float x = in[i];
+
+    if (d->mode == DECIMATE_ABS)
+      x = fabsf(x);
+    else if (d->mode == DECIMATE_SQUARE)
+      x *= x;
+
+    d->pos = d->pos == 0 ? d->taps - 1 : d->pos - 1;
+    d->history[d->pos] = d->history[d->pos + d->taps] = x;
+
+    if (++d->phase == d->factor) {
+      d->phase = 0;
+      out[produced++] = dot(d->coeffs, d->history + d->pos, d->taps);
+    }
+  }
+
+  return produced;
+}
+
+double decimate_response(const struct decimator* d, double frequency) {
+  double re = 0, im = 0;
+
+  for (int k = 0; k < d->taps; k++) {
+    re += d->coeffs[k] * cos(2 * M_PI * frequency * k);
+    im -= d->coeffs[k] * sin(2 * M_PI * frequency * k);
+  }
+
+  return sqrt(re * re + im * im);
+}
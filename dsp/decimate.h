@@ -0,0 +1,98 @@
+/*! @file decimate.h
+ * @brief Declarations for FIR decimation of sampled streams
+ */
+
+/*!
+ * @defgroup dsp Signal processing
+ * @brief Filtering of high rate ADC streams into lower rate views
+ */
+
+#ifndef DSP_DECIMATE_H
+#define DSP_DECIMATE_H
+
+#include <stdint.h>
+
+// Taps are processed DECIMATE_LANES at a time, so filters are padded to a multiple of it
+#define DECIMATE_LANES 4
+#define DECIMATE_MAX_TAPS 128
+#define DECIMATE_MAX_FACTOR 64
+
+/*!
+ * @brief What each stage filters: the samples, or their magnitude (envelope) or square (mean
+ * square, i.e. RMS once the output is square rooted)
+ */
+enum decimate_mode { DECIMATE_LINEAR, DECIMATE_ABS, DECIMATE_SQUARE };
+
+/*!
+ * @brief Decimating FIR stage
+ *
+ * @details Every input sample is written twice into the delay line, `taps` apart, so the latest
+ * `taps` samples are always contiguous and each output is a single dot product against the
+ * coefficients. Outputs are only computed for the samples kept, so a stage costs `taps / factor`
+ * multiply-accumulates per input sample, as a polyphase decimator does.
+ *
+ * Stages are cascaded for large ratios (e.g. 3840 Hz / 8 / 8 / 6 = 10 Hz), each one feeding its
+ * output block to the next: short filters at high rates, sharp ones only where few samples are
+ * left.
+ */
+struct decimator {
+  float coeffs[DECIMATE_MAX_TAPS] __attribute__((aligned(16)));
+  float history[2 * DECIMATE_MAX_TAPS];
+  enum decimate_mode mode;
+  uint16_t taps;
+  uint16_t factor;
+  uint16_t pos;
+  uint16_t phase;
+};
+
+/**
+ * \ingroup dsp
+ * @brief Designs a decimation stage: windowed sinc (Blackman), unity gain at DC
+ *
+ * @details The Blackman window gives ~74 dB of stop band attenuation with a transition band of
+ * about 5.5 / `taps` of the input rate, centered on the cutoff. A cutoff at the output Nyquist
+ * frequency (0.5) keeps aliases out of the lower half of the output band as long as the
+ * transition is narrower than half the output rate.
+ *
+ * @param[out] d Stage
+ * @param[in] factor Decimation factor (1 to DECIMATE_MAX_FACTOR)
+ * @param[in] taps Filter length, rounded up to a multiple of DECIMATE_LANES
+ * @param[in] cutoff Cutoff frequency (-6 dB), as a fraction of the output sample rate (0 to 0.5)
+ * @param[in] mode What is filtered
+ * @retval 0 OK
+ * @retval -1 Invalid factor, length or cutoff
+ */
+int8_t decimate_init(struct decimator* d,
+                     uint16_t factor,
+                     uint16_t taps,
+                     double cutoff,
+                     enum decimate_mode mode);
+
+/**
+ * \ingroup dsp
+ * @brief Clears the delay line, as if the stream started over
+ * @param[in, out] d Stage
+ */
+void decimate_reset(struct decimator* d);
+
+/**
+ * \ingroup dsp
+ * @brief Filters a block of samples
+ * @param[in, out] d Stage
+ * @param[in] in Input samples
+ * @param[in] amount Input samples
+ * @param[out] out Output samples, room for `amount / factor + 1` of them (may alias `in`)
+ * @returns Output samples written
+ */
+uint32_t decimate_block(struct decimator* d, const float* in, uint32_t amount, float* out);
+
+/**
+ * \ingroup dsp
+ * @brief Gets the magnitude response of a stage's filter
+ * @param[in] d Stage
+ * @param[in] frequency Frequency, as a fraction of the input sample rate (0 to 0.5)
+ * @returns Gain
+ */
+double decimate_response(const struct decimator* d, double frequency);
+
+#endif
@@ -18,7 +18,8 @@ gpio_t mux1 = {.pin = P9_16};  // MSB
 
 int8_t pins_configured = 0;
 
-uint8_t ext_addr = -1;
+// Extender board whose multiplexers were directed last (0 for none)
+uint8_t ext_selected = 0;
 
 void direct_mux(uint8_t id) {
   if ((id >> 0) & 1)
@@ -32,23 +33,19 @@ void direct_mux(uint8_t id) {
     mmio_set_low(mux1);
 }
 
-void direct_ext_mux(uint8_t id) {
-  char* rx;
-  rx = malloc(1 * sizeof(char));
-
+void direct_ext_mux(uint8_t id, uint8_t addr) {
+  char rx[1];
   char ext_mux_id[1] = {id};
 
-  select_module(ext_addr, 2);
-  spi_transfer(ext_mux_id, rx, 1);
-
-  free(rx);
-}
+  // Channel 0 of both multiplexers parks a board
+  if (ext_selected != 0 && ext_selected != addr) {
+    select_module(ext_selected, 2);
+    spi_transfer("\x00", rx, 1);
+  }
 
-int8_t set_ext_addr(uint8_t addr) {
-  if (addr > 15 || addr == 0)
-    return -1;
-  ext_addr = addr;
-  return 0;
+  select_module(addr, 2);
+  spi_transfer(ext_mux_id, rx, 1);
+  ext_selected = addr;
 }
 
 int8_t i2c_read(uint8_t reg_addr, uint8_t* reg_data, uint32_t length, void* intf_ptr) {
@@ -62,7 +59,7 @@ int8_t i2c_read(uint8_t reg_addr, uint8_t* reg_data, uint32_t length, void* intf
 }
 
 int8_t i2c_write(uint8_t reg_addr, const uint8_t* reg_data, uint32_t length, void* intf_ptr) {
-  uint8_t* buf;
+  uint8_t buf[I2C_MAX_WRITE + 1];
 
   // Sensirion adds CRC using their own methods, so we'll assume the address is already added if it
   // is null
@@ -71,28 +68,24 @@ int8_t i2c_write(uint8_t reg_addr, const uint8_t* reg_data, uint32_t length, voi
   struct identifier id;
   id = *((struct identifier*)intf_ptr);
 
-  buf = malloc(length + address_offset);
+  if (length > I2C_MAX_WRITE)
+    return -2;
 
   if (address_offset)
     buf[0] = reg_addr;
 
   memcpy(buf + address_offset, reg_data, length);
 
-  if (write(id.fd, buf, length + 1) < (uint16_t)length)
+  if (write(id.fd, buf, length + address_offset) < (ssize_t)(length + address_offset))
     return -2;
 
-  free(buf);
-
   return 0;
 }
 
 void unselect_i2c_extender() {
-  char* rx;
-  rx = malloc(1 * sizeof(char));
+  char rx[1];
 
   spi_mod_comm("\x00", rx, 1);
-
-  free(rx);
 }
 
 int8_t configure_mux() {
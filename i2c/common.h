@@ -16,6 +16,7 @@ extern "C" {
 
 #define WINDOW_SIZE 5
 #define MAX_NAME_LEN 16
+#define I2C_MAX_WRITE 32
 
 #include "../spi/common.h"
 
@@ -26,6 +27,7 @@ struct identifier {
   int8_t ext_mux_id;
   uint8_t mux_id;
   uint8_t fd;
+  uint8_t ext_addr;
 };
 
 /**
@@ -90,15 +92,6 @@ int8_t i2c_open(int8_t* fd, uint8_t addr);
  * @brief Generic methods for handling communication with the multiplexer and extension boards
  */
 
-/**
- * \ingroup i2cMux
- * @brief Sets the SPI extender board address
- * @param[in] addr Board address
- * @retval 0 OK
- * @retval -1 Invalid board address
- */
-int8_t set_ext_addr(uint8_t addr);
-
 /**
  * \ingroup i2cMux
  * @brief Unselects the I2C extender (and SPI extender, by proxy)
@@ -109,11 +102,15 @@ void unselect_i2c_extender();
 /**
  * \ingroup i2cMux
  * @brief Selects an available I2C channel through the SPI and I2C extender boards (0 to 8)
+ *
+ * @details Extender boards share the bus, so the board selected before (if another one) is parked
+ * first.
+ *
  * @param[in] id Desired channel ID
- * @param[in] addr Designed extender board address
+ * @param[in] addr Designed extender board address (1 to 15)
  * @return void
  */
-void direct_ext_mux(uint8_t id);
+void direct_ext_mux(uint8_t id, uint8_t addr);
 
 /**
  * \ingroup i2cMux
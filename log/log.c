@@ -0,0 +1,155 @@
+/*! @file log.c
+ * @brief Asynchronous, rate limited logging: per thread rings drained by a flusher thread
+ */
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*!
+ * @brief Record ring of a thread: the thread is the only producer, the flusher the only consumer
+ */
+struct log_ring {
+  struct log_record records[LOG_RING_LEN];
+  atomic_uint head;
+  atomic_uint tail;
+  atomic_uint dropped;
+};
+
+static struct log_ring rings[LOG_THREADS];
+static atomic_uint ring_count;
+static atomic_bool started;
+static atomic_bool stopped;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local struct log_ring* ring;
+static _Thread_local uint8_t ring_claimed;
+
+/**
+ * @brief Sends a record to syslog
+ * @param[in] record Log record
+ */
+static void emit(const struct log_record* record) {
+  if (record->suppressed)
+    syslog(record->priority, "%s [%s:%d, %u more suppressed]", record->msg, record->site->file,
+           record->site->line, record->suppressed);
+  else
+    syslog(record->priority, "%s", record->msg);
+}
+
+/**
+ * @brief Gets the ring of the calling thread, claiming one on first use
+ * @returns Ring, or NULL if every ring is taken
+ */
+static struct log_ring* thread_ring() {
+  if (!ring_claimed) {
+    unsigned i = atomic_fetch_add(&ring_count, 1);
+
+    ring = i < LOG_THREADS ? &rings[i] : NULL;
+    ring_claimed = 1;
+  }
+
+  return ring;
+}
+
+static void* flusher(void* arg) {
+  const struct timespec period = {0, LOG_FLUSH_PERIOD * 1e9};
+
+  while (!atomic_load(&stopped)) {
+    nanosleep(&period, NULL);
+    log_flush();
+  }
+
+  return NULL;
+}
+
+int8_t log_init(const char* ident) {
+  pthread_t thread;
+
+  openlog(ident, 0, LOG_LOCAL0);
+
+  if (pthread_create(&thread, NULL, flusher, NULL))
+    return -1;
+
+  pthread_detach(thread);
+  atexit(log_flush);
+  atomic_store(&started, 1);
+
+  return 0;
+}
+
+void log_write(struct log_site* site, int priority, const char* fmt, ...) {
+  struct timespec now;
+  struct log_record direct, *record = &direct;
+  struct log_ring* r = atomic_load_explicit(&started, memory_order_acquire) ? thread_ring() : NULL;
+  unsigned tail = 0;
+  va_list args;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long long window = atomic_load_explicit(&site->window, memory_order_relaxed);
+
+  // Whoever moves the window on resets the count
+  if (now.tv_sec - window >= LOG_WINDOW &&
+      atomic_compare_exchange_strong(&site->window, &window, now.tv_sec))
+    atomic_store(&site->count, 0);
+
+  if (atomic_fetch_add(&site->count, 1) >= LOG_BURST) {
+    atomic_fetch_add(&site->suppressed, 1);
+    return;
+  }
+
+  if (r != NULL) {
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == LOG_RING_LEN) {
+      atomic_fetch_add(&r->dropped, 1);
+      return;
+    }
+
+    record = &r->records[tail % LOG_RING_LEN];
+  }
+
+  record->site = site;
+  record->priority = priority;
+  record->suppressed = atomic_exchange(&site->suppressed, 0);
+
+  va_start(args, fmt);
+  vsnprintf(record->msg, sizeof(record->msg), fmt, args);
+  va_end(args);
+
+  if (r != NULL)
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  else
+    emit(record);
+}
+
+void log_flush() {
+  pthread_mutex_lock(&flush_lock);
+
+  unsigned amount = atomic_load(&ring_count);
+
+  for (unsigned i = 0; i < amount && i < LOG_THREADS; i++) {
+    struct log_ring* r = &rings[i];
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    while (head != atomic_load_explicit(&r->tail, memory_order_acquire)) {
+      emit(&r->records[head % LOG_RING_LEN]);
+      atomic_store_explicit(&r->head, ++head, memory_order_release);
+    }
+
+    unsigned dropped = atomic_exchange(&r->dropped, 0);
+    if (dropped)
+      syslog(LOG_WARNING, "%u log messages dropped, queue full", dropped);
+  }
+
+  pthread_mutex_unlock(&flush_lock);
+}
+
+void log_stop_flusher() {
+  atomic_store(&stopped, 1);
+}
@@ -0,0 +1,97 @@
+/*! @file log.h
+ * @brief Declarations for asynchronous, rate limited logging
+ */
+
+/*!
+ * @defgroup log Logging
+ * @brief Asynchronous, rate limited logging
+ */
+
+#ifndef LOG_LOG_H
+#define LOG_LOG_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <syslog.h>
+
+#define LOG_THREADS 8
+#define LOG_RING_LEN 64
+#define LOG_MSG_LEN 120
+#define LOG_FLUSH_PERIOD 0.2
+#define LOG_BURST 10
+#define LOG_WINDOW 60
+
+/*!
+ * @brief Message site (one per SIMAR_LOG call), holding its rate limit state
+ */
+struct log_site {
+  const char* file;
+  int line;
+  atomic_llong window;
+  atomic_uint count;
+  atomic_uint suppressed;
+};
+
+/*!
+ * @brief Log record, as queued for the flusher
+ */
+struct log_record {
+  const struct log_site* site;
+  uint32_t suppressed;
+  int priority;
+  char msg[LOG_MSG_LEN];
+};
+
+/**
+ * \ingroup log
+ * @brief Logs a message without blocking the caller
+ *
+ * @details Drop-in replacement for syslog(). Each call site may log LOG_BURST messages per
+ * LOG_WINDOW seconds; the rest are counted and the count is reported with the next message that
+ * goes through.
+ */
+#define SIMAR_LOG(priority, ...)                                           \
+  do {                                                                     \
+    static struct log_site log_site_ = {.file = __FILE__, .line = __LINE__}; \
+    log_write(&log_site_, priority, __VA_ARGS__);                          \
+  } while (0)
+
+/**
+ * \ingroup log
+ * @brief Opens the system log and starts the flusher thread
+ *
+ * @details Messages logged before this call, or by threads beyond LOG_THREADS, go to syslog()
+ * directly. Queued messages are flushed on exit.
+ *
+ * @param[in] ident Syslog identity
+ * @retval 0 OK
+ * @retval -1 The flusher could not be started, messages go to syslog() directly
+ */
+int8_t log_init(const char* ident);
+
+/**
+ * \ingroup log
+ * @brief Rate limits, formats and queues a message (use SIMAR_LOG)
+ * @param[in, out] site Message site
+ * @param[in] priority Syslog priority
+ * @param[in] fmt Format string
+ */
+void log_write(struct log_site* site, int priority, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * \ingroup log
+ * @brief Sends every queued message to syslog
+ */
+void log_flush();
+
+/**
+ * \ingroup log
+ * @brief Stops the flusher thread, for daemons that sleep for long and must not be woken up by it
+ *
+ * @details The caller then flushes with log_flush() at its own wake-ups. Messages from other
+ * threads wait for those, so rings may fill up if they log more than LOG_RING_LEN in between.
+ */
+void log_stop_flusher();
+
+#endif
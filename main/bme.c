@@ -4,23 +4,142 @@
 
 #include <fcntl.h>
 #include <hiredis/hiredis.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
-#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "../bme280/common/common.h"
+#include "../log/log.h"
+#include "../mem/arena.h"
+#include "../mem/shm.h"
+#include "../mqtt/common.h"
+#include "../redis/common.h"
+#include "../redis/writer.h"
+#include "../sched/account.h"
+#include "../sched/adaptive.h"
+#include "../sched/startup.h"
+#include "../sensor/registry.h"
+#include "../sensor/results.h"
+#include "../sht3x/alert.h"
 #include "../sht3x/sht3x.h"
-#include "../utils/json/cJSON.h"
-
-// Set to 3 to enable the I2C Expansion Board
-#define ERROR_THRESHOLD 5
-#define EXT_BOARD_I2C_LEN 6
+#include "../utils/json/config.h"
+
+// I2C channels of an expansion board (1 to 7, 4 parks the multiplexers) and how many channel
+// numbers each board takes in the sensor names
+#define EXT_BOARD_CHANNELS 6
+#define EXT_BOARD_NAMES 8
+// Expansion board addresses are 4 bit, 0 standing for the interface board itself
+#define BOARD_ADDRS 16
+#define BOARD_REPORT_PERIOD 60
+// Wireless node whose pressure is used as external reference
+#define REFERENCE_NODE "wgen2"
+#define REFERENCE_PERIOD 1
+// Sampling period limits (s) and activity thresholds (short-term std. deviation, change per second)
+#define MIN_PERIOD 0.1
+#define MAX_PERIOD 2
+#define PRESSURE_SIGMA 0.05
+#define PRESSURE_RATE 0.2
+#define TEMPERATURE_SIGMA 0.1
+#define TEMPERATURE_RATE 0.05
+// BMx readouts feed the door detection, whose moving average window (WINDOW_SIZE readouts) and
+// confirmation strikes are counted in readouts tuned for one every 250 ms, so BMx sensors keep that
+// fixed period instead of adapting it
+#define DOOR_PERIOD 0.25
+// Fraction of the time the I2C bus may be busy
+#define BUS_BUDGET 0.5
+// Retry delay for sensors without new data (s), free running ones convert about once per second
+#define RETRY_PERIOD 1
+// Script publish mode: sweeps packed at a time (one being filled while the writer appends the
+// other) and room for each formatted value
+#define SWEEP_PACKS 2
+#define SWEEP_VALUE_LEN 16
 
 uint8_t iface_board_len = 4;
+struct mqtt_client mqtt;
+struct shm_board* shm;
+struct shm_entry* reference;
+struct results_pool results;
+struct redis_writer writer;
+
+/*!
+ * @brief Redis publish mode, from the `"redis"` object of the device configuration
+ *
+ * @details `"publish": "script"` sends every sweep as a single `EVALSHA` of the sweep script
+ * (see sweep_script_load), with `"ttl"` and `"history"` for its sensor hash expiry and history
+ * length; anything else keeps one command per readout.
+ */
+struct publish_config {
+  uint8_t script;
+  int ttl;
+  int history;
+};
+
+/*!
+ * @brief Sweep packed as sweep script arguments, handed over to the writer by reference
+ *
+ * @details Sensor names point to the sensor slots; every other argument is formatted into
+ * `values`. The pack stays busy until the writer has appended it.
+ */
+struct sweep_pack {
+  atomic_uchar busy;
+  int argc;
+  int used;
+  const char** argv;
+  size_t* argvlen;
+  char (*values)[SWEEP_VALUE_LEN];
+};
+
+struct publish_config publish;
+struct sweep_pack packs[SWEEP_PACKS];
+char sweep_sha[SWEEP_SHA_LEN];
+// Reference pressure (thousandths) for the next packed sweep, 0 once taken
+atomic_int reference_pending;
+
+/*!
+ * @brief SPI expansion board: its address and the I2C channels in use
+ */
+struct ext_board {
+  uint8_t addr;
+  uint8_t channels[EXT_BOARD_CHANNELS];
+  uint8_t channel_amount;
+};
+
+/*!
+ * @brief Sensors of a board, and the I2C time spent on them since the last report (s)
+ */
+struct board_time {
+  uint16_t sensors;
+  double busy;
+};
 
-const char servers[3][32] = {"10.0.38.46", "10.0.38.42", "10.0.38.59"};
+struct ext_board boards[BOARD_ADDRS - 1];
+uint8_t board_amount;
+struct board_time board_time[BOARD_ADDRS];
+
+/*!
+ * @brief Sweep time of a board, as queued for the Redis writer
+ */
+struct board_record {
+  uint8_t board;
+  double ms;
+};
+
+/*!
+ * @brief Sweep results entry, as queued for the Redis writer
+ */
+struct readout_record {
+  const char* sensor;
+  double temperature;
+  double pressure;
+  double humidity;
+  double average;
+  double open_average;
+  uint8_t flags;
+  uint8_t alert;
+};
 
 /**
  * @brief Updates door opening status
@@ -112,217 +231,926 @@ void update_open(struct bme_sensor_data* sensor) {
   }
 }
 
-int main(int argc, char* argv[]) {
-  openlog("simar", 0, LOG_LOCAL0);
+/// Sensor bank of each registered type
+#define SENSOR_INSTANCE(type, ...) static struct type##_bank type##_bank;
 
-  redisContext *c, *c_remote;
-  redisReply *reply, *reply_remote;
+SENSOR_DRIVERS(SENSOR_INSTANCE)
 
-  struct bme_sensor_data bme_sensors[16];
-  struct sht3x_sensor_data sht_sensors[16];
-
-  bme_sensors[0].dev.settings.osr_h = BME280_OVERSAMPLING_4X;
-  bme_sensors[0].dev.settings.osr_p = BME280_OVERSAMPLING_16X;
-  bme_sensors[0].dev.settings.osr_t = BME280_OVERSAMPLING_4X;
-  bme_sensors[0].dev.settings.filter = BME280_FILTER_COEFF_OFF;
-
-  uint8_t valid_bme = 0;
-  uint8_t valid_sht = 0;
-  uint8_t board_addr;
-
-  int fd = open("/opt/device.json", O_RDONLY);
-  if (fd > 0) {
-    int len = lseek(fd, 0, SEEK_END);
-    char* json_buf = malloc(len + 1);
-    lseek(fd, 0, SEEK_SET);
-    read(fd, json_buf, len);
-
-    const cJSON* boards = NULL;
-    const cJSON* board = NULL;
-    cJSON* boards_json = cJSON_Parse(json_buf);
-
-    if (json_buf != NULL) {
-      boards = cJSON_GetObjectItemCaseSensitive(boards_json, "boards");
-      cJSON_ArrayForEach(board, boards) {
-        cJSON* address = cJSON_GetObjectItemCaseSensitive(board, "type");
-        if (cJSON_IsString(address) && strcmp(address->valuestring, "spiExpansion") == 0) {
-          cJSON* board_no = cJSON_GetObjectItemCaseSensitive(board, "address");
-          if (cJSON_IsNumber(board_no)) {
-            board_addr = board_no->valueint;
-            set_ext_addr(board_addr);
-            iface_board_len = 3;
-          }
-        }
-      }
+/// Writers of the sweep results of each type (defined along with the sweep), for the bank services
+#define SENSOR_RECORD(type, ...) \
+  static int type##_record(struct results_block* block, int sensor, uint8_t flags);
+
+SENSOR_DRIVERS(SENSOR_RECORD)
+
+/**
+ * @brief Moves a deadline forward to a delay after a given time
+ * @param[in, out] deadline Deadline
+ * @param[in] from Start of the delay
+ * @param[in] us Delay (µs)
+ */
+static void extend_deadline(struct timespec* deadline, const struct timespec* from, long us) {
+  struct timespec t = {from->tv_sec + us / 1000000, from->tv_nsec + us % 1000000 * 1000};
+
+  if (t.tv_nsec >= 1000000000L) {
+    t.tv_sec++;
+    t.tv_nsec -= 1000000000L;
+  }
+
+  if (timespec_diff(&t, deadline) > 0)
+    *deadline = t;
+}
+
+static int8_t bme_driver_probe(struct bme_sensor_data* s, struct identifier id, uint8_t addr) {
+  *s = (struct bme_sensor_data){.id = id};
+
+  s->dev.settings.osr_h = BME280_OVERSAMPLING_4X;
+  s->dev.settings.osr_p = BME280_OVERSAMPLING_16X;
+  s->dev.settings.osr_t = BME280_OVERSAMPLING_4X;
+  s->dev.settings.filter = BME280_FILTER_COEFF_OFF;
+
+  return bme_init(&s->dev, &s->id, addr);
+}
+
+static void bme_driver_setup(struct bme_bank* bank, int i) {
+  // The bus identifier moved along with the slot
+  bank->sensors[i].dev.intf_ptr = &bank->sensors[i].id;
+  adaptive_init(&bank->rates[i], DOOR_PERIOD, DOOR_PERIOD, PRESSURE_SIGMA, PRESSURE_RATE);
+}
+
+// Normal mode: the sensor converts on its own and the latest result can be read at any time
+static int8_t bme_driver_start(struct bme_sensor_data* s) {
+  return 0;
+}
+
+static int8_t bme_driver_read(struct bme_sensor_data* s) {
+  if (bme_read(&s->dev, &s->data) != BME280_OK || check_alteration(*s) != BME280_OK)
+    return -1;
+
+  update_open(s);
+  s->past_pres = s->data.pressure;
+
+  return 0;
+}
+
+static double bme_driver_activity(const struct bme_sensor_data* s) {
+  return s->data.pressure;
+}
+
+static uint8_t bme_driver_flags(const struct bme_sensor_data* s) {
+  return RESULT_PRESSURE | (s->is_open ? RESULT_OPEN : 0);
+}
+
+static void bme_driver_service(struct bme_bank* bank, struct results_block* block) {}
+
+static int8_t sht_driver_probe(struct sht_slot* s, struct identifier id, uint8_t addr) {
+  *s = (struct sht_slot){.dev.id = id};
+
+  return sht3x_init(&s->dev, addr) == STATUS_OK ? 0 : -1;
+}
+
+static void sht_driver_setup(struct sht_bank* bank, int i) {
+  struct sht_slot* s = &bank->sensors[i];
+
+  // Sensors tracking their own alert limits only need a slow trend rate
+  if (sht3x_alert_config(&s->alert.limits, ALERT_CONFIG, s->dev.name) == 0 &&
+      sht3x_alert_program(&s->dev, &s->alert) == STATUS_OK) {
+    SIMAR_LOG(LOG_NOTICE, "Alerts enabled for %s: %.1f to %.1f °C, %.1f to %.1f %%RH", s->dev.name,
+              s->alert.limits.temperature_low, s->alert.limits.temperature_high,
+              s->alert.limits.humidity_low, s->alert.limits.humidity_high);
+    adaptive_init(&bank->rates[i], ALERT_TREND_PERIOD, ALERT_TREND_PERIOD, TEMPERATURE_SIGMA,
+                  TEMPERATURE_RATE);
+
+    if (!bank->serviced)
+      adaptive_init(&bank->service, ALERT_POLL_PERIOD, ALERT_POLL_PERIOD, 0, 0);
+    bank->serviced = 1;
+  } else {
+    s->alert.limits.enabled = 0;
+    adaptive_init(&bank->rates[i], MIN_PERIOD, MAX_PERIOD, TEMPERATURE_SIGMA, TEMPERATURE_RATE);
+  }
+}
+
+// Sensors with alerts measure periodically, the others once per readout
+static int8_t sht_driver_start(struct sht_slot* s) {
+  if (s->alert.limits.enabled)
+    return 0;
+
+  return sht3x_measure(&s->dev) == STATUS_OK ? 1 : -1;
+}
+
+static int8_t sht_driver_read(struct sht_slot* s) {
+  // No new periodic measurement yet (the alert poll may have just fetched it)
+  if (s->alert.limits.enabled)
+    return sht3x_fetch(&s->dev) == STATUS_OK ? 0 : 1;
+
+  return sht3x_read(&s->dev) == STATUS_OK ? 0 : -1;
+}
+
+static double sht_driver_activity(const struct sht_slot* s) {
+  return s->dev.data.temperature;
+}
+
+static uint8_t sht_driver_flags(const struct sht_slot* s) {
+  return 0;
+}
+
+// One status word per alerting sensor; measurements are only fetched on alerts
+static void sht_driver_service(struct sht_bank* bank, struct results_block* block) {
+  uint8_t raised, cleared;
+  int entry;
+
+  for (int i = 0; i < bank->amount; i++) {
+    struct sht_slot* s = &bank->sensors[i];
+
+    if (!s->alert.limits.enabled ||
+        sht3x_alert_poll(&s->dev, &s->alert, &raised, &cleared) != STATUS_OK ||
+        (raised | cleared) == 0)
+      continue;
+
+    SIMAR_LOG(LOG_WARNING, "%s alert on %s (flags 0x%x): %.2f °C, %.2f %%RH",
+              raised ? "Raised" : "Cleared", s->dev.name, s->alert.active,
+              s->dev.data.temperature, s->dev.data.humidity);
+
+    if ((entry = sht_record(block, i, RESULT_ALERT)) >= 0)
+      block->alert[entry] = s->alert.active;
+  }
+}
+
+/**
+ * @brief Charges the time a sensor kept the bus busy to the bus budget and to its board
+ * @param[in, out] bus Bus budget
+ * @param[in] id Sensor bus identifier
+ * @param[in] elapsed Bus time (s)
+ */
+static void bus_spend(struct bus_budget* bus, const struct identifier* id, double elapsed) {
+  budget_spend(bus, elapsed);
+  board_time[id->ext_addr].busy += elapsed;
+}
+
+#define SENSOR_FIELD(column, member) block->column[i] = s->member;
+
+/*
+ * Sweep functions of each registered type, with the driver hooks resolved at compile time:
+ * - <type>_discover: probes one address of a channel, naming the sensor after the channel
+ * - <type>_record: appends a readout to the sweep results
+ * - <type>_setup: moves the bank into the arena and sets the sampling rates, once the topology is
+ *   known
+ * - <type>_begin: starts the conversions of the due sensors, moving `ready` to when they are done
+ * - <type>_collect: reads the sensors started by <type>_begin into the sweep results and runs
+ *   the bank service if due (-1 once the type's error limit is exceeded)
+ * - <type>_earliest: lowers `earliest` to the next due time of the bank
+ */
+#define SENSOR_SWEEP(type, label, slot, name, id, primary, secondary, conversion, errors,    \
+                     fields)                                                                 \
+  static int8_t type##_discover(struct identifier bus, uint8_t second, int channel) {        \
+    struct type##_bank* bank = &type##_bank;                                                 \
+    uint8_t addr = second ? secondary : primary;                                             \
+                                                                                             \
+    if (bank->amount == bank->capacity) {                                                    \
+      uint16_t capacity = bank->capacity ? 2 * bank->capacity : 4;                           \
+      slot* sensors = realloc(bank->sensors, capacity * sizeof(slot));                       \
+                                                                                             \
+      if (sensors == NULL)                                                                   \
+        return MEM_FAIL;                                                                     \
+      bank->sensors = sensors;                                                               \
+      bank->capacity = capacity;                                                             \
+    }                                                                                        \
+                                                                                             \
+    slot* s = &bank->sensors[bank->amount];                                                  \
+    int8_t status = type##_driver_probe(s, bus, addr);                                       \
+                                                                                             \
+    if (status != 0)                                                                         \
+      return status;                                                                         \
+                                                                                             \
+    snprintf(s->name, MAX_NAME_LEN, "sensor_%d_%x", channel, addr);                          \
+    SIMAR_LOG(LOG_INFO, "Initialized %s device with address 0x%x at channel %d (%s)", label, \
+              addr, channel, s->name);                                                       \
+    bank->amount++;                                                                          \
+                                                                                             \
+    return 0;                                                                                \
+  }                                                                                          \
+                                                                                             \
+  static int type##_record(struct results_block* block, int sensor, uint8_t flags) {         \
+    const slot* s = &type##_bank.sensors[sensor];                                            \
+    int i = results_add(block, s->name, type##_bank.entries[sensor],                         \
+                        type##_driver_flags(s) | flags);                                     \
+                                                                                             \
+    if (i >= 0) {                                                                            \
+      fields(SENSOR_FIELD)                                                                   \
+    }                                                                                        \
+                                                                                             \
+    return i;                                                                                \
+  }                                                                                          \
+                                                                                             \
+  static int8_t type##_setup() {                                                             \
+    struct type##_bank* bank = &type##_bank;                                                 \
+    slot* sensors = arena_alloc(bank->amount * sizeof(slot), label " sensors");              \
+                                                                                             \
+    bank->rates = arena_alloc(bank->amount * sizeof(*bank->rates), label " sensors");        \
+    bank->started = arena_alloc(bank->amount, label " sensors");                             \
+    bank->entries = arena_alloc(bank->amount * sizeof(*bank->entries), label " sensors");    \
+    if (sensors == NULL || bank->rates == NULL || bank->started == NULL ||                   \
+        bank->entries == NULL)                                                               \
+      return MEM_FAIL;                                                                       \
+                                                                                             \
+    if (bank->amount > 0)                                                                    \
+      memcpy(sensors, bank->sensors, bank->amount * sizeof(slot));                           \
+    free(bank->sensors);                                                                     \
+    bank->sensors = sensors;                                                                 \
+    bank->capacity = bank->amount;                                                           \
+                                                                                             \
+    for (int i = 0; i < bank->amount; i++) {                                                 \
+      board_time[bank->sensors[i].id.ext_addr].sensors++;                                    \
+      type##_driver_setup(bank, i);                                                          \
+    }                                                                                        \
+                                                                                             \
+    return 0;                                                                                \
+  }                                                                                          \
+                                                                                             \
+  static int8_t type##_begin(const struct timespec* now, struct bus_budget* bus,             \
+                             struct timespec* ready) {                                       \
+    struct type##_bank* bank = &type##_bank;                                                 \
+    struct timespec started, done;                                                           \
+                                                                                             \
+    for (int i = 0; i < bank->amount; i++) {                                                 \
+      bank->started[i] = 0;                                                                  \
+                                                                                             \
+      if (!adaptive_due(&bank->rates[i], now))                                               \
+        continue;                                                                            \
+                                                                                             \
+      if (!budget_available(bus)) {                                                          \
+        adaptive_defer(&bank->rates[i], MIN_PERIOD);                                         \
+        continue;                                                                            \
+      }                                                                                      \
+                                                                                             \
+      clock_gettime(CLOCK_MONOTONIC, &started);                                              \
+      int8_t status = type##_driver_start(&bank->sensors[i]);                                \
+      clock_gettime(CLOCK_MONOTONIC, &done);                                                 \
+      bus_spend(bus, &bank->sensors[i].id, timespec_diff(&done, &started));                  \
+                                                                                             \
+      if (status < 0) {                                                                      \
+        if (++bank->failures > (errors))                                                     \
+          return SENSOR_FAIL;                                                                \
+        adaptive_defer(&bank->rates[i], MIN_PERIOD);                                         \
+        continue;                                                                            \
+      }                                                                                      \
+                                                                                             \
+      if (status > 0)                                                                        \
+        extend_deadline(ready, &done, conversion);                                           \
+      bank->started[i] = 1;                                                                  \
+    }                                                                                        \
+                                                                                             \
+    return 0;                                                                                \
+  }                                                                                          \
+                                                                                             \
+  static int8_t type##_collect(const struct timespec* now, struct bus_budget* bus,           \
+                               struct results_block* block) {                                \
+    struct type##_bank* bank = &type##_bank;                                                 \
+    struct timespec started, done;                                                           \
+                                                                                             \
+    for (int i = 0; i < bank->amount; i++) {                                                 \
+      slot* s = &bank->sensors[i];                                                           \
+                                                                                             \
+      if (!bank->started[i])                                                                 \
+        continue;                                                                            \
+                                                                                             \
+      clock_gettime(CLOCK_MONOTONIC, &started);                                              \
+      int8_t status = type##_driver_read(s);                                                 \
+      clock_gettime(CLOCK_MONOTONIC, &done);                                                 \
+      bus_spend(bus, &s->id, timespec_diff(&done, &started));                                \
+                                                                                             \
+      if (status < 0) {                                                                      \
+        if (++bank->failures > (errors))                                                     \
+          return -1;                                                                         \
+        adaptive_defer(&bank->rates[i], MIN_PERIOD);                                         \
+        continue;                                                                            \
+      }                                                                                      \
+                                                                                             \
+      if (status > 0) {                                                                      \
+        adaptive_defer(&bank->rates[i], RETRY_PERIOD);                                       \
+        continue;                                                                            \
+      }                                                                                      \
+                                                                                             \
+      bank->failures = 0;                                                                    \
+      adaptive_update(&bank->rates[i], type##_driver_activity(s));                           \
+      type##_record(block, i, 0);                                                            \
+    }                                                                                        \
+                                                                                             \
+    if (bank->serviced && adaptive_due(&bank->service, now)) {                               \
+      clock_gettime(CLOCK_MONOTONIC, &started);                                              \
+      type##_driver_service(bank, block);                                                    \
+      clock_gettime(CLOCK_MONOTONIC, &done);                                                 \
+      budget_spend(bus, timespec_diff(&done, &started));                                     \
+      adaptive_defer(&bank->service, bank->service.min_period);                              \
+    }                                                                                        \
+                                                                                             \
+    return 0;                                                                                \
+  }                                                                                          \
+                                                                                             \
+  static void type##_earliest(struct timespec* earliest) {                                   \
+    adaptive_earliest(type##_bank.rates, type##_bank.amount, earliest);                      \
+    if (type##_bank.serviced)                                                                \
+      adaptive_earliest(&type##_bank.service, 1, earliest);                                  \
+  }
+
+SENSOR_DRIVERS(SENSOR_SWEEP)
+
+/**
+ * @brief Probes every sensor type, in registry order, at one channel and address
+ * @param[in] id Channel
+ * @param[in] second Whether to probe the secondary address of each type
+ * @param[in] channel Channel number in the sensor names
+ * @retval 0 Sensor found
+ * @retval -1 No sensor
+ * @retval BUS_FAIL Bus failure
+ * @retval MEM_FAIL The sensor table could not grow
+ */
+static int8_t discover(struct identifier id, uint8_t second, int channel) {
+  int8_t status = -1;
+
+#define SENSOR_DISCOVER(type, ...)                                           \
+  if (status != 0 && (status = type##_discover(id, second, channel)) != 0 && \
+      (status == BUS_FAIL || status == MEM_FAIL))                            \
+    return status;
+
+  SENSOR_DRIVERS(SENSOR_DISCOVER)
+#undef SENSOR_DISCOVER
+
+  return status == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Connects to the local Redis server, waiting for it to become available
+ * @returns Redis context
+ */
+static redisContext* connect_local() {
+  redisContext* c;
+
+  do {
+    c = redisConnectWithTimeout("127.0.0.1", 6379, (struct timeval){1, 500000});
+
+    if (c->err) {
+      if (c->err == 1)
+        SIMAR_LOG(LOG_ERR,
+                  "Redis server instance not available. Have you "
+                  "initialized the Redis server? (Error code 1)\n");
+      else
+        SIMAR_LOG(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
+
+      redisFree(c);
+      c = NULL;
+      nanosleep((const struct timespec[]){{0, 700000000L}}, NULL);  // 700ms
     }
+  } while (c == NULL);
+
+  return c;
+}
+
+/**
+ * @brief Appends a readout record, and its alert if it carries one (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Readout record
+ * @returns Commands appended
+ */
+static int append_readout(redisContext* c, const void* payload) {
+  const struct readout_record* r = payload;
+  int appended = 0;
 
-    cJSON_Delete(boards_json);
-    free(json_buf);
+  if (r->flags & RESULT_ALERT)
+    appended += append_alert(c, r->sensor, r->alert, r->temperature, r->humidity);
+
+  if (r->flags & RESULT_PRESSURE)
+    appended += append_bme_sensor(c, r->sensor, r->temperature, r->pressure, r->humidity,
+                                  (r->flags & RESULT_OPEN) != 0, r->average, r->open_average);
+  else
+    appended += append_sht_sensor(c, r->sensor, r->temperature, r->humidity);
+
+  return appended;
+}
+
+/**
+ * @brief Appends the latest reference pressure (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Pressure, as read from the reference node
+ * @returns Commands appended
+ */
+static int append_reference(redisContext* c, const void* payload) {
+  return redisAppendCommand(c, "SET last_ext_pressure %s", (const char*)payload) == REDIS_OK;
+}
+
+/**
+ * @brief Connects to the local Redis server and loads the sweep script (writer, script mode)
+ *
+ * @details The script is loaded on every connection, so it is back after a server restart (the
+ * writer reconnects on the NOSCRIPT error of the first sweep sent meanwhile).
+ *
+ * @returns Redis context
+ */
+static redisContext* connect_script() {
+  redisContext* c = connect_local();
+
+  if (sweep_script_load(c, sweep_sha))
+    SIMAR_LOG(LOG_ERR, "Could not load the sweep script, sweeps will fail until reconnected");
+
+  return c;
+}
+
+/**
+ * @brief Bytes taken in the arena by the sweep packs
+ * @param[in] capacity Entries per sweep
+ * @returns Bytes
+ */
+static size_t sweep_pack_bytes(uint16_t capacity) {
+  int args = SWEEP_COMMAND_ARGS + SWEEP_ARGS + SWEEP_READOUT_ARGS * capacity;
+
+  return SWEEP_PACKS * (ARENA_BYTES(args, const char*) + ARENA_BYTES(args, size_t) +
+                        ARENA_BYTES(args, char[SWEEP_VALUE_LEN]));
+}
+
+/**
+ * @brief Allocates the sweep packs from the memory arena
+ * @param[in] capacity Entries per sweep
+ * @retval 0 OK
+ * @retval -1 Arena exhausted
+ */
+static int8_t sweep_pack_init(uint16_t capacity) {
+  int args = SWEEP_COMMAND_ARGS + SWEEP_ARGS + SWEEP_READOUT_ARGS * capacity;
+
+  for (int i = 0; i < SWEEP_PACKS; i++) {
+    packs[i].argv = arena_alloc(args * sizeof(const char*), "Sweep packs");
+    packs[i].argvlen = arena_alloc(args * sizeof(size_t), "Sweep packs");
+    packs[i].values = arena_alloc(args * SWEEP_VALUE_LEN, "Sweep packs");
+
+    if (packs[i].values == NULL)
+      return -1;
+
+    atomic_init(&packs[i].busy, 0);
   }
 
-  for (int i = 0; i < iface_board_len * 2; i++) {
-    struct bme_sensor_data sensor;
-    sensor.dev = bme_sensors[0].dev;
-    sensor.id.mux_id = i % iface_board_len;
-    sensor.id.ext_mux_id = -1;
+  return 0;
+}
+
+/**
+ * @brief Adds a string argument to a sweep pack
+ * @param[in, out] p Sweep pack
+ * @param[in] value Argument, kept by reference
+ */
+static void pack_string(struct sweep_pack* p, const char* value) {
+  p->argv[p->argc] = value;
+  p->argvlen[p->argc++] = strlen(value);
+}
 
-    uint8_t sensor_addr = i < iface_board_len ? BME280_I2C_ADDR_PRIM : BME280_I2C_ADDR_SEC;
-    uint8_t sensor_status = bme_init(&sensor.dev, &sensor.id, sensor_addr);
+/**
+ * @brief Adds a number argument to a sweep pack
+ * @param[in, out] p Sweep pack
+ * @param[in] format Format (of a double)
+ * @param[in] value Argument
+ */
+static void pack_number(struct sweep_pack* p, const char* format, double value) {
+  char* text = p->values[p->used++];
 
-    if (sensor_status == BUS_FAIL)
-      return BUS_FAIL;
+  p->argv[p->argc] = text;
+  p->argvlen[p->argc++] = snprintf(text, SWEEP_VALUE_LEN, format, value);
+}
 
-    if (sensor_status == BME280_OK) {
-      bme_sensors[valid_bme] = sensor;
-      bme_sensors[valid_bme].dev.intf_ptr = &bme_sensors[valid_bme].id;
-      bme_sensors[valid_bme].average = bme_sensors[valid_bme].open_average = 0;
-      bme_sensors[valid_bme].strikes_closed = bme_sensors[valid_bme].is_open = 0;
+/**
+ * @brief Appends a packed sweep, then hands the pack back to the Redis sink (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Sweep pack pointer
+ * @returns Commands appended
+ */
+static int append_pack(redisContext* c, const void* payload) {
+  struct sweep_pack* p = *(struct sweep_pack* const*)payload;
+  int appended = append_sweep_script(c, sweep_sha, p->argc, p->argv, p->argvlen);
 
-      snprintf(bme_sensors[valid_bme].name, MAX_NAME_LEN, "sensor_%d_%x", i % iface_board_len,
-               sensor_addr);
+  // hiredis formats the command into its output buffer, so the arguments are no longer needed
+  atomic_store_explicit(&p->busy, 0, memory_order_release);
+  return appended;
+}
 
-      syslog(LOG_INFO, "Initialized BMx device with address 0x%x at channel %d", sensor_addr,
-             sensor.id.mux_id);
-      valid_bme++;
+/**
+ * @brief Redis output, script mode: every readout and alert of a sweep, and the latest reference
+ * pressure, as a single command
+ * @param[in] block Sweep results
+ * @param[in] arg Redis writer
+ */
+static void redis_script_sink(const struct results_block* block, void* arg) {
+  const struct timespec period = {0, WRITER_POLL};
+  struct sweep_pack* p = &packs[block->sequence % SWEEP_PACKS];
+  struct timespec now;
+
+  // Every pack is still queued: the writer is behind, and the results pool holds the sensors back
+  while (atomic_load_explicit(&p->busy, memory_order_acquire))
+    nanosleep(&period, NULL);
+
+  int reference = atomic_exchange(&reference_pending, 0);
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  p->argc = SWEEP_COMMAND_ARGS;
+  p->used = 0;
+  pack_number(p, "%.3f", now.tv_sec + now.tv_nsec / 1e9);
+  pack_number(p, "%.0f", publish.ttl);
+  pack_number(p, "%.0f", publish.history);
+  if (reference != 0)
+    pack_number(p, "%.3f", reference / 1e3);
+  else
+    pack_string(p, "");
+
+  for (int i = 0; i < block->amount; i++) {
+    pack_string(p, block->sensor[i]);
+    pack_number(p, "%.3f", block->temperature[i]);
+    pack_number(p, "%.3f", block->humidity[i]);
+
+    if (block->flags[i] & RESULT_PRESSURE) {
+      pack_number(p, "%.3f", block->pressure[i]);
+      pack_number(p, "%.0f", (block->flags[i] & RESULT_OPEN) != 0);
+      pack_number(p, "%.3f", block->average[i]);
+      pack_number(p, "%.3f", block->open_average[i]);
     } else {
-      struct sht3x_sensor_data sht_sensor = {.id.mux_id = i % iface_board_len, .id.ext_mux_id = -1};
-      uint8_t sht_sensor_addr = i < iface_board_len ? SHT3X_I2C_ADDR_DFLT : SHT3X_I2C_ADDR_ALT;
+      for (int f = 0; f < 4; f++)
+        pack_string(p, "");
+    }
+
+    if (block->flags[i] & RESULT_ALERT)
+      pack_number(p, "%.0f", block->alert[i]);
+    else
+      pack_string(p, "");
+  }
+
+  atomic_store_explicit(&p->busy, 1, memory_order_relaxed);
+  if (writer_push(arg, append_pack, &p, sizeof(p)))
+    atomic_store_explicit(&p->busy, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief Loads the Redis publish mode, falling back to one command per readout
+ * @param[out] cfg Publish mode
+ * @param[in] path Device configuration
+ */
+static void load_publish(struct publish_config* cfg, const char* path) {
+  const cJSON *redis, *item;
 
-      if (sht3x_init(&sht_sensor, sht_sensor_addr) == BME280_OK) {
-        sht_sensors[valid_sht] = sht_sensor;
-        snprintf(sht_sensors[valid_sht].name, MAX_NAME_LEN, "sensor_%d_%x", i % iface_board_len,
-                 sht_sensor_addr);
+  *cfg = (struct publish_config){.script = 0, .ttl = SWEEP_TTL, .history = SWEEP_HISTORY};
 
-        syslog(LOG_INFO, "Initialized SHT3x device with address 0x%x at channel %d",
-               sht_sensor_addr, sht_sensor.id.mux_id);
-        valid_sht++;
+  cJSON* json = config_load(path);
+
+  redis = cJSON_GetObjectItemCaseSensitive(json, "redis");
+  item = cJSON_GetObjectItemCaseSensitive(redis, "publish");
+  cfg->script = cJSON_IsString(item) && strcmp(item->valuestring, "script") == 0;
+
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(redis, "ttl")) && item->valueint >= 0)
+    cfg->ttl = item->valueint;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(redis, "history")) &&
+      item->valueint > 0)
+    cfg->history = item->valueint;
+
+  cJSON_Delete(json);
+}
+
+/**
+ * @brief Redis output: queues every readout and alert of a sweep for the writer
+ * @param[in] block Sweep results
+ * @param[in] arg Redis writer
+ */
+static void redis_sink(const struct results_block* block, void* arg) {
+  struct redis_writer* w = arg;
+
+  for (int i = 0; i < block->amount; i++) {
+    struct readout_record r = {.sensor = block->sensor[i],
+                               .temperature = block->temperature[i],
+                               .pressure = block->pressure[i],
+                               .humidity = block->humidity[i],
+                               .average = block->average[i],
+                               .open_average = block->open_average[i],
+                               .flags = block->flags[i],
+                               .alert = block->alert[i]};
+
+    writer_push(w, append_readout, &r, sizeof(r));
+  }
+}
+
+/**
+ * @brief MQTT output: a sweep of every readout and alert
+ * @param[in] block Sweep results
+ * @param[in] arg MQTT client
+ */
+static void mqtt_sink(const struct results_block* block, void* arg) {
+  struct mqtt_client* client = arg;
+
+  mqtt_sweep_begin(client, "bme");
+
+  for (int i = 0; i < block->amount; i++) {
+    mqtt_sweep_add(client, block->sensor[i], "temperature", block->temperature[i]);
+    if (block->flags[i] & RESULT_PRESSURE)
+      mqtt_sweep_add(client, block->sensor[i], "pressure", block->pressure[i]);
+    mqtt_sweep_add(client, block->sensor[i], "humidity", block->humidity[i]);
+    if (block->flags[i] & RESULT_PRESSURE)
+      mqtt_sweep_add(client, block->sensor[i], "open", (block->flags[i] & RESULT_OPEN) != 0);
+    if (block->flags[i] & RESULT_ALERT)
+      mqtt_sweep_add(client, block->sensor[i], "alert", block->alert[i]);
+  }
+
+  // Broker outages only delay the MQTT output, the sweep stays queued
+  mqtt_sweep_end(client);
+}
+
+/**
+ * @brief Claims the shared memory board entry of every sensor, once the topology is known
+ * @param[in, out] board Shared memory board
+ */
+static void shm_claim_sensors(struct shm_board* board) {
+  static const char* const fields[] = {"temperature", "humidity",     "pressure",
+                                       "average",     "open_average", "open"};
+
+  // SHT3x sensors only have the first two fields
+#define SENSOR_CLAIM(type, label, slot, name, ...)                                          \
+  for (int i = 0; i < type##_bank.amount; i++) {                                            \
+    uint8_t count = type##_driver_flags(&type##_bank.sensors[i]) & RESULT_PRESSURE ? 6 : 2; \
+                                                                                            \
+    if ((type##_bank.entries[i] =                                                           \
+             shm_claim(board, type##_bank.sensors[i].name, fields, count)) == NULL)         \
+      SIMAR_LOG(LOG_WARNING, "Shared memory board full, %s is not shared",                  \
+                type##_bank.sensors[i].name);                                               \
+  }
+
+  SENSOR_DRIVERS(SENSOR_CLAIM)
+#undef SENSOR_CLAIM
+}
+
+/**
+ * @brief Shared memory output: the latest readout of every sensor, for consumers on this node
+ * @param[in] block Sweep results
+ * @param[in] arg Unused (entries are claimed at startup)
+ */
+static void shm_sink(const struct results_block* block, void* arg) {
+  for (int i = 0; i < block->amount; i++) {
+    double values[] = {block->temperature[i],
+                       block->humidity[i],
+                       block->pressure[i],
+                       block->average[i],
+                       block->open_average[i],
+                       (block->flags[i] & RESULT_OPEN) != 0};
+
+    if (block->shm[i] != NULL)
+      shm_publish(block->shm[i], values);
+  }
+}
+
+/**
+ * @brief Appends the sweep time of a board (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Board record
+ * @returns Commands appended
+ */
+static int append_board_time(redisContext* c, const void* payload) {
+  const struct board_record* r = payload;
+  return redisAppendCommand(c, "HSET sweep_time %d %.3f", r->board, r->ms) == REDIS_OK;
+}
+
+/**
+ * @brief Reports the average I2C time per sweep of every board with sensors, then starts over
+ * @param[in] sweeps Sweeps since the last report
+ */
+static void report_boards(uint32_t sweeps) {
+  for (int i = 0; i < BOARD_ADDRS; i++) {
+    if (board_time[i].sensors == 0)
+      continue;
+
+    struct board_record r = {.board = i, .ms = sweeps ? board_time[i].busy * 1e3 / sweeps : 0};
+
+    SIMAR_LOG(LOG_INFO, "Board %d: %.3f ms per sweep over %u sweeps", i, r.ms, sweeps);
+    writer_push(&writer, append_board_time, &r, sizeof(r));
+    board_time[i].busy = 0;
+  }
+}
+
+/**
+ * @brief Loads the SPI expansion boards from the device configuration
+ *
+ * @details Each `spiExpansion` entry of the `"boards"` array has its address (1 to 15) and,
+ * optionally, the board channels in use (`"channels"`, 1 to 7 except 4; all of them by default).
+ *
+ * @param[out] boards Expansion boards (BOARD_ADDRS - 1 at most)
+ * @param[in] path Device configuration
+ * @returns Expansion boards found
+ */
+static uint8_t load_boards(struct ext_board* boards, const char* path) {
+  static const uint8_t all_channels[EXT_BOARD_CHANNELS] = {1, 2, 3, 5, 6, 7};
+  const cJSON *board, *item;
+  uint8_t amount = 0;
+
+  cJSON* json = config_load(path);
+
+  cJSON_ArrayForEach(board, cJSON_GetObjectItemCaseSensitive(json, "boards")) {
+    item = cJSON_GetObjectItemCaseSensitive(board, "type");
+    if (!cJSON_IsString(item) || strcmp(item->valuestring, "spiExpansion") != 0)
+      continue;
+
+    item = cJSON_GetObjectItemCaseSensitive(board, "address");
+    if (!cJSON_IsNumber(item) || item->valueint < 1 || item->valueint >= BOARD_ADDRS) {
+      SIMAR_LOG(LOG_ERR, "Ignoring expansion board without a valid address (1 to %d)",
+                BOARD_ADDRS - 1);
+      continue;
+    }
+
+    uint8_t duplicate = 0;
+    for (int i = 0; i < amount; i++)
+      duplicate |= boards[i].addr == item->valueint;
+
+    if (duplicate) {
+      SIMAR_LOG(LOG_ERR, "Ignoring duplicate expansion board %d", item->valueint);
+      continue;
+    }
+
+    struct ext_board* b = &boards[amount];
+    *b = (struct ext_board){.addr = item->valueint};
+
+    cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(board, "channels")) {
+      if (!cJSON_IsNumber(item) || item->valueint < 1 || item->valueint > 7 ||
+          item->valueint == 4 || b->channel_amount == EXT_BOARD_CHANNELS) {
+        SIMAR_LOG(LOG_ERR, "Ignoring invalid channel of expansion board %d", b->addr);
+        continue;
       }
+      b->channels[b->channel_amount++] = item->valueint;
+    }
+
+    if (b->channel_amount == 0) {
+      memcpy(b->channels, all_channels, sizeof(all_channels));
+      b->channel_amount = EXT_BOARD_CHANNELS;
     }
+
+    SIMAR_LOG(LOG_NOTICE, "Expansion board %d, %d channels", b->addr, b->channel_amount);
+    amount++;
   }
 
-  if (iface_board_len == 3) {
+  cJSON_Delete(json);
+  return amount;
+}
+
+int main(int argc, char* argv[]) {
+  startup_begin("bme");
+  log_init("simar");
+  account_init("bme");
+
+  redisContext *c, *c_remote;
+  redisReply *reply, *reply_remote;
+
+  startup_phase("config");
+  board_amount = load_boards(boards, "/opt/device.json");
+  load_publish(&publish, "/opt/device.json");
+
+  // The fourth interface board channel leads to the expansion boards
+  if (board_amount > 0)
+    iface_board_len = 3;
+
+  for (int i = 0; i < iface_board_len * 2; i++) {
+    struct identifier id = {.mux_id = i % iface_board_len, .ext_mux_id = -1};
+
+    startup_phase("probe %d%s", i % iface_board_len, i >= iface_board_len ? " secondary" : "");
+    int8_t status = discover(id, i >= iface_board_len, i % iface_board_len);
+
+    if (status == BUS_FAIL || status == MEM_FAIL)
+      return status;
+  }
+
+  if (board_amount > 0) {
     uint32_t mode = 3;
     uint8_t bpw = 8;
     uint32_t speed = 1000000;
 
+    startup_phase("bus open");
     spi_open("/dev/spidev0.0", &mode, &bpw, &speed);
 
-    for (int i = 1; i < EXT_BOARD_I2C_LEN + 2; i++) {
-      if (i % 4 == 0)
-        continue;
-
-      struct bme_sensor_data sensor;
-      sensor.dev = bme_sensors[0].dev;
-      sensor.id.mux_id = 3;
-
-      /* Gets multiplexer channel ID for I2C extension board.
-       *  Up to the fourth channel, only the first mux is used, which
-       *  is selected by the first pair of bits (from LSB).
-       *  From the fourth channel onwards, the second mux. is used.
-       *  Channels xx00 and 00xx cannot be used, as they are currently
-       *  used for "parking" each multiplexer to prevent cross-communication.
-       */
-      sensor.id.ext_mux_id = i < 4 ? i % 4 : (i % 4) << 2;
-
-      uint8_t sensor_addr = BME280_I2C_ADDR_PRIM;
-      uint8_t sht_sensor_addr = SHT3X_I2C_ADDR_DFLT;
-
-      do {
-        uint8_t sensor_status = bme_init(&sensor.dev, &sensor.id, sensor_addr);
-
-        if (sensor_status == BUS_FAIL)
-          return BUS_FAIL;
-
-        if (sensor_status == BME280_OK) {
-          bme_sensors[valid_bme] = sensor;
-          bme_sensors[valid_bme].dev.intf_ptr = &bme_sensors[valid_bme].id;
-          bme_sensors[valid_bme].average = bme_sensors[valid_bme].open_average = 0;
-          bme_sensors[valid_bme].strikes_closed = bme_sensors[valid_bme].is_open = 0;
-
-          snprintf(bme_sensors[valid_bme].name, MAX_NAME_LEN, "sensor_%d_%x",
-                   i + iface_board_len + 1, sensor_addr);
-
-          syslog(LOG_INFO,
-                 "Initialized BMx device on expansion board with address 0x%x at channel %d",
-                 sensor_addr, sensor.id.ext_mux_id);
-          valid_bme++;
-        } else {
-          struct sht3x_sensor_data sht_sensor = {.id.mux_id = i % iface_board_len,
-                                                 .id.ext_mux_id = -1};
-          if (sht3x_init(&sht_sensor, sht_sensor_addr) == BME280_OK) {
-            sht_sensors[valid_sht] = sht_sensor;
-            snprintf(sht_sensors[valid_sht].name, MAX_NAME_LEN, "sensor_%d_%x", i % iface_board_len,
-                     sht_sensor_addr);
-
-            syslog(LOG_INFO,
-                   "Initialized SHT3x on expansion board device with address 0x%x at channel %d",
-                   sht_sensor_addr, sht_sensor.id.ext_mux_id);
-            valid_sht++;
-          }
+    for (int b = 0; b < board_amount; b++) {
+      for (int k = 0; k < boards[b].channel_amount; k++) {
+        uint8_t channel = boards[b].channels[k];
+
+        /* Gets multiplexer channel ID for I2C extension board.
+         *  Up to the fourth channel, only the first mux is used, which
+         *  is selected by the first pair of bits (from LSB).
+         *  From the fourth channel onwards, the second mux. is used.
+         *  Channels xx00 and 00xx cannot be used, as they are currently
+         *  used for "parking" each multiplexer to prevent cross-communication.
+         */
+        struct identifier id = {.mux_id = 3,
+                                .ext_mux_id = channel < 4 ? channel : (channel % 4) << 2,
+                                .ext_addr = boards[b].addr};
+
+        for (uint8_t second = 0; second < 2; second++) {
+          int number = iface_board_len + 1 + b * EXT_BOARD_NAMES + channel;
+
+          startup_phase("probe %d%s", number, second ? " secondary" : "");
+          int8_t status = discover(id, second, number);
+
+          if (status == BUS_FAIL || status == MEM_FAIL)
+            return status;
         }
-      } while (sensor_addr++ < BME280_I2C_ADDR_SEC && sht_sensor_addr++ < SHT3X_I2C_ADDR_ALT);
+      }
     }
 
     unselect_i2c_extender();
   }
 
-  if (valid_bme < 1 && valid_sht < 1) {
-    syslog(LOG_CRIT, "No sensors found");
+#define SENSOR_COUNT(type, ...) +type##_bank.amount
+#define SENSOR_RESERVE(type, label, slot, ...)                  \
+  +ARENA_BYTES(type##_bank.amount, slot) +                      \
+      ARENA_BYTES(type##_bank.amount, struct adaptive_rate) +   \
+      ARENA_BYTES(type##_bank.amount, uint8_t) +                \
+      ARENA_BYTES(type##_bank.amount, struct shm_entry*)
+
+  int sensors = 0 SENSOR_DRIVERS(SENSOR_COUNT);
+
+  if (sensors < 1) {
+    SIMAR_LOG(LOG_CRIT, "No sensors found");
     return SENSOR_FAIL;
   }
 
-  syslog(LOG_NOTICE, "Starting up...");
+  SIMAR_LOG(LOG_NOTICE, "Starting up...");
+  startup_phase("memory");
 
-  int server_i = 0;
+  // Sensor tables and their scheduling state, sweep results (a readout and an alert per sensor at
+  // most) and their packs for the sweep script, and the writer and reference connections, the
+  // writer pipelining up to 3 commands per record
+  size_t pack_bytes = publish.script ? sweep_pack_bytes(2 * sensors) : 0;
 
-  do {
-    c = redisConnectWithTimeout("127.0.0.1", 6379, (struct timeval){1, 500000});
-    c_remote = redisConnectWithTimeout(servers[server_i], 6379, (struct timeval){1, 500000});
+  if (arena_init(results_bytes(2 * sensors) + pack_bytes SENSOR_DRIVERS(SENSOR_RESERVE), 2,
+                 3 * WRITER_BATCH) ||
+      results_init(&results, 2 * sensors) || (publish.script && sweep_pack_init(2 * sensors)))
+    return MEM_FAIL;
 
-    if (c->err) {
-      if (c->err == 1)
-        syslog(LOG_ERR,
-               "Redis server instance not available. Have you "
-               "initialized the Redis server? (Error code 1)\n");
-      else
-        syslog(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
+#define SENSOR_SETUP(type, ...) \
+  if (type##_setup())           \
+    return MEM_FAIL;
 
-      nanosleep((const struct timespec[]){{0, 700000000L}}, NULL);  // 700ms
-    }
+  // Sensor tables move into the arena here, so they must not be used through older pointers
+  SENSOR_DRIVERS(SENSOR_SETUP)
 
-    if (c_remote->err) {
-      if (server_i == 0) {
-        syslog(LOG_ERR,
-               "No remote Redis server instance for calibration is available. "
-               "Attempting to fetch local mirror.\n");
-        c_remote = c;
-      }
+  for (int i = 0; i < BOARD_ADDRS; i++) {
+    if (board_time[i].sensors > 0)
+      SIMAR_LOG(LOG_NOTICE, "%d sensors on %s %d", board_time[i].sensors,
+                i == 0 ? "the interface board" : "expansion board", i);
+  }
 
-      syslog(LOG_ERR, "%s remote Redis server not available, switching...\n", servers[server_i++]);
-    }
+  startup_phase("redis local");
+  c = connect_local();
 
-  } while (c->err || c_remote->err);
+  // The reference node lives on whichever central server owns the wireless keys in the hash ring
+  struct redis_ring ring;
+  startup_phase("redis remote");
+  ring_init(&ring, redis_servers, sizeof(redis_servers) / sizeof(redis_servers[0]));
+  c_remote = ring_connect(&ring, WIRELESS_KEY, (struct timeval){1, 500000}, RING_REPLICAS, NULL);
+
+  if (c_remote == NULL) {
+    SIMAR_LOG(LOG_ERR,
+              "No remote Redis server instance for calibration is available. "
+              "Attempting to fetch local mirror.\n");
+    c_remote = connect_local();
+  }
+
+  SIMAR_LOG(LOG_NOTICE, "Redis DB connected");
+
+  startup_phase("outputs");
+  struct mqtt_config mqtt_cfg;
+  if (mqtt_load_config(&mqtt_cfg, MQTT_CONFIG) == 0)
+    SIMAR_LOG(LOG_NOTICE, "MQTT output enabled, broker at %s:%d", mqtt_cfg.host, mqtt_cfg.port);
+  mqtt_init(&mqtt, &mqtt_cfg);
+
+  // Each output consumes the sweep results on its own thread
+  if (publish.script && sweep_script_load(c, sweep_sha) == 0) {
+    SIMAR_LOG(LOG_NOTICE, "Publishing sweeps through the sweep script (expiry %d s, history %d)",
+              publish.ttl, publish.history);
+    results_sink_add(&results, "Redis", redis_script_sink, &writer);
+  } else {
+    publish.script = 0;
+    results_sink_add(&results, "Redis", redis_sink, &writer);
+  }
+  if (mqtt_cfg.enabled)
+    results_sink_add(&results, "MQTT", mqtt_sink, &mqtt);
+  if ((shm = shm_attach(1)) != NULL) {
+    shm_claim_sensors(shm);
+    results_sink_add(&results, "Shared memory", shm_sink, NULL);
+    reference = shm_claim(shm, "reference", (const char* const[]){"pressure"}, 1);
+  }
 
-  syslog(LOG_NOTICE, "Redis DB connected");
   int retries = 0;
 
   // Populate moving average window before anything else
 
   double pressure_delta = 0;
 
-  reply_remote = redisCommand(c_remote, "GET wgen2_pressure");
+  startup_phase("calibration read");
+  reply_remote = redisCommand(c_remote, "GET %s_pressure", REFERENCE_NODE);
 
-  if (reply_remote->str) {
+  if (reply_remote != NULL && reply_remote->str) {
     double external_pressure = atof(reply_remote->str);
     reply = redisCommand(c, "GET last_ext_pressure");
 
-    if (reply->str) {
+    if (reply != NULL && reply->str) {
       double pressure_cache = atof(reply->str);
       pressure_delta = external_pressure - pressure_cache;
-      syslog(LOG_NOTICE,
-             "Deviation detected, pressure delta is %.3f, current external "
-             "pressure is %.3f and last recorded pressure is %.3f\n",
-             pressure_delta, external_pressure, pressure_cache);
+      SIMAR_LOG(LOG_NOTICE,
+                "Deviation detected, pressure delta is %.3f, current external "
+                "pressure is %.3f and last recorded pressure is %.3f\n",
+                pressure_delta, external_pressure, pressure_cache);
     }
     freeReplyObject(reply);
   }
@@ -332,10 +1160,15 @@ int main(int argc, char* argv[]) {
   reply = (redisReply*)redisCommand(c, "DEL valid_sensors");
   freeReplyObject(reply);
 
-  for (int i = 0; i < valid_bme; i++) {
+  // Door state calibration (BMx only)
+  struct bme_sensor_data* bme_sensors = bme_bank.sensors;
+
+  for (int i = 0; i < bme_bank.amount; i++) {
+    startup_phase("calibration %s", bme_sensors[i].name);
     reply = redisCommand(c, "HGET %s avg", bme_sensors[i].name);
 
-    if (!reply->str) {
+    if (reply == NULL || !reply->str) {
+      startup_phase("warm-up %s", bme_sensors[i].name);
       bme_sensors[i].past_pres = 0;
 
       // First 3 readouts are discarded
@@ -356,7 +1189,8 @@ int main(int argc, char* argv[]) {
           --j;
           ++retries;
           if (retries > 10) {
-            syslog(LOG_ERR, "Could not obtain realistic data from sensor number %d\n", i);
+            SIMAR_LOG(LOG_ERR, "Could not obtain realistic data from sensor number %d\n", i);
+            freeReplyObject(reply);
             return SENSOR_FAIL;
           }
         }
@@ -364,7 +1198,7 @@ int main(int argc, char* argv[]) {
     } else {
       double avg = atof(reply->str);
 
-      syslog(LOG_NOTICE, "Pressure moving average for %d was %.3f\n", i, avg);
+      SIMAR_LOG(LOG_NOTICE, "Pressure moving average for %d was %.3f\n", i, avg);
 
       avg += pressure_delta;
       bme_sensors[i].past_pres = avg;
@@ -377,20 +1211,23 @@ int main(int argc, char* argv[]) {
 
         ++retries;
         if (retries > 10) {
-          syslog(LOG_ERR, "Could not obtain realistic data from sensor number %d\n", i);
+          SIMAR_LOG(LOG_ERR, "Could not obtain realistic data from sensor number %d\n", i);
+          freeReplyObject(reply);
           return SENSOR_FAIL;
         }
       }
 
+      freeReplyObject(reply);
       reply = redisCommand(c, "HGET %s open", bme_sensors[i].name);
-      syslog(LOG_NOTICE, "Sensor %d had open state %s", i, reply->str);
+      SIMAR_LOG(LOG_NOTICE, "Sensor %d had open state %s", i,
+                reply != NULL && reply->str ? reply->str : "(none)");
 
-      if (!strcmp(reply->str, "1")) {
-        syslog(LOG_NOTICE, "Sensor %d had open avg. %s", i, reply->str);
+      if (reply != NULL && reply->str && !strcmp(reply->str, "1")) {
+        SIMAR_LOG(LOG_NOTICE, "Sensor %d had open avg. %s", i, reply->str);
         freeReplyObject(reply);
         reply = redisCommand(c, "HGET %s openavg", bme_sensors[i].name);
 
-        if (reply->str && atof(reply->str)) {
+        if (reply != NULL && reply->str && atof(reply->str)) {
           bme_sensors[i].open_average = atof(reply->str) + pressure_delta;
           bme_sensors[i].strikes_closed = WINDOW_SIZE;
           bme_sensors[i].average = bme_sensors[i].open_average - 0.3;
@@ -409,85 +1246,84 @@ int main(int argc, char* argv[]) {
     update_open(&bme_sensors[i]);
   }
 
-  syslog(LOG_NOTICE, "Calibration data obtained");
-  int i = 0;
+  SIMAR_LOG(LOG_NOTICE, "Calibration data obtained");
 
   reply = (redisReply*)redisCommand(c, "SET retries 0");
   freeReplyObject(reply);
 
-  uint8_t bme_errors = 0;
+  // From here on, the local connection is only written to by the writer, for every thread
+  startup_phase("first publish");
+  if (writer_start(&writer, c, publish.script ? connect_script : connect_local))
+    return DB_FAIL;
 
-  while (1) {
-    for (i = 0; i < valid_bme; i++) {
-      if (bme_read(&bme_sensors[i].dev, &bme_sensors[i].data) == BME280_OK &&
-          check_alteration(bme_sensors[i]) == BME280_OK) {
-        bme_errors = 0;
-        reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", bme_sensors[i].name, "temperature",
-                                          bme_sensors[i].data.temperature);
-        if (reply == NULL)
-          return DB_FAIL;
-
-        freeReplyObject(reply);
-
-        reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", bme_sensors[i].name, "pressure",
-                                          bme_sensors[i].data.pressure);
-        freeReplyObject(reply);
-
-        reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", bme_sensors[i].name, "humidity",
-                                          bme_sensors[i].data.humidity);
-        freeReplyObject(reply);
+  // Each sensor is sampled at its own rate, all of them sharing the I2C bus time budget
+  struct bus_budget bus;
+  struct timespec now, ready, earliest, last_reference = {0, 0}, last_report;
+  uint32_t sweeps = 0;
 
-        update_open(&bme_sensors[i]);
-        reply = (redisReply*)redisCommand(c, "HSET %s %s %d", bme_sensors[i].name, "open",
-                                          bme_sensors[i].is_open);
-        freeReplyObject(reply);
+  clock_gettime(CLOCK_MONOTONIC, &last_report);
+  budget_init(&bus, BUS_BUDGET, MAX_PERIOD * BUS_BUDGET);
+  arena_seal();
 
-        reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", bme_sensors[i].name, "avg",
-                                          bme_sensors[i].average);
-        freeReplyObject(reply);
+#define SENSOR_BEGIN(type, ...)         \
+  if (type##_begin(&now, &bus, &ready)) \
+    return SENSOR_FAIL;
+#define SENSOR_COLLECT(type, ...)        \
+  if (type##_collect(&now, &bus, block)) \
+    return SENSOR_FAIL;
+#define SENSOR_EARLIEST(type, ...) type##_earliest(&earliest);
 
-        reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", bme_sensors[i].name, "openavg",
-                                          bme_sensors[i].open_average);
-        freeReplyObject(reply);
+  while (1) {
+    struct results_block* block = results_acquire(&results);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    account_tick();
 
-        bme_sensors->past_pres = bme_sensors[i].data.pressure;
-      } else {
-        if (bme_errors++ > ERROR_THRESHOLD)
-          return SENSOR_FAIL;
-      }
-    }
+    // Conversions of every due sensor run at the same time, so the sweep only waits for the
+    // slowest one before reading them back
+    ready = (struct timespec){0, 0};
+    SENSOR_DRIVERS(SENSOR_BEGIN)
 
-    for (i = 0; i < valid_sht; i++) {
-      if (sht3x_measure_blocking_read(&sht_sensors[i]) != BME280_OK)
-        return SENSOR_FAIL;
+    if (ready.tv_sec != 0)
+      adaptive_sleep(&ready);
 
-      reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", sht_sensors[i].name, "temperature",
-                                        sht_sensors[i].data.temperature);
+    SENSOR_DRIVERS(SENSOR_COLLECT)
 
-      if (reply == NULL)
-        return DB_FAIL;
+    // Every sensor read in this pass goes to the outputs at once, without copies
+    results_publish(&results, block);
+    sweeps++;
 
-      freeReplyObject(reply);
+    if (board_amount > 0)
+      unselect_i2c_extender();
 
-      reply = (redisReply*)redisCommand(c, "HSET %s %s %.3f", sht_sensors[i].name, "humidity",
-                                        sht_sensors[i].data.humidity);
-      freeReplyObject(reply);
+    if (timespec_diff(&now, &last_report) >= BOARD_REPORT_PERIOD) {
+      report_boards(sweeps);
+      sweeps = 0;
+      last_report = now;
     }
 
-    if (iface_board_len == 3)
-      unselect_i2c_extender();
-
-    reply_remote = (redisReply*)redisCommand(c_remote, "GET wgen2_pressure");
+    if (timespec_diff(&now, &last_reference) >= REFERENCE_PERIOD) {
+      reply_remote = (redisReply*)redisCommand(c_remote, "GET %s_pressure", REFERENCE_NODE);
+
+      if (reply_remote != NULL && reply_remote->str && strlen(reply_remote->str) < WRITER_PAYLOAD) {
+        // Script mode: stored along with the next sweep
+        if (publish.script)
+          atomic_store(&reference_pending, lround(atof(reply_remote->str) * 1e3));
+        else
+          writer_push(&writer, append_reference, reply_remote->str, strlen(reply_remote->str) + 1);
+        if (reference != NULL)
+          shm_publish(reference, (double[]){atof(reply_remote->str)});
+      }
 
-    if (reply_remote->str) {
-      reply = (redisReply*)redisCommand(c, "SET last_ext_pressure %s", reply_remote->str);
-      freeReplyObject(reply);
+      freeReplyObject(reply_remote);
+      last_reference = now;
     }
 
-    freeReplyObject(reply_remote);
-    nanosleep((const struct timespec[]){{0, 250000000L}}, NULL);
+    // Sleep until the next sensor is due, but never longer than the slowest rate
+    clock_gettime(CLOCK_MONOTONIC, &earliest);
+    earliest.tv_sec += MAX_PERIOD;
+    SENSOR_DRIVERS(SENSOR_EARLIEST)
+    adaptive_sleep(&earliest);
   }
 
-  redisFree(c);
   return 0;
 }
@@ -3,15 +3,25 @@
  */
 
 #include <fcntl.h>
+#include <getopt.h>
 #include <hiredis/hiredis.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
+#include "../log/log.h"
+#include "../mem/arena.h"
+#include "../mem/shm.h"
+#include "../mqtt/common.h"
+#include "../sched/account.h"
+#include "../sched/startup.h"
 #include "../spi/common.h"
 
 #define AI_PIN "/sys/bus/iio/devices/iio:device0/in_voltage1_raw"
 
+struct mqtt_client mqtt;
+const char* adc_path = AI_PIN;
+
 double get_rpm(double runtime) {
   char adc[5] = {0};
 
@@ -23,9 +33,9 @@ double get_rpm(double runtime) {
   uint32_t valley_count = 1;
 
   for (uint8_t i = 0; i < 100; i++) {
-    int fd = open(AI_PIN, O_RDONLY);
+    int fd = open(adc_path, O_RDONLY);
     if (read(fd, adc, 4) < 1) {
-      syslog(LOG_ERR, "No ADC found for fan sensor");
+      SIMAR_LOG(LOG_ERR, "No ADC found for fan sensor");
       exit(-2);
     }
     close(fd);
@@ -51,36 +61,89 @@ double get_rpm(double runtime) {
   return (60 / (sum_valley_spacing / count_valley_spacing * runtime)) / 3;
 }
 
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-a ADC file (such as a simulated one, instead of %s)]\n", prog,
+          AI_PIN);
+}
+
 int main(int argc, char* argv[]) {
-  openlog("simar", 0, LOG_LOCAL0);
+  int opt;
+
+  startup_begin("fan");
+
+  while ((opt = getopt(argc, argv, "a:h")) != -1) {
+    switch (opt) {
+      case 'a':
+        adc_path = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  log_init("simar");
+  account_init("fan");
 
   clock_t t;
   redisContext* c;
   redisReply* reply;
 
+  startup_phase("calibration");
   t = clock();
   get_rpm(0.0013);
   t = clock() - t;
 
   double runtime = ((double)t) / CLOCKS_PER_SEC / 18;
 
+  startup_phase("memory");
+  if (arena_init(0, 1, 1))
+    return MEM_FAIL;
+
+  startup_phase("redis local");
   do {
     c = redisConnectWithTimeout("127.0.0.1", 6379, (struct timeval){1, 500000});
 
     if (c->err) {
       if (c->err == 1)
-        syslog(LOG_ERR,
-               "Redis server instance not available. Have you "
-               "initialized the Redis server? (Error code 1)\n");
+        SIMAR_LOG(LOG_ERR,
+                  "Redis server instance not available. Have you "
+                  "initialized the Redis server? (Error code 1)\n");
       else
-        syslog(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
+        SIMAR_LOG(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
 
+      redisFree(c);
+      c = NULL;
       nanosleep((const struct timespec[]){{0, 700000000L}}, NULL);  // 700ms
     }
-  } while (c->err);
+  } while (c == NULL);
+
+  startup_phase("outputs");
+  struct mqtt_config mqtt_cfg;
+  if (mqtt_load_config(&mqtt_cfg, MQTT_CONFIG) == 0)
+    SIMAR_LOG(LOG_NOTICE, "MQTT output enabled, broker at %s:%d", mqtt_cfg.host, mqtt_cfg.port);
+  mqtt_init(&mqtt, &mqtt_cfg);
+
+  struct shm_board* board = shm_attach(1);
+  struct shm_entry* entry =
+      board != NULL ? shm_claim(board, "fan", (const char* const[]){"speed"}, 1) : NULL;
+  arena_seal();
+  startup_phase("first publish");
 
   while (1) {
-    reply = (redisReply*)redisCommand(c, "HSET fan speed %.3f", get_rpm(runtime));
+    account_tick();
+    double rpm = get_rpm(runtime);
+
+    reply = (redisReply*)redisCommand(c, "HSET fan speed %.3f", rpm);
+    if (reply != NULL && reply->type != REDIS_REPLY_ERROR)
+      startup_published();
     freeReplyObject(reply);
+
+    if (entry != NULL)
+      shm_publish(entry, &rpm);
+
+    mqtt_sweep_begin(&mqtt, "fan");
+    mqtt_sweep_add(&mqtt, "fan", "speed", rpm);
+    mqtt_sweep_end(&mqtt);
   }
 }
@@ -1,12 +1,11 @@
 /*! @file leak.c
- * @brief Main starting point for fan RPM sensor module
+ * @brief Main starting point for leak detector module
  */
 
 #include <hiredis/hiredis.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -17,48 +16,125 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
+#include "../digital/debounce.h"
+#include "../log/log.h"
+#include "../mem/arena.h"
+#include "../mem/shm.h"
+#include "../mqtt/common.h"
+#include "../redis/common.h"
+#include "../sched/account.h"
+#include "../sched/adaptive.h"
+#include "../sched/startup.h"
 #include "../spi/common.h"
 
+// Sampling period limits (s); any change in the detector state counts as activity
+#define MIN_PERIOD 0.25
+#define MAX_PERIOD 2
+#define STATE_SIGMA 0.1
+#define STATE_RATE 0
+
+struct mqtt_client mqtt;
+
+/**
+ * @brief Takes a burst of sub-samples from the digital board
+ * @param[out] subsamples Sub-samples (one bit per channel)
+ * @param[in] cfg Debouncing parameters
+ * @retval 0 OK
+ * @retval -1 Read failure
+ */
+int8_t sample_channels(uint8_t* subsamples, const struct debounce_config* cfg) {
+  const struct timespec interval = {(time_t)cfg->interval,
+                                    (cfg->interval - (time_t)cfg->interval) * 1e9};
+
+  // Each sub-sample is a full read sequence, module selection cycles included
+  for (int s = 0; s < cfg->subsamples; s++) {
+    if (s > 0)
+      nanosleep(&interval, NULL);
+
+    if (read_data(3, (char*)&subsamples[s], 1) != 1)
+      return -1;
+  }
+
+  return 0;
+}
+
 int main(int argc, char* argv[]) {
-  openlog("simar", 0, LOG_LOCAL0);
+  startup_begin("leak");
+  log_init("simar");
+  account_init("leak");
 
   redisContext* c;
-  redisReply* reply;
 
+  startup_phase("memory");
+  if (arena_init(0, 1, 1))
+    return MEM_FAIL;
+
+  startup_phase("redis local");
   do {
     c = redisConnectWithTimeout("127.0.0.1", 6379, (struct timeval){1, 500000});
 
     if (c->err) {
       if (c->err == 1)
-        syslog(LOG_ERR,
-               "Redis server instance not available. Have you "
-               "initialized the Redis server? (Error code 1)\n");
+        SIMAR_LOG(LOG_ERR,
+                  "Redis server instance not available. Have you "
+                  "initialized the Redis server? (Error code 1)\n");
       else
-        syslog(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
+        SIMAR_LOG(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
 
+      redisFree(c);
+      c = NULL;
       nanosleep((const struct timespec[]){{0, 700000000L}}, NULL);  // 700ms
     }
-  } while (c->err);
+  } while (c == NULL);
+
+  SIMAR_LOG(LOG_NOTICE, "Redis DB connected");
 
-  syslog(LOG_NOTICE, "Redis DB connected");
+  startup_phase("outputs");
+  struct mqtt_config mqtt_cfg;
+  if (mqtt_load_config(&mqtt_cfg, MQTT_CONFIG) == 0)
+    SIMAR_LOG(LOG_NOTICE, "MQTT output enabled, broker at %s:%d", mqtt_cfg.host, mqtt_cfg.port);
+  mqtt_init(&mqtt, &mqtt_cfg);
 
-  char digital_buffer[1];
+  static const char* const channels[DEBOUNCE_CHANNELS] = {"0", "1", "2", "3", "4", "5", "6", "7"};
+  struct shm_board* board = shm_attach(1);
+  struct shm_entry* entry =
+      board != NULL ? shm_claim(board, "leak_detector", channels, DEBOUNCE_CHANNELS) : NULL;
+  double states[DEBOUNCE_CHANNELS];
+
+  uint8_t subsamples[DEBOUNCE_MAX_SUBSAMPLES];
+  char channel[4];
 
   uint32_t mode = 3;
   uint8_t bpw = 8;
   uint32_t speed = 1000000;
 
-  int fd = spi_open("/dev/spidev0.0", &mode, &bpw, &speed);
+  startup_phase("bus open");
+  spi_open("/dev/spidev0.0", &mode, &bpw, &speed);
+
+  struct adaptive_rate rate;
+  adaptive_init(&rate, MIN_PERIOD, MAX_PERIOD, STATE_SIGMA, STATE_RATE);
+
+  struct debounce_config debounce_cfg;
+  struct debounce debouncer;
+  struct timespec now, last_scan;
 
-  const struct timespec* period = (const struct timespec[]){{1, 0}};
+  startup_phase("config");
+  if (debounce_load_config(&debounce_cfg, DEBOUNCE_CONFIG) == 0)
+    SIMAR_LOG(LOG_NOTICE,
+              "Leak debouncing: %d of %d sub-samples, %.1f s to confirm, %.1f s to clear",
+              debounce_cfg.votes, debounce_cfg.subsamples, debounce_cfg.confirm,
+              debounce_cfg.clear);
+  debounce_init(&debouncer, &debounce_cfg);
+  clock_gettime(CLOCK_MONOTONIC, &last_scan);
 
   int s;
   struct sockaddr_can addr;
   struct ifreq ifr;
   struct can_frame frame;
 
+  startup_phase("can");
   if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
-    syslog(LOG_ERR, "Could not open CAN socket");
+    SIMAR_LOG(LOG_ERR, "Could not open CAN socket");
     // return -2;
   }
 
@@ -70,32 +146,69 @@ int main(int argc, char* argv[]) {
   addr.can_ifindex = ifr.ifr_ifindex;
 
   if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-    syslog(LOG_ERR, "CAN binding error");
+    SIMAR_LOG(LOG_ERR, "CAN binding error");
     // return -2;
   }
 
   frame.can_id = 0x555;
   frame.can_dlc = 5;
+  arena_seal();
+  startup_phase("first scan");
 
   for (;;) {
-    read_data(3, digital_buffer, 1);
-
-    if (read(fd, digital_buffer, 1)) {
-      for (int i = 0; i < 8; i++) {
-        if (digital_buffer[0] >> i & 0b00000001) {
-          /*snprintf(frame.data, 4, "%d %d", i, 1);  // TODO: Decide what to write
-          if (write(s, &frame, sizeof(struct can_frame)) != sizeof(struct can_frame)) {
-            syslog(LOG_ERR, "CAN communication error");
-            return -2;
-          }
+    account_tick();
+
+    if (sample_channels(subsamples, &debounce_cfg)) {
+      SIMAR_LOG(LOG_ERR, "Could not read the leak detectors");
+      adaptive_defer(&rate, MAX_PERIOD);
+      adaptive_sleep(&rate.next);
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint8_t vote = debounce_vote(&debouncer, subsamples);
+    uint8_t changed = debounce_update(&debouncer, vote, timespec_diff(&now, &last_scan));
+    last_scan = now;
+
+    // Nothing is published until a transition is confirmed, so the startup ends with the first scan
+    startup_published();
+
+    // Only confirmed transitions are published
+    if (changed) {
+      int pending = 0;
+      mqtt_sweep_begin(&mqtt, "leak");
+
+      for (int i = 0; i < DEBOUNCE_CHANNELS; i++) {
+        uint8_t state = debouncer.state >> i & 1;
+
+        if (!(changed >> i & 1))
+          continue;
+
+        /*snprintf(frame.data, 4, "%d %d", i, state);  // TODO: Decide what to write
+        if (write(s, &frame, sizeof(struct can_frame)) != sizeof(struct can_frame)) {
+          SIMAR_LOG(LOG_ERR, "CAN communication error");
+          return -2;
         }*/
-          reply = redisCommand(c, "HSET leak_detector %d %d", i,
-                               ((digital_buffer[0] >> i) & 0b00000001));
-          freeReplyObject(reply);
-        }
+        pending += redisAppendCommand(c, "HSET leak_detector %d %d", i, state) == REDIS_OK;
+
+        snprintf(channel, sizeof(channel), "%d", i);
+        mqtt_sweep_add(&mqtt, "leak_detector", channel, state);
+      }
+
+      if (redis_drain(c, pending))
+        return DB_FAIL;
+
+      if (entry != NULL) {
+        for (int i = 0; i < DEBOUNCE_CHANNELS; i++)
+          states[i] = debouncer.state >> i & 1;
+        shm_publish(entry, states);
       }
 
-      nanosleep(period, NULL);
+      mqtt_sweep_end(&mqtt);
     }
+
+    // Votes still waiting for confirmation count as activity, so they are followed closely
+    adaptive_update(&rate, vote);
+    adaptive_sleep(&rate.next);
   }
 }
@@ -4,84 +4,269 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <hiredis/hiredis.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/poll.h>
-#include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../log/log.h"
+#include "../mem/arena.h"
+#include "../mem/shm.h"
+#include "../mqtt/common.h"
+#include "../power/calibration.h"
+#include "../power/energy.h"
+#include "../power/quality.h"
+#include "../redis/common.h"
+#include "../redis/writer.h"
+#include "../sched/account.h"
+#include "../sched/adaptive.h"
+#include "../sched/rt.h"
+#include "../sched/startup.h"
 #include "../spi/common.h"
 
-#define OUTLET_QUANTITY 7
 #define RESOLUTION 0.01953125
 #define VOLTAGE_CONST 68.8073472464
 #define PRU0_DEVICE_NAME "/dev/rpmsg_pru30"
 #define PRU1_DEVICE_NAME "/dev/rpmsg_pru31"
 #define ACTUATION_CHANNEL 3
-
-const char servers[11][16] = {
-    "10.0.38.59",    "10.0.38.46",    "10.0.38.42",    "10.128.153.81",
-    "10.128.153.82", "10.128.153.83", "10.128.153.84", "10.128.153.85",
-    "10.128.153.86", "10.128.153.87", "10.128.153.88",
+// Sampling period limits (s) and activity thresholds for the total current (A, A/s)
+#define MIN_PERIOD 0.5
+#define MAX_PERIOD 3
+#define CURRENT_SIGMA 0.1
+#define CURRENT_RATE 0.5
+// Measurement blocks waiting for the publisher, and how often it checks for them (ns)
+#define BLOCK_QUEUE_LEN 16
+#define PUBLISH_POLL 100000000L
+// Fixed capture period used to measure jitter (ns)
+#define JITTER_PERIOD 10000000L
+
+/*!
+ * @brief AC board measurement block, handed over from the capture loop to the publisher
+ */
+struct volt_block {
+  struct timespec at;
+  double voltage;
+  double current[OUTLET_QUANTITY];
+  uint8_t code[OUTLET_QUANTITY];
+  double total_current;
+  double pfactor;
+  uint8_t valid;
 };
 
-redisContext *c, *c_remote;
+redisContext* c_remote;
+struct redis_writer writer;
+struct redis_ring ring;
+int remote_server = -1;
+struct mqtt_client mqtt;
+struct energy_meter meter;
+struct current_calibration calibration;
+struct power_quality quality;
+// Latest values for consumers on this node: the AC input, then every outlet in ADC channel order
+struct shm_entry* shm_ac;
+struct shm_entry* shm_outlets[OUTLET_QUANTITY];
 char name[72];
 pthread_mutex_t spi_mutex;
 double duty = 1;
 uint32_t glitch;
 uint32_t frequency;
+// Last actuation byte written by the command listener (outlet i on: bit i + 1); all on until then
+atomic_uchar relays = 0xFF;
+
+// Single producer (capture loop), single consumer (publisher), so no locks or syscalls are needed
+struct volt_block blocks[BLOCK_QUEUE_LEN];
+atomic_uint block_head, block_tail;
+uint32_t block_overruns;
 
 /**
- * @brief Connects to a local Redis server (or exits, in case none are available)
- * @returns void
+ * @brief Queues a measurement block for the publisher (capture loop side)
+ * @param[in] block Measurement block
+ * @retval 0 OK
+ * @retval -1 Queue full, block dropped
+ */
+int8_t block_push(const struct volt_block* block) {
+  unsigned tail = atomic_load_explicit(&block_tail, memory_order_relaxed);
+
+  if (tail - atomic_load_explicit(&block_head, memory_order_acquire) == BLOCK_QUEUE_LEN)
+    return -1;
+
+  blocks[tail % BLOCK_QUEUE_LEN] = *block;
+  atomic_store_explicit(&block_tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+/**
+ * @brief Takes the oldest measurement block (publisher side)
+ * @param[out] block Measurement block
+ * @retval 0 OK
+ * @retval -1 Queue empty
+ */
+int8_t block_pop(struct volt_block* block) {
+  unsigned head = atomic_load_explicit(&block_head, memory_order_relaxed);
+
+  if (head == atomic_load_explicit(&block_tail, memory_order_acquire))
+    return -1;
+
+  *block = blocks[head % BLOCK_QUEUE_LEN];
+  atomic_store_explicit(&block_head, head + 1, memory_order_release);
+  return 0;
+}
+
+/*!
+ * @brief Measurement record, as queued for the Redis writer
+ */
+struct volt_record {
+  double voltage;
+  double current[OUTLET_QUANTITY];
+  double pfactor;
+  uint32_t glitch;
+  uint32_t frequency;
+  uint8_t valid;
+};
+
+/**
+ * @brief Appends a measurement record (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Measurement record
+ * @returns Commands appended
+ */
+int append_volt_record(redisContext* c, const void* payload) {
+  const struct volt_record* r = payload;
+  return append_volt(c, r->voltage, r->current, r->valid, r->pfactor, r->glitch, r->frequency);
+}
+
+/**
+ * @brief Appends the energy per outlet (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Energy per outlet (Wh), in ADC channel order
+ * @returns Commands appended
+ */
+int append_energy_record(redisContext* c, const void* payload) {
+  return append_energy(c, payload);
+}
+
+/*!
+ * @brief Power quality event record, as queued for the Redis writer
  */
-void connect_local() {
+struct event_record {
+  enum quality_type type;
+  double start;
+  double duration;
+  double extreme;
+  double depth;
+  uint8_t outlets;
+};
+
+/**
+ * @brief Appends a power quality event (Redis writer)
+ * @param[in] c Redis context
+ * @param[in] payload Event record
+ * @returns Commands appended
+ */
+int append_event_record(redisContext* c, const void* payload) {
+  const struct event_record* r = payload;
+  return append_power_event(c, quality_type_name(r->type), r->start, r->duration, r->extreme,
+                            r->depth, r->outlets);
+}
+
+/**
+ * @brief Queues a power quality event once it ends (publisher)
+ * @param[in] event Event, with its start in Unix time
+ * @param[in] arg Unused
+ */
+void report_event(const struct quality_event* event, void* arg) {
+  struct event_record record = {.type = event->type,
+                                .start = event->start.tv_sec + event->start.tv_nsec / 1e9,
+                                .duration = event->duration,
+                                .extreme = event->extreme,
+                                .depth = event->depth,
+                                .outlets = event->outlets};
+
+  SIMAR_LOG(LOG_WARNING, "Voltage %s: %.1f V (%.1f%% from nominal) for %.1f s",
+            quality_type_name(event->type), event->extreme, event->depth * 100, event->duration);
+  writer_push(&writer, append_event_record, &record, sizeof(record));
+}
+
+/**
+ * @brief Claims the shared memory entries of the AC input and the outlets
+ * @retval 0 OK
+ * @retval -1 No shared memory board, or it is full
+ */
+int8_t claim_shm() {
+  static const char* const ac_fields[] = {"voltage", "pfactor", "frequency", "glitch"};
+  static const char* const outlet_fields[] = {"current", "energy"};
+  struct shm_board* board = shm_attach(1);
+  char key[16];
+
+  if (board == NULL)
+    return -1;
+
+  for (int i = 0; i < OUTLET_QUANTITY; i++) {
+    snprintf(key, sizeof(key), "outlet_%d", OUTLET_QUANTITY - 1 - i);
+    if ((shm_outlets[i] = shm_claim(board, key, outlet_fields, 2)) == NULL)
+      return -1;
+  }
+
+  // Claimed last: the publisher only uses the outlet entries once this one is set
+  shm_ac = shm_claim(board, "ac", ac_fields, 4);
+  return shm_ac != NULL ? 0 : -1;
+}
+
+/**
+ * @brief Connects to a local Redis server, waiting for one to become available
+ * @returns Redis context
+ */
+redisContext* connect_local() {
+  redisContext* c;
+
   do {
-    syslog(LOG_NOTICE, "Attempting to reconnect to local Redis database...");
+    SIMAR_LOG(LOG_NOTICE, "Attempting to reconnect to local Redis database...");
     c = redisConnectWithTimeout("127.0.0.1", 6379, (struct timeval){1, 500000});
 
     if (c->err) {
       if (c->err == 1)
-        syslog(LOG_ERR,
-               "Redis server instance not available. Have you "
-               "initialized the Redis server? (Error code 1)\n");
+        SIMAR_LOG(LOG_ERR,
+                  "Redis server instance not available. Have you "
+                  "initialized the Redis server? (Error code 1)\n");
       else
-        syslog(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
+        SIMAR_LOG(LOG_ERR, "Unknown redis error (error code %d)\n", c->err);
 
+      redisFree(c);
+      c = NULL;
       nanosleep((const struct timespec[]){{0, 700000000L}}, NULL);  // 700ms
     }
 
-  } while (c->err);
+  } while (c == NULL);
 
   redisSetTimeout(c, (struct timeval){0, 500000});
+  return c;
 }
 
 /**
- * @brief Connects to remote Redis server (or exits, in case none are available)
+ * @brief Connects to the remote Redis server owning this device (or exits, in case none are
+ * available)
+ *
+ * @details Devices are spread across the central servers by consistent hashing of their name. If
+ * the owner is unreachable, the next servers in ring order take over; the command listener moves
+ * back once the owner returns.
+ *
  * @returns void
  */
 void connect_remote() {
-  int server_i = 0;
-  int server_amount = sizeof(servers) / sizeof(servers[0]);
-  syslog(LOG_NOTICE, "Attempting to reconnect to remote Redis database...");
+  SIMAR_LOG(LOG_NOTICE, "Attempting to reconnect to remote Redis database...");
 
-  do {
-    c_remote = redisConnectWithTimeout(servers[server_i], 6379, (struct timeval){1, 500000});
+  redisFree(c_remote);
+  c_remote = ring_connect(&ring, name, (struct timeval){1, 500000}, ring.server_amount,
+                          &remote_server);
 
-    if (c_remote->err) {
-      syslog(LOG_ERR, "%s remote Redis server not available, switching...\n", servers[server_i++]);
-
-      nanosleep((const struct timespec[]){{1, 0}}, NULL);  // 1s
-    }
-
-    if (server_i == server_amount) {
-      syslog(LOG_ERR, "No server found");
-      exit(-3);
-    }
-  } while (c_remote->err);
+  if (c_remote == NULL) {
+    SIMAR_LOG(LOG_ERR, "No server found");
+    exit(-3);
+  }
 
   redisSetTimeout(c_remote, (struct timeval){0, 500000});
 }
@@ -96,9 +281,11 @@ void* command_listener() {
   char msg_command[1] = {0x00};
 
   const struct timespec* period = (const struct timespec[]){{2, 0}};
+  time_t last_failback = time(NULL);
 
+  account_thread("commands");
   connect_remote();
-  syslog(LOG_NOTICE, "Redis command DB connected");
+  SIMAR_LOG(LOG_NOTICE, "Redis command DB connected");
 
   up_reply = redisCommand(c_remote, "EXISTS %s", name);
 
@@ -109,7 +296,7 @@ void* command_listener() {
       if (reply->element[i]->str != NULL) {
         command = reply->element[i]->str[0] - '0';
         if (command != 1 && command != 0) {
-          syslog(LOG_ERR, "Received malformed command: %d", command);
+          SIMAR_LOG(LOG_ERR, "Received malformed command: %d", command);
           rb_reply = redisCommand(c_remote, "HSET %s %d %d", name, i, 1);
           freeReplyObject(rb_reply);
           continue;
@@ -120,6 +307,7 @@ void* command_listener() {
     pthread_mutex_lock(&spi_mutex);
     write_data(ACTUATION_CHANNEL, msg_command, 1);
     pthread_mutex_unlock(&spi_mutex);
+    atomic_store(&relays, msg_command[0]);
   } else {
     // Sets default values if they do not exist already
     reply = redisCommand(c_remote, "HSET %s 0 1 1 1 2 1 3 1 4 1 5 1 6 1", name);
@@ -128,18 +316,35 @@ void* command_listener() {
   freeReplyObject(reply);
 
   while (1) {
-    reply = redisCommand(c_remote, "HMGET %s 0 1 2 3 4 5 6", name);
-    up_reply = redisCommand(c_remote, "HMGET %s:RB 0 1 2 3 4 5 6", name);
+    account_tick();
+
+    if (time(NULL) - last_failback > RING_FAILBACK_PERIOD) {
+      if (ring_failback(&ring, name, &c_remote, &remote_server, (struct timeval){1, 500000}))
+        redisSetTimeout(c_remote, (struct timeval){0, 500000});
+      last_failback = time(NULL);
+    }
+
+    // Both hashes are requested in a single round trip
+    reply = up_reply = NULL;
+    append_command_poll(c_remote, name);
 
     msg_command[0] = 0x00;
 
+    if (redisGetReply(c_remote, (void**)&reply) != REDIS_OK ||
+        redisGetReply(c_remote, (void**)&up_reply) != REDIS_OK) {
+      freeReplyObject(reply);
+      freeReplyObject(up_reply);
+      connect_remote();
+      continue;
+    }
+
     if (reply->type == REDIS_REPLY_ARRAY) {
       for (int i = 0; i < (int)reply->elements; i++) {
         if (reply->element[i]->str != NULL) {
           command = reply->element[i]->str[0] - '0';
 
           if (command != 1 && command != 0) {
-            syslog(LOG_ERR, "Received malformed command: %d", command);
+            SIMAR_LOG(LOG_ERR, "Received malformed command: %d", command);
             rb_reply = redisCommand(c_remote, "HSET %s %d %d", name, i,
                                     up_reply->element[i]->str[0] - '0');
             freeReplyObject(rb_reply);
@@ -150,8 +355,8 @@ void* command_listener() {
 
           if (up_reply->element[i]->str == NULL ||
               reply->element[i]->str[0] != up_reply->element[i]->str[0]) {
-            syslog(LOG_NOTICE, "User %s switched outlet %d %s", reply->element[i]->str + 2, i,
-                   command == 1 ? "on" : "off");
+            SIMAR_LOG(LOG_NOTICE, "User %s switched outlet %d %s", reply->element[i]->str + 2, i,
+                      command == 1 ? "on" : "off");
             rb_reply = redisCommand(c_remote, "HSET %s:RB %d %d", name, i, command);
             freeReplyObject(rb_reply);
           }
@@ -160,6 +365,7 @@ void* command_listener() {
       pthread_mutex_lock(&spi_mutex);
       write_data(ACTUATION_CHANNEL, msg_command, 1);
       pthread_mutex_unlock(&spi_mutex);
+      atomic_store(&relays, msg_command[0]);
     } else if (reply->type == REDIS_REPLY_ERROR) {
       connect_remote();
     }
@@ -173,21 +379,30 @@ void* command_listener() {
 
 /**
  * @brief Gets glitch count, frequency and duty cycle information from the PRU
+ * @param[in] arg Real-time profile
  * @returns void
  */
-void* glitch_counter() {
+void* glitch_counter(void* arg) {
+  const struct rt_profile* profile = arg;
   struct pollfd prufd;
   const struct timespec* period = (const struct timespec[]){{0, 500000L}};
 
+  account_thread("glitches");
   prufd.fd = open(PRU1_DEVICE_NAME, O_RDWR);
   char buf[16];
 
   if (prufd.fd < 0) {
-    syslog(LOG_ERR, "Failed to communicate with PRU1");
+    SIMAR_LOG(LOG_ERR, "Failed to communicate with PRU1");
     exit(-9);
   }
 
+  if (profile->enabled) {
+    rt_apply(profile->pru_priority, profile->cpu);
+    rt_prefault_stack();
+  }
+
   for (;;) {
+    account_tick();
     write(prufd.fd, "-", 1);
     usleep(4999600);
     write(prufd.fd, "-", 1);
@@ -206,60 +421,334 @@ void* glitch_counter() {
 }
 
 /**
- * @brief Calculate actual voltage, by picking out the 8 bits in the middle of the ADCs response
+ * @brief Picks out the 8 bits in the middle of the ADCs response
+ * @param[in] buffer ADC response buffer
+ * @returns ADC code
+ */
+uint8_t adc_code(char* buffer) {
+  return ((buffer[1] & 0x0F) * 16) + ((buffer[0] & 0xF0) >> 4);
+}
+
+/**
+ * @brief Calculate actual voltage from the ADCs response
  * @param[in] buffer ADC response buffer
  * @returns Actual voltage value
  */
 double calc_voltage(char* buffer) {
-  return (((buffer[1] & 0x0F) * 16) + ((buffer[0] & 0xF0) >> 4)) * RESOLUTION;
+  return adc_code(buffer) * RESOLUTION;
 }
 
-int main(int argc, char* argv[]) {
-  const struct timespec* inner_period = (const struct timespec[]){{1, 500000000L}};
+/**
+ * @brief Gets the channels whose outlet relay is open
+ * @returns Bit mask, in ADC channel order
+ */
+uint8_t open_outlets() {
+  uint8_t actuation = atomic_load(&relays);
+  uint8_t off = 0;
+
+  // Outlets are numbered in the opposite order of the ADC channels
+  for (int i = 0; i < OUTLET_QUANTITY; i++) {
+    if (!(actuation >> (OUTLET_QUANTITY - i) & 1))
+      off |= 1 << i;
+  }
 
-  openlog("simar", 0, LOG_LOCAL0);
-  redisReply* reply;
+  return off;
+}
+
+/**
+ * @brief Reads one measurement block (all outlet currents and the voltage) from the ADC
+ *
+ * @details Called from the capture loop: only bus I/O, no allocations.
+ *
+ * @param[in] spi_fd SPI device
+ * @param[out] block Measurement block
+ * @retval 0 OK
+ * @retval -1 Voltage reading failure
+ * @retval -2 Communication error
+ */
+int8_t capture_block(int spi_fd, struct volt_block* block) {
+  char message[2] = {16, 0};
+  char buffer[3];
+  uint8_t i;
 
-  syslog(LOG_NOTICE, "Starting up...");
+  pthread_mutex_lock(&spi_mutex);
+  transfer_module("\x01\x01", 2);
 
-  connect_local();
+  // Current
+  for (i = 1; i < 8; i++) {
+    message[1] = 131 + i * 4;
 
-  syslog(LOG_NOTICE, "Redis voltage DB connected");
+    if (write(spi_fd, message, 2) < 1) {
+      SIMAR_LOG(LOG_CRIT,
+                "Communication error while writing to ADC, reading current from channel %d: %s", i,
+                strerror(errno));
+      return -2;
+    }
+
+    if (read(spi_fd, buffer, 2) < 1) {
+      SIMAR_LOG(LOG_CRIT, "Communication error while reading back current from channel %d: %s", i,
+                strerror(errno));
+      return -2;
+    }
+
+    // Calibrated through the lookup table, which the publisher only rebuilds under spi_mutex
+    if (buffer[0] != 255 || buffer[1] != 255) {
+      block->code[i - 1] = adc_code(buffer);
+      block->current[i - 1] = calibration.amps[i - 1][block->code[i - 1]];
+    }
+  }
+
+  // Throwaway value, only used to read 2 bytes from the ADC
+  if (write(spi_fd, "\x10\x83", 2) < 1) {
+    SIMAR_LOG(LOG_CRIT,
+              "Communication error while writing to ADC, reading voltage from channel %d: %s", i,
+              strerror(errno));
+    return -2;
+  }
+
+  if (read(spi_fd, buffer, 2) < 1) {
+    SIMAR_LOG(LOG_CRIT, "Communication error while reading back voltage: %s", strerror(errno));
+    return -2;
+  }
+  pthread_mutex_unlock(&spi_mutex);
+
+  clock_gettime(CLOCK_MONOTONIC, &block->at);
+
+  if (buffer[0] == 255 && buffer[1] == 255)
+    return -1;
+
+  block->voltage = calc_voltage(buffer) * VOLTAGE_CONST;
+
+  uint8_t low_current = 1;
+  block->valid = 0;
+  block->total_current = 0;
+
+  for (i = 0; i < OUTLET_QUANTITY; i++) {
+    if (block->current[i] > 100 || block->current[i] < -2)
+      continue;
+    block->valid |= 1 << i;
+    block->total_current += block->current[i];
+
+    if (block->current[i] > 0.8)
+      low_current = 0;
+  }
+
+  block->pfactor = low_current ? 1.0 : duty;
+  return 0;
+}
+
+/**
+ * @brief Publishes measurement blocks handed over by the capture loop
+ *
+ * @details Everything that allocates or does network/file I/O (Redis, MQTT, energy checkpoints)
+ * runs here, outside the capture loop.
+ *
+ * @returns void
+ */
+void* publisher() {
+  const struct timespec* period = (const struct timespec[]){{0, PUBLISH_POLL}};
+  struct volt_block block;
+  struct volt_record record;
+  double energy[OUTLET_QUANTITY];
+  char outlet[16];
+  uint32_t overruns = 0;
+  struct timespec mono, real, start;
+
+  account_thread("publisher");
+  account_adopt();
+
+  for (;;) {
+    account_tick();
+
+    if (block_overruns != overruns) {
+      SIMAR_LOG(LOG_WARNING, "Publisher fell behind, %u measurement blocks dropped",
+                block_overruns - overruns);
+      overruns = block_overruns;
+    }
+
+    // Blocks are stamped with the monotonic clock; events are reported in Unix time
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    while (block_pop(&block) == 0) {
+      uint8_t open = open_outlets();
+      uint8_t stale = calibration_learn(&calibration, &block.at, block.code, block.valid, open);
+      uint8_t energized = 0;
+
+      for (int i = 0; i < OUTLET_QUANTITY; i++)
+        energized |= !(open >> i & 1) << (OUTLET_QUANTITY - 1 - i);
+
+      start.tv_sec = real.tv_sec + block.at.tv_sec - mono.tv_sec;
+      start.tv_nsec = real.tv_nsec + block.at.tv_nsec - mono.tv_nsec;
+      if (start.tv_nsec < 0) {
+        start.tv_nsec += 1000000000L;
+        start.tv_sec--;
+      } else if (start.tv_nsec >= 1000000000L) {
+        start.tv_nsec -= 1000000000L;
+        start.tv_sec++;
+      }
+      quality_evaluate(&quality, block.voltage, &start, energized);
+
+      if (stale) {
+        pthread_mutex_lock(&spi_mutex);
+        calibration_apply(&calibration, stale);
+        pthread_mutex_unlock(&spi_mutex);
+      }
+
+      energy_update(&meter, &block.at, block.voltage, block.current, block.valid, block.pfactor);
+      for (int i = 0; i < OUTLET_QUANTITY; i++)
+        energy[i] = energy_wh(&meter, i);
+
+      // PRU counts over 5 s windows
+      record = (struct volt_record){.voltage = block.voltage,
+                                    .pfactor = block.pfactor,
+                                    .glitch = glitch,
+                                    .frequency = frequency / 5,
+                                    .valid = block.valid};
+      memcpy(record.current, block.current, sizeof(record.current));
+
+      writer_push(&writer, append_volt_record, &record, sizeof(record));
+      writer_push(&writer, append_energy_record, energy, sizeof(energy));
+
+      if (shm_ac != NULL) {
+        shm_publish(shm_ac, (double[]){block.voltage, block.pfactor, frequency / 5, glitch});
+        for (int i = 0; i < OUTLET_QUANTITY; i++)
+          shm_publish(shm_outlets[i],
+                      (double[]){block.valid >> i & 1 ? block.current[i] : NAN, energy[i]});
+      }
+
+      mqtt_sweep_begin(&mqtt, "volt");
+      mqtt_sweep_add(&mqtt, "ac", "voltage", block.voltage);
+      mqtt_sweep_add(&mqtt, "ac", "pfactor", block.pfactor);
+      mqtt_sweep_add(&mqtt, "ac", "frequency", frequency / 5);
+      mqtt_sweep_add(&mqtt, "ac", "glitch", glitch);
+      for (int i = 0; i < OUTLET_QUANTITY; i++) {
+        snprintf(outlet, sizeof(outlet), "outlet_%d", OUTLET_QUANTITY - 1 - i);
+        if (block.valid >> i & 1)
+          mqtt_sweep_add(&mqtt, outlet, "current", block.current[i]);
+        mqtt_sweep_add(&mqtt, outlet, "energy", energy[i]);
+      }
+      mqtt_sweep_end(&mqtt);
+    }
+
+    calibration_save(&calibration);
+    nanosleep(period, NULL);
+  }
+}
+
+/**
+ * @brief Measures the capture loop period at a fixed rate, prints its deviation histogram
+ * @param[in] spi_fd SPI device
+ * @param[in] seconds Duration
+ * @param[in] title Histogram title
+ */
+void measure_jitter(int spi_fd, int seconds, const char* title) {
+  static struct rt_histogram hist;
+  struct volt_block block;
+  struct timespec next, now, last;
+  long samples = seconds * (1000000000L / JITTER_PERIOD);
+
+  memset(&hist, 0, sizeof(hist));
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  last = next;
+
+  for (long n = 0; n < samples; n++) {
+    if (capture_block(spi_fd, &block) == -2)
+      exit(-2);
+
+    next.tv_nsec += JITTER_PERIOD;
+    if (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    adaptive_sleep(&next);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double deviation = timespec_diff(&now, &last) * 1e6 - JITTER_PERIOD / 1e3;
+    rt_hist_add(&hist, deviation < 0 ? -deviation : deviation);
+    last = now;
+  }
+
+  rt_hist_print(&hist, stdout, title);
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-j seconds (measure capture jitter without and with the profile)]\n",
+          prog);
+}
+
+int main(int argc, char* argv[]) {
+  struct adaptive_rate rate;
+  struct rt_profile profile;
+  int jitter = 0, opt;
+
+  while ((opt = getopt(argc, argv, "j:h")) != -1) {
+    switch (opt) {
+      case 'j':
+        jitter = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  startup_begin("volt");
+  log_init("simar");
+  account_init("volt");
+  redisReply* reply;
+
+  startup_phase("config");
+  if (rt_load_config(&profile, RT_CONFIG) == 0 || jitter > 0) {
+    // The SPI bus is shared with the command listener, so it must not invert priorities
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&spi_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+  } else {
+    pthread_mutex_init(&spi_mutex, NULL);
+  }
 
-  char message[2] = {16, 0};
-  char buffer[3];
-  double current[7];
-  double voltage = 0;
   uint32_t mode = 1;
   uint8_t bpw = 16;
   uint32_t speed = 200000;
+  char buffer[3];
 
-  pthread_mutex_init(&spi_mutex, NULL);
-
+  startup_phase("bus open");
   int spi_fd = spi_open("/dev/spidev0.0", &mode, &bpw, &speed);
 
-  pthread_t cmd_thread;
-  pthread_create(&cmd_thread, NULL, command_listener, NULL);
+  if (jitter > 0) {
+    if (!profile.enabled) {
+      profile.capture_priority = 80;
+      profile.cpu = -1;
+    }
 
-  pthread_t glitch_thread;
-  pthread_create(&glitch_thread, NULL, glitch_counter, NULL);
+    measure_jitter(spi_fd, jitter, "SCHED_OTHER");
 
-  syslog(LOG_NOTICE, "All threads initialized");
+    if (rt_lock_memory() || rt_apply(profile.capture_priority, profile.cpu)) {
+      fprintf(stderr, "Could not apply the real-time profile (run as root)\n");
+      return 1;
+    }
 
-  // Dummy conversions
-  pthread_mutex_lock(&spi_mutex);
+    measure_jitter(spi_fd, jitter, "Real-time profile");
+    return 0;
+  }
 
-  spi_transfer("\x0F\x0F", buffer, 2);
-  spi_transfer("\x0F\x0F", buffer, 2);
+  SIMAR_LOG(LOG_NOTICE, "Starting up...");
+  startup_phase("memory");
 
-  pthread_mutex_unlock(&spi_mutex);
+  // Local (writer) and remote connections, pipelining up to 3 commands per record or a command poll
+  if (arena_init(0, 2, 3 * WRITER_BATCH))
+    return MEM_FAIL;
 
-  uint8_t i, read_fails = 0, low_current;
-  struct timeval timeout = {5, 0};
-  redisSetTimeout(c, timeout);
+  startup_phase("redis local");
+  redisContext* c = connect_local();
 
-  syslog(LOG_NOTICE, "Main loop starting...");
+  SIMAR_LOG(LOG_NOTICE, "Redis voltage DB connected");
 
+  // The device name decides which central server owns it, so it is needed before any thread starts
+  startup_phase("device name");
   reply = redisCommand(c, "HMGET device ip_address name");
 
   if (reply != NULL && reply->type == REDIS_REPLY_ARRAY)
@@ -269,84 +758,97 @@ int main(int argc, char* argv[]) {
 
   freeReplyObject(reply);
 
-  for (;;) {
-    pthread_mutex_lock(&spi_mutex);
-    transfer_module("\x01\x01", 2);
+  ring_init(&ring, redis_servers, sizeof(redis_servers) / sizeof(redis_servers[0]));
 
-    // Current
-    for (i = 1; i < 8; i++) {
-      message[1] = 131 + i * 4;
+  startup_phase("outputs");
+  struct mqtt_config mqtt_cfg;
+  if (mqtt_load_config(&mqtt_cfg, MQTT_CONFIG) == 0)
+    SIMAR_LOG(LOG_NOTICE, "MQTT output enabled, broker at %s:%d", mqtt_cfg.host, mqtt_cfg.port);
+  mqtt_init(&mqtt, &mqtt_cfg);
 
-      if (write(spi_fd, message, 2) < 1) {
-        syslog(LOG_CRIT,
-               "Communication error while writing to ADC, reading current from channel %d: %s", i,
-               strerror(errno));
-        return -2;
-      }
+  startup_phase("calibration read");
+  energy_init(&meter, ENERGY_CHECKPOINT);
 
-      if (read(spi_fd, buffer, 2) < 1) {
-        syslog(LOG_CRIT, "Communication error while reading back current from channel %d: %s", i,
-               strerror(errno));
-        return -2;
-      }
+  if (calibration_init(&calibration, CALIBRATION_FILE) == 0)
+    SIMAR_LOG(LOG_NOTICE, "Current calibration restored from %s", CALIBRATION_FILE);
 
-      if (buffer[0] != 255 || buffer[1] != 255)
-        current[i - 1] = (calc_voltage(buffer) - 2.5) / 0.66;
-    }
+  struct quality_config quality_cfg;
+  if (quality_load_config(&quality_cfg, QUALITY_CONFIG) == 0)
+    SIMAR_LOG(LOG_NOTICE, "Power quality thresholds: sag %.2f, swell %.2f of %.0f V",
+              quality_cfg.sag, quality_cfg.swell, quality_cfg.nominal);
+  quality_init(&quality, &quality_cfg, 0, report_event, NULL);
 
-    // Throwaway value, only used to read 2 bytes from the ADC
-    if (write(spi_fd, "\x10\x83", 2) < 1) {
-      syslog(LOG_CRIT,
-             "Communication error while writing to ADC, reading voltage from channel %d: %s", i,
-             strerror(errno));
-      return -2;
-    }
+  redisSetTimeout(c, (struct timeval){5, 0});
 
-    if (read(spi_fd, buffer, 2) < 1) {
-      syslog(LOG_CRIT, "Communication error while reading back voltage: %s", strerror(errno));
-      return -2;
-    }
-    pthread_mutex_unlock(&spi_mutex);
+  // The publisher and any other thread write to the local server through the writer only
+  startup_phase("threads");
+  if (writer_start(&writer, c, connect_local))
+    exit(-9);
 
-    if (buffer[0] != 255 || buffer[1] != 255) {
-      voltage = calc_voltage(buffer);
-    } else {
-      syslog(LOG_ERR, "Voltage reading failure");
-      if (read_fails++ > 10)
-        return (-2);
-      continue;
-    }
+  if (claim_shm() == 0)
+    SIMAR_LOG(LOG_NOTICE, "Latest values published to the shared memory board %s", SHM_NAME);
 
-    if (voltage * VOLTAGE_CONST != 0.0) {
-      reply = redisCommand(c, "SET volt %.3f", voltage * VOLTAGE_CONST);
-      if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
-        connect_local();
-      freeReplyObject(reply);
-    }
+  // Locked before the threads start, so their stacks are locked as well (MCL_FUTURE)
+  if (profile.enabled && rt_lock_memory() == 0)
+    SIMAR_LOG(LOG_NOTICE, "Real-time profile enabled, capture priority %d, PRU priority %d, CPU %d",
+              profile.capture_priority, profile.pru_priority, profile.cpu);
 
-    low_current = 1;
+  pthread_t cmd_thread;
+  pthread_create(&cmd_thread, NULL, command_listener, NULL);
 
-    for (i = 0; i < 7; i++) {
-      if (current[i] > 100 || current[i] < -2)
-        continue;
-      reply = redisCommand(c, "HSET ich %d %.3f", 6 - i, current[i]);
-      freeReplyObject(reply);
+  pthread_t glitch_thread;
+  pthread_create(&glitch_thread, NULL, glitch_counter, &profile);
 
-      if (current[i] > 0.8)
-        low_current = 0;
-    }
+  // The capture loop (this thread) is sampled by the publisher, so it spends no time on accounting
+  account_hand_over();
 
-    reply = redisCommand(c, "SET pfactor %.3f", low_current ? 1.0 : duty);
-    freeReplyObject(reply);
+  pthread_t publish_thread;
+  pthread_create(&publish_thread, NULL, publisher, NULL);
 
-    reply = redisCommand(c, "SET glitch %d", glitch);
-    freeReplyObject(reply);
+  SIMAR_LOG(LOG_NOTICE, "All threads initialized");
+  arena_seal();
 
-    if (frequency > 0) {
-      reply = redisCommand(c, "SET frequency %d", frequency / 5);
-      freeReplyObject(reply);
+  // Dummy conversions
+  startup_phase("warm-up");
+  pthread_mutex_lock(&spi_mutex);
+
+  spi_transfer("\x0F\x0F", buffer, 2);
+  spi_transfer("\x0F\x0F", buffer, 2);
+
+  pthread_mutex_unlock(&spi_mutex);
+
+  uint8_t read_fails = 0;
+  struct volt_block block;
+
+  adaptive_init(&rate, MIN_PERIOD, MAX_PERIOD, CURRENT_SIGMA, CURRENT_RATE);
+
+  if (profile.enabled) {
+    rt_apply(profile.capture_priority, profile.cpu);
+    rt_prefault_stack();
+  }
+
+  SIMAR_LOG(LOG_NOTICE, "Main loop starting...");
+  startup_phase("first publish");
+
+  // Capture loop: bus I/O and sleeping only, publishing is done by the publisher thread
+  for (;;) {
+    int8_t status = capture_block(spi_fd, &block);
+
+    if (status == -2)
+      return -2;
+
+    if (status == -1) {
+      SIMAR_LOG(LOG_ERR, "Voltage reading failure");
+      if (read_fails++ > 10)
+        return (-2);
+      continue;
     }
 
-    nanosleep(inner_period, NULL);
+    if (block_push(&block))
+      block_overruns++;
+
+    // Load transients are sampled faster, steady loads back off
+    adaptive_update(&rate, block.total_current);
+    adaptive_sleep(&rate.next);
   }
 }
@@ -3,137 +3,424 @@
  */
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <hiredis/hiredis.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <string.h>
-#include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "../bme280/common/common.h"
+#include "../codec/delta.h"
+#include "../log/log.h"
+#include "../mem/arena.h"
+#include "../redis/common.h"
+#include "../sched/account.h"
+#include "../sched/startup.h"
+#include "../utils/json/config.h"
+
+// Batched uplink: encoded batch buffer, longest interval between batches (s), and pipeline length
+// (readout, batch, power figures and lease commands, the batch taking several commands' worth of
+// output buffer)
+#define UPLINK_BATCH_LEN 1024
+#define UPLINK_MAX_INTERVAL 60
+#define UPLINK_PIPELINE 10
+// Default period of the low power mode (s)
+#define LOW_POWER_PERIOD 10
+
+/*!
+ * @brief Uplink settings (`"wireless"` object of /opt/device.json)
+ *
+ * @details With `"uplink": "batch"`, readouts are delta encoded and sent every `"interval"`
+ * seconds as a single pipeline (latest readout, batch and lease renewal), instead of three `SET`
+ * commands every period, so the radio can sleep between batches. The latest readout keys then
+ * expire WIRELESS_EXPIRY seconds after the next batch was due, and lag by up to the interval.
+ *
+ * With `"low_power": true` (which implies the batched uplink), the node wakes up every `"period"`
+ * seconds and otherwise sleeps: the sensor converts once per wake-up (forced mode, oversampling
+ * off, as Bosch recommends for weather monitoring) and sleeps in between, and the LED pulse, log
+ * flush and batches all ride on the same wake-ups instead of their own threads' timers.
+ */
+struct uplink_config {
+  uint8_t batch;
+  int interval;
+  uint8_t low_power;
+  int period;
+};
 
 redisContext *c, *local_c;
-const char servers[12][16] = {"10.0.38.59",    "10.0.38.46",    "10.0.38.42",    "10.128.153.81",
-                              "10.128.153.82", "10.128.153.83", "10.128.153.84", "10.128.153.85",
-                              "10.128.153.86", "10.128.153.87", "10.128.153.88", "10.128.255.5"};
+struct redis_ring ring;
+int remote_server = -1;
 gpio_t led = {.pin = USR_3};
 gpio_t dec_led = {.pin = USR_2};
 int8_t sensor_number = -1;
+char node[64];
+struct uplink_config uplink;
+struct delta_encoder encoder;
+uint8_t batch_buf[UPLINK_BATCH_LEN];
+
+/**
+ * @brief Monotonic time in seconds
+ * @returns Seconds since an arbitrary point
+ */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
+/**
+ * @brief Connects to the remote Redis server owning the wireless keys
+ *
+ * @details Every wireless key (wgen<ID>_* readouts and wgen:id:<ID> leases) is placed on the ring
+ * under WIRELESS_KEY, so that IDs can be leased atomically and renewed on the same connection as
+ * the readouts, and readers on other nodes (such as the reference pressure used by bme) can find
+ * them. The current connection is kept if it already points to the right server.
+ *
+ * @retval 1 Connected
+ * @retval 0 No replica is reachable
+ */
 uint8_t redis_connect() {
-  int server_i = 0;
-  do {
-    c = redisConnectWithTimeout(servers[server_i], 6379, (struct timeval){1, 500000});
-
-    if (c->err) {
-      if (server_i == 2) {
-        syslog(LOG_ERR, "No remote Redis server instance found");
-        return 0;
-      }
+  if (c != NULL && !c->err && ring_lookup(&ring, WIRELESS_KEY, 0, 1) == remote_server)
+    return 1;
 
-      syslog(LOG_ERR, "%s remote Redis server not available, switching...\n", servers[server_i++]);
-    }
-  } while (c->err);
+  redisFree(c);
+  c = ring_connect(&ring, WIRELESS_KEY, (struct timeval){1, 500000}, RING_REPLICAS,
+                   &remote_server);
+
+  if (c == NULL) {
+    SIMAR_LOG(LOG_ERR, "No remote Redis server instance found");
+    return 0;
+  }
+
+  redisSetTimeout(c, (struct timeval){1, 500000});
   return 1;
 }
 
-void* blink_led() {
+/**
+ * @brief Gets an identity unique to this node: the lowest non-zero MAC address of its network
+ * interfaces (whatever order they are listed in), else the hostname
+ * @param[out] node Node identity
+ * @param[in] len Buffer length
+ */
+void node_identity(char* node, size_t len) {
+  char path[300], mac[18], lowest[18] = "";
+  struct dirent* de;
+  DIR* dr = opendir("/sys/class/net/");
+
+  while (dr != NULL && (de = readdir(dr)) != NULL) {
+    if (de->d_name[0] == '.' || !strcmp(de->d_name, "lo"))
+      continue;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/address", de->d_name);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+      continue;
+
+    // Same length and case for every address, so they compare as strings
+    if (fscanf(f, "%17s", mac) == 1 && strlen(mac) == 17 && strcmp(mac, "00:00:00:00:00:00") &&
+        (lowest[0] == '\0' || strcmp(mac, lowest) < 0))
+      strcpy(lowest, mac);
+    fclose(f);
+  }
+
+  if (dr != NULL)
+    closedir(dr);
+
+  if (lowest[0] != '\0') {
+    snprintf(node, len, "%s", lowest);
+  } else if (gethostname(node, len)) {
+    snprintf(node, len, "unknown");
+  }
+
+  // gethostname leaves no terminator when the name is truncated
+  node[len - 1] = '\0';
+}
+
+/**
+ * @brief Renews the ID lease, leasing another ID if this one went to another node
+ *
+ * @details Sent on its own, ahead of the readouts, so that they are only written under an ID this
+ * node holds.
+ *
+ * @param[in] ttl Lease time (s)
+ * @retval 0 An ID is held
+ * @retval -1 The server went away
+ */
+int8_t renew_lease(int ttl) {
+  int8_t renewed = append_lease(c, sensor_number, node, ttl) ? read_renewal(c) : -1;
+
+  if (renewed != 0)
+    return renewed < 0 ? -1 : 0;
+
+  // Offline for longer than the lease: the ID expired, and may have been leased to another node
+  int id = wireless_lease(c, node, sensor_number);
+  if (id < 1 && c->err)
+    return -1;
+  if (id < 1) {
+    SIMAR_LOG(LOG_CRIT, "Wireless ID %d was lost and no other one is free", sensor_number);
+    exit(SENSOR_FAIL);
+  }
+
+  if (id != sensor_number) {
+    SIMAR_LOG(LOG_WARNING, "Wireless ID %d was leased to another node, now utilizing id %d",
+              sensor_number, id);
+    sensor_number = id;
+    redisReply* reply = (redisReply*)redisCommand(local_c, "HSET device simar_gia %d", id);
+    freeReplyObject(reply);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Loads the uplink settings
+ * @param[out] cfg Settings (per readout uplink if absent)
+ * @param[in] path Configuration file
+ */
+void load_uplink(struct uplink_config* cfg, const char* path) {
+  const cJSON *wireless, *item;
+
+  *cfg = (struct uplink_config){
+      .batch = 0, .interval = 30, .low_power = 0, .period = LOW_POWER_PERIOD};
+
+  cJSON* json = config_load(path);
+
+  wireless = cJSON_GetObjectItemCaseSensitive(json, "wireless");
+  item = cJSON_GetObjectItemCaseSensitive(wireless, "uplink");
+  cfg->batch = cJSON_IsString(item) && strcmp(item->valuestring, "batch") == 0;
+
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(wireless, "interval")) &&
+      item->valueint >= 1)
+    cfg->interval = item->valueint < UPLINK_MAX_INTERVAL ? item->valueint : UPLINK_MAX_INTERVAL;
+
+  cfg->low_power = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(wireless, "low_power"));
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(wireless, "period")) &&
+      item->valueint >= 1)
+    cfg->period = item->valueint < UPLINK_MAX_INTERVAL ? item->valueint : UPLINK_MAX_INTERVAL;
+
+  // Low power nodes only transmit at their wake-ups, which batches must line up with
+  if (cfg->low_power) {
+    cfg->batch = 1;
+    cfg->interval = (cfg->interval + cfg->period - 1) / cfg->period * cfg->period;
+  }
+
+  cJSON_Delete(json);
+}
+
+/**
+ * @brief Measures the CPU wake-ups and CPU time of the daemon since the last call
+ * @param[out] wakeups Wake-ups per minute: voluntary context switches (blocking waits) of every
+ * thread
+ * @param[out] cpu CPU time per minute (ms)
+ */
+void power_figures(double* wakeups, double* cpu) {
+  static struct rusage last;
+  static double last_at;
+  struct rusage usage;
+  double at = now();
+
+  getrusage(RUSAGE_SELF, &usage);
+
+  double minutes = last_at > 0 ? (at - last_at) / 60 : 0;
+  double used = (usage.ru_utime.tv_sec - last.ru_utime.tv_sec) * 1e3 +
+                (usage.ru_utime.tv_usec - last.ru_utime.tv_usec) / 1e3 +
+                (usage.ru_stime.tv_sec - last.ru_stime.tv_sec) * 1e3 +
+                (usage.ru_stime.tv_usec - last.ru_stime.tv_usec) / 1e3;
+
+  *wakeups = minutes > 0 ? (usage.ru_nvcsw - last.ru_nvcsw) / minutes : 0;
+  *cpu = minutes > 0 ? used / minutes : 0;
+
+  last = usage;
+  last_at = at;
+}
+
+/**
+ * @brief Takes a readout, forcing a conversion and waiting for it first in low power mode
+ * @param[in, out] sensor Sensor
+ * @retval 0 OK
+ * @retval -2 Communication failure
+ */
+int8_t read_now(struct bme_sensor_data* sensor) {
+  if (uplink.low_power) {
+    if (bme_force(&sensor->dev))
+      return BUS_FAIL;
+    sensor->dev.delay_us((bme280_cal_meas_delay(&sensor->dev.settings) + 1) * 1000, NULL);
+  }
+
+  return bme_read(&sensor->dev, &sensor->data);
+}
+
+/**
+ * @brief Moves back to the owner of the wireless keys once it returns, every RING_FAILBACK_PERIOD
+ * @param[in, out] last_failback Time of the last check
+ */
+void failback(time_t* last_failback) {
+  if (time(NULL) - *last_failback <= RING_FAILBACK_PERIOD)
+    return;
+
+  if (ring_failback(&ring, WIRELESS_KEY, &c, &remote_server, (struct timeval){1, 500000}))
+    redisSetTimeout(c, (struct timeval){1, 500000});
+  *last_failback = time(NULL);
+}
+
+/**
+ * @brief Renews the lease when due, then sends the pending batch with the latest readout and the
+ * power figures
+ * @param[in] sensor Latest readout
+ * @param[in, out] last_renewal Time of the last lease renewal
+ * @retval 0 Sent
+ * @retval -1 The server went away; the batch is kept for the next attempt
+ */
+int8_t flush_batch(const struct bme_sensor_data* sensor, time_t* last_renewal) {
+  int expiry = uplink.interval + WIRELESS_EXPIRY;
+  // Only renewed ahead of batches: it spans three of them, and is renewed a batch early
+  int lease = 3 * expiry > WIRELESS_LEASE_TTL ? 3 * expiry : WIRELESS_LEASE_TTL;
+  double wakeups, cpu;
+
+  if (time(NULL) - *last_renewal >= lease / 3 - uplink.interval) {
+    if (renew_lease(lease))
+      return -1;
+    *last_renewal = time(NULL);
+  }
+
+  power_figures(&wakeups, &cpu);
+
+  int pending = append_wireless(c, sensor_number, sensor->data.temperature, sensor->data.pressure,
+                                sensor->data.humidity, expiry);
+  pending += append_wireless_batch(c, sensor_number, encoder.buf, encoder.len);
+  if (cpu > 0)
+    pending += append_wireless_power(c, sensor_number, wakeups, cpu);
+
+  if (redis_drain(c, pending))
+    return -1;
+
+  delta_reset(&encoder);
+  return 0;
+}
+
+/**
+ * @brief Blinks the node ID once: as many blinks as the ID, with the second LED lit above 9
+ */
+void blink_id() {
   const struct timespec blink_delay = {0, 250000000L};
+
+  if (sensor_number > 9)
+    mmio_set_high(dec_led);
+
+  for (int i = 0; i < sensor_number; i++) {
+    mmio_set_high(led);
+    nanosleep(&blink_delay, NULL);
+    mmio_set_low(led);
+    nanosleep(&blink_delay, NULL);
+  }
+}
+
+void* blink_led() {
+  account_thread("led");
+
   if (sensor_number == 99) {
     const struct timespec blink_period = {10, 0};
     for (;;) {
+      account_tick();
       mmio_set_high(led);
       nanosleep(&blink_period, NULL);
       // nanosl
     }
   } else {
     const struct timespec blink_period = {0, 750000000L};
-    if (sensor_number > 9) {
-      mmio_set_high(dec_led);
-    }
     for (;;) {
-      for (int i = 0; i < sensor_number; i++) {
-        mmio_set_high(led);
-        nanosleep(&blink_delay, NULL);
-        mmio_set_low(led);
-        nanosleep(&blink_delay, NULL);
-      }
+      account_tick();
+      blink_id();
       nanosleep(&blink_period, NULL);
     }
   }
 }
 
 int main(int argc, char* argv[]) {
-  openlog("simar_bme", 0, LOG_LOCAL0);
+  startup_begin("wireless");
+  log_init("simar_bme");
+  account_init("wireless");
 
   redisReply* reply;
   struct bme_sensor_data sensor;
-  syslog(LOG_NOTICE, "Starting up...");
+  SIMAR_LOG(LOG_NOTICE, "Starting up...");
 
-  sensor.dev.settings.osr_h = BME280_OVERSAMPLING_4X;
-  sensor.dev.settings.osr_p = BME280_OVERSAMPLING_16X;
-  sensor.dev.settings.osr_t = BME280_OVERSAMPLING_4X;
+  startup_phase("config");
+  load_uplink(&uplink, "/opt/device.json");
+  delta_init(&encoder, batch_buf, sizeof(batch_buf), 3);
+
+  sensor.dev.settings.osr_h = uplink.low_power ? BME280_OVERSAMPLING_1X : BME280_OVERSAMPLING_4X;
+  sensor.dev.settings.osr_p = uplink.low_power ? BME280_OVERSAMPLING_1X : BME280_OVERSAMPLING_16X;
+  sensor.dev.settings.osr_t = uplink.low_power ? BME280_OVERSAMPLING_1X : BME280_OVERSAMPLING_4X;
   sensor.dev.settings.filter = BME280_FILTER_COEFF_OFF;
   sensor.id.mux_id = 0;
+  sensor.id.ext_mux_id = -1;
   sensor.past_pres = 0;
 
+  startup_phase("probe");
   if (bme_init(&sensor.dev, &sensor.id, 0x76) == BME280_OK) {
     sensor.dev.intf_ptr = &sensor.id;
   } else {
-    syslog(LOG_CRIT, "No sensor found");
+    SIMAR_LOG(LOG_CRIT, "No sensor found");
     return -2;
   }
 
+  // bme_init leaves it converting continuously
+  if (uplink.low_power && bme_sleep(&sensor.dev)) {
+    SIMAR_LOG(LOG_CRIT, "Sensor could not be put to sleep");
+    return SENSOR_FAIL;
+  }
+
+  // Local and remote connections, the remote one pipelining a readout (or a batch) and a lease
+  // renewal
+  startup_phase("memory");
+  if (arena_init(0, 2, uplink.batch ? UPLINK_PIPELINE : 2))
+    return MEM_FAIL;
+
+  startup_phase("redis local");
   for (int i = 0; i < 20; i++) {
     local_c = redisConnectWithTimeout("127.0.0.1", 6379, (struct timeval){1, 500000});
     if (!local_c->err)
       break;
 
+    redisFree(local_c);
+    local_c = NULL;
     sensor.dev.delay_us(500000, NULL);
   }
 
-  if (local_c->err) {
-    syslog(LOG_CRIT, "Could not find a local Redis server");
+  if (local_c == NULL) {
+    SIMAR_LOG(LOG_CRIT, "Could not find a local Redis server");
     return -2;
   }
 
-  if (redis_connect()) {
-    redisSetTimeout(c, (struct timeval){1, 500000});
+  startup_phase("redis remote");
+  ring_init(&ring, redis_servers, sizeof(redis_servers) / sizeof(redis_servers[0]));
 
-    reply = (redisReply*)redisCommand(local_c, "HGET device simar_gia");
+  node_identity(node, sizeof(node));
 
-    if (reply->str) {
-      int sensor_preassigned = atoi(reply->str);
-
-      freeReplyObject(reply);
-      reply = (redisReply*)redisCommand(c, "GET wgen%d_pressure", sensor_preassigned);
+  if (redis_connect()) {
+    int preferred = 0;
+    reply = (redisReply*)redisCommand(local_c, "HGET device simar_gia");
 
-      if (!reply->str && sensor_preassigned < 20)
-        sensor_number = sensor_preassigned;
-      else
-        syslog(LOG_NOTICE, "Preassigned SIMAR ID was not available, resorting to available ID");
-    }
+    if (reply != NULL && reply->str)
+      preferred = atoi(reply->str);
     freeReplyObject(reply);
 
-    if (sensor_number == -1) {
-      for (int i = 1; i < 10; i++) {
-        reply = (redisReply*)redisCommand(c, "GET wgen%d_pressure", i);
-        if (!reply->str) {
-          sensor_number = i;
-          freeReplyObject(reply);
-          break;
-        }
-        freeReplyObject(reply);
-      }
+    sensor_number = wireless_lease(c, node, preferred);
 
-      if (sensor_number == -1) {
-        syslog(LOG_CRIT, "Sensor could not be allocated a variable");
-        exit(SENSOR_FAIL);
-      }
+    if (sensor_number < 1) {
+      SIMAR_LOG(LOG_CRIT, "Sensor could not be allocated a variable");
+      exit(SENSOR_FAIL);
     }
-    syslog(LOG_NOTICE, "Redis DB connected");
 
-    syslog(LOG_NOTICE, "Sensor connected, utilizing id %d", sensor_number);
+    if (preferred > 0 && sensor_number != preferred)
+      SIMAR_LOG(LOG_NOTICE, "Preassigned SIMAR ID was not available, resorting to available ID");
+    SIMAR_LOG(LOG_NOTICE, "Redis DB connected");
+
+    SIMAR_LOG(LOG_NOTICE, "Sensor connected, utilizing id %d", sensor_number);
     reply = (redisReply*)redisCommand(local_c, "HSET device simar_gia %d", sensor_number);
     freeReplyObject(reply);
   } else {
@@ -143,47 +430,76 @@ int main(int argc, char* argv[]) {
   reply = (redisReply*)redisCommand(local_c, "SET retries 0");
   freeReplyObject(reply);
 
-  syslog(LOG_NOTICE, "Starting readings...");
+  SIMAR_LOG(LOG_NOTICE, "Starting readings...");
+  startup_phase("warm-up");
   for (int i = 0; i < 10; i++) {
-    bme_read(&sensor.dev, &sensor.data);  // Perform "calibration" readings
+    read_now(&sensor);  // Perform "calibration" readings
     sensor.dev.delay_us(500000, NULL);
   }
 
+  startup_phase("outputs");
   mmio_get_gpio(&led);
   mmio_set_output(led);
   mmio_get_gpio(&dec_led);
   mmio_set_output(dec_led);
 
+  // In low power mode, the ID is only shown at startup and the LED then pulses at every wake-up
   pthread_t led_thread;
-  pthread_create(&led_thread, NULL, blink_led, NULL);
+  if (!uplink.low_power)
+    pthread_create(&led_thread, NULL, blink_led, NULL);
+  else if (sensor_number != 99)
+    blink_id();
 
   FILE* file = fopen("/log.csv", "a");
-  char* filename;
-  filename = (char*)calloc(512, sizeof(char));
+  char filename[512] = "", path[512];
   DIR* dr = opendir("/media/");
   struct dirent* de;
   int found_loc = 0;
 
   const struct timespec period = {0, 750000000L};
+  double loop_period = uplink.low_power ? uplink.period : 0.75;
+  struct timespec wakeup;
+
+  time_t last_failback = time(NULL), last_renewal = time(NULL);
+  double last_batch = now();
 
   time_t t = time(NULL);
   struct tm* current_time = localtime(&t);
   char time_str[64];
 
   if (dr == NULL) {
-    syslog(LOG_ERR, "Could not open logging directory");
+    SIMAR_LOG(LOG_ERR, "Could not open logging directory");
     return -4;
   }
 
+  if (uplink.batch)
+    SIMAR_LOG(LOG_NOTICE, "Batched uplink, every %d s", uplink.interval);
+
+  if (uplink.low_power) {
+    SIMAR_LOG(LOG_NOTICE, "Low power mode, waking up every %d s", uplink.period);
+    log_stop_flusher();
+
+    // Converts while the node sleeps, for the first wake-up to read
+    bme_force(&sensor.dev);
+  }
+
+  arena_seal();
+  startup_phase("first publish");
+  clock_gettime(CLOCK_MONOTONIC, &wakeup);
+
   for (;;) {
     found_loc = 0;
 
     while ((de = readdir(dr)) != NULL) {
       if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")) {
-        if (strcmp(de->d_name, filename)) {
-          snprintf(filename, 512, "/media/%s/datalog.csv", de->d_name);
-          fclose(file);
-          fopen(filename, "a");
+        snprintf(path, sizeof(path), "/media/%s/datalog.csv", de->d_name);
+
+        // Only reopened when the drive changes
+        if (strcmp(path, filename)) {
+          strcpy(filename, path);
+          if (file != NULL)
+            fclose(file);
+          file = fopen(filename, "a");
         }
         found_loc = 1;
         break;
@@ -197,25 +513,74 @@ int main(int argc, char* argv[]) {
     if (sensor_number == 99 && redis_connect())
       return DB_FAIL;
 
-    bme_read(&sensor.dev, &sensor.data);
-    if (check_alteration(sensor)) {
-      reply = (redisReply*)redisCommand(c, "SET wgen%d_%s %.3f EX 5", sensor_number, "temperature",
-                                        sensor.data.temperature);
+    // Batched, the radio only wakes up for the batches, which the checks ride along with
+    if (sensor_number != 99 && !uplink.batch)
+      failback(&last_failback);
 
-      if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
-        return DB_FAIL;
-      freeReplyObject(reply);
+    double woke = now();
+    account_tick();
 
-      reply = (redisReply*)redisCommand(c, "SET wgen%d_%s %.3f EX 5", sensor_number, "pressure",
-                                        sensor.data.pressure);
-      freeReplyObject(reply);
+    if (uplink.low_power) {
+      mmio_set_high(led);
+      bme_read(&sensor.dev, &sensor.data);
 
-      reply = (redisReply*)redisCommand(c, "SET wgen%d_%s %.3f EX 5", sensor_number, "humidity",
-                                        sensor.data.humidity);
-      freeReplyObject(reply);
+      // The next conversion runs while the node sleeps, so reads never wait for one
+      bme_force(&sensor.dev);
+    } else {
+      bme_read(&sensor.dev, &sensor.data);
+    }
+
+    if (check_alteration(sensor) == 0) {
+      if (uplink.batch) {
+        struct timespec now;
+        double values[] = {sensor.data.temperature, sensor.data.pressure, sensor.data.humidity};
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        int64_t ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+        int8_t full = delta_add(&encoder, ms, values);
+
+        // Sent once the interval is over (give or take wake-up latency), or earlier if the batch
+        // filled up
+        if (sensor_number != 99 &&
+            (full || woke - last_batch >= uplink.interval - loop_period / 2)) {
+          failback(&last_failback);
+
+          if (flush_batch(&sensor, &last_renewal)) {
+            redisFree(c);
+            c = NULL;
+            if (!redis_connect())
+              return DB_FAIL;
+            continue;
+          }
+
+          startup_published();
+          last_batch = woke;
+          if (full)
+            delta_add(&encoder, ms, values);
+        }
+      } else {
+        // The lease is renewed well before it would expire, and ahead of the readouts
+        uint8_t renew = time(NULL) - last_renewal >= WIRELESS_LEASE_TTL / 3;
+
+        if ((renew && renew_lease(WIRELESS_LEASE_TTL)) ||
+            redis_drain(c, append_wireless(c, sensor_number, sensor.data.temperature,
+                                           sensor.data.pressure, sensor.data.humidity,
+                                           WIRELESS_EXPIRY))) {
+          // Server went away: fail over to the next replica (or restart if none is left)
+          redisFree(c);
+          c = NULL;
+          if (!redis_connect())
+            return DB_FAIL;
+          continue;
+        }
+
+        if (renew)
+          last_renewal = time(NULL);
+        startup_published();
+      }
 
       sensor.past_pres = sensor.data.pressure;
-      if (strcmp(filename, "")) {
+      if (strcmp(filename, "") && file != NULL) {
         t = time(0);
         current_time = localtime(&t);
         strftime(time_str, sizeof(time_str), "%c", current_time);
@@ -225,14 +590,30 @@ int main(int argc, char* argv[]) {
         fflush(file);
       }
     } else {
-      syslog(LOG_ERR, "Invalid sensor reading");
+      SIMAR_LOG(LOG_ERR, "Invalid sensor reading");
       return SENSOR_FAIL;
     }
-    nanosleep(&period, NULL);
+
+    if (!uplink.low_power) {
+      nanosleep(&period, NULL);
+      continue;
+    }
+
+    // Everything else waits for the next wake-up, which is kept on a fixed grid
+    mmio_set_low(led);
+    log_flush();
+
+    // After a stall (such as a reconnection) the grid restarts, instead of catching up at once
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+    if (wakeup.tv_sec + uplink.period < current.tv_sec)
+      wakeup = current;
+
+    wakeup.tv_sec += uplink.period;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
   }
 
   // Unreachable
-  free(filename);
   pthread_join(led_thread, NULL);
   redisFree(c);
   redisFree(local_c);
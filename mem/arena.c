@@ -0,0 +1,299 @@
+/*! @file arena.c
+ * @brief Startup-sized memory arena and the hiredis block pool of the static memory mode
+ */
+
+#include "arena.h"
+
+#include <assert.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+
+#ifdef STATIC_MEM
+#include <hiredis/hiredis.h>
+#endif
+
+/// Block size of each pool class
+static const size_t class_size[ARENA_CLASSES] = {64, 256, 1024, 4096, 16384, 65536};
+
+static struct {
+  uint8_t* base;
+  size_t size;
+  size_t reserve;
+  size_t used;
+  uint8_t sealed;
+  struct {
+    const char* tag;
+    size_t bytes;
+  } tags[ARENA_TAGS];
+  uint8_t* pool[ARENA_CLASSES];
+  uint8_t* pool_end;
+  uint32_t blocks[ARENA_CLASSES];
+  uint32_t available[ARENA_CLASSES];
+  void* free[ARENA_CLASSES];
+  pthread_mutex_t lock;
+} arena = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+#ifdef STATIC_MEM
+/// Pool blocks per Redis connection: reader tasks and replies, reader, context, formatted commands
+/// and the read buffer. The output buffer is added according to the pipeline length.
+static const uint32_t connection_blocks[ARENA_CLASSES] = {32, 8, 4, 2, 2, 0};
+
+/// Estimated size of a formatted command in the output buffer
+#define COMMAND_SIZE 256
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+// The daemon is linked with --wrap, so its own calls land here; libraries keep the real allocator
+void* __wrap_malloc(size_t size) {
+  assert(!arena.sealed);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size) {
+  assert(!arena.sealed);
+  return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  assert(!arena.sealed);
+  return __real_realloc(ptr, size);
+}
+
+/**
+ * @brief Finds the pool class of a block
+ * @param[in] ptr Block
+ * @returns Class, or -1 if the block does not belong to the pool
+ */
+static int class_of(const void* ptr) {
+  const uint8_t* p = ptr;
+  int k = ARENA_CLASSES - 1;
+
+  if (arena.pool_end == NULL || p < arena.pool[0] || p >= arena.pool_end)
+    return -1;
+
+  while (k > 0 && p < arena.pool[k])
+    k--;
+
+  return k;
+}
+
+static void* pool_malloc(size_t size) {
+  void* block = NULL;
+
+  pthread_mutex_lock(&arena.lock);
+
+  // Smallest class with a free block, larger ones only absorb a shortage
+  for (int k = 0; k < ARENA_CLASSES && block == NULL; k++) {
+    if (size <= class_size[k] && arena.free[k] != NULL) {
+      block = arena.free[k];
+      arena.free[k] = *(void**)block;
+      arena.available[k]--;
+    }
+  }
+
+  pthread_mutex_unlock(&arena.lock);
+
+  if (block == NULL)
+    SIMAR_LOG(LOG_ERR, "Redis memory pool exhausted (%zu bytes requested)", size);
+
+  return block;
+}
+
+static void pool_free(void* ptr) {
+  int k = class_of(ptr);
+
+  if (ptr == NULL)
+    return;
+
+  // Allocated before the pool took over
+  if (k < 0) {
+    free(ptr);
+    return;
+  }
+
+  pthread_mutex_lock(&arena.lock);
+  *(void**)ptr = arena.free[k];
+  arena.free[k] = ptr;
+  arena.available[k]++;
+  pthread_mutex_unlock(&arena.lock);
+}
+
+static void* pool_calloc(size_t nmemb, size_t size) {
+  if (size != 0 && nmemb > SIZE_MAX / size)
+    return NULL;
+
+  void* block = pool_malloc(nmemb * size);
+
+  if (block != NULL)
+    memset(block, 0, nmemb * size);
+
+  return block;
+}
+
+static void* pool_realloc(void* ptr, size_t size) {
+  int k = class_of(ptr);
+
+  if (ptr == NULL)
+    return pool_malloc(size);
+
+  if (k >= 0 && size <= class_size[k])
+    return ptr;
+
+  void* block = pool_malloc(size);
+
+  if (block != NULL) {
+    size_t old = k >= 0 ? class_size[k] : malloc_usable_size(ptr);
+    memcpy(block, ptr, old < size ? old : size);
+    pool_free(ptr);
+  }
+
+  return block;
+}
+
+static char* pool_strdup(const char* str) {
+  size_t len = strlen(str) + 1;
+  char* dup = pool_malloc(len);
+
+  if (dup != NULL)
+    memcpy(dup, str, len);
+
+  return dup;
+}
+
+/**
+ * @brief Sizes the pool for a number of connections and pipeline length
+ * @param[in] connections Redis connections
+ * @param[in] pipeline Largest amount of pipelined commands per connection
+ * @returns Pool size (bytes)
+ */
+static size_t pool_plan(int connections, int pipeline) {
+  size_t obuf = (size_t)pipeline * COMMAND_SIZE, size = 0;
+  int k = 0;
+
+  // One spare connection, so failover can connect before the old context is freed
+  connections++;
+
+  // The output buffer grows by doubling, so every class on the way needs a block to realloc into
+  while (k < ARENA_CLASSES - 1 && class_size[k] < obuf)
+    arena.blocks[k++] += connections;
+  arena.blocks[k] += connections;
+
+  for (k = 0; k < ARENA_CLASSES; k++) {
+    arena.blocks[k] += connection_blocks[k] * connections;
+    size += arena.blocks[k] * class_size[k];
+  }
+
+  return size;
+}
+
+/**
+ * @brief Carves the pool out of the end of the arena and hands it to hiredis
+ */
+static void pool_init() {
+  uint8_t* p = arena.base + arena.reserve;
+
+  for (int k = 0; k < ARENA_CLASSES; k++) {
+    arena.pool[k] = p;
+
+    for (uint32_t i = 0; i < arena.blocks[k]; i++, p += class_size[k]) {
+      *(void**)p = arena.free[k];
+      arena.free[k] = p;
+    }
+    arena.available[k] = arena.blocks[k];
+  }
+
+  arena.pool_end = p;
+
+  hiredisAllocFuncs ha = {.mallocFn = pool_malloc,
+                          .callocFn = pool_calloc,
+                          .reallocFn = pool_realloc,
+                          .strdupFn = pool_strdup,
+                          .freeFn = pool_free};
+  hiredisSetAllocators(&ha);
+}
+#endif
+
+int8_t arena_init(size_t reserve, int connections, int pipeline) {
+  arena.reserve = (reserve + 63) & ~(size_t)63;
+  arena.size = arena.reserve;
+
+#ifdef STATIC_MEM
+  arena.size += pool_plan(connections, pipeline);
+#endif
+
+  if (arena.size == 0)
+    return 0;
+
+  // Populated up front, so the first use in the main loop does not page fault
+  arena.base = mmap(NULL, arena.size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+  if (arena.base == MAP_FAILED) {
+    SIMAR_LOG(LOG_CRIT, "Could not map a %zu byte memory arena", arena.size);
+    arena.base = NULL;
+    return -1;
+  }
+
+#ifdef STATIC_MEM
+  pool_init();
+#endif
+
+  return 0;
+}
+
+void* arena_alloc(size_t size, const char* tag) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (arena.base == NULL || arena.used + size > arena.reserve) {
+    SIMAR_LOG(LOG_ERR, "Memory arena exhausted (%zu bytes requested for %s)", size, tag);
+    return NULL;
+  }
+
+  void* ptr = arena.base + arena.used;
+  arena.used += size;
+
+  // Allocations under the same tag are listed together; the last slot collects any overflow
+  int i = 0;
+  while (i < ARENA_TAGS - 1 && arena.tags[i].tag != NULL && strcmp(arena.tags[i].tag, tag))
+    i++;
+
+  if (arena.tags[i].tag == NULL)
+    arena.tags[i].tag = tag;
+  arena.tags[i].bytes += size;
+
+  return ptr;
+}
+
+void arena_seal() {
+  long pages = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+
+  if (statm != NULL) {
+    if (fscanf(statm, "%*s %ld", &pages) != 1)
+      pages = 0;
+    fclose(statm);
+  }
+
+  SIMAR_LOG(LOG_NOTICE, "Memory budget: %zu B arena, %zu of %zu B reserved in use", arena.size,
+            arena.used, arena.reserve);
+
+  for (int i = 0; i < ARENA_TAGS && arena.tags[i].tag != NULL; i++)
+    SIMAR_LOG(LOG_NOTICE, "  %s: %zu B", arena.tags[i].tag, arena.tags[i].bytes);
+
+  for (int k = 0; k < ARENA_CLASSES; k++)
+    if (arena.blocks[k] != 0)
+      SIMAR_LOG(LOG_NOTICE, "  Redis pool: %u x %zu B (%u free)", arena.blocks[k], class_size[k],
+                arena.available[k]);
+
+  SIMAR_LOG(LOG_NOTICE, "  Resident set at startup: %ld kB", pages * sysconf(_SC_PAGESIZE) / 1024);
+
+  arena.sealed = 1;
+}
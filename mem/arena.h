@@ -0,0 +1,58 @@
+/*! @file arena.h
+ * @brief Declarations for the startup-sized memory arena
+ */
+
+/*!
+ * @defgroup mem Memory
+ * @brief Static memory mode
+ */
+
+#ifndef MEM_ARENA_H
+#define MEM_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_CLASSES 6
+#define ARENA_TAGS 8
+
+/// Bytes taken in the arena by n objects of a type, alignment included
+#define ARENA_BYTES(n, type) \
+  (((n) * sizeof(type) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/**
+ * \ingroup mem
+ * @brief Reserves the arena, sized from the topology discovered at startup
+ *
+ * @details In static memory builds (`make STATIC_MEM=1`), the arena also holds a block pool that
+ * hiredis allocates from, with room for `connections` contexts (plus one spare for failover) and
+ * pipelines of up to `pipeline` commands. Other builds only reserve `reserve` bytes and leave
+ * hiredis on the C library allocator.
+ *
+ * @param[in] reserve Bytes for arena_alloc() (see ARENA_BYTES)
+ * @param[in] connections Redis connections open at the same time
+ * @param[in] pipeline Largest amount of pipelined commands per connection
+ * @retval 0 OK
+ * @retval -1 The arena could not be mapped
+ */
+int8_t arena_init(size_t reserve, int connections, int pipeline);
+
+/**
+ * \ingroup mem
+ * @brief Allocates zeroed memory from the arena (never freed)
+ * @param[in] size Bytes
+ * @param[in] tag Name under which the allocation is listed in the budget report
+ * @returns Pointer, or NULL if the reserve is exhausted
+ */
+void* arena_alloc(size_t size, const char* tag);
+
+/**
+ * \ingroup mem
+ * @brief Ends initialization and logs the memory budget
+ *
+ * @details In static memory builds, any malloc() from the daemon afterwards trips an assertion.
+ */
+void arena_seal();
+
+#endif
@@ -0,0 +1,140 @@
+/*! @file shm.c
+ * @brief Shared memory board of latest values, updated under seqlocks
+ */
+
+#include "shm.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+
+struct shm_board* shm_attach(uint8_t writable) {
+  struct shm_board* board;
+  struct stat st;
+  int fd = shm_open(SHM_NAME, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+
+  if (fd < 0) {
+    SIMAR_LOG(LOG_ERR, "Could not open the shared memory board %s", SHM_NAME);
+    return NULL;
+  }
+
+  // A new segment is all zeros, which is an empty board
+  if (writable && fstat(fd, &st) == 0 && st.st_size == 0 && ftruncate(fd, sizeof(*board))) {
+    close(fd);
+    return NULL;
+  }
+
+  if (fstat(fd, &st) || st.st_size != sizeof(*board)) {
+    SIMAR_LOG(LOG_ERR, "Shared memory board %s has another layout, not using it", SHM_NAME);
+    close(fd);
+    return NULL;
+  }
+
+  board = mmap(NULL, sizeof(*board), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+               fd, 0);
+  close(fd);
+
+  if (board == MAP_FAILED)
+    return NULL;
+
+  if (writable && atomic_load(&board->magic) == 0) {
+    board->version = SHM_VERSION;
+    atomic_store(&board->magic, SHM_MAGIC);
+  }
+
+  if (atomic_load(&board->magic) != SHM_MAGIC || board->version != SHM_VERSION) {
+    SIMAR_LOG(LOG_ERR, "Shared memory board %s has another version, not using it", SHM_NAME);
+    munmap(board, sizeof(*board));
+    return NULL;
+  }
+
+  return board;
+}
+
+struct shm_entry* shm_claim(struct shm_board* board,
+                            const char* key,
+                            const char* const* fields,
+                            uint8_t count) {
+  struct shm_entry* entry = (struct shm_entry*)shm_find(board, key);
+
+  if (entry != NULL)
+    return entry;
+
+  for (int i = 0; i < SHM_ENTRIES; i++) {
+    unsigned state = SHM_FREE;
+    entry = &board->entries[i];
+
+    if (!atomic_compare_exchange_strong(&entry->state, &state, SHM_CLAIMING))
+      continue;
+
+    strncpy(entry->key, key, SHM_KEY_LEN - 1);
+    entry->count = count < SHM_VALUES ? count : SHM_VALUES;
+    for (int f = 0; f < entry->count; f++)
+      strncpy(entry->fields[f], fields[f], SHM_FIELD_LEN - 1);
+
+    // Readers only look at entries in use, so they never see a half written key
+    atomic_store_explicit(&entry->state, SHM_READY, memory_order_release);
+    return entry;
+  }
+
+  SIMAR_LOG(LOG_ERR, "Shared memory board full, %s not published", key);
+  return NULL;
+}
+
+void shm_publish(struct shm_entry* entry, const double* values) {
+  unsigned sequence = atomic_load_explicit(&entry->sequence, memory_order_relaxed);
+
+  // Left odd by a writer that died mid update
+  sequence += sequence & 1;
+
+  atomic_store_explicit(&entry->sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  clock_gettime(CLOCK_MONOTONIC, &entry->at);
+  memcpy(entry->values, values, entry->count * sizeof(double));
+
+  atomic_store_explicit(&entry->sequence, sequence + 2, memory_order_release);
+}
+
+const struct shm_entry* shm_find(const struct shm_board* board, const char* key) {
+  for (int i = 0; i < SHM_ENTRIES; i++) {
+    const struct shm_entry* entry = &board->entries[i];
+
+    if (atomic_load_explicit(&entry->state, memory_order_acquire) == SHM_READY &&
+        strncmp(entry->key, key, SHM_KEY_LEN) == 0)
+      return entry;
+  }
+
+  return NULL;
+}
+
+int8_t shm_read(const struct shm_entry* entry, struct shm_snapshot* snapshot) {
+  for (int attempt = 0; attempt < SHM_READ_RETRIES; attempt++) {
+    unsigned before = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+
+    // Being written: let the writer finish if it was preempted on this core
+    if (before & 1) {
+      sched_yield();
+      continue;
+    }
+
+    snapshot->count = entry->count;
+    snapshot->at = entry->at;
+    memcpy(snapshot->values, entry->values, sizeof(snapshot->values));
+
+    // The copy must be complete before the sequence is checked again
+    atomic_thread_fence(memory_order_acquire);
+
+    if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) == before) {
+      snapshot->updates = before / 2;
+      return 0;
+    }
+  }
+
+  return -1;
+}
@@ -0,0 +1,118 @@
+/*! @file shm.h
+ * @brief Declarations for the shared memory board of latest values
+ */
+
+#ifndef MEM_SHM_H
+#define MEM_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SHM_NAME "/simar_board"
+#define SHM_MAGIC 0x53424F44
+#define SHM_VERSION 1
+#define SHM_ENTRIES 256
+#define SHM_KEY_LEN 24
+#define SHM_FIELD_LEN 16
+#define SHM_VALUES 8
+// Attempts of a reader before giving up on an entry being rewritten
+#define SHM_READ_RETRIES 64
+
+// Entry states: free, being claimed (key and fields not set yet), in use
+#define SHM_FREE 0
+#define SHM_CLAIMING 1
+#define SHM_READY 2
+
+/*!
+ * @brief Latest values of one source (a sensor, the AC input, an outlet...)
+ *
+ * @details Each entry has a single writer, the daemon that claimed it, and any number of readers
+ * in other processes. Updates go under a seqlock: the sequence is odd while the values are being
+ * written, and grows by 2 with every update, so `sequence / 2` counts the updates. Readers copy
+ * the values and retry if the sequence changed meanwhile, which takes no locks and no syscalls
+ * (short of yielding to a writer preempted mid update) and never blocks the writer. Entries are
+ * cache line aligned, so writers do not contend with each other either.
+ */
+struct shm_entry {
+  atomic_uint sequence;
+  atomic_uint state;
+  char key[SHM_KEY_LEN];
+  char fields[SHM_VALUES][SHM_FIELD_LEN];
+  uint8_t count;
+  struct timespec at;
+  double values[SHM_VALUES];
+} __attribute__((aligned(64)));
+
+/*!
+ * @brief Shared memory segment (`/dev/shm/simar_board`), created by the first daemon to attach
+ */
+struct shm_board {
+  atomic_uint magic;
+  uint32_t version;
+  struct shm_entry entries[SHM_ENTRIES];
+};
+
+/*!
+ * @brief Consistent copy of an entry
+ */
+struct shm_snapshot {
+  uint32_t updates;
+  uint8_t count;
+  struct timespec at;
+  double values[SHM_VALUES];
+};
+
+/**
+ * \ingroup mem
+ * @brief Maps the board, creating it if no daemon did yet
+ * @param[in] writable 1 for daemons publishing values, 0 for readers
+ * @returns Board, or NULL if it could not be mapped or has another layout
+ */
+struct shm_board* shm_attach(uint8_t writable);
+
+/**
+ * \ingroup mem
+ * @brief Gets the entry of a source, claiming a free one the first time
+ *
+ * @details Entries are kept across restarts of their daemon, which finds them again by key.
+ *
+ * @param[in, out] board Board
+ * @param[in] key Source name
+ * @param[in] fields Field names (up to SHM_VALUES)
+ * @param[in] count Fields
+ * @returns Entry, or NULL if the board is full
+ */
+struct shm_entry* shm_claim(struct shm_board* board,
+                            const char* key,
+                            const char* const* fields,
+                            uint8_t count);
+
+/**
+ * \ingroup mem
+ * @brief Publishes the latest values of an entry (its writer only)
+ * @param[in, out] entry Entry
+ * @param[in] values Values, one per field
+ */
+void shm_publish(struct shm_entry* entry, const double* values);
+
+/**
+ * \ingroup mem
+ * @brief Finds the entry of a source
+ * @param[in] board Board
+ * @param[in] key Source name
+ * @returns Entry, or NULL if no daemon published it
+ */
+const struct shm_entry* shm_find(const struct shm_board* board, const char* key);
+
+/**
+ * \ingroup mem
+ * @brief Copies the latest values of an entry
+ * @param[in] entry Entry
+ * @param[out] snapshot Values, their time (monotonic clock) and the updates so far
+ * @retval 0 OK
+ * @retval -1 The entry kept being rewritten (its writer died mid update, or is far too busy)
+ */
+int8_t shm_read(const struct shm_entry* entry, struct shm_snapshot* snapshot);
+
+#endif
@@ -0,0 +1,585 @@
+/*! @file common.c
+ * @brief Common functions for the MQTT output backend
+ */
+
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "../utils/json/config.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xC0
+#define MQTT_DISCONNECT 0xE0
+#define MQTT_DUP 0x08
+
+int8_t mqtt_load_config(struct mqtt_config* cfg, const char* path) {
+  cJSON *json, *mqtt, *item;
+
+  memset(cfg, 0, sizeof(*cfg));
+
+  json = config_load(path);
+
+  mqtt = cJSON_GetObjectItemCaseSensitive(json, "mqtt");
+  item = cJSON_GetObjectItemCaseSensitive(mqtt, "host");
+
+  if (!cJSON_IsString(item)) {
+    cJSON_Delete(json);
+    return -1;
+  }
+
+  snprintf(cfg->host, sizeof(cfg->host), "%s", item->valuestring);
+  cfg->port = MQTT_PORT;
+  cfg->qos = 1;
+  cfg->window = MQTT_DEFAULT_WINDOW;
+  snprintf(cfg->prefix, sizeof(cfg->prefix), "simar");
+  gethostname(cfg->client_id, sizeof(cfg->client_id) - 1);
+
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(mqtt, "port")))
+    cfg->port = item->valueint;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(mqtt, "qos")))
+    cfg->qos = item->valueint > 0;  // QoS 2 is not supported, 1 already gives at-least-once
+  if (cJSON_IsBool(item = cJSON_GetObjectItemCaseSensitive(mqtt, "batch")))
+    cfg->batch = cJSON_IsTrue(item);
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(mqtt, "window")) &&
+      item->valueint > 0 && item->valueint <= MQTT_QUEUE_LEN)
+    cfg->window = item->valueint;
+  if (cJSON_IsString(item = cJSON_GetObjectItemCaseSensitive(mqtt, "prefix")))
+    snprintf(cfg->prefix, sizeof(cfg->prefix), "%s", item->valuestring);
+  if (cJSON_IsString(item = cJSON_GetObjectItemCaseSensitive(mqtt, "client_id")))
+    snprintf(cfg->client_id, sizeof(cfg->client_id), "%s", item->valuestring);
+
+  cJSON_Delete(json);
+  cfg->enabled = 1;
+
+  return 0;
+}
+
+void mqtt_init(struct mqtt_client* client, const struct mqtt_config* cfg) {
+  memset(client, 0, sizeof(*client));
+  client->cfg = *cfg;
+  client->fd = -1;
+  client->next_id = 1;
+  client->state = MQTT_DISCONNECTED;
+}
+
+/**
+ * @brief Encodes the remaining length field
+ * @param[out] buf Output buffer (at least 4 bytes)
+ * @param[in] len Remaining length
+ * @returns Bytes written
+ */
+static size_t encode_length(uint8_t* buf, size_t len) {
+  size_t i = 0;
+
+  do {
+    buf[i] = len % 128;
+    len /= 128;
+    if (len > 0)
+      buf[i] |= 0x80;
+  } while (len > 0 && ++i < 4);
+
+  return i + 1;
+}
+
+/**
+ * @brief Encodes a length-prefixed string
+ * @param[out] buf Output buffer
+ * @param[in] str String
+ * @returns Bytes written
+ */
+static size_t encode_string(uint8_t* buf, const char* str) {
+  size_t len = strlen(str);
+
+  buf[0] = len >> 8;
+  buf[1] = len & 0xFF;
+  memcpy(buf + 2, str, len);
+
+  return len + 2;
+}
+
+/**
+ * @brief Writes a short control packet in full
+ * @param[in, out] client Client
+ * @param[in] buf Packet
+ * @param[in] len Packet length
+ * @retval 0 OK
+ * @retval -1 Write failure
+ */
+static int8_t write_packet(struct mqtt_client* client, const uint8_t* buf, size_t len) {
+  if (send(client->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)len)
+    return -1;
+
+  client->last_io = time(NULL);
+  return 0;
+}
+
+void mqtt_disconnect(struct mqtt_client* client) {
+  if (client->fd >= 0) {
+    if (client->state == MQTT_CONNECTED)
+      write_packet(client, (const uint8_t[]){MQTT_DISCONNECT, 0}, 2);
+    close(client->fd);
+  }
+
+  client->fd = -1;
+  client->state = MQTT_DISCONNECTED;
+  client->in_len = 0;
+  client->out_off = 0;
+
+  // In flight messages are written again (as duplicates) after reconnecting
+  client->sent = client->head;
+}
+
+int8_t mqtt_publish(struct mqtt_client* client,
+                    const char* topic,
+                    const void* payload,
+                    size_t len) {
+  uint8_t qos = client->cfg.qos;
+  size_t topic_len = strlen(topic);
+  size_t remaining = 2 + topic_len + (qos ? 2 : 0) + len;
+
+  if (remaining + 5 > MQTT_MAX_PACKET)
+    return -1;
+
+  if (client->tail - client->head == MQTT_QUEUE_LEN) {
+    client->stats.dropped++;
+
+    // In flight messages wait for their PUBACK, so the oldest waiting message is dropped instead:
+    // this one if none is waiting, or if the oldest is half written
+    if (client->sent == client->tail || client->out_off > 0)
+      return 0;
+
+    // The in flight messages move up one slot over it (none while disconnected)
+    for (uint32_t i = client->sent; i != client->head; i--)
+      client->queue[i % MQTT_QUEUE_LEN] = client->queue[(i - 1) % MQTT_QUEUE_LEN];
+    client->head++;
+    client->sent++;
+  }
+
+  struct mqtt_message* msg = &client->queue[client->tail % MQTT_QUEUE_LEN];
+  size_t i = 0;
+
+  msg->data[i++] = MQTT_PUBLISH | qos << 1;
+  i += encode_length(msg->data + i, remaining);
+  i += encode_string(msg->data + i, topic);
+
+  msg->id = 0;
+  if (qos) {
+    if (client->next_id == 0)
+      client->next_id = 1;
+    msg->id = client->next_id++;
+    msg->data[i++] = msg->id >> 8;
+    msg->data[i++] = msg->id & 0xFF;
+  }
+
+  memcpy(msg->data + i, payload, len);
+  msg->len = i + len;
+  msg->acked = 0;
+
+  client->tail++;
+  client->stats.published++;
+
+  return 0;
+}
+
+int8_t mqtt_subscribe(struct mqtt_client* client, const char* filter) {
+  uint8_t buf[MQTT_MAX_PACKET];
+  size_t filter_len = strlen(filter), i = 0;
+
+  if (client->state != MQTT_CONNECTED || filter_len + 16 > MQTT_MAX_PACKET)
+    return -1;
+
+  buf[i++] = MQTT_SUBSCRIBE;
+  i += encode_length(buf + i, 2 + 2 + filter_len + 1);
+  buf[i++] = 0;
+  buf[i++] = 1;  // Packet ID (SUBACK is not tracked)
+  i += encode_string(buf + i, filter);
+  buf[i++] = 0;
+
+  return write_packet(client, buf, i);
+}
+
+/**
+ * @brief Starts a non-blocking connection to the broker
+ * @param[in, out] client Client
+ */
+static void start_connect(struct mqtt_client* client) {
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+  char port[8];
+
+  client->last_attempt = time(NULL);
+  snprintf(port, sizeof(port), "%d", client->cfg.port);
+
+  if (getaddrinfo(client->cfg.host, port, &hints, &res) != 0) {
+    SIMAR_LOG(LOG_ERR, "Could not resolve MQTT broker %s", client->cfg.host);
+    return;
+  }
+
+  client->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  fcntl(client->fd, F_SETFL, O_NONBLOCK);
+
+  if (connect(client->fd, res->ai_addr, res->ai_addrlen) == 0 || errno == EINPROGRESS) {
+    client->state = MQTT_CONNECTING;
+  } else {
+    close(client->fd);
+    client->fd = -1;
+  }
+
+  freeaddrinfo(res);
+}
+
+/**
+ * @brief Sends CONNECT once the TCP connection is established
+ * @param[in, out] client Client
+ * @retval 0 OK
+ * @retval -1 Connection failure
+ */
+static int8_t send_connect(struct mqtt_client* client) {
+  uint8_t buf[128];
+  size_t i = 0, id_len = strlen(client->cfg.client_id);
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+
+  if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err)
+    return -1;
+
+  buf[i++] = MQTT_CONNECT;
+  i += encode_length(buf + i, 10 + 2 + id_len);
+  i += encode_string(buf + i, "MQTT");
+  buf[i++] = 4;  // Protocol level (3.1.1)
+  buf[i++] = 0;  // No clean session: the broker keeps our in flight messages across reconnections
+  buf[i++] = MQTT_KEEPALIVE >> 8;
+  buf[i++] = MQTT_KEEPALIVE & 0xFF;
+  i += encode_string(buf + i, client->cfg.client_id);
+
+  client->state = MQTT_WAIT_CONNACK;
+  return write_packet(client, buf, i);
+}
+
+/**
+ * @brief Handles one complete packet from the broker
+ * @param[in, out] client Client
+ * @param[in] type Packet type (first byte)
+ * @param[in] body Variable header and payload
+ * @param[in] len Body length
+ * @retval 0 OK
+ * @retval -1 Protocol failure
+ */
+static int8_t handle_packet(struct mqtt_client* client, uint8_t type, uint8_t* body, size_t len) {
+  switch (type & 0xF0) {
+    case MQTT_CONNACK:
+      if (len < 2 || body[1] != 0) {
+        SIMAR_LOG(LOG_ERR, "MQTT broker refused the connection (return code %d)",
+                  len < 2 ? -1 : body[1]);
+        return -1;
+      }
+
+      SIMAR_LOG(LOG_NOTICE, "MQTT broker connected (session %s)", body[0] & 1 ? "resumed" : "new");
+      client->state = MQTT_CONNECTED;
+      client->stats.reconnects++;
+      break;
+
+    case MQTT_PUBACK: {
+      if (len < 2)
+        return -1;
+
+      uint16_t id = body[0] << 8 | body[1];
+
+      for (uint32_t i = client->head; i != client->sent; i++) {
+        struct mqtt_message* msg = &client->queue[i % MQTT_QUEUE_LEN];
+        if (msg->id == id && !msg->acked) {
+          msg->acked = 1;
+          client->stats.acked++;
+          break;
+        }
+      }
+
+      // Acknowledgements may arrive out of order; the window only slides over acked messages
+      while (client->head != client->sent && client->queue[client->head % MQTT_QUEUE_LEN].acked)
+        client->head++;
+      break;
+    }
+
+    case MQTT_PUBLISH: {
+      char topic[256];
+      uint8_t qos = (type >> 1) & 3;
+      size_t topic_len = len >= 2 ? (size_t)(body[0] << 8 | body[1]) : len;
+      size_t offset = 2 + topic_len + (qos ? 2 : 0);
+
+      if (offset > len || topic_len >= sizeof(topic))
+        return -1;
+
+      memcpy(topic, body + 2, topic_len);
+      topic[topic_len] = '\0';
+
+      if (qos) {
+        uint8_t ack[4] = {MQTT_PUBACK, 2, body[2 + topic_len], body[3 + topic_len]};
+        write_packet(client, ack, sizeof(ack));
+      }
+
+      if (client->on_message)
+        client->on_message(topic, body + offset, len - offset);
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Reads and handles everything available from the broker
+ * @param[in, out] client Client
+ * @retval 0 OK
+ * @retval -1 Connection failure
+ */
+static int8_t read_packets(struct mqtt_client* client) {
+  ssize_t got = recv(client->fd, client->in + client->in_len, sizeof(client->in) - client->in_len,
+                     MSG_DONTWAIT);
+
+  if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    return -1;
+  if (got > 0)
+    client->in_len += got;
+
+  for (;;) {
+    size_t len = 0, i = 1;
+    uint32_t multiplier = 1;
+
+    // Fixed header: type, then up to 4 bytes of remaining length
+    do {
+      if (i >= client->in_len)
+        return 0;
+      len += (client->in[i] & 0x7F) * multiplier;
+      multiplier *= 128;
+    } while (client->in[i++] & 0x80 && i < 5);
+
+    if (i + len > sizeof(client->in))
+      return -1;
+    if (i + len > client->in_len)
+      return 0;
+
+    if (handle_packet(client, client->in[0], client->in + i, len))
+      return -1;
+
+    client->in_len -= i + len;
+    memmove(client->in, client->in + i + len, client->in_len);
+  }
+}
+
+/**
+ * @brief Writes queued messages while the in flight window allows it
+ * @param[in, out] client Client
+ * @retval 0 OK
+ * @retval -1 Connection failure
+ */
+static int8_t write_queue(struct mqtt_client* client) {
+  while (client->sent != client->tail && client->sent - client->head < client->cfg.window) {
+    struct mqtt_message* msg = &client->queue[client->sent % MQTT_QUEUE_LEN];
+    ssize_t written = send(client->fd, msg->data + client->out_off, msg->len - client->out_off,
+                           MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (written < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    client->last_io = time(NULL);
+    client->out_off += written;
+    if (client->out_off < msg->len)
+      return 0;
+
+    client->out_off = 0;
+    client->sent++;
+
+    // QoS 0 messages are done as soon as they are written; QoS 1 ones are flagged as duplicates in
+    // case they have to be written again after a reconnection
+    msg->acked = msg->id == 0;
+    msg->data[0] |= msg->id ? MQTT_DUP : 0;
+  }
+
+  while (client->head != client->sent && client->queue[client->head % MQTT_QUEUE_LEN].acked)
+    client->head++;
+
+  return 0;
+}
+
+int8_t mqtt_sync(struct mqtt_client* client, int timeout_ms) {
+  struct pollfd pfd;
+  time_t now = time(NULL);
+
+  if (!client->cfg.enabled)
+    return -1;
+
+  if (client->state == MQTT_DISCONNECTED) {
+    if (now - client->last_attempt < MQTT_RETRY_PERIOD)
+      return -1;
+    start_connect(client);
+    if (client->state == MQTT_DISCONNECTED)
+      return -1;
+  }
+
+  pfd.fd = client->fd;
+  pfd.events = POLLIN;
+  if (client->state == MQTT_CONNECTING ||
+      (client->state == MQTT_CONNECTED && client->sent != client->tail))
+    pfd.events |= POLLOUT;
+
+  if (poll(&pfd, 1, timeout_ms) < 0 || pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+    goto fail;
+
+  if (client->state == MQTT_CONNECTING) {
+    if (!(pfd.revents & POLLOUT)) {
+      if (now - client->last_attempt > MQTT_RETRY_PERIOD)
+        goto fail;
+      return -1;
+    }
+    if (send_connect(client))
+      goto fail;
+    return -1;
+  }
+
+  if (pfd.revents & POLLIN && read_packets(client))
+    goto fail;
+
+  if (client->state != MQTT_CONNECTED) {
+    if (now - client->last_attempt > MQTT_RETRY_PERIOD)
+      goto fail;
+    return -1;
+  }
+
+  if (write_queue(client))
+    goto fail;
+
+  if (now - client->last_io > MQTT_KEEPALIVE / 2 &&
+      write_packet(client, (const uint8_t[]){MQTT_PINGREQ, 0}, 2))
+    goto fail;
+
+  return 0;
+
+fail:
+  SIMAR_LOG(LOG_ERR, "MQTT broker connection lost, %u messages queued",
+            (unsigned)(client->tail - client->head));
+  mqtt_disconnect(client);
+  return -1;
+}
+
+void mqtt_sweep_begin(struct mqtt_client* client, const char* group) {
+  struct timespec ts;
+
+  client->sweep_group = group;
+  client->sweep_sensor[0] = '\0';
+  client->sweep_len = 0;
+
+  if (client->cfg.batch) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    client->sweep_len = snprintf(client->sweep, sizeof(client->sweep), "{\"ts\":%lld",
+                                 (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+  }
+}
+
+// A batched sweep shares its packet with the fixed header (up to 5 bytes), the topic and its
+// length, and the packet ID
+#define BATCH_TOPIC_LEN 160
+#define BATCH_HEADROOM (5 + 2 + BATCH_TOPIC_LEN + 2)
+// Longest formatted value: 15 integer digits, sign and decimals, or %.17g
+#define MQTT_VALUE_LEN 32
+
+/**
+ * @brief Publishes the batched sweep document built so far
+ * @param[in, out] client Client
+ */
+static void publish_batch(struct mqtt_client* client) {
+  char topic[BATCH_TOPIC_LEN];
+
+  if (client->sweep_sensor[0])
+    client->sweep[client->sweep_len++] = '}';
+  client->sweep[client->sweep_len++] = '}';
+
+  snprintf(topic, sizeof(topic), "%s/%s/%s", client->cfg.prefix, client->cfg.client_id,
+           client->sweep_group);
+  mqtt_publish(client, topic, client->sweep, client->sweep_len);
+}
+
+/**
+ * @brief Formats a value as JSON, non-finite ones (failed readouts) as `null` and huge ones in
+ * exponent notation
+ * @param[out] buf Buffer (at least MQTT_VALUE_LEN bytes)
+ * @param[in] value Value
+ */
+static void format_value(char* buf, double value) {
+  if (!isfinite(value))
+    snprintf(buf, MQTT_VALUE_LEN, "null");
+  else if (fabs(value) < 1e15)
+    snprintf(buf, MQTT_VALUE_LEN, "%.3f", value);
+  else
+    snprintf(buf, MQTT_VALUE_LEN, "%.17g", value);
+}
+
+void mqtt_sweep_add(struct mqtt_client* client,
+                    const char* sensor,
+                    const char* field,
+                    double value) {
+  char topic[192], payload[MQTT_VALUE_LEN];
+
+  if (!client->cfg.enabled)
+    return;
+
+  format_value(payload, value);
+
+  if (!client->cfg.batch) {
+    snprintf(topic, sizeof(topic), "%s/%s/%s/%s/%s", client->cfg.prefix, client->cfg.client_id,
+             client->sweep_group, sensor, field);
+    mqtt_publish(client, topic, payload, strlen(payload));
+    return;
+  }
+
+  // Formatted in place, then flushed and formatted again if it did not fit along with the two
+  // closing braces
+  for (int attempt = 0; attempt < 2; attempt++) {
+    char* out = client->sweep + client->sweep_len;
+    size_t left = sizeof(client->sweep) - BATCH_HEADROOM - client->sweep_len;
+    uint8_t opens = strcmp(sensor, client->sweep_sensor) != 0;
+    int len = opens ? snprintf(out, left, "%s,\"%s\":{\"%s\":%s",
+                               client->sweep_sensor[0] ? "}" : "", sensor, field, payload)
+                    : snprintf(out, left, ",\"%s\":%s", field, payload);
+
+    if (len >= 0 && (size_t)len + 2 < left) {
+      client->sweep_len += len;
+      if (opens)
+        snprintf(client->sweep_sensor, sizeof(client->sweep_sensor), "%s", sensor);
+      return;
+    }
+
+    // Nothing to flush: the field alone is too large
+    if (!client->sweep_sensor[0])
+      break;
+
+    publish_batch(client);
+    mqtt_sweep_begin(client, client->sweep_group);
+  }
+
+  SIMAR_LOG(LOG_WARNING, "MQTT field %s/%s does not fit in a packet, dropped", sensor, field);
+}
+
+int8_t mqtt_sweep_end(struct mqtt_client* client) {
+  if (client->cfg.enabled && client->cfg.batch && client->sweep_len > 0)
+    publish_batch(client);
+
+  return mqtt_sync(client, 0);
+}
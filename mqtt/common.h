@@ -0,0 +1,200 @@
+/*! @file common.h
+ * @brief Common declarations for the MQTT output backend
+ */
+
+/*!
+ * @defgroup mqtt MQTT
+ * @brief Optional MQTT 3.1.1 output backend, shared by bme, volt, fan and leak
+ *
+ * @details The client never blocks the acquisition loop: connection, writes and acknowledgements
+ * are all advanced by mqtt_sync(). Messages are kept in a fixed queue until acknowledged (QoS 1),
+ * so they survive broker outages and reconnections (the session is persistent), and at most
+ * `window` of them are in flight at once. Every call is a no-op on a disabled client, so daemons
+ * call them unconditionally.
+ */
+
+#ifndef MQTT_COMMON_H
+#define MQTT_COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MQTT_PORT 1883
+#define MQTT_MAX_PACKET 2048
+#define MQTT_QUEUE_LEN 128
+#define MQTT_DEFAULT_WINDOW 16
+#define MQTT_KEEPALIVE 30
+#define MQTT_RETRY_PERIOD 5
+#define MQTT_CONFIG "/opt/device.json"
+
+/// Connection states
+enum mqtt_state { MQTT_DISCONNECTED, MQTT_CONNECTING, MQTT_WAIT_CONNACK, MQTT_CONNECTED };
+
+/*!
+ * @brief Backend settings, read from the "mqtt" object of the device configuration
+ */
+struct mqtt_config {
+  uint8_t enabled;
+  char host[64];
+  uint16_t port;
+  char client_id[64];
+  char prefix[32];
+  uint8_t qos;
+  uint8_t batch;
+  uint16_t window;
+};
+
+/*!
+ * @brief Queued PUBLISH packet, stored already encoded
+ */
+struct mqtt_message {
+  uint16_t id;
+  uint16_t len;
+  uint8_t acked;
+  uint8_t data[MQTT_MAX_PACKET];
+};
+
+/*!
+ * @brief Backend statistics
+ */
+struct mqtt_stats {
+  uint32_t published;
+  uint32_t acked;
+  uint32_t dropped;
+  uint32_t reconnects;
+};
+
+/*!
+ * @brief MQTT client
+ *
+ * @details head, sent and tail are free-running counters (slot = counter % MQTT_QUEUE_LEN).
+ * Messages from head to sent are in flight (written, waiting for PUBACK); messages from sent to
+ * tail are waiting for the window or for the connection.
+ */
+struct mqtt_client {
+  struct mqtt_config cfg;
+  enum mqtt_state state;
+  int fd;
+  time_t last_attempt;
+  time_t last_io;
+  uint16_t next_id;
+  uint32_t head, sent, tail;
+  uint16_t out_off;
+  struct mqtt_message queue[MQTT_QUEUE_LEN];
+  uint8_t in[MQTT_MAX_PACKET];
+  size_t in_len;
+  char sweep[MQTT_MAX_PACKET];
+  size_t sweep_len;
+  const char* sweep_group;
+  char sweep_sensor[32];
+  struct mqtt_stats stats;
+  void (*on_message)(const char* topic, const uint8_t* payload, size_t len);
+};
+
+/**
+ * \ingroup mqtt
+ * @brief Reads the backend settings from the device configuration
+ *
+ * @details Example: `"mqtt": {"host": "10.0.38.59", "port": 1883, "qos": 1, "batch": true,
+ * "window": 16, "prefix": "simar"}`. The client ID defaults to the hostname.
+ *
+ * @param[out] cfg Settings (disabled if there is no "mqtt" object)
+ * @param[in] path Configuration file
+ * @retval 0 MQTT enabled
+ * @retval -1 MQTT disabled or not configured
+ */
+int8_t mqtt_load_config(struct mqtt_config* cfg, const char* path);
+
+/**
+ * \ingroup mqtt
+ * @brief Initializes the client (no I/O is done until mqtt_sync())
+ * @param[out] client Client
+ * @param[in] cfg Settings
+ */
+void mqtt_init(struct mqtt_client* client, const struct mqtt_config* cfg);
+
+/**
+ * \ingroup mqtt
+ * @brief Queues a message; if the queue is full, the oldest message waiting to be written is
+ * dropped (in flight messages are kept until acknowledged), or this one if none is waiting
+ * @param[in, out] client Client
+ * @param[in] topic Topic
+ * @param[in] payload Payload
+ * @param[in] len Payload length
+ * @retval 0 OK
+ * @retval -1 Message too large
+ */
+int8_t mqtt_publish(struct mqtt_client* client,
+                    const char* topic,
+                    const void* payload,
+                    size_t len);
+
+/**
+ * \ingroup mqtt
+ * @brief Subscribes to a topic filter (QoS 0); messages are handed to on_message
+ * @param[in, out] client Client (must be connected)
+ * @param[in] filter Topic filter
+ * @retval 0 OK
+ * @retval -1 Not connected or write failure
+ */
+int8_t mqtt_subscribe(struct mqtt_client* client, const char* filter);
+
+/**
+ * \ingroup mqtt
+ * @brief Advances the connection, writes queued messages within the window and reads replies
+ * @param[in, out] client Client
+ * @param[in] timeout_ms Time to wait for socket activity (0 never blocks)
+ * @retval 0 Connected
+ * @retval -1 Not connected (messages stay queued)
+ */
+int8_t mqtt_sync(struct mqtt_client* client, int timeout_ms);
+
+/**
+ * \ingroup mqtt
+ * @brief Closes the connection (queued messages are kept)
+ * @param[in, out] client Client
+ */
+void mqtt_disconnect(struct mqtt_client* client);
+
+/**
+ * \ingroup mqtt
+ * \defgroup mqttSweep Sweeps
+ * @brief Publishing of a whole measurement sweep
+ *
+ * @details In topic-per-sensor mode, each field goes to `<prefix>/<client id>/<group>/<sensor>/
+ * <field>`. In batched mode, the sweep is published once to `<prefix>/<client id>/<group>` as
+ * `{"ts": <ms>, "<sensor>": {"<field>": <value>, ...}, ...}`.
+ */
+
+/**
+ * \ingroup mqttSweep
+ * @brief Starts a sweep
+ * @param[in, out] client Client
+ * @param[in] group Publishing daemon ("bme", "volt", ...)
+ */
+void mqtt_sweep_begin(struct mqtt_client* client, const char* group);
+
+/**
+ * \ingroup mqttSweep
+ * @brief Adds a field to the sweep (fields of the same sensor must be added in sequence)
+ * @param[in, out] client Client
+ * @param[in] sensor Sensor name
+ * @param[in] field Field name
+ * @param[in] value Value
+ */
+void mqtt_sweep_add(struct mqtt_client* client,
+                    const char* sensor,
+                    const char* field,
+                    double value);
+
+/**
+ * \ingroup mqttSweep
+ * @brief Finishes the sweep and syncs without blocking
+ * @param[in, out] client Client
+ * @retval 0 Connected
+ * @retval -1 Not connected (the sweep stays queued)
+ */
+int8_t mqtt_sweep_end(struct mqtt_client* client);
+
+#endif
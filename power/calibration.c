@@ -0,0 +1,151 @@
+/*! @file calibration.c
+ * @brief Outlet current calibration: zero offsets learned while the relays are open
+ */
+
+#include "calibration.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+
+/**
+ * @brief Checks a calibration table read from the file
+ * @param[in] table Calibration table
+ * @retval 1 Usable
+ * @retval 0 Corrupt, or from another sensor type
+ */
+static uint8_t table_valid(const struct calibration_record* table) {
+  if (table->magic != CALIBRATION_MAGIC)
+    return 0;
+
+  for (int i = 0; i < CALIBRATION_CHANNELS; i++) {
+    if (!(table->sensitivity[i] > 0) ||
+        !(fabs(table->zero[i] - CALIBRATION_ZERO) <= CALIBRATION_MAX_DRIFT))
+      return 0;
+  }
+
+  return 1;
+}
+
+int8_t calibration_init(struct current_calibration* cal, const char* path) {
+  struct calibration_record table;
+  int8_t rslt = -1;
+
+  memset(cal, 0, sizeof(*cal));
+  cal->path = path;
+  cal->last_save = time(NULL);
+  cal->table.magic = CALIBRATION_MAGIC;
+
+  for (int i = 0; i < CALIBRATION_CHANNELS; i++) {
+    cal->table.zero[i] = CALIBRATION_ZERO;
+    cal->table.sensitivity[i] = CALIBRATION_SENSITIVITY;
+  }
+
+  int fd = open(path, O_RDONLY);
+
+  if (fd >= 0) {
+    if (read(fd, &table, sizeof(table)) == sizeof(table) && table_valid(&table)) {
+      cal->table = table;
+      rslt = 0;
+    } else {
+      SIMAR_LOG(LOG_WARNING, "Invalid current calibration %s, using nominal values", path);
+    }
+
+    close(fd);
+  }
+
+  calibration_apply(cal, (1 << CALIBRATION_CHANNELS) - 1);
+  return rslt;
+}
+
+uint8_t calibration_learn(struct current_calibration* cal,
+                          const struct timespec* at,
+                          const uint8_t* codes,
+                          uint8_t valid,
+                          uint8_t off) {
+  struct calibration_record* table = &cal->table;
+  struct timespec now;
+  uint8_t stale = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int i = 0; i < CALIBRATION_CHANNELS; i++) {
+    if (!(off >> i & 1))
+      continue;
+
+    // Readings captured before the relay was seen open are older than this, so they never count
+    if (!(cal->off >> i & 1)) {
+      cal->off_since[i] = now;
+      continue;
+    }
+
+    double settled = (at->tv_sec - cal->off_since[i].tv_sec) +
+                     (at->tv_nsec - cal->off_since[i].tv_nsec) / 1e9;
+    double zero = codes[i] * CALIBRATION_STEP;
+
+    if (!(valid >> i & 1) || settled < CALIBRATION_SETTLE ||
+        fabs(zero - CALIBRATION_ZERO) > CALIBRATION_MAX_DRIFT)
+      continue;
+
+    // The ADC step is ~30 mA; averaging the noise around it resolves the zero well below that
+    table->zero[i] += CALIBRATION_WEIGHT * (zero - table->zero[i]);
+    if (table->samples[i] != UINT32_MAX)
+      table->samples[i]++;
+    cal->dirty = 1;
+
+    if (fabs(table->zero[i] - cal->built[i]) >= CALIBRATION_REBUILD)
+      stale |= 1 << i;
+  }
+
+  cal->off = off;
+  return stale;
+}
+
+void calibration_apply(struct current_calibration* cal, uint8_t channels) {
+  for (int i = 0; i < CALIBRATION_CHANNELS; i++) {
+    if (!(channels >> i & 1))
+      continue;
+
+    double zero = cal->table.zero[i];
+    double scale = 1 / cal->table.sensitivity[i];
+
+    for (int code = 0; code < CALIBRATION_CODES; code++)
+      cal->amps[i][code] = (code * CALIBRATION_STEP - zero) * scale;
+
+    cal->built[i] = zero;
+  }
+}
+
+int8_t calibration_save(struct current_calibration* cal) {
+  char tmp[128];
+
+  if (!cal->dirty || time(NULL) - cal->last_save < CALIBRATION_SAVE_PERIOD)
+    return 0;
+
+  cal->last_save = time(NULL);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", cal->path);
+
+  // Written aside and renamed over the old table, so a power loss leaves one of them intact
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0 || write(fd, &cal->table, sizeof(cal->table)) != sizeof(cal->table) || fsync(fd)) {
+    SIMAR_LOG(LOG_ERR, "Could not write current calibration %s", tmp);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  if (rename(tmp, cal->path)) {
+    SIMAR_LOG(LOG_ERR, "Could not replace current calibration %s", cal->path);
+    return -1;
+  }
+
+  cal->dirty = 0;
+  return 0;
+}
@@ -0,0 +1,109 @@
+/*! @file calibration.h
+ * @brief Declarations for the calibration of the outlet current channels
+ */
+
+#ifndef POWER_CALIBRATION_H
+#define POWER_CALIBRATION_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define CALIBRATION_CHANNELS 7
+// ADC codes per channel (8 bit readings) and their step (V)
+#define CALIBRATION_CODES 256
+#define CALIBRATION_STEP 0.01953125
+// Nominal sensor output at zero current (V) and sensitivity (V/A)
+#define CALIBRATION_ZERO 2.5
+#define CALIBRATION_SENSITIVITY 0.66
+// Learned offsets further than this from the nominal zero are sensor faults, not drift (V)
+#define CALIBRATION_MAX_DRIFT 0.25
+// Time an outlet must have been switched off before its readings are taken as zero current (s)
+#define CALIBRATION_SETTLE 2
+// Weight of each new zero sample, and the drift that triggers a table rebuild (V)
+#define CALIBRATION_WEIGHT 0.02
+#define CALIBRATION_REBUILD 0.002
+#define CALIBRATION_SAVE_PERIOD 600
+#define CALIBRATION_FILE "/opt/simar_calibration.dat"
+#define CALIBRATION_MAGIC 0x43414C42
+
+/*!
+ * @brief Calibration table, as stored in the calibration file
+ *
+ * @details Sensitivities are not learned; they are kept at the nominal value unless a table written
+ * at the factory provides them.
+ */
+struct calibration_record {
+  uint32_t magic;
+  uint32_t samples[CALIBRATION_CHANNELS];
+  double zero[CALIBRATION_CHANNELS];
+  double sensitivity[CALIBRATION_CHANNELS];
+};
+
+/*!
+ * @brief Current channel calibration
+ *
+ * @details The zero of each channel is an exponentially weighted average of its readings while the
+ * outlet relay is open, so it follows the drift of the sensor with temperature and age. Readings
+ * are converted through a per channel table indexed by the ADC code, rebuilt whenever the zero has
+ * moved, so the capture loop does a single load per channel.
+ */
+struct current_calibration {
+  float amps[CALIBRATION_CHANNELS][CALIBRATION_CODES];
+  struct calibration_record table;
+  double built[CALIBRATION_CHANNELS];
+  struct timespec off_since[CALIBRATION_CHANNELS];
+  uint8_t off;
+  uint8_t dirty;
+  time_t last_save;
+  const char* path;
+};
+
+/**
+ * \ingroup power
+ * @brief Loads the calibration table (or starts from the nominal values) and builds the lookup
+ * tables
+ * @param[out] cal Calibration
+ * @param[in] path Calibration file
+ * @retval 0 OK, table restored
+ * @retval -1 No valid table, nominal values in use
+ */
+int8_t calibration_init(struct current_calibration* cal, const char* path);
+
+/**
+ * \ingroup power
+ * @brief Updates the zero of the channels whose outlet has been off for CALIBRATION_SETTLE seconds
+ *
+ * @details Only updates the estimates; the lookup tables are left to calibration_apply, so the
+ * caller decides how they are shared with the capture loop.
+ *
+ * @param[in, out] cal Calibration
+ * @param[in] at Monotonic time of the readings
+ * @param[in] codes ADC code per channel
+ * @param[in] valid Bit mask of the channels with a reading
+ * @param[in] off Bit mask of the channels whose outlet relay is open
+ * @returns Bit mask of the channels whose lookup table is out of date
+ */
+uint8_t calibration_learn(struct current_calibration* cal,
+                          const struct timespec* at,
+                          const uint8_t* codes,
+                          uint8_t valid,
+                          uint8_t off);
+
+/**
+ * \ingroup power
+ * @brief Rebuilds the lookup tables of some channels from their current zero and sensitivity
+ * @param[in, out] cal Calibration
+ * @param[in] channels Bit mask of the channels
+ */
+void calibration_apply(struct current_calibration* cal, uint8_t channels);
+
+/**
+ * \ingroup power
+ * @brief Writes the calibration table if it changed, at most every CALIBRATION_SAVE_PERIOD seconds
+ * @param[in, out] cal Calibration
+ * @retval 0 OK, or nothing to write yet
+ * @retval -1 The file could not be written
+ */
+int8_t calibration_save(struct current_calibration* cal);
+
+#endif
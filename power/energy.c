@@ -0,0 +1,141 @@
+/*! @file energy.c
+ * @brief Per-outlet energy accumulation with a crash-safe checkpoint
+ */
+
+#include "energy.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+
+/**
+ * @brief Calculates the CRC-32 (IEEE) of a buffer
+ * @param[in] buf Buffer
+ * @param[in] len Buffer length
+ * @returns CRC-32
+ */
+static uint32_t crc32(const uint8_t* buf, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+
+  for (size_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int k = 0; k < 8; k++)
+      crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+  }
+
+  return ~crc;
+}
+
+/**
+ * @brief Calculates the CRC of a record, covering everything after the crc field
+ * @param[in] record Checkpoint record
+ * @returns CRC-32
+ */
+static uint32_t record_crc(const struct energy_record* record) {
+  size_t offset = offsetof(struct energy_record, sequence);
+  return crc32((const uint8_t*)record + offset, sizeof(*record) - offset);
+}
+
+int8_t energy_init(struct energy_meter* meter, const char* path) {
+  memset(meter, 0, sizeof(*meter));
+  clock_gettime(CLOCK_MONOTONIC, &meter->last_sample);
+  meter->last_checkpoint = time(NULL);
+  meter->page = sysconf(_SC_PAGESIZE);
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0 || ftruncate(fd, 2 * meter->page)) {
+    SIMAR_LOG(LOG_ERR, "Could not open energy checkpoint %s, totals will not persist", path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  void* map = mmap(NULL, 2 * meter->page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    SIMAR_LOG(LOG_ERR, "Could not map energy checkpoint %s, totals will not persist", path);
+    return -1;
+  }
+
+  meter->map = map;
+
+  const struct energy_record* latest = NULL;
+
+  for (int i = 0; i < 2; i++) {
+    const struct energy_record* record =
+        (const struct energy_record*)(meter->map + i * meter->page);
+
+    if (record->magic == ENERGY_MAGIC && record->crc == record_crc(record) &&
+        (latest == NULL || record->sequence > latest->sequence))
+      latest = record;
+  }
+
+  if (latest) {
+    memcpy(meter->total_uj, latest->total_uj, sizeof(meter->total_uj));
+    meter->sequence = latest->sequence;
+    SIMAR_LOG(LOG_NOTICE, "Energy totals restored from checkpoint %llu",
+              (unsigned long long)latest->sequence);
+  }
+
+  return 0;
+}
+
+int8_t energy_checkpoint(struct energy_meter* meter) {
+  if (meter->map == NULL)
+    return -1;
+
+  // The slot being written is never the one holding the latest commit
+  uint64_t sequence = meter->sequence + 1;
+  uint8_t* slot = meter->map + (sequence % 2) * meter->page;
+  struct energy_record* record = (struct energy_record*)slot;
+
+  record->magic = ENERGY_MAGIC;
+  record->sequence = sequence;
+  record->timestamp = time(NULL);
+  memcpy(record->total_uj, meter->total_uj, sizeof(record->total_uj));
+  record->crc = record_crc(record);
+
+  if (msync(slot, meter->page, MS_SYNC)) {
+    SIMAR_LOG(LOG_ERR, "Energy checkpoint sync failed");
+    return -1;
+  }
+
+  meter->sequence = sequence;
+  return 0;
+}
+
+void energy_update(struct energy_meter* meter,
+                   const struct timespec* at,
+                   double voltage,
+                   const double* current,
+                   uint8_t valid,
+                   double pfactor) {
+  double dt = (at->tv_sec - meter->last_sample.tv_sec) +
+              (at->tv_nsec - meter->last_sample.tv_nsec) / 1e9;
+  meter->last_sample = *at;
+
+  if (dt > 0 && dt <= ENERGY_MAX_GAP) {
+    for (int i = 0; i < ENERGY_OUTLETS; i++) {
+      double power = voltage * current[i] * pfactor;
+
+      // Negative readings are offset noise on idle outlets, not energy flowing back
+      if (valid >> i & 1 && power > 0)
+        meter->total_uj[i] += (uint64_t)(power * dt * 1e6 + 0.5);
+    }
+  }
+
+  if (time(NULL) - meter->last_checkpoint >= ENERGY_CHECKPOINT_PERIOD) {
+    energy_checkpoint(meter);
+    meter->last_checkpoint = time(NULL);
+  }
+}
+
+double energy_wh(const struct energy_meter* meter, uint8_t outlet) {
+  return meter->total_uj[outlet] / 3.6e9;
+}
@@ -0,0 +1,99 @@
+/*! @file energy.h
+ * @brief Declarations for per-outlet energy accumulation
+ */
+
+/*!
+ * @defgroup power Power
+ * @brief AC board measurement processing
+ */
+
+#ifndef POWER_ENERGY_H
+#define POWER_ENERGY_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define ENERGY_OUTLETS 7
+#define ENERGY_MAX_GAP 10
+#define ENERGY_CHECKPOINT_PERIOD 60
+#define ENERGY_CHECKPOINT "/opt/simar_energy.dat"
+#define ENERGY_MAGIC 0x454E5247
+
+/*!
+ * @brief Checkpoint slot, as stored in the checkpoint file
+ */
+struct energy_record {
+  uint32_t magic;
+  uint32_t crc;
+  uint64_t sequence;
+  int64_t timestamp;
+  uint64_t total_uj[ENERGY_OUTLETS];
+};
+
+/*!
+ * @brief Energy integrator
+ *
+ * @details Totals are kept as integer microjoules (enough for ~5e9 Wh per outlet), so adding small
+ * increments to large totals never loses precision. The checkpoint file holds two slots, each on
+ * its own page; commits alternate between them and the valid one with the highest sequence number
+ * wins on load, so a power loss mid-write only ever tears the older copy.
+ */
+struct energy_meter {
+  uint64_t total_uj[ENERGY_OUTLETS];
+  struct timespec last_sample;
+  time_t last_checkpoint;
+  uint64_t sequence;
+  uint8_t* map;
+  long page;
+};
+
+/**
+ * \ingroup power
+ * @brief Maps the checkpoint file and restores the latest committed totals
+ * @param[out] meter Energy integrator
+ * @param[in] path Checkpoint file (created if missing)
+ * @retval 0 OK (totals restored, or zeroed for a new file)
+ * @retval -1 The file could not be mapped; totals are kept in memory only
+ */
+int8_t energy_init(struct energy_meter* meter, const char* path);
+
+/**
+ * \ingroup power
+ * @brief Integrates one measurement block and checkpoints every ENERGY_CHECKPOINT_PERIOD seconds
+ *
+ * @details Blocks more than ENERGY_MAX_GAP seconds apart are not integrated, since nothing is known
+ * about the load in between.
+ *
+ * @param[in, out] meter Energy integrator
+ * @param[in] at Monotonic time of the measurement
+ * @param[in] voltage Voltage (V)
+ * @param[in] current Current per outlet (A), in ADC channel order
+ * @param[in] valid Bit mask of the outlets with a valid current reading
+ * @param[in] pfactor Power factor
+ */
+void energy_update(struct energy_meter* meter,
+                   const struct timespec* at,
+                   double voltage,
+                   const double* current,
+                   uint8_t valid,
+                   double pfactor);
+
+/**
+ * \ingroup power
+ * @brief Commits the current totals to the inactive checkpoint slot
+ * @param[in, out] meter Energy integrator
+ * @retval 0 OK
+ * @retval -1 No checkpoint file, or sync failure
+ */
+int8_t energy_checkpoint(struct energy_meter* meter);
+
+/**
+ * \ingroup power
+ * @brief Gets the accumulated energy of an outlet
+ * @param[in] meter Energy integrator
+ * @param[in] outlet Outlet, in ADC channel order
+ * @returns Energy (Wh)
+ */
+double energy_wh(const struct energy_meter* meter, uint8_t outlet);
+
+#endif
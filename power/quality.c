@@ -0,0 +1,173 @@
+/*! @file quality.c
+ * @brief Voltage sag, swell and interruption detection from half-cycle RMS values
+ */
+
+#include "quality.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "../utils/json/config.h"
+
+int8_t quality_load_config(struct quality_config* cfg, const char* path) {
+  cJSON *json, *pq, *item;
+
+  *cfg = (struct quality_config){.nominal = QUALITY_NOMINAL,
+                                 .frequency = QUALITY_FREQUENCY,
+                                 .sag = QUALITY_SAG_LEVEL,
+                                 .swell = QUALITY_SWELL_LEVEL,
+                                 .interruption = QUALITY_INTERRUPTION_LEVEL,
+                                 .hysteresis = QUALITY_HYSTERESIS};
+
+  json = config_load(path);
+
+  pq = cJSON_GetObjectItemCaseSensitive(json, "power_quality");
+
+  if (!cJSON_IsObject(pq)) {
+    cJSON_Delete(json);
+    return -1;
+  }
+
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(pq, "nominal")))
+    cfg->nominal = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(pq, "frequency")))
+    cfg->frequency = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(pq, "sag")))
+    cfg->sag = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(pq, "swell")))
+    cfg->swell = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(pq, "interruption")))
+    cfg->interruption = item->valuedouble;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(pq, "hysteresis")))
+    cfg->hysteresis = item->valuedouble;
+
+  cJSON_Delete(json);
+  return 0;
+}
+
+void quality_init(struct power_quality* pq,
+                  const struct quality_config* cfg,
+                  double rate,
+                  void (*report)(const struct quality_event* event, void* arg),
+                  void* arg) {
+  memset(pq, 0, sizeof(*pq));
+  pq->cfg = *cfg;
+  pq->report = report;
+  pq->arg = arg;
+  pq->rate = rate;
+
+  if (rate > 0) {
+    double half = rate / (2 * cfg->frequency);
+    pq->min_count = half / 2;
+    pq->max_count = half * 1.5;
+  }
+}
+
+/**
+ * @brief Gets a time offset by some seconds
+ * @param[in] t Time
+ * @param[in] seconds Offset (s, positive)
+ * @returns Offset time
+ */
+static struct timespec timespec_add(const struct timespec* t, double seconds) {
+  struct timespec r = {t->tv_sec + (time_t)seconds, t->tv_nsec};
+
+  r.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+  if (r.tv_nsec >= 1000000000L) {
+    r.tv_nsec -= 1000000000L;
+    r.tv_sec++;
+  }
+
+  return r;
+}
+
+void quality_feed(struct power_quality* pq,
+                  const float* samples,
+                  uint32_t amount,
+                  const struct timespec* first,
+                  uint8_t outlets) {
+  // The offset (e.g. an ADC biased at mid scale) follows the signal with a 1 s time constant
+  double alpha = 1 / pq->rate;
+
+  for (uint32_t i = 0; i < amount; i++) {
+    double v = samples[i] - pq->offset;
+    pq->offset += alpha * v;
+
+    uint8_t crossed = (v >= 0) != (pq->last >= 0);
+
+    if (pq->count >= pq->max_count || (pq->count >= pq->min_count && crossed)) {
+      quality_evaluate(pq, sqrt(pq->sum / pq->count), &pq->half_start, outlets);
+      pq->sum = 0;
+      pq->count = 0;
+    }
+
+    if (pq->count == 0)
+      pq->half_start = timespec_add(first, i / pq->rate);
+
+    pq->sum += v * v;
+    pq->count++;
+    pq->last = v;
+  }
+}
+
+void quality_evaluate(struct power_quality* pq,
+                      double rms,
+                      const struct timespec* at,
+                      uint8_t outlets) {
+  const struct quality_config* cfg = &pq->cfg;
+  struct quality_event* e = &pq->event;
+  double level = rms / cfg->nominal;
+  uint8_t ended;
+
+  if (e->type == QUALITY_NONE) {
+    if (level < cfg->sag)
+      e->type = level < cfg->interruption ? QUALITY_INTERRUPTION : QUALITY_SAG;
+    else if (level > cfg->swell)
+      e->type = QUALITY_SWELL;
+    else
+      return;
+
+    e->start = *at;
+    e->extreme = rms;
+    e->outlets = outlets;
+    return;
+  }
+
+  if (e->type == QUALITY_SWELL) {
+    ended = level < cfg->swell - cfg->hysteresis;
+    if (!ended && rms > e->extreme)
+      e->extreme = rms;
+  } else {
+    ended = level > cfg->sag + cfg->hysteresis;
+    if (!ended && rms < e->extreme)
+      e->extreme = rms;
+    if (!ended && level < cfg->interruption)
+      e->type = QUALITY_INTERRUPTION;
+  }
+
+  if (!ended) {
+    e->outlets |= outlets;
+    return;
+  }
+
+  e->duration = (at->tv_sec - e->start.tv_sec) + (at->tv_nsec - e->start.tv_nsec) / 1e9;
+  e->depth = fabs(cfg->nominal - e->extreme) / cfg->nominal;
+  pq->report(e, pq->arg);
+  e->type = QUALITY_NONE;
+
+  // The value ending an event may start the opposite one
+  quality_evaluate(pq, rms, at, outlets);
+}
+
+const char* quality_type_name(enum quality_type type) {
+  switch (type) {
+    case QUALITY_SAG:
+      return "sag";
+    case QUALITY_SWELL:
+      return "swell";
+    case QUALITY_INTERRUPTION:
+      return "interruption";
+    default:
+      return "none";
+  }
+}
@@ -0,0 +1,145 @@
+/*! @file quality.h
+ * @brief Declarations for voltage sag, swell and interruption detection
+ */
+
+#ifndef POWER_QUALITY_H
+#define POWER_QUALITY_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define QUALITY_CONFIG "/opt/device.json"
+// Defaults, as fractions of the nominal voltage (IEC 61000-4-30 style thresholds)
+#define QUALITY_NOMINAL 220
+#define QUALITY_FREQUENCY 60
+#define QUALITY_SAG_LEVEL 0.9
+#define QUALITY_SWELL_LEVEL 1.1
+#define QUALITY_INTERRUPTION_LEVEL 0.1
+#define QUALITY_HYSTERESIS 0.02
+
+/*!
+ * @brief Event types
+ */
+enum quality_type { QUALITY_NONE, QUALITY_SAG, QUALITY_SWELL, QUALITY_INTERRUPTION };
+
+/*!
+ * @brief Power quality event, reported once it ends
+ *
+ * @details `extreme` is the lowest (sags, interruptions) or highest (swells) RMS voltage, `depth`
+ * its distance to the nominal voltage as a fraction of it, and `outlets` the outlets energized at
+ * any point of the event.
+ */
+struct quality_event {
+  enum quality_type type;
+  struct timespec start;
+  double duration;
+  double extreme;
+  double depth;
+  uint8_t outlets;
+};
+
+/*!
+ * @brief Thresholds, from the `"power_quality"` object of the device configuration
+ */
+struct quality_config {
+  double nominal;
+  double frequency;
+  double sag;
+  double swell;
+  double interruption;
+  double hysteresis;
+};
+
+/*!
+ * @brief Sag, swell and interruption detector
+ *
+ * @details Two stages, both in constant memory:
+ * - Half-cycle RMS: squares are summed from one zero crossing of the waveform to the next. A
+ *   crossing only counts after half the expected half-cycle, so noise around zero does not split
+ *   it, and a half-cycle is closed after 1.5 times the expected length even without a crossing,
+ *   so a collapsed waveform still yields RMS values.
+ * - Evaluation: every RMS value is checked against the thresholds. An event starts when the
+ *   value crosses a threshold and ends once it is back past the threshold plus the hysteresis; a
+ *   dip reaching the interruption threshold is reported as an interruption.
+ */
+struct power_quality {
+  struct quality_config cfg;
+  void (*report)(const struct quality_event* event, void* arg);
+  void* arg;
+
+  // Half-cycle RMS
+  double rate;
+  double offset;
+  double sum;
+  double last;
+  uint32_t count;
+  uint32_t min_count;
+  uint32_t max_count;
+  struct timespec half_start;
+
+  // Evaluation
+  struct quality_event event;
+};
+
+/**
+ * \ingroup power
+ * @brief Loads the thresholds, falling back to the defaults for anything not configured
+ * @param[out] cfg Thresholds
+ * @param[in] path Device configuration
+ * @retval 0 OK
+ * @retval -1 No `"power_quality"` object, defaults in use
+ */
+int8_t quality_load_config(struct quality_config* cfg, const char* path);
+
+/**
+ * \ingroup power
+ * @brief Initializes a detector
+ * @param[out] pq Detector
+ * @param[in] cfg Thresholds
+ * @param[in] rate Waveform sample rate (Hz), 0 if only RMS values are evaluated
+ * @param[in] report Called with every event, once it ends
+ * @param[in] arg Passed to report
+ */
+void quality_init(struct power_quality* pq,
+                  const struct quality_config* cfg,
+                  double rate,
+                  void (*report)(const struct quality_event* event, void* arg),
+                  void* arg);
+
+/**
+ * \ingroup power
+ * @brief Feeds waveform samples, evaluating every half-cycle completed
+ * @param[in, out] pq Detector
+ * @param[in] samples Instantaneous voltage (V)
+ * @param[in] amount Samples
+ * @param[in] first Time of the first sample
+ * @param[in] outlets Bit mask of the energized outlets
+ */
+void quality_feed(struct power_quality* pq,
+                  const float* samples,
+                  uint32_t amount,
+                  const struct timespec* first,
+                  uint8_t outlets);
+
+/**
+ * \ingroup power
+ * @brief Evaluates one RMS value
+ * @param[in, out] pq Detector
+ * @param[in] rms RMS voltage (V)
+ * @param[in] at Start of the interval the value covers
+ * @param[in] outlets Bit mask of the energized outlets
+ */
+void quality_evaluate(struct power_quality* pq,
+                      double rms,
+                      const struct timespec* at,
+                      uint8_t outlets);
+
+/**
+ * \ingroup power
+ * @brief Gets the name of an event type
+ * @param[in] type Event type
+ * @returns Name
+ */
+const char* quality_type_name(enum quality_type type);
+
+#endif
@@ -0,0 +1,461 @@
+/*! @file common.c
+ * @brief Common functions for Redis connections and server sharding
+ */
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log/log.h"
+
+const char redis_servers[12][SERVER_LEN] = {
+    "10.0.38.59",    "10.0.38.46",    "10.0.38.42",    "10.128.153.81",
+    "10.128.153.82", "10.128.153.83", "10.128.153.84", "10.128.153.85",
+    "10.128.153.86", "10.128.153.87", "10.128.153.88", "10.128.255.5"};
+
+uint32_t ring_hash(const char* key) {
+  uint32_t h = 2166136261u;
+
+  while (*key) {
+    h ^= (uint8_t)*key++;
+    h *= 16777619u;
+  }
+
+  // FNV-1a alone clusters for keys that only differ in their last characters (IPs, "#n" suffixes)
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+
+  return h;
+}
+
+static int compare_points(const void* a, const void* b) {
+  uint32_t ha = ((const struct ring_point*)a)->hash;
+  uint32_t hb = ((const struct ring_point*)b)->hash;
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+int8_t ring_init(struct redis_ring* ring, const char (*servers)[SERVER_LEN], uint8_t amount) {
+  char vnode[SERVER_LEN + 8];
+
+  if (amount == 0 || amount > RING_MAX_SERVERS)
+    return -1;
+
+  ring->servers = servers;
+  ring->server_amount = amount;
+  ring->point_amount = 0;
+  memset(ring->down, 0, sizeof(ring->down));
+
+  for (uint8_t i = 0; i < amount; i++) {
+    for (int j = 0; j < RING_VNODES; j++) {
+      snprintf(vnode, sizeof(vnode), "%s#%d", servers[i], j);
+      ring->points[ring->point_amount].hash = ring_hash(vnode);
+      ring->points[ring->point_amount++].server = i;
+    }
+  }
+
+  qsort(ring->points, ring->point_amount, sizeof(struct ring_point), compare_points);
+
+  return 0;
+}
+
+int ring_lookup(const struct redis_ring* ring,
+                const char* key,
+                uint8_t replica,
+                uint8_t skip_down) {
+  uint32_t h = ring_hash(key);
+  uint8_t seen[RING_MAX_SERVERS] = {0};
+  int lo = 0, hi = ring->point_amount;
+
+  // First virtual node clockwise from the key
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ring->points[mid].hash < h)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (int i = 0; i < ring->point_amount; i++) {
+    uint8_t server = ring->points[(lo + i) % ring->point_amount].server;
+
+    if (seen[server] || (skip_down && ring->down[server]))
+      continue;
+
+    seen[server] = 1;
+    if (replica-- == 0)
+      return server;
+  }
+
+  return -1;
+}
+
+int ring_server_addr(const char* server, char* host) {
+  const char* port = strchr(server, ':');
+  size_t len = port ? (size_t)(port - server) : strlen(server);
+
+  if (len >= SERVER_LEN)
+    len = SERVER_LEN - 1;
+
+  memcpy(host, server, len);
+  host[len] = '\0';
+
+  return port ? atoi(port + 1) : REDIS_PORT;
+}
+
+/**
+ * @brief Connects to a single server of the ring, updating its down mark
+ * @param[in, out] ring Hash ring
+ * @param[in] server Server index
+ * @param[in] timeout Connection timeout
+ * @returns Connected context, or NULL if unreachable
+ */
+static redisContext* ring_connect_server(struct redis_ring* ring,
+                                         int server,
+                                         struct timeval timeout) {
+  char host[SERVER_LEN];
+  int port = ring_server_addr(ring->servers[server], host);
+  redisContext* c = redisConnectWithTimeout(host, port, timeout);
+
+  if (c == NULL || c->err) {
+    SIMAR_LOG(LOG_ERR, "%s remote Redis server not available, switching...\n",
+              ring->servers[server]);
+    redisFree(c);
+    ring->down[server] = 1;
+    return NULL;
+  }
+
+  ring->down[server] = 0;
+  return c;
+}
+
+redisContext* ring_connect(struct redis_ring* ring,
+                           const char* key,
+                           struct timeval timeout,
+                           uint8_t replicas,
+                           int* server) {
+  uint8_t tried[RING_MAX_SERVERS] = {0};
+  redisContext* c;
+
+  // Replicas are tried in ring order, primary owner first: those marked down are skipped on the
+  // first pass, and only retried (down marks being hints) once every other replica failed
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    for (uint8_t replica = 0; replica < replicas && replica < ring->server_amount; replica++) {
+      int candidate = ring_lookup(ring, key, replica, 0);
+
+      if (candidate < 0)
+        break;
+
+      if (tried[candidate] || (pass == 0 && ring->down[candidate]))
+        continue;
+
+      tried[candidate] = 1;
+
+      if ((c = ring_connect_server(ring, candidate, timeout)) != NULL) {
+        if (replica > 0)
+          SIMAR_LOG(LOG_NOTICE, "Failed over to %s (replica %d)", ring->servers[candidate],
+                    replica);
+        if (server != NULL)
+          *server = candidate;
+        return c;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int8_t ring_failback(struct redis_ring* ring,
+                     const char* key,
+                     redisContext** c,
+                     int* server,
+                     struct timeval timeout) {
+  int primary = ring_lookup(ring, key, 0, 0);
+  redisContext* primary_c;
+
+  if (primary < 0 || primary == *server)
+    return 0;
+
+  if ((primary_c = ring_connect_server(ring, primary, timeout)) == NULL)
+    return 0;
+
+  SIMAR_LOG(LOG_NOTICE, "%s is reachable again, moving back from %s", ring->servers[primary],
+            ring->servers[*server]);
+
+  redisFree(*c);
+  *c = primary_c;
+  *server = primary;
+
+  return 1;
+}
+
+int8_t redis_drain(redisContext* c, int pending) {
+  redisReply* reply;
+  int8_t ret = 0;
+
+  while (pending-- > 0) {
+    if (redisGetReply(c, (void**)&reply) != REDIS_OK || reply == NULL)
+      return -1;
+
+    if (reply->type == REDIS_REPLY_ERROR)
+      ret = -1;
+
+    freeReplyObject(reply);
+  }
+
+  return ret;
+}
+
+int append_bme_sensor(redisContext* c,
+                      const char* name,
+                      double temperature,
+                      double pressure,
+                      double humidity,
+                      uint8_t is_open,
+                      double average,
+                      double open_average) {
+  return redisAppendCommand(c,
+                            "HSET %s temperature %.3f pressure %.3f humidity %.3f open %d avg %.3f "
+                            "openavg %.3f",
+                            name, temperature, pressure, humidity, is_open, average,
+                            open_average) == REDIS_OK;
+}
+
+int append_sht_sensor(redisContext* c, const char* name, double temperature, double humidity) {
+  return redisAppendCommand(c, "HSET %s temperature %.3f humidity %.3f", name, temperature,
+                            humidity) == REDIS_OK;
+}
+
+int append_volt(redisContext* c,
+                double voltage,
+                const double* current,
+                uint8_t valid,
+                double pfactor,
+                uint32_t glitch,
+                uint32_t frequency) {
+  const char* argv[2 + OUTLET_QUANTITY * 2];
+  size_t argvlen[2 + OUTLET_QUANTITY * 2];
+  char fields[OUTLET_QUANTITY][2], values[OUTLET_QUANTITY][16];
+  int argc = 2, appended = 0;
+
+  if (voltage != 0.0)
+    appended += redisAppendCommand(c, "SET volt %.3f", voltage) == REDIS_OK;
+
+  argv[0] = "HSET";
+  argv[1] = "ich";
+
+  // Outlets are numbered in the opposite order of the ADC channels
+  for (int i = 0; i < OUTLET_QUANTITY; i++) {
+    if (!(valid >> i & 1))
+      continue;
+
+    snprintf(fields[i], sizeof(fields[i]), "%d", OUTLET_QUANTITY - 1 - i);
+    snprintf(values[i], sizeof(values[i]), "%.3f", current[i]);
+    argv[argc] = fields[i];
+    argvlen[argc++] = strlen(fields[i]);
+    argv[argc] = values[i];
+    argvlen[argc++] = strlen(values[i]);
+  }
+
+  argvlen[0] = 4;
+  argvlen[1] = 3;
+
+  if (argc > 2)
+    appended += redisAppendCommandArgv(c, argc, argv, argvlen) == REDIS_OK;
+
+  appended += redisAppendCommand(c, "SET pfactor %.3f", pfactor) == REDIS_OK;
+  appended += redisAppendCommand(c, "SET glitch %d", glitch) == REDIS_OK;
+
+  if (frequency > 0)
+    appended += redisAppendCommand(c, "SET frequency %d", frequency) == REDIS_OK;
+
+  return appended;
+}
+
+int append_alert(redisContext* c,
+                 const char* name,
+                 uint8_t active,
+                 double temperature,
+                 double humidity) {
+  int appended = 0;
+
+  appended += redisAppendCommand(c, "HSET %s alert %d", name, active) == REDIS_OK;
+  appended += redisAppendCommand(c, "PUBLISH alerts %s:%d:%.3f:%.3f", name, active, temperature,
+                                 humidity) == REDIS_OK;
+
+  return appended;
+}
+
+int append_energy(redisContext* c, const double* energy) {
+  // Outlets are numbered in the opposite order of the ADC channels
+  return redisAppendCommand(c, "HSET energy 0 %.4f 1 %.4f 2 %.4f 3 %.4f 4 %.4f 5 %.4f 6 %.4f",
+                            energy[6], energy[5], energy[4], energy[3], energy[2], energy[1],
+                            energy[0]) == REDIS_OK;
+}
+
+int append_power_event(redisContext* c,
+                       const char* type,
+                       double start,
+                       double duration,
+                       double extreme,
+                       double depth,
+                       uint8_t outlets) {
+  int appended = 0;
+
+  appended += redisAppendCommand(c, "HSET power_quality %s %.3f:%.3f:%.1f:%.3f:%u", type, start,
+                                 duration, extreme, depth, outlets) == REDIS_OK;
+  appended += redisAppendCommand(c, "PUBLISH power_events %s:%.3f:%.3f:%.1f:%.3f:%u", type, start,
+                                 duration, extreme, depth, outlets) == REDIS_OK;
+
+  return appended;
+}
+
+/// ARGV: see sweep_script_load
+static const char sweep_script[] =
+    "local stamp, ttl, keep, reference = ARGV[1], tonumber(ARGV[2]), tonumber(ARGV[3]), ARGV[4] "
+    "if reference ~= '' then redis.call('SET', 'last_ext_pressure', reference) end "
+    "for i = 5, #ARGV, 8 do "
+    "  local name, t, h, p, alert = ARGV[i], ARGV[i + 1], ARGV[i + 2], ARGV[i + 3], ARGV[i + 7] "
+    "  local sample = stamp .. ':' .. t .. ':' .. h "
+    "  if p ~= '' then "
+    "    redis.call('HSET', name, 'temperature', t, 'pressure', p, 'humidity', h, "
+    "               'open', ARGV[i + 4], 'avg', ARGV[i + 5], 'openavg', ARGV[i + 6]) "
+    "    sample = sample .. ':' .. p "
+    "  else "
+    "    redis.call('HSET', name, 'temperature', t, 'humidity', h) "
+    "  end "
+    "  if alert ~= '' then "
+    "    redis.call('HSET', name, 'alert', alert) "
+    "    redis.call('PUBLISH', 'alerts', name .. ':' .. alert .. ':' .. t .. ':' .. h) "
+    "  else "
+    "    redis.call('RPUSH', name .. ':history', sample) "
+    "    redis.call('LTRIM', name .. ':history', -keep, -1) "
+    "  end "
+    "  if ttl > 0 then redis.call('EXPIRE', name, ttl) end "
+    "end "
+    "return (#ARGV - 4) / 8";
+
+int8_t sweep_script_load(redisContext* c, char* sha) {
+  redisReply* reply = redisCommand(c, "SCRIPT LOAD %s", sweep_script);
+  int8_t rslt = -1;
+
+  if (reply != NULL && reply->type == REDIS_REPLY_STRING && reply->len == SWEEP_SHA_LEN - 1) {
+    memcpy(sha, reply->str, SWEEP_SHA_LEN);
+    rslt = 0;
+  } else if (reply != NULL && reply->type == REDIS_REPLY_ERROR) {
+    SIMAR_LOG(LOG_ERR, "Sweep script rejected: %s", reply->str);
+  }
+
+  freeReplyObject(reply);
+  return rslt;
+}
+
+int append_sweep_script(redisContext* c,
+                        const char* sha,
+                        int argc,
+                        const char** argv,
+                        size_t* argvlen) {
+  argv[0] = "EVALSHA";
+  argvlen[0] = 7;
+  argv[1] = sha;
+  argvlen[1] = SWEEP_SHA_LEN - 1;
+  argv[2] = "0";
+  argvlen[2] = 1;
+
+  return redisAppendCommandArgv(c, argc, argv, argvlen) == REDIS_OK;
+}
+
+int append_wireless(redisContext* c,
+                    int id,
+                    double temperature,
+                    double pressure,
+                    double humidity,
+                    int expiry) {
+  int appended = 0;
+
+  appended += redisAppendCommand(c, "SET wgen%d_temperature %.3f EX %d", id, temperature,
+                                 expiry) == REDIS_OK;
+  appended +=
+      redisAppendCommand(c, "SET wgen%d_pressure %.3f EX %d", id, pressure, expiry) == REDIS_OK;
+  appended +=
+      redisAppendCommand(c, "SET wgen%d_humidity %.3f EX %d", id, humidity, expiry) == REDIS_OK;
+
+  return appended;
+}
+
+int append_wireless_batch(redisContext* c, int id, const uint8_t* batch, size_t len) {
+  int appended = 0;
+
+  appended += redisAppendCommand(c, "RPUSH wgen%d_batches %b", id, batch, len) == REDIS_OK;
+  appended +=
+      redisAppendCommand(c, "LTRIM wgen%d_batches -%d -1", id, WIRELESS_BATCHES) == REDIS_OK;
+
+  return appended;
+}
+
+int append_wireless_power(redisContext* c, int id, double wakeups, double cpu) {
+  return redisAppendCommand(c, "HSET wgen%d_power wakeups_per_min %.1f cpu_ms_per_min %.1f", id,
+                            wakeups, cpu) == REDIS_OK;
+}
+
+int append_command_poll(redisContext* c, const char* name) {
+  int appended = 0;
+
+  appended += redisAppendCommand(c, "HMGET %s 0 1 2 3 4 5 6", name) == REDIS_OK;
+  appended += redisAppendCommand(c, "HMGET %s:RB 0 1 2 3 4 5 6", name) == REDIS_OK;
+
+  return appended;
+}
+
+/// ARGV: node identity, preferred ID, highest ID, TTL (s)
+static const char lease_script[] =
+    "local node, preferred, max, ttl = ARGV[1], tonumber(ARGV[2]), tonumber(ARGV[3]), ARGV[4] "
+    "for id = 1, max do "
+    "  if redis.call('GET', 'wgen:id:' .. id) == node then "
+    "    redis.call('SET', 'wgen:id:' .. id, node, 'EX', ttl) return id end "
+    "end "
+    "if preferred >= 1 and preferred <= max and "
+    "   redis.call('SET', 'wgen:id:' .. preferred, node, 'NX', 'EX', ttl) then "
+    "  return preferred end "
+    "for id = 1, max do "
+    "  if redis.call('SET', 'wgen:id:' .. id, node, 'NX', 'EX', ttl) then return id end "
+    "end "
+    "return -1";
+
+int wireless_lease(redisContext* c, const char* node, int preferred) {
+  redisReply* reply = redisCommand(c, "EVAL %s 0 %s %d %d %d", lease_script, node, preferred,
+                                   WIRELESS_MAX_ID, WIRELESS_LEASE_TTL);
+  int id = reply != NULL && reply->type == REDIS_REPLY_INTEGER ? reply->integer : -1;
+
+  if (reply != NULL && reply->type == REDIS_REPLY_ERROR)
+    SIMAR_LOG(LOG_ERR, "Wireless ID lease failed: %s", reply->str);
+
+  freeReplyObject(reply);
+  return id;
+}
+
+int append_lease(redisContext* c, int id, const char* node, int ttl) {
+  return redisAppendCommand(c, "EVAL %s 1 wgen:id:%d %s %d", LEASE_RENEWAL_SCRIPT, id, node,
+                            ttl) == REDIS_OK;
+}
+
+int8_t read_renewal(redisContext* c) {
+  redisReply* reply;
+  int8_t ret = -1;
+
+  if (redisGetReply(c, (void**)&reply) != REDIS_OK || reply == NULL)
+    return -1;
+
+  if (reply->type == REDIS_REPLY_INTEGER)
+    ret = reply->integer == 1;
+  else if (reply->type == REDIS_REPLY_ERROR)
+    SIMAR_LOG(LOG_ERR, "Wireless ID lease renewal failed: %s", reply->str);
+
+  freeReplyObject(reply);
+  return ret;
+}
@@ -0,0 +1,416 @@
+/*! @file common.h
+ * @brief Common declarations for Redis connections and server sharding
+ */
+
+/*!
+ * @defgroup redis Redis
+ * @brief Central Redis server selection (consistent hashing) and connection handling
+ */
+
+#ifndef REDIS_COMMON_H
+#define REDIS_COMMON_H
+
+#include <hiredis/hiredis.h>
+#include <stdint.h>
+
+#define REDIS_PORT 6379
+#define SERVER_LEN 16
+#define RING_MAX_SERVERS 16
+#define RING_VNODES 160
+#define RING_REPLICAS 3
+#define RING_FAILBACK_PERIOD 60
+#define OUTLET_QUANTITY 7
+// Every wireless key (readouts and ID leases) lives on the owner of this ring key
+#define WIRELESS_KEY "wgen"
+#define WIRELESS_MAX_ID 98
+#define WIRELESS_LEASE_TTL 30
+// Lease renewal (KEYS: lease; ARGV: node identity, TTL): only extended while it holds this node
+#define LEASE_RENEWAL_SCRIPT                                                                     \
+  "if redis.call('GET', KEYS[1]) == ARGV[1] then return redis.call('EXPIRE', KEYS[1], ARGV[2]) " \
+  "end return 0"
+// Expiry of the latest wireless readouts (s), on top of the interval between batches when batched,
+// and batches kept per node in its `wgen<ID>_batches` list
+#define WIRELESS_EXPIRY 5
+#define WIRELESS_BATCHES 120
+// Sweep script: leading command arguments (EVALSHA, SHA1, key count), arguments per sweep and per
+// readout, and the defaults for the expiry of the sensor hashes (s) and the history length
+#define SWEEP_COMMAND_ARGS 3
+#define SWEEP_ARGS 4
+#define SWEEP_READOUT_ARGS 8
+#define SWEEP_SHA_LEN 41
+#define SWEEP_TTL 600
+#define SWEEP_HISTORY 360
+
+/// Central Redis servers, shared by every module that writes to or reads from them
+extern const char redis_servers[12][SERVER_LEN];
+
+/*!
+ * @brief Virtual node in the hash ring
+ */
+struct ring_point {
+  uint32_t hash;
+  uint8_t server;
+};
+
+/*!
+ * @brief Consistent hash ring over a list of servers ("host" or "host:port")
+ *
+ * @details Each server is placed RING_VNODES times around the ring, so removing one only moves
+ * the keys it owned (to the next distinct server clockwise), while the others keep theirs.
+ */
+struct redis_ring {
+  const char (*servers)[SERVER_LEN];
+  uint8_t server_amount;
+  uint8_t down[RING_MAX_SERVERS];
+  struct ring_point points[RING_MAX_SERVERS * RING_VNODES];
+  uint16_t point_amount;
+};
+
+/**
+ * \ingroup redis
+ * \defgroup redisRing Sharding
+ * @brief Consistent hashing of nodes across central servers
+ */
+
+/**
+ * \ingroup redisRing
+ * @brief 32-bit FNV-1a hash with a murmur3 finalizer, used for ring placement
+ * @param[in] key Null-terminated key
+ * @returns Hash value
+ */
+uint32_t ring_hash(const char* key);
+
+/**
+ * \ingroup redisRing
+ * @brief Builds the hash ring for a server list
+ * @param[out] ring Ring to initialize
+ * @param[in] servers Server list
+ * @param[in] amount Number of servers (at most RING_MAX_SERVERS)
+ * @retval 0 OK
+ * @retval -1 Invalid server amount
+ */
+int8_t ring_init(struct redis_ring* ring, const char (*servers)[SERVER_LEN], uint8_t amount);
+
+/**
+ * \ingroup redisRing
+ * @brief Finds the server responsible for a key
+ * @param[in] ring Hash ring
+ * @param[in] key Key to place (device name)
+ * @param[in] replica 0 for the primary owner, n for the n-th distinct failover server
+ * @param[in] skip_down Whether servers marked as down are skipped
+ * @returns Server index
+ * @retval -1 No such replica
+ */
+int ring_lookup(const struct redis_ring* ring,
+                const char* key,
+                uint8_t replica,
+                uint8_t skip_down);
+
+/**
+ * \ingroup redisRing
+ * @brief Splits a server entry into host and port
+ * @param[in] server Server entry ("host" or "host:port")
+ * @param[out] host Host buffer (at least SERVER_LEN bytes)
+ * @returns Port
+ */
+int ring_server_addr(const char* server, char* host);
+
+/**
+ * \ingroup redisRing
+ * @brief Connects to the first reachable server for a key, walking its replicas in ring order
+ *
+ * @details Unreachable servers are marked as down, and reachable ones as up again. Replicas marked
+ * down are only tried after every other one failed, so a dead primary does not cost a connection
+ * timeout on every reconnection; ring_failback moves back to it once it is reachable again.
+ *
+ * @param[in, out] ring Hash ring
+ * @param[in] key Key to place (device name)
+ * @param[in] timeout Connection timeout
+ * @param[in] replicas Number of distinct servers to try (RING_REPLICAS, or all of them)
+ * @param[out] server Index of the connected server (may be NULL)
+ * @returns Connected context, or NULL if no replica is reachable
+ */
+redisContext* ring_connect(struct redis_ring* ring,
+                           const char* key,
+                           struct timeval timeout,
+                           uint8_t replicas,
+                           int* server);
+
+/**
+ * \ingroup redisRing
+ * @brief Moves a failed over connection back to the primary owner when it becomes reachable
+ * @param[in, out] ring Hash ring
+ * @param[in] key Key to place (device name)
+ * @param[in, out] c Current context, replaced (and the old one freed) on failback
+ * @param[in, out] server Index of the current server
+ * @param[in] timeout Connection timeout
+ * @retval 1 Moved back to the primary owner
+ * @retval 0 Nothing changed
+ */
+int8_t ring_failback(struct redis_ring* ring,
+                     const char* key,
+                     redisContext** c,
+                     int* server,
+                     struct timeval timeout);
+
+/**
+ * \ingroup redis
+ * \defgroup redisPublish Publishing
+ * @brief Commands shared by the daemons and the fleet load simulator
+ *
+ * @details Commands are only appended to the context's output buffer, so a whole sweep leaves in a
+ * single write. Replies are collected afterwards with redis_drain(). Every function returns the
+ * number of commands appended (that is, the number of replies to wait for).
+ */
+
+/**
+ * \ingroup redisPublish
+ * @brief Reads and discards pending replies
+ * @param[in] c Redis context
+ * @param[in] pending Number of replies to wait for
+ * @retval 0 OK
+ * @retval -1 Connection failure or error reply
+ */
+int8_t redis_drain(redisContext* c, int pending);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends a BMx sensor readout, including door status (bme)
+ * @param[in] c Redis context
+ * @param[in] name Sensor name (hash key)
+ * @param[in] temperature Temperature (°C)
+ * @param[in] pressure Pressure (hPa)
+ * @param[in] humidity Relative humidity (%)
+ * @param[in] is_open Door status
+ * @param[in] average Closed door pressure moving average
+ * @param[in] open_average Open door pressure moving average
+ * @returns Commands appended
+ */
+int append_bme_sensor(redisContext* c,
+                      const char* name,
+                      double temperature,
+                      double pressure,
+                      double humidity,
+                      uint8_t is_open,
+                      double average,
+                      double open_average);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends an SHT3x sensor readout (bme)
+ * @param[in] c Redis context
+ * @param[in] name Sensor name (hash key)
+ * @param[in] temperature Temperature (°C)
+ * @param[in] humidity Relative humidity (%)
+ * @returns Commands appended
+ */
+int append_sht_sensor(redisContext* c, const char* name, double temperature, double humidity);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends an AC board measurement block (volt)
+ * @param[in] c Redis context
+ * @param[in] voltage Voltage (V), skipped if 0
+ * @param[in] current Current per outlet (A), in ADC channel order
+ * @param[in] valid Bit mask of the outlets with a valid current reading
+ * @param[in] pfactor Power factor
+ * @param[in] glitch Glitch count
+ * @param[in] frequency Frequency (Hz), skipped if 0
+ * @returns Commands appended
+ */
+int append_volt(redisContext* c,
+                double voltage,
+                const double* current,
+                uint8_t valid,
+                double pfactor,
+                uint32_t glitch,
+                uint32_t frequency);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends a sensor alert state change, also published on the "alerts" channel as
+ * `<name>:<flags>:<temperature>:<humidity>` (bme)
+ * @param[in] c Redis context
+ * @param[in] name Sensor name (hash key)
+ * @param[in] active Active alert flags (0 once every alert cleared)
+ * @param[in] temperature Temperature (°C)
+ * @param[in] humidity Relative humidity (%)
+ * @returns Commands appended
+ */
+int append_alert(redisContext* c,
+                 const char* name,
+                 uint8_t active,
+                 double temperature,
+                 double humidity);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends the accumulated energy per outlet (volt)
+ * @param[in] c Redis context
+ * @param[in] energy Energy per outlet (Wh), in ADC channel order (OUTLET_QUANTITY values)
+ * @returns Commands appended
+ */
+int append_energy(redisContext* c, const double* energy);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends a power quality event (volt): stored as the last event of its type and published
+ * on `power_events` as `<type>:<start>:<duration>:<extreme>:<depth>:<outlets>`
+ * @param[in] c Redis context
+ * @param[in] type Event type name
+ * @param[in] start Start (Unix time, s)
+ * @param[in] duration Duration (s)
+ * @param[in] extreme Lowest or highest RMS voltage (V)
+ * @param[in] depth Distance of the extreme to the nominal voltage, as a fraction of it
+ * @param[in] outlets Bit mask of the outlets energized during the event (bit i: outlet i)
+ * @returns Commands appended
+ */
+int append_power_event(redisContext* c,
+                       const char* type,
+                       double start,
+                       double duration,
+                       double extreme,
+                       double depth,
+                       uint8_t outlets);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends a wireless node readout (wireless)
+ * @param[in] c Redis context
+ * @param[in] id Wireless node ID
+ * @param[in] temperature Temperature (°C)
+ * @param[in] pressure Pressure (hPa)
+ * @param[in] humidity Relative humidity (%)
+ * @param[in] expiry Expiry (s)
+ * @returns Commands appended
+ */
+int append_wireless(redisContext* c,
+                    int id,
+                    double temperature,
+                    double pressure,
+                    double humidity,
+                    int expiry);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends a batch of wireless node readouts to its `wgen<ID>_batches` list (wireless)
+ *
+ * @details The batch is delta encoded (codec/delta.h: time, temperature, pressure, humidity). The
+ * list keeps the latest WIRELESS_BATCHES batches; the latest readout itself goes through
+ * append_wireless, so readers of the `wgen<ID>_*` keys need not decode anything.
+ *
+ * @param[in] c Redis context
+ * @param[in] id Wireless node ID
+ * @param[in] batch Encoded batch
+ * @param[in] len Batch length
+ * @returns Commands appended
+ */
+int append_wireless_batch(redisContext* c, int id, const uint8_t* batch, size_t len);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends the power figures of a wireless node (`HSET wgen<ID>_power`, wireless)
+ * @param[in] c Redis context
+ * @param[in] id Wireless node ID
+ * @param[in] wakeups CPU wake-ups per minute (voluntary context switches of every thread)
+ * @param[in] cpu CPU time per minute (ms)
+ * @returns Commands appended
+ */
+int append_wireless_power(redisContext* c, int id, double wakeups, double cpu);
+
+/**
+ * \ingroup redisPublish
+ * @brief Loads the sweep script (`SCRIPT LOAD`), which publishes a whole bme sweep at once
+ *
+ * @details The script does, atomically and server-side, what the separate commands would: for
+ * every readout, `HSET` of its hash (and of its alert, which is also published on `alerts`), an
+ * expiry on the hash, and an entry in its `<sensor>:history` list, trimmed to the history length.
+ * Alert readouts only refresh the hash, so they do not add history entries. A reference pressure,
+ * if given, is stored in `last_ext_pressure`.
+ *
+ * Script arguments (after the SWEEP_COMMAND_ARGS command arguments): time (Unix, s), expiry (s, 0
+ * for none), history length, reference pressure (empty for none), then for every readout: sensor,
+ * temperature, humidity, pressure, door open, average, open average (the last four empty for
+ * SHT3x sensors) and alert state (empty if it did not change).
+ *
+ * @param[in] c Redis context
+ * @param[out] sha Script SHA1, for append_sweep (SWEEP_SHA_LEN bytes)
+ * @retval 0 OK
+ * @retval -1 The server rejected the script, or is unreachable
+ */
+int8_t sweep_script_load(redisContext* c, char* sha);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends a sweep as a single `EVALSHA` of the sweep script
+ * @param[in] c Redis context
+ * @param[in] sha Script SHA1
+ * @param[in] argc Arguments, SWEEP_COMMAND_ARGS included
+ * @param[in, out] argv Arguments; the first SWEEP_COMMAND_ARGS ones are set here
+ * @param[in, out] argvlen Argument lengths; same
+ * @returns Commands appended
+ */
+int append_sweep_script(redisContext* c,
+                        const char* sha,
+                        int argc,
+                        const char** argv,
+                        size_t* argvlen);
+
+/**
+ * \ingroup redisPublish
+ * @brief Appends the outlet command poll: requested states, then last applied states (volt)
+ * @param[in] c Redis context
+ * @param[in] name Device name
+ * @returns Commands appended
+ */
+int append_command_poll(redisContext* c, const char* name);
+
+/**
+ * \ingroup redis
+ * \defgroup redisLease Wireless ID leases
+ * @brief Collision-free wireless node IDs, held as `wgen:id:<ID>` keys with a TTL
+ */
+
+/**
+ * \ingroup redisLease
+ * @brief Leases a wireless node ID in a single round trip
+ *
+ * @details Runs server-side as one script, so concurrent nodes can never get the same ID. In order
+ * of preference: the ID this node already holds (e.g. after a restart), the preferred ID, then the
+ * lowest free one.
+ *
+ * @param[in] c Redis context (owner of WIRELESS_KEY)
+ * @param[in] node Node identity (lease value)
+ * @param[in] preferred Preferred ID (0 for none)
+ * @returns Leased ID, or -1 if none is free or the server is unreachable
+ */
+int wireless_lease(redisContext* c, const char* node, int preferred);
+
+/**
+ * \ingroup redisLease
+ * @brief Appends the renewal of a wireless ID lease (wireless)
+ *
+ * @details A compare-and-set: the lease is only extended while it still holds this node. If it
+ * expired (the node being offline for longer than the TTL) and another node took the ID meanwhile,
+ * it is left alone, and read_renewal() reports it lost so that the node leases another ID. The
+ * renewal is sent on its own, ahead of anything written under the ID.
+ *
+ * @param[in] c Redis context
+ * @param[in] id Leased ID
+ * @param[in] node Node identity
+ * @param[in] ttl Lease time (s), at least WIRELESS_LEASE_TTL and three renewals long
+ * @returns Commands appended
+ */
+int append_lease(redisContext* c, int id, const char* node, int ttl);
+
+/**
+ * \ingroup redisLease
+ * @brief Reads the reply of a lease renewal appended with append_lease()
+ * @param[in] c Redis context (no other reply pending before the renewal's)
+ * @retval 1 Renewed
+ * @retval 0 The lease was lost: the ID must be leased again with wireless_lease()
+ * @retval -1 Connection failure or error reply
+ */
+int8_t read_renewal(redisContext* c);
+
+#endif
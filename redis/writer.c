@@ -0,0 +1,124 @@
+/*! @file writer.c
+ * @brief Local Redis writer: a lock-free record queue drained by one thread and one connection
+ */
+
+#include "writer.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "../log/log.h"
+#include "../sched/account.h"
+#include "../sched/startup.h"
+#include "common.h"
+
+/**
+ * @brief Appends the queued records to the pipeline, up to WRITER_BATCH of them
+ * @param[in, out] w Writer
+ * @param[out] pending Commands appended
+ * @returns Records taken
+ */
+static int take(struct redis_writer* w, int* pending) {
+  int taken = 0;
+
+  while (taken < WRITER_BATCH) {
+    struct writer_cell* cell = &w->cells[w->head % WRITER_QUEUE_LEN];
+
+    // Claimed by a producer that has not finished filling it yet, or empty
+    if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != w->head + 1)
+      break;
+
+    *pending += cell->record.append(w->c, cell->record.payload);
+    atomic_store_explicit(&cell->sequence, w->head + WRITER_QUEUE_LEN, memory_order_release);
+    w->head++;
+    taken++;
+  }
+
+  return taken;
+}
+
+static void* writer_thread(void* arg) {
+  const struct timespec period = {0, WRITER_POLL};
+  struct redis_writer* w = arg;
+  unsigned dropped;
+  int pending;
+
+  account_thread("writer");
+
+  for (;;) {
+    account_tick();
+    pending = 0;
+
+    if (take(w, &pending) == 0) {
+      nanosleep(&period, NULL);
+      continue;
+    }
+
+    if (redis_drain(w->c, pending)) {
+      SIMAR_LOG(LOG_ERR, "Local Redis write failed, reconnecting");
+      redisFree(w->c);
+      w->c = w->connect();
+    } else {
+      startup_published();
+    }
+
+    if ((dropped = atomic_exchange(&w->dropped, 0)) != 0)
+      SIMAR_LOG(LOG_WARNING, "Redis writer fell behind, %u records dropped", dropped);
+  }
+
+  return NULL;
+}
+
+int8_t writer_start(struct redis_writer* w, redisContext* c, redisContext* (*connect)()) {
+  pthread_t thread;
+
+  for (unsigned i = 0; i < WRITER_QUEUE_LEN; i++)
+    atomic_init(&w->cells[i].sequence, i);
+
+  atomic_init(&w->tail, 0);
+  atomic_init(&w->dropped, 0);
+  w->head = 0;
+  w->c = c;
+  w->connect = connect;
+
+  if (pthread_create(&thread, NULL, writer_thread, w))
+    return -1;
+
+  pthread_detach(thread);
+  return 0;
+}
+
+int8_t writer_push(struct redis_writer* w,
+                   int (*append)(redisContext* c, const void* payload),
+                   const void* payload,
+                   size_t size) {
+  unsigned pos = atomic_load_explicit(&w->tail, memory_order_relaxed);
+  struct writer_cell* cell;
+
+  assert(size <= WRITER_PAYLOAD);
+
+  for (;;) {
+    cell = &w->cells[pos % WRITER_QUEUE_LEN];
+    int lap = (int)(atomic_load_explicit(&cell->sequence, memory_order_acquire) - pos);
+
+    // Free for this lap: claim it. Still holding the previous lap's record: the queue is full.
+    if (lap == 0) {
+      if (atomic_compare_exchange_weak_explicit(&w->tail, &pos, pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (lap < 0) {
+      atomic_fetch_add_explicit(&w->dropped, 1, memory_order_relaxed);
+      return -1;
+    } else {
+      pos = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    }
+  }
+
+  cell->record.append = append;
+  memcpy(cell->record.payload, payload, size);
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*! @file writer.h
+ * @brief Declarations for the local Redis writer shared by the threads of a daemon
+ */
+
+#ifndef REDIS_WRITER_H
+#define REDIS_WRITER_H
+
+#include <hiredis/hiredis.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WRITER_QUEUE_LEN 256
+#define WRITER_PAYLOAD 96
+// Records appended per pipelined write, and how often an idle writer checks for new ones (ns)
+#define WRITER_BATCH 64
+#define WRITER_POLL 20000000L
+
+/*!
+ * @brief Publish record: the function appending its commands, and its data
+ */
+struct writer_record {
+  int (*append)(redisContext* c, const void* payload);
+  uint8_t payload[WRITER_PAYLOAD];
+};
+
+/*!
+ * @brief Queue slot; its sequence tells whether it is free or holds a record, and for which lap
+ */
+struct writer_cell {
+  atomic_uint sequence;
+  struct writer_record record;
+};
+
+/*!
+ * @brief Bounded multi-producer, single-consumer record queue and the connection it is written to
+ *
+ * @details Producers claim a slot by advancing `tail`, fill it and publish it through the slot
+ * sequence, so they never take a lock or wait for the network. The writer thread is the only one
+ * moving `head` and the only user of the connection.
+ */
+struct redis_writer {
+  struct writer_cell cells[WRITER_QUEUE_LEN];
+  atomic_uint tail;
+  unsigned head;
+  atomic_uint dropped;
+  redisContext* c;
+  redisContext* (*connect)();
+};
+
+/**
+ * \ingroup redis
+ * \defgroup redisWriter Writer
+ * @brief Single local Redis connection fed by every thread of a daemon
+ */
+
+/**
+ * \ingroup redisWriter
+ * @brief Starts the writer thread
+ * @param[out] w Writer
+ * @param[in] c Local connection, owned by the writer from now on
+ * @param[in] connect Opens a new local connection after a failure (waiting as long as needed)
+ * @retval 0 OK
+ * @retval -1 The thread could not be started
+ */
+int8_t writer_start(struct redis_writer* w, redisContext* c, redisContext* (*connect)());
+
+/**
+ * \ingroup redisWriter
+ * @brief Queues a record (any thread, never blocks)
+ * @param[in, out] w Writer
+ * @param[in] append Appends the record's commands to the pipeline, returns the commands appended
+ * @param[in] payload Record data, copied into the queue (up to WRITER_PAYLOAD bytes)
+ * @param[in] size Size of the record data
+ * @retval 0 OK
+ * @retval -1 Queue full, record dropped
+ */
+int8_t writer_push(struct redis_writer* w,
+                   int (*append)(redisContext* c, const void* payload),
+                   const void* payload,
+                   size_t size);
+
+#endif
@@ -0,0 +1,287 @@
+/*! @file account.c
+ * @brief Per thread CPU accounting, published on the shared memory board
+ */
+
+#define _GNU_SOURCE
+#include "account.h"
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "../mem/shm.h"
+#include "../utils/json/config.h"
+
+const char* const account_fields[ACCOUNT_FIELDS] = {
+    "cpu_ms", "sys_ms", "voluntary", "involuntary", "cycles", "instructions", "tid"};
+
+/// Counters opened per thread: cycles, instructions
+#define ACCOUNT_COUNTERS 2
+
+static struct shm_board* board;
+static char daemon_name[ACCOUNT_NAME_LEN];
+static double period = ACCOUNT_PERIOD;
+static uint8_t perf;
+static struct shm_entry* process;
+
+/*!
+ * @brief Accounting state of a thread
+ */
+struct account_state {
+  struct shm_entry* entry;
+  int counters[ACCOUNT_COUNTERS];
+  double next;
+  uint8_t main;
+  uint8_t adopter;
+};
+
+/*!
+ * @brief Thread sampled by another one (account_hand_over)
+ */
+struct account_handed {
+  struct shm_entry* entry;
+  clockid_t clock;
+  pid_t tid;
+  uint8_t main;
+};
+
+static _Thread_local struct account_state state = {.counters = {-1, -1}};
+static struct account_handed handed;
+
+/**
+ * @brief Monotonic time in seconds
+ * @returns Seconds since an arbitrary point
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Loads the `"accounting"` object of the device configuration
+ * @param[in] path Configuration file
+ */
+static void load_config(const char* path) {
+  const cJSON *accounting, *item;
+
+  cJSON* json = config_load(path);
+
+  accounting = cJSON_GetObjectItemCaseSensitive(json, "accounting");
+  perf = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(accounting, "perf"));
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(accounting, "period")) &&
+      item->valuedouble > 0)
+    period = item->valuedouble;
+
+  cJSON_Delete(json);
+}
+
+/**
+ * @brief Opens a user space hardware counter of the calling thread
+ * @param[in] config Counter (PERF_COUNT_HW_*)
+ * @returns File descriptor, or -1 if unavailable
+ */
+static int open_counter(uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * @brief Milliseconds of a time value
+ * @param[in] tv Time value
+ * @returns Milliseconds
+ */
+static double ms(struct timeval tv) {
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/**
+ * @brief Fills the fields of a sample from resource usage
+ * @param[out] values Fields
+ * @param[in] usage Resource usage
+ */
+static void fill_usage(double* values, const struct rusage* usage) {
+  values[ACCOUNT_CPU] = ms(usage->ru_utime) + ms(usage->ru_stime);
+  values[ACCOUNT_SYS] = ms(usage->ru_stime);
+  values[ACCOUNT_VOLUNTARY] = usage->ru_nvcsw;
+  values[ACCOUNT_INVOLUNTARY] = usage->ru_nivcsw;
+}
+
+/**
+ * @brief Reads a file of a thread's /proc/self/task/<tid> directory
+ * @param[in] tid Thread
+ * @param[in] file File name
+ * @param[out] buf Contents, terminated
+ * @param[in] len Buffer length
+ * @retval 0 OK
+ * @retval -1 Unreadable
+ */
+static int8_t read_task(pid_t tid, const char* file, char* buf, size_t len) {
+  char path[64];
+
+  snprintf(path, sizeof(path), "/proc/self/task/%d/%s", tid, file);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  ssize_t n = read(fd, buf, len - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+
+  buf[n] = '\0';
+  return 0;
+}
+
+/**
+ * @brief Fills the fields of a sample of the handed over thread: CPU time from its CPU clock,
+ * system time from its stat file and context switches from its status file
+ * @param[out] values Fields
+ * @retval 0 OK
+ * @retval -1 The thread could not be read
+ */
+static int8_t fill_handed(double* values) {
+  char buf[4096];
+  const char *voluntary, *involuntary;
+  struct timespec cpu;
+  unsigned long stime;
+
+  if (clock_gettime(handed.clock, &cpu) || read_task(handed.tid, "stat", buf, sizeof(buf)))
+    return -1;
+
+  // The thread name may hold spaces and parentheses; stime is the 13th field after it
+  const char* fields = strrchr(buf, ')');
+  if (fields == NULL ||
+      sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %lu", &stime) != 1)
+    return -1;
+
+  if (read_task(handed.tid, "status", buf, sizeof(buf)) ||
+      (voluntary = strstr(buf, "\nvoluntary_ctxt_switches:")) == NULL ||
+      (involuntary = strstr(buf, "\nnonvoluntary_ctxt_switches:")) == NULL)
+    return -1;
+
+  values[ACCOUNT_CPU] = cpu.tv_sec * 1e3 + cpu.tv_nsec / 1e6;
+  values[ACCOUNT_SYS] = stime * 1e3 / sysconf(_SC_CLK_TCK);
+  values[ACCOUNT_VOLUNTARY] = strtoul(voluntary + strlen("\nvoluntary_ctxt_switches:"), NULL, 10);
+  values[ACCOUNT_INVOLUNTARY] =
+      strtoul(involuntary + strlen("\nnonvoluntary_ctxt_switches:"), NULL, 10);
+  values[ACCOUNT_CYCLES] = values[ACCOUNT_INSTRUCTIONS] = NAN;
+  values[ACCOUNT_TID] = handed.tid;
+  return 0;
+}
+
+int8_t account_init(const char* daemon) {
+  char key[SHM_KEY_LEN];
+
+  snprintf(daemon_name, sizeof(daemon_name), "%s", daemon);
+  load_config(ACCOUNT_CONFIG);
+
+  if ((board = shm_attach(1)) == NULL) {
+    SIMAR_LOG(LOG_WARNING, "No shared memory board, thread accounting is off");
+    return -1;
+  }
+
+  snprintf(key, sizeof(key), ACCOUNT_PREFIX "%s", daemon);
+  process = shm_claim(board, key, account_fields, ACCOUNT_FIELDS);
+
+  state.main = 1;
+  account_thread("main");
+  return 0;
+}
+
+void account_thread(const char* name) {
+  char key[SHM_KEY_LEN], comm[ACCOUNT_NAME_LEN];
+
+  snprintf(comm, sizeof(comm), "%s", name);
+  pthread_setname_np(pthread_self(), comm);
+
+  if (board == NULL)
+    return;
+
+  snprintf(key, sizeof(key), ACCOUNT_PREFIX "%s/%s", daemon_name, name);
+  state.entry = shm_claim(board, key, account_fields, ACCOUNT_FIELDS);
+
+  if (perf) {
+    state.counters[0] = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+    state.counters[1] = open_counter(PERF_COUNT_HW_INSTRUCTIONS);
+
+    if (state.counters[0] < 0 || state.counters[1] < 0)
+      SIMAR_LOG(LOG_WARNING, "No hardware counters for %s, publishing CPU time only", key);
+  }
+
+  state.next = 0;
+  account_tick();
+}
+
+void account_hand_over() {
+  if (state.entry == NULL || pthread_getcpuclockid(pthread_self(), &handed.clock))
+    return;
+
+  for (int i = 0; i < ACCOUNT_COUNTERS; i++) {
+    if (state.counters[i] >= 0)
+      close(state.counters[i]);
+    state.counters[i] = -1;
+  }
+
+  handed.tid = syscall(SYS_gettid);
+  handed.main = state.main;
+  handed.entry = state.entry;
+  state.main = 0;
+  state.entry = NULL;
+}
+
+void account_adopt() {
+  state.adopter = 1;
+}
+
+void account_tick() {
+  double values[ACCOUNT_FIELDS], at;
+  struct rusage usage;
+
+  if (state.entry == NULL || (at = now()) < state.next)
+    return;
+
+  state.next = at + period;
+
+  getrusage(RUSAGE_THREAD, &usage);
+  fill_usage(values, &usage);
+
+  for (int i = 0; i < ACCOUNT_COUNTERS; i++) {
+    uint64_t count;
+
+    values[ACCOUNT_CYCLES + i] = NAN;
+    if (state.counters[i] >= 0 && read(state.counters[i], &count, sizeof(count)) == sizeof(count))
+      values[ACCOUNT_CYCLES + i] = count;
+  }
+
+  values[ACCOUNT_TID] = syscall(SYS_gettid);
+  shm_publish(state.entry, values);
+
+  if (state.adopter && handed.entry != NULL && fill_handed(values) == 0)
+    shm_publish(handed.entry, values);
+
+  if ((state.main || (state.adopter && handed.main)) && process != NULL) {
+    getrusage(RUSAGE_SELF, &usage);
+    fill_usage(values, &usage);
+    values[ACCOUNT_CYCLES] = values[ACCOUNT_INSTRUCTIONS] = NAN;
+    values[ACCOUNT_TID] = getpid();
+    shm_publish(process, values);
+  }
+}
@@ -0,0 +1,88 @@
+/*! @file account.h
+ * @brief Declarations for per thread CPU accounting
+ */
+
+#ifndef SCHED_ACCOUNT_H
+#define SCHED_ACCOUNT_H
+
+#include <stdint.h>
+
+#define ACCOUNT_CONFIG "/opt/device.json"
+// Shared memory board keys: ACCOUNT_PREFIX<daemon> for the process, then /<thread> for threads
+#define ACCOUNT_PREFIX "cpu:"
+// Default time between samples of a thread (s)
+#define ACCOUNT_PERIOD 1.0
+#define ACCOUNT_NAME_LEN 16
+
+/// Published fields, all cumulative since the thread (or process) started
+enum account_field {
+  ACCOUNT_CPU,
+  ACCOUNT_SYS,
+  ACCOUNT_VOLUNTARY,
+  ACCOUNT_INVOLUNTARY,
+  ACCOUNT_CYCLES,
+  ACCOUNT_INSTRUCTIONS,
+  ACCOUNT_TID,
+  ACCOUNT_FIELDS
+};
+
+/// Field names on the board, in account_field order
+extern const char* const account_fields[ACCOUNT_FIELDS];
+
+/**
+ * \ingroup sched
+ * @brief Starts the accounting of a daemon, and of its calling (main) thread as `main`
+ *
+ * @details Every accounted thread publishes its counters on the shared memory board
+ * (mem/shm.h), as `cpu:<daemon>/<thread>`: CPU time and system time (ms, from
+ * `getrusage(RUSAGE_THREAD)`), voluntary context switches (waits, i.e. wake-ups) and involuntary
+ * ones (preemptions), and with `"accounting": {"perf": true}` in /opt/device.json the CPU cycles
+ * and instructions it ran (user space, from `perf_event_open`; NaN if the kernel has no PMU
+ * support or forbids it). The main thread also publishes the whole process as `cpu:<daemon>`, so
+ * threads that are not accounted show up as the difference. `"period"` sets the time between
+ * samples (s).
+ *
+ * Threads sample themselves from their own loops (account_tick), so accounting adds no thread and
+ * no wake-up of its own; loops that must not spend time on it hand their sampling over to another
+ * thread (account_hand_over). Without this call, the other functions only name threads.
+ *
+ * @param[in] daemon Daemon name
+ * @retval 0 OK
+ * @retval -1 No shared memory board, accounting is off
+ */
+int8_t account_init(const char* daemon);
+
+/**
+ * \ingroup sched
+ * @brief Names the calling thread and starts its accounting
+ * @param[in] name Thread name (up to ACCOUNT_NAME_LEN - 1 characters are kept)
+ */
+void account_thread(const char* name);
+
+/**
+ * \ingroup sched
+ * @brief Publishes the counters of the calling thread, if its sampling period is over
+ *
+ * @details Meant for every iteration of a thread's loop: in between samples it costs a clock read.
+ */
+void account_tick();
+
+/**
+ * \ingroup sched
+ * @brief Hands the sampling of the calling thread over to the thread that calls account_adopt
+ *
+ * @details For loops that must not spend time on accounting, such as volt's capture loop. The
+ * adopting thread reads the CPU time of this one from its CPU clock (`pthread_getcpuclockid`), and
+ * its system time and context switches from /proc/self/task/<tid>; its cycles and instructions are
+ * not counted (NaN). The process totals of the main thread move along. To be called before the
+ * adopting thread starts.
+ */
+void account_hand_over();
+
+/**
+ * \ingroup sched
+ * @brief Has the calling thread sample the thread handed over, if any, in its own account_tick
+ */
+void account_adopt();
+
+#endif
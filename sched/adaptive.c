@@ -0,0 +1,113 @@
+/*! @file adaptive.c
+ * @brief Activity-driven sampling rates and bus time budgets
+ */
+
+#include "adaptive.h"
+
+#include <errno.h>
+
+double timespec_diff(const struct timespec* end, const struct timespec* start) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Adds a number of seconds to a time
+ * @param[in, out] ts Time
+ * @param[in] seconds Seconds to add
+ */
+static void timespec_add(struct timespec* ts, double seconds) {
+  long long ns = ts->tv_nsec + (long long)(seconds * 1e9);
+
+  ts->tv_sec += ns / 1000000000LL;
+  ts->tv_nsec = ns % 1000000000LL;
+}
+
+void adaptive_init(struct adaptive_rate* rate,
+                   double min_period,
+                   double max_period,
+                   double sigma_threshold,
+                   double rate_threshold) {
+  rate->period = rate->min_period = min_period;
+  rate->max_period = max_period;
+  rate->sigma_threshold = sigma_threshold;
+  rate->rate_threshold = rate_threshold;
+  rate->mean = rate->variance = rate->last = 0;
+  rate->primed = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &rate->next);
+  rate->last_sample = rate->next;
+}
+
+uint8_t adaptive_due(const struct adaptive_rate* rate, const struct timespec* now) {
+  return timespec_diff(now, &rate->next) >= 0;
+}
+
+double adaptive_update(struct adaptive_rate* rate, double value) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (!rate->primed) {
+    rate->mean = rate->last = value;
+    rate->primed = 1;
+  } else {
+    double elapsed = timespec_diff(&now, &rate->last_sample);
+    double change = value - rate->last;
+    double diff = value - rate->mean;
+
+    rate->mean += ADAPTIVE_ALPHA * diff;
+    rate->variance = (1 - ADAPTIVE_ALPHA) * (rate->variance + ADAPTIVE_ALPHA * diff * diff);
+    rate->last = value;
+
+    if (rate->variance > rate->sigma_threshold * rate->sigma_threshold ||
+        (elapsed > 0 && (change < 0 ? -change : change) / elapsed > rate->rate_threshold))
+      rate->period = rate->min_period;
+    else if ((rate->period *= ADAPTIVE_BACKOFF) > rate->max_period)
+      rate->period = rate->max_period;
+  }
+
+  rate->last_sample = rate->next = now;
+  timespec_add(&rate->next, rate->period);
+
+  return rate->period;
+}
+
+void adaptive_defer(struct adaptive_rate* rate, double delay) {
+  clock_gettime(CLOCK_MONOTONIC, &rate->next);
+  timespec_add(&rate->next, delay);
+}
+
+void adaptive_earliest(const struct adaptive_rate* rates, int amount, struct timespec* earliest) {
+  for (int i = 0; i < amount; i++) {
+    if (timespec_diff(&rates[i].next, earliest) < 0)
+      *earliest = rates[i].next;
+  }
+}
+
+void adaptive_sleep(const struct timespec* until) {
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, until, NULL) == EINTR)
+    ;
+}
+
+void budget_init(struct bus_budget* budget, double fraction, double burst) {
+  budget->fraction = fraction;
+  budget->burst = budget->tokens = burst;
+  clock_gettime(CLOCK_MONOTONIC, &budget->last);
+}
+
+uint8_t budget_available(struct bus_budget* budget) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  budget->tokens += timespec_diff(&now, &budget->last) * budget->fraction;
+  budget->last = now;
+
+  if (budget->tokens > budget->burst)
+    budget->tokens = budget->burst;
+
+  return budget->tokens > 0;
+}
+
+void budget_spend(struct bus_budget* budget, double seconds) {
+  budget->tokens -= seconds;
+}
@@ -0,0 +1,143 @@
+/*! @file adaptive.h
+ * @brief Declarations for activity-driven sampling rates
+ */
+
+/*!
+ * @defgroup sched Scheduling
+ * @brief Sampling period control for the acquisition loops
+ */
+
+#ifndef SCHED_ADAPTIVE_H
+#define SCHED_ADAPTIVE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define ADAPTIVE_ALPHA 0.2
+#define ADAPTIVE_BACKOFF 1.5
+
+/*!
+ * @brief Sampling period of a single metric
+ *
+ * @details The short-term mean and variance are exponentially weighted (ADAPTIVE_ALPHA). When the
+ * standard deviation or the rate of change crosses its threshold the period drops to min_period at
+ * once; while quiet it grows by ADAPTIVE_BACKOFF per sample, up to max_period.
+ */
+struct adaptive_rate {
+  double period;
+  double min_period;
+  double max_period;
+  double sigma_threshold;
+  double rate_threshold;
+  double mean;
+  double variance;
+  double last;
+  uint8_t primed;
+  struct timespec last_sample;
+  struct timespec next;
+};
+
+/*!
+ * @brief Bus time budget (token bucket) shared by the metrics read over the same bus
+ */
+struct bus_budget {
+  double fraction;
+  double burst;
+  double tokens;
+  struct timespec last;
+};
+
+/**
+ * \ingroup sched
+ * @brief Initializes a sampling period, starting at the fastest rate
+ * @param[out] rate Sampling period
+ * @param[in] min_period Shortest period (s)
+ * @param[in] max_period Longest period (s)
+ * @param[in] sigma_threshold Short-term standard deviation above which the metric is active
+ * @param[in] rate_threshold Rate of change (units/s) above which the metric is active
+ */
+void adaptive_init(struct adaptive_rate* rate,
+                   double min_period,
+                   double max_period,
+                   double sigma_threshold,
+                   double rate_threshold);
+
+/**
+ * \ingroup sched
+ * @brief Checks whether a metric is due for sampling
+ * @param[in] rate Sampling period
+ * @param[in] now Current monotonic time
+ * @retval 1 Due
+ * @retval 0 Not due
+ */
+uint8_t adaptive_due(const struct adaptive_rate* rate, const struct timespec* now);
+
+/**
+ * \ingroup sched
+ * @brief Feeds a new sample and schedules the next one
+ * @param[in, out] rate Sampling period
+ * @param[in] value Sampled value
+ * @returns New period (s)
+ */
+double adaptive_update(struct adaptive_rate* rate, double value);
+
+/**
+ * \ingroup sched
+ * @brief Postpones a sample that could not be taken (e.g. bus budget exhausted)
+ * @param[in, out] rate Sampling period
+ * @param[in] delay Delay (s)
+ */
+void adaptive_defer(struct adaptive_rate* rate, double delay);
+
+/**
+ * \ingroup sched
+ * @brief Lowers `earliest` to the next due time among a set of metrics
+ * @param[in] rates Sampling periods
+ * @param[in] amount Amount of metrics
+ * @param[in, out] earliest Earliest due time so far
+ */
+void adaptive_earliest(const struct adaptive_rate* rates, int amount, struct timespec* earliest);
+
+/**
+ * \ingroup sched
+ * @brief Sleeps until an absolute monotonic time
+ * @param[in] until Wake up time
+ */
+void adaptive_sleep(const struct timespec* until);
+
+/**
+ * \ingroup sched
+ * @brief Initializes a bus time budget
+ * @param[out] budget Budget
+ * @param[in] fraction Fraction of wall time the bus may be busy (0-1)
+ * @param[in] burst Largest amount of unused bus time (s) that can be saved up
+ */
+void budget_init(struct bus_budget* budget, double fraction, double burst);
+
+/**
+ * \ingroup sched
+ * @brief Checks whether there is bus time left (the last read may overdraw it)
+ * @param[in, out] budget Budget
+ * @retval 1 Available
+ * @retval 0 Exhausted
+ */
+uint8_t budget_available(struct bus_budget* budget);
+
+/**
+ * \ingroup sched
+ * @brief Charges bus time to the budget
+ * @param[in, out] budget Budget
+ * @param[in] seconds Bus time spent (s)
+ */
+void budget_spend(struct bus_budget* budget, double seconds);
+
+/**
+ * \ingroup sched
+ * @brief Monotonic time difference
+ * @param[in] end End time
+ * @param[in] start Start time
+ * @returns end - start (s)
+ */
+double timespec_diff(const struct timespec* end, const struct timespec* start);
+
+#endif
@@ -0,0 +1,124 @@
+/*! @file rt.c
+ * @brief Real-time execution profile (scheduling, affinity, memory locking) and jitter histograms
+ */
+
+#define _GNU_SOURCE
+
+#include "rt.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../log/log.h"
+#include "../utils/json/config.h"
+
+/// Upper bound (µs) of each histogram bucket, the last one collects everything above
+static const double bucket_limits[RT_HIST_BUCKETS - 1] = {1,   2,   5,    10,   20,   50,  100,
+                                                          200, 500, 1000, 2000, 5000, 10000};
+
+int8_t rt_load_config(struct rt_profile* profile, const char* path) {
+  cJSON *json, *rt, *item;
+
+  memset(profile, 0, sizeof(*profile));
+  profile->cpu = -1;
+
+  json = config_load(path);
+
+  rt = cJSON_GetObjectItemCaseSensitive(json, "rt");
+
+  if (!cJSON_IsObject(rt)) {
+    cJSON_Delete(json);
+    return -1;
+  }
+
+  profile->capture_priority = 80;
+  profile->pru_priority = 70;
+
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(rt, "cpu")))
+    profile->cpu = item->valueint;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(rt, "capture_priority")))
+    profile->capture_priority = item->valueint;
+  if (cJSON_IsNumber(item = cJSON_GetObjectItemCaseSensitive(rt, "pru_priority")))
+    profile->pru_priority = item->valueint;
+
+  cJSON_Delete(json);
+  profile->enabled = 1;
+
+  return 0;
+}
+
+void rt_prefault_stack() {
+  volatile uint8_t stack[RT_STACK_PREFAULT];
+
+  for (size_t i = 0; i < sizeof(stack); i += 512)
+    stack[i] = 0;
+}
+
+int8_t rt_lock_memory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    SIMAR_LOG(LOG_ERR, "Could not lock memory, the capture loop may page fault");
+    return -1;
+  }
+
+  rt_prefault_stack();
+  return 0;
+}
+
+int8_t rt_apply(int priority, int cpu) {
+  struct sched_param param = {.sched_priority = priority};
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+      SIMAR_LOG(LOG_ERR, "Could not pin thread to CPU %d", cpu);
+      return -1;
+    }
+  }
+
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+    SIMAR_LOG(LOG_ERR, "Could not set SCHED_FIFO priority %d (missing CAP_SYS_NICE?)", priority);
+    return -1;
+  }
+
+  return 0;
+}
+
+void rt_hist_add(struct rt_histogram* hist, double deviation) {
+  int i = 0;
+
+  while (i < RT_HIST_BUCKETS - 1 && deviation > bucket_limits[i])
+    i++;
+
+  hist->buckets[i]++;
+
+  if (hist->samples == 0 || deviation < hist->min)
+    hist->min = deviation;
+  if (deviation > hist->max)
+    hist->max = deviation;
+
+  hist->sum += deviation;
+  hist->samples++;
+}
+
+void rt_hist_print(const struct rt_histogram* hist, FILE* out, const char* title) {
+  fprintf(out, "%s: %llu periods, deviation min %.1f µs, mean %.1f µs, max %.1f µs\n", title,
+          (unsigned long long)hist->samples, hist->min,
+          hist->samples ? hist->sum / hist->samples : 0.0, hist->max);
+
+  for (int i = 0; i < RT_HIST_BUCKETS; i++) {
+    if (hist->buckets[i] == 0)
+      continue;
+
+    if (i < RT_HIST_BUCKETS - 1)
+      fprintf(out, "  <= %6.0f µs: %10llu (%6.2f%%)\n", bucket_limits[i],
+              (unsigned long long)hist->buckets[i], 100.0 * hist->buckets[i] / hist->samples);
+    else
+      fprintf(out, "   > %6.0f µs: %10llu (%6.2f%%)\n", bucket_limits[i - 1],
+              (unsigned long long)hist->buckets[i], 100.0 * hist->buckets[i] / hist->samples);
+  }
+}
@@ -0,0 +1,92 @@
+/*! @file rt.h
+ * @brief Declarations for the real-time execution profile
+ */
+
+#ifndef SCHED_RT_H
+#define SCHED_RT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define RT_CONFIG "/opt/device.json"
+#define RT_STACK_PREFAULT (64 * 1024)
+#define RT_HIST_BUCKETS 14
+
+/*!
+ * @brief Real-time profile, read from the "rt" object of the device configuration
+ */
+struct rt_profile {
+  uint8_t enabled;
+  int cpu;
+  int capture_priority;
+  int pru_priority;
+};
+
+/*!
+ * @brief Histogram of the deviation from the nominal period (µs)
+ */
+struct rt_histogram {
+  uint64_t buckets[RT_HIST_BUCKETS];
+  uint64_t samples;
+  double min;
+  double max;
+  double sum;
+};
+
+/**
+ * \ingroup sched
+ * @brief Reads the real-time profile from the device configuration
+ *
+ * @details Example: `"rt": {"cpu": 0, "capture_priority": 80, "pru_priority": 70}`. A CPU of -1
+ * (the default) leaves the affinity alone.
+ *
+ * @param[out] profile Profile (disabled if there is no "rt" object)
+ * @param[in] path Configuration file
+ * @retval 0 Profile enabled
+ * @retval -1 Profile disabled or not configured
+ */
+int8_t rt_load_config(struct rt_profile* profile, const char* path);
+
+/**
+ * \ingroup sched
+ * @brief Locks all current and future memory and prefaults the calling thread's stack
+ * @retval 0 OK
+ * @retval -1 Memory could not be locked (insufficient privileges or RLIMIT_MEMLOCK)
+ */
+int8_t rt_lock_memory();
+
+/**
+ * \ingroup sched
+ * @brief Touches RT_STACK_PREFAULT bytes of the calling thread's stack, so the capture loop never
+ * page faults on it
+ */
+void rt_prefault_stack();
+
+/**
+ * \ingroup sched
+ * @brief Moves the calling thread to SCHED_FIFO and pins it to a CPU
+ * @param[in] priority SCHED_FIFO priority (1-99)
+ * @param[in] cpu CPU, or -1 to keep the current affinity
+ * @retval 0 OK
+ * @retval -1 Failure (usually insufficient privileges)
+ */
+int8_t rt_apply(int priority, int cpu);
+
+/**
+ * \ingroup sched
+ * @brief Adds a sample to a period histogram
+ * @param[in, out] hist Histogram
+ * @param[in] deviation Deviation from the nominal period (µs, absolute)
+ */
+void rt_hist_add(struct rt_histogram* hist, double deviation);
+
+/**
+ * \ingroup sched
+ * @brief Prints a period histogram
+ * @param[in] hist Histogram
+ * @param[in] out Output stream
+ * @param[in] title Title
+ */
+void rt_hist_print(const struct rt_histogram* hist, FILE* out, const char* title);
+
+#endif
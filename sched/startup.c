@@ -0,0 +1,240 @@
+/*! @file startup.c
+ * @brief Startup phase timeline, written at the first publish
+ */
+
+#include "startup.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+
+/*!
+ * @brief Start of a startup phase
+ */
+struct startup_mark {
+  char name[STARTUP_NAME_LEN];
+  double start;
+  double cpu;
+};
+
+static char daemon_name[STARTUP_NAME_LEN];
+static struct startup_mark marks[STARTUP_PHASES];
+static int mark_amount;
+static int merged;
+static double process_start;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uchar done = 1;
+
+/**
+ * @brief Time since boot, in milliseconds (counts suspend, like the process start time)
+ * @returns Milliseconds
+ */
+static double boot_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief CPU time of the process, in milliseconds
+ * @returns Milliseconds
+ */
+static double cpu_ms() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+/**
+ * @brief Start time of the process, from /proc/self/stat
+ * @param[in] fallback Returned if unavailable
+ * @returns Milliseconds since boot (clock tick resolution)
+ */
+static double read_process_start(double fallback) {
+  char line[512];
+  unsigned long long ticks;
+  int fd = open("/proc/self/stat", O_RDONLY);
+
+  if (fd < 0)
+    return fallback;
+
+  ssize_t len = read(fd, line, sizeof(line) - 1);
+  close(fd);
+  line[len > 0 ? len : 0] = '\0';
+
+  // starttime is the 22nd field, after the name (which may hold spaces)
+  char* rest = strrchr(line, ')');
+  if (rest == NULL || sscanf(rest,
+                             ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d "
+                             "%*d %*d %*d %llu",
+                             &ticks) != 1)
+    return fallback;
+
+  return ticks * 1e3 / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * @brief Duration of a phase
+ * @param[in] i Phase
+ * @param[in] end End of the startup (ms since boot)
+ * @returns Milliseconds
+ */
+static double duration(int i, double end) {
+  return (i + 1 < mark_amount ? marks[i + 1].start : end) - marks[i].start;
+}
+
+/**
+ * @brief Names a phase, keeping the JSON output valid
+ * @param[out] mark Phase
+ * @param[in] format Name format
+ * @param[in] args Format arguments
+ */
+static void name_mark(struct startup_mark* mark, const char* format, va_list args) {
+  vsnprintf(mark->name, sizeof(mark->name), format, args);
+
+  for (char* c = mark->name; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\' || (unsigned char)*c < ' ')
+      *c = '_';
+  }
+}
+
+/**
+ * @brief Writes the timeline, up to the given time, replacing the previous one
+ * @param[in] end End of the startup (ms since boot)
+ * @param[in] cpu CPU time at the end (ms)
+ * @retval 0 OK
+ * @retval -1 The timeline could not be written
+ */
+static int8_t write_timeline(double end, double cpu) {
+  static char buf[STARTUP_PHASES * 128 + 256];
+  char path[128], tmp[136];
+  int len, fd;
+
+  len = snprintf(buf, sizeof(buf),
+                 "{\n  \"daemon\": \"%s\",\n  \"pid\": %d,\n  \"exec_ms\": %.1f,\n"
+                 "  \"first_publish_ms\": %.1f,\n  \"cpu_ms\": %.1f,\n  \"merged_phases\": %d,\n"
+                 "  \"phases\": [\n",
+                 daemon_name, getpid(), marks[0].start - process_start, end - process_start, cpu,
+                 merged);
+
+  for (int i = 0; i < mark_amount && len < (int)sizeof(buf); i++) {
+    double next_cpu = i + 1 < mark_amount ? marks[i + 1].cpu : cpu;
+
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "    {\"name\": \"%s\", \"start_ms\": %.1f, \"ms\": %.1f, "
+                    "\"cpu_ms\": %.1f}%s\n",
+                    marks[i].name, marks[i].start - process_start, duration(i, end),
+                    next_cpu - marks[i].cpu, i + 1 < mark_amount ? "," : "");
+  }
+
+  if (len < (int)sizeof(buf))
+    len += snprintf(buf + len, sizeof(buf) - len, "  ]\n}\n");
+  if (len >= (int)sizeof(buf))
+    return -1;
+
+  // Written aside and renamed, so readers never see half a timeline
+  snprintf(path, sizeof(path), STARTUP_TIMELINE, daemon_name);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    return -1;
+
+  if (write(fd, buf, len) != len) {
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+
+  close(fd);
+  return rename(tmp, path) == 0 ? 0 : -1;
+}
+
+void startup_begin(const char* daemon) {
+  double now = boot_ms();
+
+  pthread_mutex_lock(&lock);
+  snprintf(daemon_name, sizeof(daemon_name), "%s", daemon);
+  process_start = read_process_start(now);
+  if (process_start > now)
+    process_start = now;
+
+  snprintf(marks[0].name, sizeof(marks[0].name), "init");
+  marks[0].start = now;
+  marks[0].cpu = cpu_ms();
+  mark_amount = 1;
+  merged = 0;
+  atomic_store(&done, 0);
+  pthread_mutex_unlock(&lock);
+}
+
+void startup_phase(const char* format, ...) {
+  va_list args;
+
+  if (atomic_load_explicit(&done, memory_order_acquire))
+    return;
+
+  pthread_mutex_lock(&lock);
+
+  if (!atomic_load(&done)) {
+    struct startup_mark* mark = &marks[mark_amount];
+
+    // Out of phases: the last one goes on under the new name
+    if (mark_amount == STARTUP_PHASES) {
+      mark = &marks[STARTUP_PHASES - 1];
+      merged++;
+    } else {
+      mark_amount++;
+      mark->start = boot_ms();
+      mark->cpu = cpu_ms();
+    }
+
+    va_start(args, format);
+    name_mark(mark, format, args);
+    va_end(args);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+void startup_published() {
+  char path[128];
+
+  if (atomic_load_explicit(&done, memory_order_acquire))
+    return;
+
+  pthread_mutex_lock(&lock);
+
+  if (atomic_load(&done)) {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  double end = boot_ms(), cpu = cpu_ms();
+  int longest = 0;
+
+  for (int i = 1; i < mark_amount; i++) {
+    if (duration(i, end) > duration(longest, end))
+      longest = i;
+  }
+
+  snprintf(path, sizeof(path), STARTUP_TIMELINE, daemon_name);
+
+  if (write_timeline(end, cpu))
+    SIMAR_LOG(LOG_WARNING, "Startup timeline could not be written to %s", path);
+
+  SIMAR_LOG(LOG_NOTICE,
+            "First publish %.0f ms after start (%.0f ms CPU), longest phase %s (%.0f ms)",
+            end - process_start, cpu, marks[longest].name, duration(longest, end));
+
+  atomic_store_explicit(&done, 1, memory_order_release);
+  pthread_mutex_unlock(&lock);
+}
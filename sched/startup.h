@@ -0,0 +1,50 @@
+/*! @file startup.h
+ * @brief Declarations for the startup phase timeline
+ */
+
+#ifndef SCHED_STARTUP_H
+#define SCHED_STARTUP_H
+
+#include <stdint.h>
+
+// Timeline of the last startup, %s being the daemon name
+#define STARTUP_TIMELINE "/opt/simar_startup_%s.json"
+#define STARTUP_PHASES 128
+#define STARTUP_NAME_LEN 32
+
+/**
+ * \ingroup sched
+ * @brief Starts the startup timeline of a daemon, with an `init` phase
+ *
+ * @details Meant as the first call of `main`. The time between the process start and this call
+ * (loading and linking) is kept as well, so the timeline covers the whole restart.
+ *
+ * @param[in] daemon Daemon name
+ */
+void startup_begin(const char* daemon);
+
+/**
+ * \ingroup sched
+ * @brief Ends the current startup phase and starts a new one
+ *
+ * @details Phases are sequential and belong to the main thread. Past STARTUP_PHASES, each new phase
+ * is merged into the last one, which takes its name (the timeline counts the merged phases), and
+ * once the daemon has published, phases are ignored.
+ *
+ * @param[in] format Phase name (printf format, such as `"probe %d"`)
+ */
+void startup_phase(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * \ingroup sched
+ * @brief Ends the startup at the first publish: writes the timeline and logs a summary
+ *
+ * @details The timeline goes to STARTUP_TIMELINE as JSON: the time to first publish, the process
+ * CPU time until then, and the name, start, duration and CPU time of every phase (ms since the
+ * process started). Any thread can call it, after every successful publish: only the first call
+ * does anything, later ones cost an atomic load. Neither allocates, so this works with static
+ * memory.
+ */
+void startup_published();
+
+#endif
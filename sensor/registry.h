@@ -0,0 +1,102 @@
+/*! @file registry.h
+ * @brief Sensor driver registry of the environmental sensor module
+ */
+
+/*!
+ * @defgroup sensor Sensors
+ * @brief Sensor types swept by the environmental sensor module
+ */
+
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include <time.h>
+
+#include "../bme280/common/common.h"
+#include "../sched/adaptive.h"
+#include "../sht3x/alert.h"
+#include "../sht3x/sht3x.h"
+#include "results.h"
+
+// Failed BMx reads in a row before giving up
+#define ERROR_THRESHOLD 5
+
+/**
+ * \ingroup sensor
+ * @brief Sensor types, probed in this order at every channel and address
+ *
+ * @details X(type, label, slot, name, id, primary, secondary, conversion, errors, fields):
+ * - type: prefix of the driver hooks and of the bank
+ * - label: type name, for the log
+ * - slot: per sensor state
+ * - name: sensor name member of the slot (MAX_NAME_LEN)
+ * - id: bus identifier member of the slot
+ * - primary, secondary: I2C address of the first and second sensor on a channel
+ * - conversion: time from starting a conversion until the data can be read (µs)
+ * - errors: failed reads in a row that are tolerated, the next one is fatal
+ * - fields: results block columns filled from the slot, as a list of F(column, slot member)
+ *
+ * Every type implements the hooks below. The sweep is generated per type from this table, so the
+ * hooks are plain (inlinable) calls and adding a type does not touch the main loop.
+ * - `int8_t <type>_driver_probe(slot*, struct identifier, uint8_t addr)`: 0 if present,
+ *   BUS_FAIL on bus failure
+ * - `void <type>_driver_setup(struct <type>_bank*, int i)`: sampling rate and options of a sensor,
+ *   after calibration; may also enable the bank service
+ * - `int8_t <type>_driver_start(slot*)`: starts a conversion; 1 if started, 0 if the sensor is free
+ *   running, -1 on failure
+ * - `int8_t <type>_driver_read(slot*)`: reads and decodes a readout; 0 OK, 1 no new data, -1 on
+ *   failure
+ * - `double <type>_driver_activity(const slot*)`: metric driving the sampling rate
+ * - `uint8_t <type>_driver_flags(const slot*)`: results entry flags of a readout
+ * - `void <type>_driver_service(struct <type>_bank*, struct results_block*)`: bank wide task run
+ *   at the service rate (e.g. alert polling), which may add entries to the sweep results
+ */
+#define SENSOR_DRIVERS(X)                                                                       \
+  X(bme, "BMx", struct bme_sensor_data, name, id, BME280_I2C_ADDR_PRIM, BME280_I2C_ADDR_SEC, 0, \
+    ERROR_THRESHOLD + 1, BME_FIELDS)                                                            \
+  X(sht, "SHT3x", struct sht_slot, dev.name, dev.id, SHT3X_I2C_ADDR_DFLT, SHT3X_I2C_ADDR_ALT,   \
+    sht3x_measurement_duration(), 0, SHT_FIELDS)
+
+#define BME_FIELDS(F)              \
+  F(temperature, data.temperature) \
+  F(pressure, data.pressure)       \
+  F(humidity, data.humidity)       \
+  F(average, average)              \
+  F(open_average, open_average)
+
+#define SHT_FIELDS(F)                  \
+  F(temperature, dev.data.temperature) \
+  F(humidity, dev.data.humidity)
+
+/*!
+ * @brief SHT3x slot: the sensor and its alert state
+ */
+struct sht_slot {
+  struct sht3x_sensor_data dev;
+  struct sht3x_alert alert;
+};
+
+/*!
+ * @brief Sensor bank of a type: its sensors, their sampling rates and the sweep state
+ *
+ * @details Sensors are appended to a heap table while the topology is discovered, which is moved
+ * into the memory arena once its size is known. `started` flags the sensors whose conversion was
+ * started in the current sweep, and `entries` holds their shared memory board entries (claimed once
+ * at startup, NULL without a board).
+ */
+#define SENSOR_BANK(type, label, slot, ...) \
+  struct type##_bank {                      \
+    slot* sensors;                          \
+    struct adaptive_rate* rates;            \
+    struct adaptive_rate service;           \
+    uint8_t* started;                       \
+    struct shm_entry** entries;             \
+    uint16_t amount;                        \
+    uint16_t capacity;                      \
+    uint8_t failures;                       \
+    uint8_t serviced;                       \
+  };
+
+SENSOR_DRIVERS(SENSOR_BANK)
+
+#endif
@@ -0,0 +1,165 @@
+/*! @file results.c
+ * @brief Sweep results blocks: a preallocated pool, handed to the output sinks by reference
+ */
+
+#include "results.h"
+
+#include "../log/log.h"
+#include "../mem/arena.h"
+#include "../sched/account.h"
+
+size_t results_bytes(uint16_t capacity) {
+  return RESULTS_POOL *
+         (ARENA_BYTES(capacity, struct timespec) + ARENA_BYTES(capacity, const char*) +
+          5 * ARENA_BYTES(capacity, double) + 2 * ARENA_BYTES(capacity, uint8_t) +
+          ARENA_BYTES(capacity, struct shm_entry*));
+}
+
+int8_t results_init(struct results_pool* pool, uint16_t capacity) {
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->released, NULL);
+  pool->sink_amount = 0;
+  pool->sequence = 0;
+
+  for (int i = 0; i < RESULTS_POOL; i++) {
+    struct results_block* block = &pool->blocks[i];
+
+    block->capacity = capacity;
+    block->amount = 0;
+    block->time = arena_alloc(capacity * sizeof(*block->time), "Results");
+    block->sensor = arena_alloc(capacity * sizeof(*block->sensor), "Results");
+    block->temperature = arena_alloc(capacity * sizeof(double), "Results");
+    block->pressure = arena_alloc(capacity * sizeof(double), "Results");
+    block->humidity = arena_alloc(capacity * sizeof(double), "Results");
+    block->average = arena_alloc(capacity * sizeof(double), "Results");
+    block->open_average = arena_alloc(capacity * sizeof(double), "Results");
+    block->alert = arena_alloc(capacity, "Results");
+    block->flags = arena_alloc(capacity, "Results");
+    block->shm = arena_alloc(capacity * sizeof(*block->shm), "Results");
+
+    if (block->flags == NULL || block->shm == NULL)
+      return -1;
+
+    pool->free[i] = block;
+  }
+
+  pool->available = RESULTS_POOL;
+  return 0;
+}
+
+/**
+ * @brief Drops a sink's reference to a block, returning it to the pool after the last one
+ * @param[in, out] pool Pool
+ * @param[in] block Block
+ */
+static void release(struct results_pool* pool, struct results_block* block) {
+  if (atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) != 1)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->free[pool->available++] = block;
+  pthread_cond_signal(&pool->released);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void* sink_thread(void* arg) {
+  struct results_sink* sink = arg;
+  struct results_pool* pool = sink->pool;
+
+  account_thread(sink->name);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (sink->head == sink->tail)
+      pthread_cond_wait(&sink->ready, &pool->lock);
+    struct results_block* block = sink->queue[sink->head++ % RESULTS_POOL];
+    pthread_mutex_unlock(&pool->lock);
+
+    sink->consume(block, sink->arg);
+    release(pool, block);
+    account_tick();
+  }
+
+  return NULL;
+}
+
+int8_t results_sink_add(struct results_pool* pool,
+                        const char* name,
+                        void (*consume)(const struct results_block* block, void* arg),
+                        void* arg) {
+  pthread_t thread;
+
+  if (pool->sink_amount == RESULTS_SINKS)
+    return -1;
+
+  struct results_sink* sink = &pool->sinks[pool->sink_amount];
+
+  *sink = (struct results_sink){.name = name, .consume = consume, .arg = arg, .pool = pool};
+  pthread_cond_init(&sink->ready, NULL);
+
+  if (pthread_create(&thread, NULL, sink_thread, sink)) {
+    SIMAR_LOG(LOG_ERR, "Could not start the %s output", name);
+    return -1;
+  }
+
+  pthread_detach(thread);
+  pool->sink_amount++;
+
+  return 0;
+}
+
+struct results_block* results_acquire(struct results_pool* pool) {
+  pthread_mutex_lock(&pool->lock);
+
+  if (pool->available == 0)
+    SIMAR_LOG(LOG_WARNING, "Outputs fell behind, waiting for a results block");
+
+  while (pool->available == 0)
+    pthread_cond_wait(&pool->released, &pool->lock);
+
+  struct results_block* block = pool->free[--pool->available];
+  pthread_mutex_unlock(&pool->lock);
+
+  block->amount = 0;
+  block->sequence = pool->sequence++;
+
+  return block;
+}
+
+int results_add(struct results_block* block,
+                const char* sensor,
+                struct shm_entry* shm,
+                uint8_t flags) {
+  if (block->amount == block->capacity)
+    return -1;
+
+  int i = block->amount++;
+
+  clock_gettime(CLOCK_MONOTONIC, &block->time[i]);
+  block->sensor[i] = sensor;
+  block->shm[i] = shm;
+  block->flags[i] = flags;
+
+  return i;
+}
+
+void results_publish(struct results_pool* pool, struct results_block* block) {
+  // One reference for the publisher, so the block cannot be released before every sink has it
+  atomic_store_explicit(&block->refs, 1, memory_order_relaxed);
+
+  if (block->amount > 0) {
+    pthread_mutex_lock(&pool->lock);
+
+    for (int i = 0; i < pool->sink_amount; i++) {
+      struct results_sink* sink = &pool->sinks[i];
+
+      atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+      sink->queue[sink->tail++ % RESULTS_POOL] = block;
+      pthread_cond_signal(&sink->ready);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  release(pool, block);
+}
@@ -0,0 +1,141 @@
+/*! @file results.h
+ * @brief Declarations for sweep results blocks shared by the output sinks
+ */
+
+#ifndef SENSOR_RESULTS_H
+#define SENSOR_RESULTS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#define RESULTS_POOL 2
+#define RESULTS_SINKS 4
+
+// Entry flags: pressure, door state and averages are set (BMx), door open, alert change
+#define RESULT_PRESSURE 0x01
+#define RESULT_OPEN 0x02
+#define RESULT_ALERT 0x04
+
+struct shm_entry;
+
+/*!
+ * @brief Readouts of one sweep, one column per quantity (structure of arrays)
+ *
+ * @details Temperature and humidity are always set; the other columns according to the entry
+ * flags. Sensor names point to the sensor slots, so they are not copied either, and each entry
+ * carries the sensor's shared memory board entry. Once published, a block is read-only until every
+ * sink has released it.
+ */
+struct results_block {
+  atomic_uint refs;
+  uint32_t sequence;
+  uint16_t amount;
+  uint16_t capacity;
+  struct timespec* time;
+  const char** sensor;
+  double* temperature;
+  double* pressure;
+  double* humidity;
+  double* average;
+  double* open_average;
+  uint8_t* alert;
+  uint8_t* flags;
+  struct shm_entry** shm;
+};
+
+struct results_pool;
+
+/*!
+ * @brief Output sink, consuming the published blocks in order on its own thread
+ */
+struct results_sink {
+  const char* name;
+  void (*consume)(const struct results_block* block, void* arg);
+  void* arg;
+  struct results_block* queue[RESULTS_POOL];
+  unsigned head;
+  unsigned tail;
+  pthread_cond_t ready;
+  struct results_pool* pool;
+};
+
+/*!
+ * @brief Preallocated results blocks and the sinks they are published to
+ */
+struct results_pool {
+  struct results_block blocks[RESULTS_POOL];
+  struct results_block* free[RESULTS_POOL];
+  uint8_t available;
+  uint32_t sequence;
+  struct results_sink sinks[RESULTS_SINKS];
+  uint8_t sink_amount;
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+};
+
+/**
+ * \ingroup sensor
+ * @brief Initializes a pool, allocating its blocks from the memory arena
+ * @param[out] pool Pool
+ * @param[in] capacity Entries per block
+ * @retval 0 OK
+ * @retval -1 Arena exhausted
+ */
+int8_t results_init(struct results_pool* pool, uint16_t capacity);
+
+/**
+ * \ingroup sensor
+ * @brief Arena bytes needed by a pool (see arena_init)
+ * @param[in] capacity Entries per block
+ * @returns Bytes
+ */
+size_t results_bytes(uint16_t capacity);
+
+/**
+ * \ingroup sensor
+ * @brief Adds an output sink and starts its thread
+ * @param[in, out] pool Pool
+ * @param[in] name Sink name, for the log
+ * @param[in] consume Called with every published block, which must not be kept afterwards
+ * @param[in] arg Passed to consume
+ * @retval 0 OK
+ * @retval -1 Too many sinks, or the thread could not be started
+ */
+int8_t results_sink_add(struct results_pool* pool,
+                        const char* name,
+                        void (*consume)(const struct results_block* block, void* arg),
+                        void* arg);
+
+/**
+ * \ingroup sensor
+ * @brief Takes an empty block, waiting for the sinks to release one if all of them are in use
+ * @param[in, out] pool Pool
+ * @returns Block
+ */
+struct results_block* results_acquire(struct results_pool* pool);
+
+/**
+ * \ingroup sensor
+ * @brief Appends an entry to a block
+ * @param[in, out] block Block
+ * @param[in] sensor Sensor name (must outlive the block)
+ * @param[in] shm Shared memory board entry of the sensor (NULL if none)
+ * @param[in] flags Entry flags
+ * @returns Entry index, or -1 if the block is full
+ */
+int results_add(struct results_block* block,
+                const char* sensor,
+                struct shm_entry* shm,
+                uint8_t flags);
+
+/**
+ * \ingroup sensor
+ * @brief Hands a block over to every sink (an empty block, or one without sinks, is released)
+ * @param[in, out] pool Pool
+ * @param[in] block Block
+ */
+void results_publish(struct results_pool* pool, struct results_block* block);
+
+#endif
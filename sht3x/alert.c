@@ -0,0 +1,145 @@
+/*! @file alert.c
+ * @brief Event-driven SHT3x threshold alerts
+ */
+
+#include "alert.h"
+
+#include <string.h>
+
+#include "../log/log.h"
+#include "../utils/json/config.h"
+
+/**
+ * @brief Reads a [low, high] pair from a limits object
+ * @param[in] limits Limits object
+ * @param[in] key "temperature" or "humidity"
+ * @param[out] low Low limit
+ * @param[out] high High limit
+ * @retval 0 Found
+ * @retval -1 Not found
+ */
+static int8_t read_pair(const cJSON* limits, const char* key, double* low, double* high) {
+  const cJSON* pair = cJSON_GetObjectItemCaseSensitive(limits, key);
+
+  if (!cJSON_IsArray(pair) || cJSON_GetArraySize(pair) != 2 ||
+      !cJSON_IsNumber(cJSON_GetArrayItem(pair, 0)) || !cJSON_IsNumber(cJSON_GetArrayItem(pair, 1)))
+    return -1;
+
+  *low = cJSON_GetArrayItem(pair, 0)->valuedouble;
+  *high = cJSON_GetArrayItem(pair, 1)->valuedouble;
+  return 0;
+}
+
+int8_t sht3x_alert_config(struct sht3x_limits* limits, const char* path, const char* name) {
+  cJSON *json, *alerts;
+
+  // Sides that are not configured keep the sensor's range as limits and are masked out
+  *limits = (struct sht3x_limits){.temperature_low = -45, .temperature_high = 130,
+                                  .humidity_low = 0, .humidity_high = 100};
+
+  json = config_load(path);
+
+  alerts = cJSON_GetObjectItemCaseSensitive(json, "alerts");
+
+  const cJSON* sources[] = {cJSON_GetObjectItemCaseSensitive(alerts, "default"),
+                            cJSON_GetObjectItemCaseSensitive(alerts, name)};
+
+  for (int i = 0; i < 2; i++) {
+    if (!cJSON_IsObject(sources[i]))
+      continue;
+
+    if (read_pair(sources[i], "temperature", &limits->temperature_low,
+                  &limits->temperature_high) == 0)
+      limits->enabled |= SHT3X_ALERT_T_HIGH | SHT3X_ALERT_T_LOW;
+    if (read_pair(sources[i], "humidity", &limits->humidity_low, &limits->humidity_high) == 0)
+      limits->enabled |= SHT3X_ALERT_RH_HIGH | SHT3X_ALERT_RH_LOW;
+  }
+
+  cJSON_Delete(json);
+  return limits->enabled ? 0 : -1;
+}
+
+int16_t sht3x_alert_program(struct sht3x_sensor_data* sht, struct sht3x_alert* alert) {
+  const struct sht3x_limits* l = &alert->limits;
+  int16_t ret;
+
+  alert->active = 0;
+
+  // Thresholds are given in 1000 * %RH and 1000 * °C
+  ret = sht3x_set_alert_thd(sht, SHT3X_HIALRT_SET, l->humidity_high * 1000,
+                            l->temperature_high * 1000);
+  ret |= sht3x_set_alert_thd(sht, SHT3X_HIALRT_CLR, (l->humidity_high - ALERT_RH_HYSTERESIS) * 1000,
+                             (l->temperature_high - ALERT_T_HYSTERESIS) * 1000);
+  ret |= sht3x_set_alert_thd(sht, SHT3X_LOALRT_CLR, (l->humidity_low + ALERT_RH_HYSTERESIS) * 1000,
+                             (l->temperature_low + ALERT_T_HYSTERESIS) * 1000);
+  ret |= sht3x_set_alert_thd(sht, SHT3X_LOALRT_SET, l->humidity_low * 1000,
+                             l->temperature_low * 1000);
+  ret |= sht3x_clear_status(sht);
+  ret |= sht3x_start_periodic(sht);
+
+  return ret;
+}
+
+/**
+ * @brief Evaluates the alert flags of a measurement, with the same hysteresis as the sensor
+ * @param[in] sht Sensor struct
+ * @param[in] alert Alert state
+ * @returns Alert flags, of the configured sides only
+ */
+static uint8_t evaluate(const struct sht3x_sensor_data* sht, const struct sht3x_alert* alert) {
+  const struct sht3x_limits* l = &alert->limits;
+  double t = sht->data.temperature, rh = sht->data.humidity;
+  uint8_t flags = 0;
+
+  if (t >= l->temperature_high ||
+      (alert->active & SHT3X_ALERT_T_HIGH && t > l->temperature_high - ALERT_T_HYSTERESIS))
+    flags |= SHT3X_ALERT_T_HIGH;
+  if (t <= l->temperature_low ||
+      (alert->active & SHT3X_ALERT_T_LOW && t < l->temperature_low + ALERT_T_HYSTERESIS))
+    flags |= SHT3X_ALERT_T_LOW;
+  if (rh >= l->humidity_high ||
+      (alert->active & SHT3X_ALERT_RH_HIGH && rh > l->humidity_high - ALERT_RH_HYSTERESIS))
+    flags |= SHT3X_ALERT_RH_HIGH;
+  if (rh <= l->humidity_low ||
+      (alert->active & SHT3X_ALERT_RH_LOW && rh < l->humidity_low + ALERT_RH_HYSTERESIS))
+    flags |= SHT3X_ALERT_RH_LOW;
+
+  return flags & l->enabled;
+}
+
+int16_t sht3x_alert_poll(struct sht3x_sensor_data* sht,
+                         struct sht3x_alert* alert,
+                         uint8_t* raised,
+                         uint8_t* cleared) {
+  uint16_t status;
+  int16_t ret = sht3x_get_status(sht, &status);
+
+  *raised = *cleared = 0;
+
+  if (ret != STATUS_OK)
+    return ret;
+
+  if (SHT3X_IS_SYSTEM_RST_DETECT(status)) {
+    SIMAR_LOG(LOG_WARNING, "SHT3x %s was reset, reprogramming alert limits", sht->name);
+    return sht3x_alert_program(sht, alert);
+  }
+
+  if (!SHT3X_IS_ALRT_PENDING(status) && !alert->active)
+    return STATUS_OK;
+
+  // A new measurement is only available once per second; until then the last one still holds.
+  // The pending alert is only acknowledged once evaluated, so a failed fetch retries it.
+  if (sht3x_fetch(sht) != STATUS_OK)
+    return STATUS_OK;
+
+  uint8_t flags = evaluate(sht, alert);
+
+  *raised = flags & ~alert->active;
+  *cleared = alert->active & ~flags;
+  alert->active = flags;
+
+  if (SHT3X_IS_ALRT_PENDING(status))
+    ret = sht3x_clear_status(sht);
+
+  return ret;
+}
@@ -0,0 +1,92 @@
+/*! @file alert.h
+ * @brief Declarations for event-driven SHT3x threshold alerts
+ */
+
+#ifndef SHT3X_ALERT_H
+#define SHT3X_ALERT_H
+
+#include "sht3x.h"
+
+#define ALERT_CONFIG "/opt/device.json"
+#define ALERT_POLL_PERIOD 0.25
+#define ALERT_TREND_PERIOD 30
+#define ALERT_T_HYSTERESIS 0.5
+#define ALERT_RH_HYSTERESIS 2
+
+/* alert flags */
+#define SHT3X_ALERT_T_HIGH 0x01
+#define SHT3X_ALERT_T_LOW 0x02
+#define SHT3X_ALERT_RH_HIGH 0x04
+#define SHT3X_ALERT_RH_LOW 0x08
+
+/*!
+ * @brief Alert limits of a sensor (°C, %RH)
+ */
+struct sht3x_limits {
+  uint8_t enabled;  // Configured sides (alert flags), the others never raise an alert
+  double temperature_low;
+  double temperature_high;
+  double humidity_low;
+  double humidity_high;
+};
+
+/*!
+ * @brief Alert state of a sensor
+ */
+struct sht3x_alert {
+  struct sht3x_limits limits;
+  uint8_t active;
+};
+
+/**
+ * \ingroup sht3x
+ * \defgroup sht3xAlert Alerts
+ * @brief Hardware threshold alerts
+ *
+ * @details The limits are programmed into the sensor, which then tracks them on its own at one
+ * measurement per second. Watching an alert costs a single status word read; the measurement is
+ * only fetched when the sensor flags an alert, or while one is active.
+ */
+
+/**
+ * \ingroup sht3xAlert
+ * @brief Reads the alert limits of a sensor from the device configuration
+ *
+ * @details Example: `"alerts": {"default": {"temperature": [10, 35], "humidity": [20, 80]},
+ * "sensor_2_44": {"temperature": [15, 30]}}`. Per sensor entries override the default.
+ *
+ * @param[out] limits Alert limits (disabled if there are none for this sensor)
+ * @param[in] path Configuration file
+ * @param[in] name Sensor name
+ * @retval 0 Alerts enabled
+ * @retval -1 No limits configured
+ */
+int8_t sht3x_alert_config(struct sht3x_limits* limits, const char* path, const char* name);
+
+/**
+ * \ingroup sht3xAlert
+ * @brief Programs the limits (with hysteresis) and starts periodic measurements
+ * @param[in] sensor Sensor struct
+ * @param[in, out] alert Alert state (limits must be set)
+ * @return 0 if the commands were successful, else an error code
+ */
+int16_t sht3x_alert_program(struct sht3x_sensor_data* sensor, struct sht3x_alert* alert);
+
+/**
+ * \ingroup sht3xAlert
+ * @brief Checks the alert status of a sensor
+ *
+ * @details Reprograms the sensor if it was reset (its limits would be back to the defaults).
+ *
+ * @param[in, out] sensor Sensor struct (data is updated if a measurement was fetched)
+ * @param[in, out] alert Alert state
+ * @param[out] raised Alert flags raised since the last call
+ * @param[out] cleared Alert flags cleared since the last call
+ * @return 0 if the commands were successful, else an error code
+ */
+int16_t sht3x_alert_poll(struct sht3x_sensor_data* sensor,
+                         struct sht3x_alert* alert,
+                         uint8_t* raised,
+                         uint8_t* cleared);
+
+#endif
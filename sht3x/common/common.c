@@ -38,6 +38,7 @@
  */
 
 #include "common.h"
+#include <time.h>
 #include "../arch_config.h"
 
 uint16_t sensirion_bytes_to_uint16_t(const uint8_t* bytes) {
@@ -89,7 +90,7 @@ int8_t sensirion_i2c_general_call_reset(struct sht3x_sensor_data* sensor) {
   direct_mux(sensor->id.mux_id);
 
   if (sensor->id.ext_mux_id >= 0)
-    direct_ext_mux(sensor->id.ext_mux_id);
+    direct_ext_mux(sensor->id.ext_mux_id, sensor->id.ext_addr);
 
   return i2c_write(0, &data, (uint16_t)sizeof(data), &sensor->id);
 }
@@ -115,6 +116,41 @@ uint16_t sensirion_fill_cmd_send_buf(uint8_t* buf,
   return idx;
 }
 
+/**
+ * @brief Marks the sensor busy for the duration of a command, just issued
+ * @param[in, out] sensor Sensor struct
+ * @param[in] cmd Command
+ * @param[in] delay Minimum duration (µs)
+ */
+static void sensirion_i2c_issued(struct sht3x_sensor_data* sensor, uint16_t cmd, uint32_t delay) {
+  const struct sensirion_duration* d;
+
+  for (d = sensor->durations; d != NULL && d->cmd != 0; d++) {
+    if (d->cmd == cmd) {
+      if (d->usec > delay)
+        delay = d->usec;
+      break;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &sensor->ready);
+  sensor->ready.tv_nsec += delay * 1000L;
+  if (sensor->ready.tv_nsec >= 1000000000L) {
+    sensor->ready.tv_nsec -= 1000000000L;
+    sensor->ready.tv_sec++;
+  }
+}
+
+void sensirion_i2c_wait_ready(const struct sht3x_sensor_data* sensor) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (now.tv_sec < sensor->ready.tv_sec ||
+      (now.tv_sec == sensor->ready.tv_sec && now.tv_nsec < sensor->ready.tv_nsec))
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sensor->ready, NULL);
+}
+
 int8_t sensirion_i2c_read_words_as_bytes(struct sht3x_sensor_data* sensor,
                                          uint8_t* data,
                                          uint16_t num_words) {
@@ -127,10 +163,19 @@ int8_t sensirion_i2c_read_words_as_bytes(struct sht3x_sensor_data* sensor,
   direct_mux(sensor->id.mux_id);
 
   if (sensor->id.ext_mux_id >= 0)
-    direct_ext_mux(sensor->id.ext_mux_id);
+    direct_ext_mux(sensor->id.ext_mux_id, sensor->id.ext_addr);
 
-  delay_us(1000, NULL);
+  sensirion_i2c_wait_ready(sensor);
   ret = i2c_read(0, buf8, size, &sensor->id);
+
+#if !USE_SENSIRION_CLOCK_STRETCHING
+  /* still busy (e.g. slower than its datasheet duration): the sensor NACKs until it is done */
+  for (i = 0; ret != NO_ERROR && i < SENSIRION_POLL_RETRIES; i++) {
+    delay_us(SENSIRION_POLL_USEC, NULL);
+    ret = i2c_read(0, buf8, size, &sensor->id);
+  }
+#endif
+
   if (ret != NO_ERROR)
     return ret;
 
@@ -169,14 +214,21 @@ int8_t sensirion_i2c_read_words(struct sht3x_sensor_data* sensor,
 int16_t sensirion_i2c_write_cmd(struct sht3x_sensor_data* sensor, uint16_t command) {
   uint8_t buf[SENSIRION_COMMAND_SIZE];
 
+  int16_t ret;
+
   sensirion_fill_cmd_send_buf(buf, command, NULL, 0);
 
   direct_mux(sensor->id.mux_id);
 
   if (sensor->id.ext_mux_id >= 0)
-    direct_ext_mux(sensor->id.ext_mux_id);
+    direct_ext_mux(sensor->id.ext_mux_id, sensor->id.ext_addr);
+
+  sensirion_i2c_wait_ready(sensor);
+  ret = i2c_write(0, buf, SENSIRION_COMMAND_SIZE, &sensor->id);
+  if (ret == NO_ERROR)
+    sensirion_i2c_issued(sensor, command, 0);
 
-  return i2c_write(0, buf, SENSIRION_COMMAND_SIZE, &sensor->id);
+  return ret;
 }
 
 int16_t sensirion_i2c_write_cmd_with_args(struct sht3x_sensor_data* sensor,
@@ -185,15 +237,21 @@ int16_t sensirion_i2c_write_cmd_with_args(struct sht3x_sensor_data* sensor,
                                           uint16_t num_words) {
   uint8_t buf[SENSIRION_MAX_BUFFER_WORDS];
   uint16_t buf_size;
+  int16_t ret;
 
   buf_size = sensirion_fill_cmd_send_buf(buf, command, data_words, num_words);
 
   direct_mux(sensor->id.mux_id);
 
   if (sensor->id.ext_mux_id >= 0)
-    direct_ext_mux(sensor->id.ext_mux_id);
+    direct_ext_mux(sensor->id.ext_mux_id, sensor->id.ext_addr);
+
+  sensirion_i2c_wait_ready(sensor);
+  ret = i2c_write(0, buf, buf_size, &sensor->id);
+  if (ret == NO_ERROR)
+    sensirion_i2c_issued(sensor, command, 0);
 
-  return i2c_write(0, buf, buf_size, &sensor->id);
+  return ret;
 }
 
 int16_t sensirion_i2c_delayed_read_cmd(struct sht3x_sensor_data* sensor,
@@ -209,14 +267,14 @@ int16_t sensirion_i2c_delayed_read_cmd(struct sht3x_sensor_data* sensor,
   direct_mux(sensor->id.mux_id);
 
   if (sensor->id.ext_mux_id >= 0)
-    direct_ext_mux(sensor->id.ext_mux_id);
+    direct_ext_mux(sensor->id.ext_mux_id, sensor->id.ext_addr);
 
+  sensirion_i2c_wait_ready(sensor);
   ret = i2c_write(0, buf, SENSIRION_COMMAND_SIZE, &sensor->id);
   if (ret != NO_ERROR)
     return ret;
 
-  if (delay)
-    delay_us(delay, NULL);
+  sensirion_i2c_issued(sensor, cmd, delay);
 
   return sensirion_i2c_read_words(sensor, data_words, num_words);
 }
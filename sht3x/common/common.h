@@ -55,6 +55,9 @@ extern "C" {
 #define SENSIRION_WORD_SIZE 2
 #define SENSIRION_NUM_WORDS(x) (sizeof(x) / SENSIRION_WORD_SIZE)
 #define SENSIRION_MAX_BUFFER_WORDS 32
+/* without clock stretching a busy sensor NACKs reads: poll period and attempts */
+#define SENSIRION_POLL_USEC 500
+#define SENSIRION_POLL_RETRIES 4
 
 #define MAX_NAME_LEN 16
 
@@ -126,9 +129,20 @@ uint16_t sensirion_fill_cmd_send_buf(uint8_t* buf,
                                      const uint16_t* args,
                                      uint8_t num_args);
 
+/**
+ * @brief Waits until the sensor is done with the last command issued
+ *
+ * @details Only sleeps for the time left of the command duration, if any.
+ *
+ * @param[in] sensor        : Sensor struct
+ */
+void sensirion_i2c_wait_ready(const struct sht3x_sensor_data* sensor);
+
 /**
  * @brief Read data words from sensor
  *
+ * @details Waits for the last command to complete (see sensirion_i2c_wait_ready).
+ *
  * @param[in] sensor Sensor struct
  * @param[out] data_words   : Allocated buffer to store the read words.
  * The buffer may also have been modified on STATUS_FAIL return.
@@ -161,6 +175,10 @@ int8_t sensirion_i2c_read_words_as_bytes(struct sht3x_sensor_data* sensor,
 
 /**
  * @brief writes a command to the sensor
+ *
+ * @details Waits for the previous command to complete, then marks the sensor busy for the
+ * duration of this one.
+ *
  * @param[in] sensor        : Sensor struct
  * @param[in] command       : Sensor command
  *
@@ -188,7 +206,8 @@ int16_t sensirion_i2c_write_cmd_with_args(struct sht3x_sensor_data* sensor,
  *                                    process and read data back
  * @param[in] sensor        Sensor struct
  * @param[in] command       Command
- * @param[in] delay         Time in microseconds to delay sending the read request
+ * @param[in] delay         Minimum time in microseconds between the command and the read
+ * request, for commands missing from the duration table
  * @param[out] data_words   Allocated buffer to store the read data
  * @param[in] num_words     Data words to read (without CRC bytes)
  *
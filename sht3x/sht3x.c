@@ -42,10 +42,10 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <sys/ioctl.h>
-#include <syslog.h>
 #include <unistd.h>
 #include "arch_config.h"
 #include "common/common.h"
+#include "../log/log.h"
 
 /* all measurement commands return T (CRC) RH (CRC) */
 #if USE_SENSIRION_CLOCK_STRETCHING
@@ -61,20 +61,39 @@
 #define SHT3X_HUMIDITY_LIMIT_MSK 0xFE00U
 #define SHT3X_TEMPERATURE_LIMIT_MSK 0x01FFU
 
-static const uint16_t SHT3X_CMD_READ_STATUS_REG = 0xF32D;
-static const uint16_t SHT3X_CMD_CLR_STATUS_REG = 0x3041;
-static const uint16_t SHT3X_CMD_READ_SERIAL_ID = 0x3780;
-static const uint16_t SHT3X_CMD_DURATION_USEC = 1000;
+#define SHT3X_CMD_READ_STATUS_REG 0xF32D
+#define SHT3X_CMD_CLR_STATUS_REG 0x3041
+#define SHT3X_CMD_READ_SERIAL_ID 0x3780
+#define SHT3X_CMD_DURATION_USEC 1000
+/* periodic measurement (1 mps, high repeatability), needed for the alert limits to be tracked */
+#define SHT3X_CMD_PERIODIC_1MPS_HPM 0x2130
+#define SHT3X_CMD_FETCH_DATA 0xE000
+#define SHT3X_CMD_BREAK 0x3093
 /* read commands for the alert settings */
-static const uint16_t SHT3X_CMD_READ_HIALRT_LIM_SET = 0xE11F;
-static const uint16_t SHT3X_CMD_READ_HIALRT_LIM_CLR = 0xE114;
-static const uint16_t SHT3X_CMD_READ_LOALRT_LIM_CLR = 0xE109;
-static const uint16_t SHT3X_CMD_READ_LOALRT_LIM_SET = 0xE102;
+#define SHT3X_CMD_READ_HIALRT_LIM_SET 0xE11F
+#define SHT3X_CMD_READ_HIALRT_LIM_CLR 0xE114
+#define SHT3X_CMD_READ_LOALRT_LIM_CLR 0xE109
+#define SHT3X_CMD_READ_LOALRT_LIM_SET 0xE102
 /* write commands for the alert settings */
-static const uint16_t SHT3X_CMD_WRITE_HIALRT_LIM_SET = 0x611D;
-static const uint16_t SHT3X_CMD_WRITE_HIALRT_LIM_CLR = 0x6116;
-static const uint16_t SHT3X_CMD_WRITE_LOALRT_LIM_CLR = 0x610B;
-static const uint16_t SHT3X_CMD_WRITE_LOALRT_LIM_SET = 0x6100;
+#define SHT3X_CMD_WRITE_HIALRT_LIM_SET 0x611D
+#define SHT3X_CMD_WRITE_HIALRT_LIM_CLR 0x6116
+#define SHT3X_CMD_WRITE_LOALRT_LIM_CLR 0x610B
+#define SHT3X_CMD_WRITE_LOALRT_LIM_SET 0x6100
+
+/* time each command keeps the sensor busy, before it can be read or take another command */
+static const struct sensirion_duration sht3x_durations[] = {
+    {SHT3X_CMD_MEASURE_HPM, SHT3X_MEASUREMENT_DURATION_USEC},
+    {SHT3X_CMD_MEASURE_MPM, SHT3X_MEASUREMENT_DURATION_MPM_USEC},
+    {SHT3X_CMD_MEASURE_LPM, SHT3X_MEASUREMENT_DURATION_LPM_USEC},
+    {SHT3X_CMD_READ_STATUS_REG, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_READ_SERIAL_ID, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_FETCH_DATA, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_BREAK, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_READ_HIALRT_LIM_SET, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_READ_HIALRT_LIM_CLR, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_READ_LOALRT_LIM_CLR, SHT3X_CMD_DURATION_USEC},
+    {SHT3X_CMD_READ_LOALRT_LIM_SET, SHT3X_CMD_DURATION_USEC},
+    {0, 0}};
 
 static uint16_t sht3x_cmd_measure = SHT3X_CMD_MEASURE_HPM;
 
@@ -85,20 +104,21 @@ int8_t sht3x_init(struct sht3x_sensor_data* sht, uint8_t addr) {
   int8_t rslt = STATUS_OK;
 
   if (configure_mux()) {
-    syslog(LOG_CRIT, "Failed to configure mux switching.");
+    SIMAR_LOG(LOG_CRIT, "Failed to configure mux switching.");
     exit(1);
   }
 
   int8_t* fd = addr == SHT3X_I2C_ADDR_DFLT ? &fd_44 : &fd_45;
 
   if (i2c_open(fd, addr)) {
-    syslog(LOG_CRIT, "Failed to open bus");
+    SIMAR_LOG(LOG_CRIT, "Failed to open bus");
     exit(SENSOR_FAIL);
   }
 
   ioctl(*fd, 0x0703, addr);
 
   sht->id.fd = *fd;
+  sht->durations = sht3x_durations;
   rslt = sht3x_probe(sht);
 
   return rslt;
@@ -106,10 +126,8 @@ int8_t sht3x_init(struct sht3x_sensor_data* sht, uint8_t addr) {
 
 int16_t sht3x_measure_blocking_read(struct sht3x_sensor_data* sht) {
   int16_t ret = sht3x_measure(sht);
-  if (ret == STATUS_OK) {
-    delay_us(SHT3X_MEASUREMENT_DURATION_USEC, NULL);
+  if (ret == STATUS_OK)
     ret = sht3x_read(sht);
-  }
   return ret;
 }
 
@@ -117,6 +135,20 @@ int16_t sht3x_measure(struct sht3x_sensor_data* sht) {
   return sensirion_i2c_write_cmd(sht, sht3x_cmd_measure);
 }
 
+/**
+ * @brief Converts a measurement readout (T, RH ticks) into the sensor data
+ * @param[out] sht Sensor struct
+ * @param[in] words Readout words
+ */
+static void sht3x_convert(struct sht3x_sensor_data* sht, const uint16_t* words) {
+  int32_t temperature, humidity;
+  tick_to_temperature(words[0], &temperature);
+  tick_to_humidity(words[1], &humidity);
+
+  sht->data.temperature = temperature / 1000.0;
+  sht->data.humidity = humidity / 1000.0;
+}
+
 int16_t sht3x_read(struct sht3x_sensor_data* sht) {
   uint16_t words[2];
   int16_t ret = sensirion_i2c_read_words(sht, words, SENSIRION_NUM_WORDS(words));
@@ -125,25 +157,37 @@ int16_t sht3x_read(struct sht3x_sensor_data* sht) {
    * algebra: Temperature = 175 * S_T / 2^16 - 45
    * Relative Humidity = * 100 * S_RH / 2^16
    */
-  int32_t temperature, humidity;
-  tick_to_temperature(words[0], &temperature);
-  tick_to_humidity(words[1], &humidity);
+  sht3x_convert(sht, words);
 
-  sht->data.temperature = temperature / 1000.0;
-  sht->data.humidity = humidity / 1000.0;
+  return ret;
+}
+
+int16_t sht3x_start_periodic(struct sht3x_sensor_data* sht) {
+  return sensirion_i2c_write_cmd(sht, SHT3X_CMD_PERIODIC_1MPS_HPM);
+}
+
+int16_t sht3x_stop_periodic(struct sht3x_sensor_data* sht) {
+  return sensirion_i2c_write_cmd(sht, SHT3X_CMD_BREAK);
+}
+
+int16_t sht3x_fetch(struct sht3x_sensor_data* sht) {
+  uint16_t words[2];
+  int16_t ret =
+      sensirion_i2c_read_cmd(sht, SHT3X_CMD_FETCH_DATA, words, SENSIRION_NUM_WORDS(words));
+
+  if (ret == STATUS_OK)
+    sht3x_convert(sht, words);
 
   return ret;
 }
 
 int16_t sht3x_probe(struct sht3x_sensor_data* sht) {
   uint16_t status;
-  return sensirion_i2c_delayed_read_cmd(sht, SHT3X_CMD_READ_STATUS_REG, SHT3X_CMD_DURATION_USEC,
-                                        &status, 1);
+  return sensirion_i2c_read_cmd(sht, SHT3X_CMD_READ_STATUS_REG, &status, 1);
 }
 
 int16_t sht3x_get_status(struct sht3x_sensor_data* sht, uint16_t* status) {
-  return sensirion_i2c_delayed_read_cmd(sht, SHT3X_CMD_READ_STATUS_REG, SHT3X_CMD_DURATION_USEC,
-                                        status, 1);
+  return sensirion_i2c_read_cmd(sht, SHT3X_CMD_READ_STATUS_REG, status, 1);
 }
 
 int16_t sht3x_clear_status(struct sht3x_sensor_data* sht) {
@@ -175,12 +219,20 @@ void sht3x_set_power_mode(sht3x_measurement_mode_t mode) {
   }
 }
 
+uint32_t sht3x_measurement_duration() {
+  const struct sensirion_duration* d;
+
+  for (d = sht3x_durations; d->cmd != sht3x_cmd_measure; d++)
+    ;
+
+  return d->usec;
+}
+
 int16_t sht3x_read_serial(struct sht3x_sensor_data* sht, uint32_t* serial) {
   int16_t ret;
   uint8_t serial_bytes[4];
 
   ret = sensirion_i2c_write_cmd(sht, SHT3X_CMD_READ_SERIAL_ID);
-  delay_us(SHT3X_CMD_DURATION_USEC, NULL);
 
   if (ret == STATUS_OK) {
     ret = sensirion_i2c_read_words_as_bytes(sht, serial_bytes, SENSIRION_NUM_WORDS(serial_bytes));
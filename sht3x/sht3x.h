@@ -50,6 +50,8 @@
 #ifndef SHT3X_H
 #define SHT3X_H
 
+#include <time.h>
+
 #include "../i2c/common.h"
 
 #ifdef __cplusplus
@@ -61,7 +63,10 @@ extern "C" {
 #define STATUS_CRC_FAIL (-2)
 #define STATUS_UNKNOWN_DEVICE (-3)
 #define STATUS_ERR_INVALID_PARAMS (-4)
-#define SHT3X_MEASUREMENT_DURATION_USEC 15000
+/* maximum measurement durations per repeatability (datasheet) */
+#define SHT3X_MEASUREMENT_DURATION_USEC 15500
+#define SHT3X_MEASUREMENT_DURATION_MPM_USEC 6500
+#define SHT3X_MEASUREMENT_DURATION_LPM_USEC 4500
 
 /* status word macros */
 #define SHT3X_IS_ALRT_PENDING(status) (((status)&0x8000U) != 0U)
@@ -78,14 +83,27 @@ struct sht3x_data {
   double humidity;
 };
 
+/*!
+ * @brief Time a command keeps the sensor busy, before it can be read or take another command
+ */
+struct sensirion_duration {
+  uint16_t cmd;
+  uint16_t usec;
+};
+
 /*!
  * @brief Parent struct for identification and readout data for the SHT3x.
+ *
+ * @details `ready` is when the sensor is done with the last command issued, from the `durations`
+ * table of the driver (terminated by a zero command).
  */
 struct sht3x_sensor_data {
   double past_pres;
   struct sht3x_data data;
   struct identifier id;
   char name[MAX_NAME_LEN];
+  struct timespec ready;
+  const struct sensirion_duration* durations;
 };
 
 /**
@@ -204,8 +222,7 @@ int16_t sht3x_measure(struct sht3x_sensor_data* sensor);
  * @brief Reads out the results of a measurement
  *
  * @details Reads out results of a measurement that was previously started by
- * sht3x_measure(). If the measurement is still in progress, this function
- * returns an error.
+ * sht3x_measure(), waiting for whatever is left of the measurement duration.
  * Temperature is returned in [degree Celsius], multiplied by 1000,
  * and relative humidity in [percent relative humidity], multiplied by 1000.
  *
@@ -215,6 +232,40 @@ int16_t sht3x_measure(struct sht3x_sensor_data* sensor);
  */
 int16_t sht3x_read(struct sht3x_sensor_data* sensor);
 
+/**
+ * \ingroup sht3xSensorData
+ * @brief Starts periodic measurements (1 per second, high repeatability)
+ *
+ * @details The alert thresholds are only tracked in periodic mode. Single shot measurements
+ * (sht3x_measure()) are rejected until sht3x_stop_periodic() is called; use sht3x_fetch() instead.
+ *
+ * @param[in] sensor                : Sensor struct
+ *
+ * @return 0 if the command was successful, else an error code.
+ */
+int16_t sht3x_start_periodic(struct sht3x_sensor_data* sensor);
+
+/**
+ * \ingroup sht3xSensorData
+ * @brief Stops periodic measurements
+ *
+ * @param[in] sensor                : Sensor struct
+ *
+ * @return 0 if the command was successful, else an error code.
+ */
+int16_t sht3x_stop_periodic(struct sht3x_sensor_data* sensor);
+
+/**
+ * \ingroup sht3xSensorData
+ * @brief Reads out the latest periodic measurement
+ *
+ * @param[in, out] sensor           : Sensor struct
+ *
+ * @return 0 if the command was successful, else an error code (also if no new measurement is
+ * available since the last fetch).
+ */
+int16_t sht3x_fetch(struct sht3x_sensor_data* sensor);
+
 /**
  * \ingroup sht3x
  * \defgroup sht3xSensorPower Sensor Power
@@ -237,6 +288,14 @@ void sht3x_enable_low_power_mode(uint8_t enable_low_power_mode);
  */
 void sht3x_set_power_mode(sht3x_measurement_mode_t mode);
 
+/**
+ * \ingroup sht3xSensorPower
+ * @brief Gets the duration of a single shot measurement in the current power mode
+ *
+ * @return Duration in microseconds
+ */
+uint32_t sht3x_measurement_duration();
+
 /**
  * @brief Read out the serial number
  *
@@ -32,6 +32,7 @@
 #define SENSOR_FAIL -2
 #define DB_FAIL -3
 #define BUS_FAIL -9
+#define MEM_FAIL -5
 
 /// Convenience enum for translating common pin names to their respective integer values
 enum pins {
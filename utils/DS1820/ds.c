@@ -4,26 +4,20 @@
 #include <string.h>
 
 double get_temp(FILE* f) {
-  char* buf = 0;
-  long length;
-  if (f) {
-    fseek(f, 0, SEEK_END);
-    length = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    buf = malloc(length);
-  }
+  char buf[128];
+  size_t length;
 
-  if (buf) {
-    fread(buf, 1, length, f);
-    buf = strstr(buf, "t=");
-  }
+  // w1_slave is regenerated on every read, so it is read from the start each time
+  rewind(f);
+  length = fread(buf, 1, sizeof(buf) - 1, f);
+  buf[length] = '\0';
 
-  return atoi(buf + 2) / 1000.0;
+  char* t = strstr(buf, "t=");
+  return t != NULL ? atoi(t + 2) / 1000.0 : 0.0;
 }
 
-char* find_device() {
+int find_device(char* device_name, size_t len) {
   DIR* dir;
-  char* device_name = malloc(80);
   struct dirent* de;
 
   dir = opendir("/sys/bus/w1/devices/");
@@ -33,17 +27,30 @@ char* find_device() {
       break;
 
     if (strstr(de->d_name, "28") != NULL) {
-      snprintf(device_name, 335, "/sys/bus/w1/devices/%s/w1_slave", de->d_name);
-      break;
+      snprintf(device_name, len, "/sys/bus/w1/devices/%s/w1_slave", de->d_name);
+      closedir(dir);
+      return 0;
     }
   }
-  closedir(dir);
 
-  return device_name;
+  if (dir)
+    closedir(dir);
+
+  return -1;
 }
 
 int main() {
-  FILE* f = fopen(find_device(), "r");
+  char device_name[300];
+
+  if (find_device(device_name, sizeof(device_name))) {
+    fprintf(stderr, "No DS18B20 found\n");
+    return 1;
+  }
+
+  FILE* f = fopen(device_name, "r");
+  if (f == NULL)
+    return 1;
+
   while (1)
     printf("%.2f C\n", get_temp(f));
 
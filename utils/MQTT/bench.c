@@ -0,0 +1,172 @@
+/*! @file bench.c
+ * @brief Throughput and latency benchmark for the MQTT backend against a local broker
+ *
+ * Publishes sweeps through the same client the daemons use (mqtt/common.c) while a second client
+ * subscribes to them. Every published value is the send time, so the subscriber measures the
+ * end-to-end latency of each message.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../mqtt/common.h"
+
+#define MAX_SAMPLES 1000000
+
+double latency[MAX_SAMPLES];
+uint32_t received, samples;
+
+/**
+ * @brief Monotonic time in milliseconds
+ * @returns Milliseconds since an arbitrary point
+ */
+double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void on_message(const char* topic, const uint8_t* payload, size_t len) {
+  char buf[MQTT_MAX_PACKET];
+  double t = now_ms();
+
+  memcpy(buf, payload, len < sizeof(buf) ? len : sizeof(buf) - 1);
+  buf[len < sizeof(buf) ? len : sizeof(buf) - 1] = '\0';
+
+  // Batched sweeps carry the send time in every field; one sample per document is enough
+  char* value = strchr(buf, '{') ? strstr(buf, "\"t0\":") : buf;
+  if (value && samples < MAX_SAMPLES)
+    latency[samples++] = t - atof(value + (value == buf ? 0 : 5));
+
+  received++;
+}
+
+int compare(const void* a, const void* b) {
+  double da = *(const double*)a, db = *(const double*)b;
+  return da < db ? -1 : da > db;
+}
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-a host] [-p port] [-n sweeps] [-s fields per sweep] [-q 0|1] [-w window] "
+          "[-b (batched)]\n",
+          prog);
+}
+
+int main(int argc, char* argv[]) {
+  struct mqtt_config cfg = {.enabled = 1, .port = MQTT_PORT, .qos = 1,
+                            .window = MQTT_DEFAULT_WINDOW};
+  struct mqtt_client *pub = malloc(sizeof(*pub)), *sub = malloc(sizeof(*sub));
+  int sweeps = 10000, fields = 8, opt;
+  char field[8];
+
+  snprintf(cfg.host, sizeof(cfg.host), "127.0.0.1");
+  snprintf(cfg.prefix, sizeof(cfg.prefix), "bench");
+
+  while ((opt = getopt(argc, argv, "a:p:n:s:q:w:bh")) != -1) {
+    switch (opt) {
+      case 'a':
+        snprintf(cfg.host, sizeof(cfg.host), "%s", optarg);
+        break;
+      case 'p':
+        cfg.port = atoi(optarg);
+        break;
+      case 'n':
+        sweeps = atoi(optarg);
+        break;
+      case 's':
+        fields = atoi(optarg);
+        break;
+      case 'q':
+        cfg.qos = atoi(optarg) > 0;
+        break;
+      case 'w':
+        cfg.window = atoi(optarg);
+        break;
+      case 'b':
+        cfg.batch = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (sweeps < 1 || fields < 1 || fields > 64 || cfg.window < 1 || cfg.window > MQTT_QUEUE_LEN) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct mqtt_config sub_cfg = cfg;
+  snprintf(cfg.client_id, sizeof(cfg.client_id), "bench-pub");
+  snprintf(sub_cfg.client_id, sizeof(sub_cfg.client_id), "bench-sub");
+
+  mqtt_init(pub, &cfg);
+  mqtt_init(sub, &sub_cfg);
+  sub->on_message = on_message;
+
+  double deadline = now_ms() + 5000;
+  while (mqtt_sync(sub, 10) || mqtt_sync(pub, 10)) {
+    if (now_ms() > deadline) {
+      fprintf(stderr, "Could not connect to %s:%d\n", cfg.host, cfg.port);
+      return 1;
+    }
+  }
+
+  mqtt_subscribe(sub, "bench/#");
+  // Let the subscription settle before measuring
+  for (double t = now_ms(); now_ms() - t < 200;)
+    mqtt_sync(sub, 10);
+
+  uint32_t per_sweep = cfg.batch ? 1 : fields;
+  uint32_t expected = sweeps * per_sweep;
+  double start = now_ms();
+
+  for (int i = 0; i < sweeps;) {
+    // Never overrun the queue: the daemons would drop data, the benchmark must not
+    if (MQTT_QUEUE_LEN - (pub->tail - pub->head) >= per_sweep) {
+      double t = now_ms();
+      mqtt_sweep_begin(pub, "sweep");
+      for (int f = 0; f < fields; f++) {
+        snprintf(field, sizeof(field), "t%d", f);
+        mqtt_sweep_add(pub, "bench", field, t);
+      }
+      mqtt_sweep_end(pub);
+      i++;
+    } else {
+      mqtt_sync(pub, 1);
+    }
+    mqtt_sync(sub, 0);
+  }
+
+  deadline = now_ms() + 10000;
+  while ((received < expected || pub->head != pub->tail) && now_ms() < deadline) {
+    mqtt_sync(pub, 1);
+    mqtt_sync(sub, 1);
+  }
+
+  double elapsed = (now_ms() - start) / 1000;
+
+  qsort(latency, samples, sizeof(double), compare);
+
+  printf("%s, QoS %d, window %d, %d sweeps of %d fields\n",
+         cfg.batch ? "batched" : "topic per sensor", cfg.qos, cfg.window, sweeps, fields);
+  printf("Published %u messages (%u acked, %u dropped), received %u in %.3f s\n",
+         pub->stats.published, pub->stats.acked, pub->stats.dropped, received, elapsed);
+  printf("Throughput: %.0f messages/s, %.0f fields/s\n", received / elapsed,
+         received * (double)fields / per_sweep / elapsed);
+
+  if (samples > 0)
+    printf("Latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", latency[samples / 2],
+           latency[samples * 9 / 10], latency[samples * 99 / 100], latency[samples - 1]);
+
+  mqtt_disconnect(pub);
+  mqtt_disconnect(sub);
+  free(pub);
+  free(sub);
+
+  return received < expected;
+}
@@ -0,0 +1,234 @@
+/*! @file bench.c
+ * @brief Frequency response checks and throughput benchmark for the decimation stages
+ *
+ * Uses the cascade a 3840 Hz ADC stream would go through down to a 10 Hz view. Every stage is fed
+ * sine waves across its input band; the measured output amplitude must match the designed
+ * response (so the vectorized path computes the right filter) and stay within the pass and stop
+ * band limits. Throughput is then measured per stage and for the whole cascade, next to a scalar
+ * reference of the same filter.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../../dsp/decimate.h"
+
+#define INPUT_RATE 3840
+#define BLOCK 1024
+// Output samples measured per frequency
+#define OUTPUTS 1024
+// Pass band edge and stop band start, as fractions of the output rate
+#define PASS_EDGE 0.25
+#define STOP_START 0.75
+#define PASS_RIPPLE_DB 0.1
+#define STOP_ATTENUATION_DB 70
+// Largest difference between the measured and the designed gain
+#define GAIN_TOLERANCE 1e-3
+
+/*!
+ * @brief Stage of the cascade
+ */
+struct stage {
+  uint16_t factor;
+  uint16_t taps;
+};
+
+const struct stage stages[] = {{8, 96}, {8, 96}, {6, 72}};
+#define STAGES (sizeof(stages) / sizeof(stages[0]))
+
+float buffer[BLOCK], source[BLOCK];
+
+/**
+ * @brief Monotonic time in seconds
+ * @returns Seconds since an arbitrary point
+ */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Measures the gain of a stage at one frequency from its output amplitude
+ *
+ * @details The frequency is a multiple of 1 / OUTPUTS of the output rate, so the output (aliased
+ * or not) holds a whole number of periods and its mean square is exactly half the squared gain.
+ *
+ * @param[in, out] d Stage
+ * @param[in] k Frequency, in 1 / OUTPUTS of the output rate
+ * @returns Gain
+ */
+double measure(struct decimator* d, uint32_t k) {
+  double frequency = (double)k / OUTPUTS / d->factor;
+  uint32_t settle = (d->taps + d->factor - 1) / d->factor * d->factor;
+  uint32_t length = settle + OUTPUTS * d->factor, outputs = 0;
+  double sum = 0;
+
+  decimate_reset(d);
+
+  for (uint32_t i = 0; i < length; i += BLOCK) {
+    uint32_t amount = length - i < BLOCK ? length - i : BLOCK;
+
+    for (uint32_t j = 0; j < amount; j++)
+      buffer[j] = sin(2 * M_PI * frequency * (i + j));
+
+    uint32_t produced = decimate_block(d, buffer, amount, buffer);
+
+    // The settling time is a multiple of the factor, so exactly OUTPUTS outputs follow it
+    for (uint32_t j = 0; j < produced; j++, outputs++) {
+      if (outputs >= settle / d->factor)
+        sum += buffer[j] * buffer[j];
+    }
+  }
+
+  return sqrt(2 * sum / OUTPUTS);
+}
+
+/**
+ * @brief Checks the response of a stage across its input band
+ * @param[in, out] d Stage
+ * @param[in] number Stage number
+ * @retval 1 Within limits
+ * @retval 0 Out of limits
+ */
+int check_response(struct decimator* d, int number) {
+  double worst_pass = 0, worst_stop = -INFINITY, worst_error = 0;
+
+  // Up to the input Nyquist frequency, skipping those aliased onto 0 or the output Nyquist
+  for (uint32_t k = 5; k < OUTPUTS / 2 * d->factor; k += 9) {
+    if (k % (OUTPUTS / 2) == 0)
+      continue;
+
+    // Frequency as a fraction of the output rate, for the limits, and of the input rate
+    double f = (double)k / OUTPUTS, input = f / d->factor;
+    double gain = measure(d, k);
+    double db = 20 * log10(gain + 1e-12);
+    double error = fabs(gain - decimate_response(d, input));
+
+    if (error > worst_error)
+      worst_error = error;
+    if (f <= PASS_EDGE && fabs(db) > worst_pass)
+      worst_pass = fabs(db);
+    if (f >= STOP_START && db > worst_stop)
+      worst_stop = db;
+  }
+
+  int ok = worst_pass <= PASS_RIPPLE_DB && worst_stop <= -STOP_ATTENUATION_DB &&
+           worst_error <= GAIN_TOLERANCE;
+
+  printf("Stage %d (/%-2u %3u taps): pass band %.4f dB, stop band %.1f dB, error %.1e  %s\n",
+         number, d->factor, d->taps, worst_pass, worst_stop, worst_error, ok ? "OK" : "FAIL");
+  return ok;
+}
+
+/**
+ * @brief Scalar reference of decimate_block, for the throughput comparison
+ * @param[in, out] d Stage
+ * @param[in] in Input samples
+ * @param[in] amount Input samples
+ * @param[out] out Output samples
+ * @returns Output samples written
+ */
+uint32_t reference_block(struct decimator* d, const float* in, uint32_t amount, float* out) {
+  uint32_t produced = 0;
+
+  for (uint32_t i = 0; i < amount; i++) {
+    d->pos = d->pos == 0 ? d->taps - 1 : d->pos - 1;
+    d->history[d->pos] = d->history[d->pos + d->taps] = in[i];
+
+    if (++d->phase == d->factor) {
+      float sum = 0;
+      d->phase = 0;
+      for (int k = 0; k < d->taps; k++)
+        sum += d->coeffs[k] * d->history[d->pos + k];
+      out[produced++] = sum;
+    }
+  }
+
+  return produced;
+}
+
+/**
+ * @brief Measures the input samples per second a stage processes
+ * @param[in, out] d Stage
+ * @param[in] block Block function
+ * @param[in] samples Samples to feed
+ * @returns Samples per second
+ */
+double throughput(struct decimator* d,
+                  uint32_t (*block)(struct decimator*, const float*, uint32_t, float*),
+                  uint32_t samples) {
+  double start = now();
+
+  for (uint32_t i = 0; i < samples; i += BLOCK)
+    block(d, source, BLOCK, buffer);
+
+  return samples / (now() - start);
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-n samples per throughput run]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  struct decimator chain[STAGES];
+  uint32_t samples = 20000000;
+  int failed = 0, opt;
+  double rate = INPUT_RATE;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        samples = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  for (unsigned s = 0; s < STAGES; s++) {
+    if (decimate_init(&chain[s], stages[s].factor, stages[s].taps, 0.5, DECIMATE_LINEAR)) {
+      fprintf(stderr, "Invalid stage %u\n", s);
+      return 1;
+    }
+    printf("Stage %u: %.0f Hz -> %.0f Hz\n", s, rate, rate / stages[s].factor);
+    rate /= stages[s].factor;
+  }
+
+  printf("\nFrequency response (pass band up to %.2f, stop band from %.2f of the output rate)\n",
+         PASS_EDGE, STOP_START);
+  for (unsigned s = 0; s < STAGES; s++)
+    failed += !check_response(&chain[s], s);
+
+  for (uint32_t i = 0; i < BLOCK; i++)
+    source[i] = sin(0.01 * i);
+
+  printf("\nThroughput (input samples/s, %d lanes)\n", DECIMATE_LANES);
+  for (unsigned s = 0; s < STAGES; s++) {
+    double vector = throughput(&chain[s], decimate_block, samples);
+    double scalar = throughput(&chain[s], reference_block, samples / 4);
+
+    printf("Stage %u: %6.1f M/s vectorized, %6.1f M/s scalar (%.1fx)\n", s, vector / 1e6,
+           scalar / 1e6, vector / scalar);
+  }
+
+  // Whole cascade: every later stage works in place on the previous stage's output
+  double start = now();
+  for (uint32_t i = 0; i < samples; i += BLOCK) {
+    uint32_t amount = decimate_block(&chain[0], source, BLOCK, buffer);
+
+    for (unsigned s = 1; s < STAGES; s++)
+      amount = decimate_block(&chain[s], buffer, amount, buffer);
+  }
+  double cascade = samples / (now() - start);
+
+  printf("Cascade: %.1f M/s, %.0fx real time at %d Hz\n", cascade / 1e6, cascade / INPUT_RATE,
+         INPUT_RATE);
+
+  printf("\n%d of %zu stages out of limits\n", failed, STAGES);
+  return failed != 0;
+}
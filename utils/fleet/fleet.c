@@ -0,0 +1,219 @@
+/*! @file fleet.c
+ * @brief Fleet simulator for central Redis server sharding
+ *
+ * Spawns many simulated nodes, places them on a set of (usually local) Redis instances through the
+ * same consistent hash ring used by the daemons, and reports per-server load and failover time when
+ * one of the servers is shut down mid-run.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../redis/common.h"
+
+#define MAX_NODES 4096
+
+/*!
+ * @brief Simulated node
+ */
+struct node {
+  char name[48];
+  redisContext* c;
+  int server;
+  int primary;
+  double failed_at;
+};
+
+struct node nodes[MAX_NODES];
+char servers[RING_MAX_SERVERS][SERVER_LEN];
+redisContext* admin[RING_MAX_SERVERS];
+
+/**
+ * @brief Monotonic time in seconds
+ * @returns Seconds since an arbitrary point
+ */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Reads the total amount of commands processed by a server
+ * @param[in] c Server context
+ * @returns Processed commands, or -1 if the server is not reachable
+ */
+long long commands_processed(redisContext* c) {
+  long long total = -1;
+  redisReply* reply = c ? redisCommand(c, "INFO stats") : NULL;
+
+  if (reply != NULL && reply->type == REDIS_REPLY_STRING) {
+    char* field = strstr(reply->str, "total_commands_processed:");
+    if (field)
+      total = atoll(field + strlen("total_commands_processed:"));
+  }
+
+  freeReplyObject(reply);
+  return total;
+}
+
+/**
+ * @brief Publishes one volt-like measurement block for a node
+ * @param[in] n Node
+ * @retval 0 OK
+ * @retval -1 Server not reachable
+ */
+int publish(struct node* n) {
+  redisReply* reply = redisCommand(
+      n->c, "HSET %s:ich 0 0.512 1 0.000 2 1.204 3 0.000 4 3.331 5 0.000 6 0.870", n->name);
+  int ret = reply == NULL || reply->type == REDIS_REPLY_ERROR ? -1 : 0;
+
+  freeReplyObject(reply);
+  return ret;
+}
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-n nodes] [-r rounds] [-k server index to shut down] host:port...\n"
+          "Example: %s -n 1000 -r 20 -k 1 127.0.0.1:6380 127.0.0.1:6381 127.0.0.1:6382\n",
+          prog, prog);
+}
+
+int main(int argc, char* argv[]) {
+  int node_amount = 500, rounds = 10, kill = -1, opt;
+  struct redis_ring ring;
+  long long before[RING_MAX_SERVERS], after[RING_MAX_SERVERS];
+  int owned[RING_MAX_SERVERS] = {0};
+
+  while ((opt = getopt(argc, argv, "n:r:k:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        node_amount = atoi(optarg);
+        break;
+      case 'r':
+        rounds = atoi(optarg);
+        break;
+      case 'k':
+        kill = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  int server_amount = argc - optind;
+
+  if (server_amount < 1 || server_amount > RING_MAX_SERVERS || node_amount < 1 ||
+      node_amount > MAX_NODES || kill >= server_amount) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  for (int i = 0; i < server_amount; i++) {
+    char host[SERVER_LEN];
+    snprintf(servers[i], SERVER_LEN, "%s", argv[optind + i]);
+    int port = ring_server_addr(servers[i], host);
+
+    admin[i] = redisConnectWithTimeout(host, port, (struct timeval){1, 0});
+    if (admin[i] == NULL || admin[i]->err) {
+      fprintf(stderr, "Could not connect to %s\n", servers[i]);
+      return 1;
+    }
+  }
+
+  ring_init(&ring, (const char(*)[SERVER_LEN])servers, server_amount);
+
+  double t = now();
+  for (int i = 0; i < node_amount; i++) {
+    struct node* n = &nodes[i];
+    snprintf(n->name, sizeof(n->name), "SIMAR:10.%d.%d.%d:sim%d", i >> 16, (i >> 8) & 0xFF,
+             i & 0xFF, i);
+    n->primary = ring_lookup(&ring, n->name, 0, 0);
+    n->c = ring_connect(&ring, n->name, (struct timeval){1, 0}, server_amount, &n->server);
+    if (n->c == NULL) {
+      fprintf(stderr, "Node %s could not connect (too many open files? check ulimit -n)\n",
+              n->name);
+      return 1;
+    }
+    owned[n->server]++;
+  }
+  printf("Connected %d nodes in %.3f s\n", node_amount, now() - t);
+
+  for (int i = 0; i < server_amount; i++)
+    before[i] = commands_processed(admin[i]);
+
+  double kill_time = 0, failover_sum = 0, failover_max = 0;
+  int failed_over = 0, moved_elsewhere = 0;
+
+  t = now();
+  for (int r = 0; r < rounds; r++) {
+    if (kill >= 0 && r == rounds / 2) {
+      // Counters are taken right before the shutdown, since the server will not report them after
+      after[kill] = commands_processed(admin[kill]);
+      redisReply* reply = redisCommand(admin[kill], "SHUTDOWN NOSAVE");
+      freeReplyObject(reply);
+      kill_time = now();
+      printf("Round %d: shut down %s\n", r, servers[kill]);
+    }
+
+    for (int i = 0; i < node_amount; i++) {
+      struct node* n = &nodes[i];
+
+      while (publish(n)) {
+        if (n->failed_at == 0)
+          n->failed_at = now();
+
+        redisFree(n->c);
+        n->c = ring_connect(&ring, n->name, (struct timeval){1, 0}, server_amount, &n->server);
+        if (n->c == NULL) {
+          fprintf(stderr, "Node %s lost every replica\n", n->name);
+          return 1;
+        }
+      }
+
+      if (n->failed_at != 0) {
+        // Time from the shutdown until this node published again on its replica
+        double failover = now() - kill_time;
+        failover_sum += failover;
+        if (failover > failover_max)
+          failover_max = failover;
+        failed_over++;
+        if (n->primary != kill)
+          moved_elsewhere++;
+        n->failed_at = 0;
+      }
+    }
+  }
+  double elapsed = now() - t;
+
+  printf("\n%-22s %8s %12s %10s\n", "Server", "Nodes", "Commands", "Share");
+  long long total = 0;
+  for (int i = 0; i < server_amount; i++) {
+    if (i != kill)
+      after[i] = commands_processed(admin[i]);
+    total += after[i] - before[i];
+  }
+  for (int i = 0; i < server_amount; i++)
+    printf("%-22s %8d %12lld %9.1f%%\n", servers[i], owned[i], after[i] - before[i],
+           100.0 * (after[i] - before[i]) / (total ? total : 1));
+
+  printf("\n%d publishes in %.3f s (%.0f ops/s)\n", node_amount * rounds, elapsed,
+         node_amount * rounds / elapsed);
+
+  if (kill >= 0) {
+    printf("Failed over %d nodes (%d of them not owned by %s), mean %.3f s, max %.3f s\n",
+           failed_over, moved_elsewhere, servers[kill],
+           failed_over ? failover_sum / failed_over : 0.0, failover_max);
+  }
+
+  for (int i = 0; i < node_amount; i++)
+    redisFree(nodes[i].c);
+  for (int i = 0; i < server_amount; i++)
+    redisFree(admin[i]);
+
+  return 0;
+}
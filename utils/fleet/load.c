@@ -0,0 +1,501 @@
+/*! @file load.c
+ * @brief Fleet load generator for central Redis capacity planning
+ *
+ * Simulates thousands of nodes from a single epoll loop, each one publishing with the same append_*
+ * functions the daemons use (redis/common.c), at the daemons' periods. Every publishing mode runs
+ * as its own phase, reporting acknowledged commands per second, sweep round-trip latency
+ * percentiles and the CPU time the Redis server spent on it.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../redis/common.h"
+
+#define MAX_NODES 16384
+#define MAX_EVENTS 256
+#define HIST_LINEAR 64
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS (HIST_LINEAR + 40 * (1 << HIST_SUB_BITS))
+#define MAX_SENSORS 256
+#define SCRIPT_ARGS (SWEEP_COMMAND_ARGS + SWEEP_ARGS + SWEEP_READOUT_ARGS * MAX_SENSORS)
+
+/// Publishing modes, one per daemon code path
+enum mode { MODE_BME, MODE_SCRIPT, MODE_VOLT, MODE_WIRELESS, MODE_COMMAND, MODE_AMOUNT };
+
+// "script" is the bme sweep in the script publish mode
+const char* mode_names[MODE_AMOUNT] = {"bme", "script", "volt", "wireless", "command"};
+// Same periods as the daemons' main loops (and volt's command listener)
+const double mode_periods[MODE_AMOUNT] = {0.25, 0.25, 1.5, 0.75, 2.0};
+
+/*!
+ * @brief Simulated node
+ */
+struct node {
+  redisContext* c;
+  uint8_t connected;
+  uint8_t writing;
+  uint8_t dead;
+  int pending;
+  int id;
+  double sent;
+  double next;
+  char name[48];
+};
+
+/*!
+ * @brief Results for one phase
+ */
+struct phase_stats {
+  uint64_t replies;
+  uint64_t errors;
+  uint64_t sweeps;
+  uint64_t overruns;
+  uint64_t latency[HIST_BUCKETS];
+};
+
+struct node nodes[MAX_NODES];
+int sensor_amount = 8;
+char sweep_sha[SWEEP_SHA_LEN];
+const char* script_argv[SCRIPT_ARGS];
+size_t script_argvlen[SCRIPT_ARGS];
+char script_values[SCRIPT_ARGS][64];
+
+/**
+ * @brief Monotonic time in seconds
+ * @returns Seconds since an arbitrary point
+ */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Maps a latency to its histogram bucket (log-linear, ~3% resolution)
+ * @param[in] us Latency in microseconds
+ * @returns Bucket index
+ */
+int hist_bucket(uint64_t us) {
+  if (us < HIST_LINEAR)
+    return us;
+
+  int msb = 63 - __builtin_clzll(us);
+  int idx = HIST_LINEAR + (msb - 6) * (1 << HIST_SUB_BITS) +
+            ((us >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+
+  return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief Lower bound of a histogram bucket
+ * @param[in] idx Bucket index
+ * @returns Latency in microseconds
+ */
+uint64_t hist_value(int idx) {
+  if (idx < HIST_LINEAR)
+    return idx;
+
+  int msb = (idx - HIST_LINEAR) / (1 << HIST_SUB_BITS) + 6;
+  uint64_t sub = (idx - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+
+  return (1ULL << msb) | (sub << (msb - HIST_SUB_BITS));
+}
+
+/**
+ * @brief Finds a latency percentile
+ * @param[in] stats Phase results
+ * @param[in] p Percentile (0 to 100)
+ * @returns Latency in milliseconds
+ */
+double percentile(const struct phase_stats* stats, double p) {
+  uint64_t target = (uint64_t)ceil(stats->sweeps * p / 100.0), seen = 0;
+
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += stats->latency[i];
+    if (seen >= target && seen > 0)
+      return hist_value(i) / 1000.0;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Reads the Redis server's accumulated CPU time
+ * @param[in] admin Blocking context to the server
+ * @returns CPU seconds (user + system)
+ */
+double server_cpu(redisContext* admin) {
+  double cpu = 0;
+  redisReply* reply = redisCommand(admin, "INFO cpu");
+
+  if (reply != NULL && reply->type == REDIS_REPLY_STRING) {
+    char* field = strstr(reply->str, "used_cpu_sys:");
+    if (field)
+      cpu += atof(field + strlen("used_cpu_sys:"));
+    field = strstr(reply->str, "used_cpu_user:");
+    if (field)
+      cpu += atof(field + strlen("used_cpu_user:"));
+  }
+
+  freeReplyObject(reply);
+  return cpu;
+}
+
+/**
+ * @brief Adds an argument to the sweep script call being built
+ * @param[in, out] argc Arguments so far
+ * @param[in] format Format
+ */
+void script_arg(int* argc, const char* format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  script_argvlen[*argc] = vsnprintf(script_values[*argc], sizeof(script_values[0]), format, ap);
+  va_end(ap);
+
+  script_argv[*argc] = script_values[*argc];
+  (*argc)++;
+}
+
+/**
+ * @brief Appends one bme sweep of a node as a single sweep script call, as bme packs it
+ * @param[in] n Node
+ * @param[in] jitter Offset of the readouts
+ * @returns Commands appended
+ */
+int append_script_sweep(struct node* n, double jitter) {
+  int argc = SWEEP_COMMAND_ARGS;
+
+  // Time, expiry, history length, no reference pressure
+  script_arg(&argc, "%.3f", now());
+  script_arg(&argc, "%d", SWEEP_TTL);
+  script_arg(&argc, "%d", SWEEP_HISTORY);
+  script_arg(&argc, "");
+
+  // Same readouts as the bme mode, none of them an alert
+  for (int i = 0; i < sensor_amount; i++) {
+    script_arg(&argc, "%s:sensor_%d_%x", n->name, i / 2, i & 1 ? 0x44 : 0x76);
+    script_arg(&argc, "%.3f", 24 + jitter);
+    script_arg(&argc, "%.3f", 40 + jitter);
+    if (!(i & 1)) {
+      script_arg(&argc, "%.3f", 935 + jitter);
+      script_arg(&argc, "0");
+      script_arg(&argc, "935.200");
+      script_arg(&argc, "0.000");
+    } else {
+      for (int f = 0; f < 4; f++)
+        script_arg(&argc, "");
+    }
+    script_arg(&argc, "");
+  }
+
+  return append_sweep_script(n->c, sweep_sha, argc, script_argv, script_argvlen);
+}
+
+/**
+ * @brief Appends one sweep of a node through the daemons' publishing functions
+ * @param[in] n Node
+ * @param[in] mode Publishing mode
+ * @returns Commands appended
+ */
+int append_sweep(struct node* n, enum mode mode) {
+  double jitter = (rand() % 1000) / 1000.0;
+  double current[OUTLET_QUANTITY];
+  char sensor[80];
+  int appended = 0;
+
+  switch (mode) {
+    case MODE_BME:
+      // Every channel holds a BMx (pressure and door status) and an SHT3x, as on a rack
+      for (int i = 0; i < sensor_amount; i++) {
+        snprintf(sensor, sizeof(sensor), "%s:sensor_%d_%x", n->name, i / 2, i & 1 ? 0x44 : 0x76);
+        if (!(i & 1))
+          appended += append_bme_sensor(n->c, sensor, 24 + jitter, 935 + jitter, 40 + jitter, 0,
+                                        935.2, 0);
+        else
+          appended += append_sht_sensor(n->c, sensor, 24 + jitter, 40 + jitter);
+      }
+      break;
+    case MODE_SCRIPT:
+      appended = append_script_sweep(n, jitter);
+      break;
+    case MODE_VOLT:
+      for (int i = 0; i < OUTLET_QUANTITY; i++)
+        current[i] = i % 2 ? 0 : 1.5 + jitter;
+      appended = append_volt(n->c, 220 + jitter, current, 0x7F, 0.98, 0, 60);
+      appended += append_energy(n->c, current);
+      break;
+    case MODE_WIRELESS:
+      appended = append_wireless(n->c, n->id, 24 + jitter, 935 + jitter, 40 + jitter,
+                                 WIRELESS_EXPIRY);
+      break;
+    case MODE_COMMAND:
+      appended = append_command_poll(n->c, n->name);
+      break;
+    default:
+      break;
+  }
+
+  return appended;
+}
+
+/**
+ * @brief Writes a node's output buffer, waiting for writability if the socket is full
+ * @param[in] ep epoll instance
+ * @param[in] n Node
+ * @retval 0 OK
+ * @retval -1 Connection failure
+ */
+int flush_node(int ep, struct node* n) {
+  int done = 0;
+
+  if (redisBufferWrite(n->c, &done) != REDIS_OK)
+    return -1;
+
+  if (done == n->writing) {
+    struct epoll_event ev = {.events = EPOLLIN | (done ? 0 : EPOLLOUT), .data.ptr = n};
+    n->writing = !done;
+    epoll_ctl(ep, EPOLL_CTL_MOD, n->c->fd, &ev);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Runs one publishing mode against the server
+ * @param[in] host Server host
+ * @param[in] port Server port
+ * @param[in] node_amount Simulated nodes
+ * @param[in] mode Publishing mode
+ * @param[in] duration Phase duration (s)
+ * @param[out] stats Phase results
+ * @returns Elapsed time (s), or -1 on failure
+ */
+double run_phase(const char* host,
+                 int port,
+                 int node_amount,
+                 enum mode mode,
+                 double duration,
+                 struct phase_stats* stats) {
+  struct epoll_event events[MAX_EVENTS];
+  double period = mode_periods[mode];
+  int ep = epoll_create1(0);
+  int alive = 0;
+
+  memset(stats, 0, sizeof(*stats));
+
+  double start = now();
+  for (int i = 0; i < node_amount; i++) {
+    struct node* n = &nodes[i];
+    memset(n, 0, sizeof(*n));
+
+    n->id = i;
+    snprintf(n->name, sizeof(n->name), "SIMAR:10.%d.%d.%d:sim%d", i >> 16, (i >> 8) & 0xFF,
+             i & 0xFF, i);
+
+    // Boot times are spread evenly over the period, as in a fleet restarted at random times
+    n->next = start + period * i / node_amount;
+    n->c = redisConnectNonBlock(host, port);
+
+    if (n->c == NULL || n->c->err) {
+      fprintf(stderr, "Could not open connection %d (raise ulimit -n?)\n", i);
+      return -1;
+    }
+
+    // Writable once the connection is established
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = n};
+    n->writing = 1;
+    epoll_ctl(ep, EPOLL_CTL_ADD, n->c->fd, &ev);
+    alive++;
+  }
+
+  // Deadlines keep their initial order, since every node has the same period
+  int due = 0;
+  double end = start + duration;
+
+  while (now() < end && alive > 0) {
+    double t = now();
+    double wake = nodes[due].next < end ? nodes[due].next : end;
+    int timeout = (int)((wake - t) * 1000);
+    int ready = epoll_wait(ep, events, MAX_EVENTS, timeout < 0 ? 0 : timeout);
+
+    for (int i = 0; i < ready; i++) {
+      struct node* n = events[i].data.ptr;
+      redisReply* reply;
+
+      if (n->dead)
+        continue;
+
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        n->dead = 1;
+        alive--;
+        stats->errors++;
+        epoll_ctl(ep, EPOLL_CTL_DEL, n->c->fd, NULL);
+        continue;
+      }
+
+      if (events[i].events & EPOLLOUT) {
+        n->connected = 1;
+        flush_node(ep, n);
+      }
+
+      if (!(events[i].events & EPOLLIN))
+        continue;
+
+      if (redisBufferRead(n->c) != REDIS_OK) {
+        n->dead = 1;
+        alive--;
+        stats->errors++;
+        epoll_ctl(ep, EPOLL_CTL_DEL, n->c->fd, NULL);
+        continue;
+      }
+
+      while (redisGetReplyFromReader(n->c, (void**)&reply) == REDIS_OK && reply != NULL) {
+        stats->replies++;
+        if (reply->type == REDIS_REPLY_ERROR)
+          stats->errors++;
+        freeReplyObject(reply);
+
+        if (--n->pending == 0) {
+          stats->latency[hist_bucket((uint64_t)((now() - n->sent) * 1e6))]++;
+          stats->sweeps++;
+        }
+      }
+    }
+
+    t = now();
+    for (int checked = 0; checked < node_amount && nodes[due].next <= t; checked++) {
+      struct node* n = &nodes[due];
+
+      n->next += period;
+      due = (due + 1) % node_amount;
+
+      if (n->dead || !n->connected)
+        continue;
+
+      // A node that is still waiting on its last sweep skips this one, as the daemons would block
+      if (n->pending > 0) {
+        stats->overruns++;
+        continue;
+      }
+
+      n->pending = append_sweep(n, mode);
+      n->sent = t;
+
+      if (flush_node(ep, n)) {
+        n->dead = 1;
+        alive--;
+        stats->errors++;
+      }
+    }
+  }
+
+  double elapsed = now() - start;
+
+  for (int i = 0; i < node_amount; i++)
+    redisFree(nodes[i].c);
+  close(ep);
+
+  return elapsed;
+}
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-a host:port] [-n nodes] [-s sensors per bme node] [-d seconds per mode] "
+          "[-m bme,script,volt,wireless,command]\n",
+          prog);
+}
+
+int main(int argc, char* argv[]) {
+  char server[SERVER_LEN] = "127.0.0.1", host[SERVER_LEN];
+  char modes[64] = "bme,script,volt,wireless,command";
+  int node_amount = 1000, opt;
+  double duration = 10;
+  struct phase_stats stats;
+  struct rlimit limit;
+
+  while ((opt = getopt(argc, argv, "a:n:s:d:m:h")) != -1) {
+    switch (opt) {
+      case 'a':
+        snprintf(server, sizeof(server), "%s", optarg);
+        break;
+      case 'n':
+        node_amount = atoi(optarg);
+        break;
+      case 's':
+        sensor_amount = atoi(optarg);
+        break;
+      case 'd':
+        duration = atof(optarg);
+        break;
+      case 'm':
+        snprintf(modes, sizeof(modes), "%s", optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (node_amount < 1 || node_amount > MAX_NODES || sensor_amount < 1 ||
+      sensor_amount > MAX_SENSORS || duration <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // One socket per simulated node
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  int port = ring_server_addr(server, host);
+  redisContext* admin = redisConnectWithTimeout(host, port, (struct timeval){1, 0});
+
+  if (admin == NULL || admin->err) {
+    fprintf(stderr, "Could not connect to %s\n", server);
+    return 1;
+  }
+
+  if (strstr(modes, "script") != NULL && sweep_script_load(admin, sweep_sha)) {
+    fprintf(stderr, "Could not load the sweep script\n");
+    return 1;
+  }
+
+  printf("%d nodes per mode, %d sensors per bme node, %.0f s per mode against %s\n\n", node_amount,
+         sensor_amount, duration, server);
+  printf("%-9s %6s %10s %9s %8s %8s %8s %8s %8s %7s %7s %8s\n", "mode", "period", "ops/s",
+         "sweeps/s", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms", "cpu %", "errors",
+         "overruns");
+
+  for (int m = 0; m < MODE_AMOUNT; m++) {
+    if (strstr(modes, mode_names[m]) == NULL)
+      continue;
+
+    double cpu = server_cpu(admin);
+    double elapsed = run_phase(host, port, node_amount, m, duration, &stats);
+
+    if (elapsed < 0)
+      return 1;
+
+    cpu = server_cpu(admin) - cpu;
+
+    printf("%-9s %6.2f %10.0f %9.0f %8.3f %8.3f %8.3f %8.3f %8.3f %7.1f %7llu %8llu\n",
+           mode_names[m], mode_periods[m], stats.replies / elapsed, stats.sweeps / elapsed,
+           percentile(&stats, 50), percentile(&stats, 90), percentile(&stats, 99),
+           percentile(&stats, 99.9), percentile(&stats, 100), 100 * cpu / elapsed,
+           (unsigned long long)stats.errors, (unsigned long long)stats.overruns);
+  }
+
+  redisFree(admin);
+  return 0;
+}
@@ -0,0 +1,31 @@
+/*! @file config.c
+ * @brief Reading of the device configuration
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+cJSON* config_load(const char* path) {
+  cJSON* json = NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return NULL;
+
+  off_t len = lseek(fd, 0, SEEK_END);
+  char* buf = len >= 0 && lseek(fd, 0, SEEK_SET) == 0 ? malloc(len + 1) : NULL;
+
+  if (buf != NULL) {
+    ssize_t read_len = read(fd, buf, len);
+
+    buf[read_len > 0 ? read_len : 0] = '\0';
+    json = cJSON_Parse(buf);
+    free(buf);
+  }
+
+  close(fd);
+  return json;
+}
@@ -0,0 +1,18 @@
+/*! @file config.h
+ * @brief Declarations for reading the device configuration
+ */
+
+#ifndef JSON_CONFIG_H
+#define JSON_CONFIG_H
+
+#include "cJSON.h"
+
+/**
+ * @brief Reads and parses a JSON file, such as the device configuration (/opt/device.json)
+ * @param[in] path File
+ * @returns JSON, to be freed with cJSON_Delete, or NULL if the file is missing, unreadable or
+ * invalid
+ */
+cJSON* config_load(const char* path);
+
+#endif
@@ -0,0 +1,188 @@
+/*! @file replay.c
+ * @brief Replays synthetic voltage waveforms through the power quality detector
+ *
+ * Each scenario is a nominal waveform with one disturbance in the middle. The events reported by
+ * the detector (power/quality.c) are checked against the disturbance, then the whole set is fed
+ * again repeatedly to measure how many samples per second the detector keeps up with, compared to
+ * the real-time sample rate.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../../power/quality.h"
+
+// Samples fed per call, as a capture loop would hand them over
+#define CHUNK 256
+#define MAX_EVENTS 8
+// Tolerances on the reported duration (s) and depth
+#define DURATION_TOLERANCE 0.02
+#define DEPTH_TOLERANCE 0.03
+
+/*!
+ * @brief Waveform with one disturbance: `level` times the nominal amplitude from `at` for `length`
+ * seconds, plus uniform noise of `noise` times the amplitude on every sample
+ */
+struct scenario {
+  const char* name;
+  double at;
+  double length;
+  double level;
+  double noise;
+  enum quality_type expected;
+};
+
+const struct scenario scenarios[] = {
+    {"nominal", 0, 0, 1, 0, QUALITY_NONE},
+    {"noise", 0, 0, 1, 0.02, QUALITY_NONE},
+    {"sag 70% 100 ms", 0.5, 0.1, 0.7, 0.01, QUALITY_SAG},
+    {"swell 120% 200 ms", 0.5, 0.2, 1.2, 0.01, QUALITY_SWELL},
+    {"interruption 300 ms", 0.5, 0.3, 0.02, 0.01, QUALITY_INTERRUPTION},
+    {"1 ms notch", 0.5, 0.001, 0, 0.01, QUALITY_NONE},
+};
+
+struct quality_event events[MAX_EVENTS];
+uint32_t reported;
+
+void on_event(const struct quality_event* event, void* arg) {
+  if (reported < MAX_EVENTS)
+    events[reported] = *event;
+  reported++;
+}
+
+/**
+ * @brief Generates one second of a scenario's waveform
+ * @param[in] s Scenario
+ * @param[in] cfg Thresholds (nominal voltage and frequency)
+ * @param[in] rate Sample rate (Hz)
+ * @param[out] samples Waveform (rate samples)
+ */
+void generate(const struct scenario* s,
+              const struct quality_config* cfg,
+              double rate,
+              float* samples) {
+  double amplitude = cfg->nominal * sqrt(2);
+
+  for (uint32_t i = 0; i < rate; i++) {
+    double t = i / rate;
+    double level = t >= s->at && t < s->at + s->length ? s->level : 1;
+    double noise = s->noise * (2.0 * rand() / RAND_MAX - 1);
+
+    samples[i] = amplitude * (level * sin(2 * M_PI * cfg->frequency * t) + noise);
+  }
+}
+
+/**
+ * @brief Feeds a waveform in CHUNK sample pieces
+ * @param[in, out] pq Detector
+ * @param[in] samples Waveform
+ * @param[in] amount Samples
+ * @param[in] rate Sample rate (Hz)
+ */
+void feed(struct power_quality* pq, const float* samples, uint32_t amount, double rate) {
+  for (uint32_t i = 0; i < amount; i += CHUNK) {
+    struct timespec first = {(time_t)(i / rate), (long)(fmod(i / rate, 1) * 1e9)};
+    quality_feed(pq, samples + i, amount - i < CHUNK ? amount - i : CHUNK, &first, 0x7F);
+  }
+}
+
+/**
+ * @brief Checks the events reported for a scenario
+ * @param[in] s Scenario
+ * @retval 1 As expected
+ * @retval 0 Missing, extra or wrong events
+ */
+int check(const struct scenario* s) {
+  if (s->expected == QUALITY_NONE)
+    return reported == 0;
+
+  if (reported != 1 || events[0].type != s->expected)
+    return 0;
+
+  double depth = fabs(1 - s->level);
+  double start = events[0].start.tv_sec + events[0].start.tv_nsec / 1e9;
+
+  return fabs(start - s->at) < DURATION_TOLERANCE &&
+         fabs(events[0].duration - s->length) < DURATION_TOLERANCE &&
+         fabs(events[0].depth - depth) < DEPTH_TOLERANCE;
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-r sample rate (Hz)] [-n throughput passes]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  struct quality_config cfg;
+  struct power_quality pq;
+  struct timespec begin, end;
+  const int count = sizeof(scenarios) / sizeof(scenarios[0]);
+  double rate = 3840;
+  int passes = 20, failed = 0, opt;
+
+  while ((opt = getopt(argc, argv, "r:n:h")) != -1) {
+    switch (opt) {
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'n':
+        passes = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // Only the defaults are replayed, so the result does not depend on the device configuration
+  quality_load_config(&cfg, "/dev/null");
+
+  float* waves = malloc(sizeof(float) * (size_t)rate * count);
+  if (waves == NULL || rate < 4 * cfg.frequency) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("%-22s %-13s %-9s %-9s %s\n", "Scenario", "Event", "Start", "Duration", "Depth");
+
+  for (int s = 0; s < count; s++) {
+    float* wave = waves + (size_t)rate * s;
+
+    generate(&scenarios[s], &cfg, rate, wave);
+    reported = 0;
+    quality_init(&pq, &cfg, rate, on_event, NULL);
+    feed(&pq, wave, rate, rate);
+
+    int ok = check(&scenarios[s]);
+    failed += !ok;
+
+    if (reported == 0)
+      printf("%-22s %-13s %-9s %-9s %-6s %s\n", scenarios[s].name, "-", "-", "-", "-",
+             ok ? "OK" : "FAIL");
+    for (uint32_t e = 0; e < reported && e < MAX_EVENTS; e++)
+      printf("%-22s %-13s %-9.4f %-9.4f %-6.3f %s\n", scenarios[s].name,
+             quality_type_name(events[e].type),
+             events[e].start.tv_sec + events[e].start.tv_nsec / 1e9, events[e].duration,
+             events[e].depth, ok ? "OK" : "FAIL");
+  }
+
+  // Throughput: every scenario back to back, as one long waveform
+  quality_init(&pq, &cfg, rate, on_event, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int p = 0; p < passes; p++)
+    feed(&pq, waves, (uint32_t)rate * count, rate);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+  double throughput = rate * count * passes / elapsed;
+
+  printf("\n%.0f samples/s (%.0fx real time at %.0f Hz), %.3f%% of a CPU\n", throughput,
+         throughput / rate, rate, 100 * rate / throughput);
+  printf("%d of %d scenarios failed\n", failed, count);
+
+  free(waves);
+  return failed != 0;
+}
@@ -0,0 +1,176 @@
+/*! @file wakeups.c
+ * @brief Measures the CPU wake-ups and CPU time of a running daemon, per thread
+ *
+ * Samples /proc/<pid>/task/<tid>/{status,stat} at the start and end of a window. Every voluntary
+ * context switch is a wait the thread blocked in (a sleep, a socket read...), i.e. a wake-up once
+ * it ends; involuntary ones are preemptions, listed apart. With -m, the run fails if the daemon
+ * woke up more often than that per minute, so a low power configuration can be checked on the
+ * node (e.g. `wireless` with `"low_power": true` against its normal mode).
+ */
+
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+
+/*!
+ * @brief Counters of a thread
+ */
+struct thread_sample {
+  int tid;
+  char name[32];
+  unsigned long voluntary;
+  unsigned long involuntary;
+  unsigned long ticks;
+};
+
+/**
+ * @brief Reads the counters of a thread
+ * @param[in] pid Process
+ * @param[in] tid Thread
+ * @param[out] t Counters
+ * @retval 0 OK
+ * @retval -1 The thread is gone
+ */
+int8_t sample_thread(int pid, int tid, struct thread_sample* t) {
+  char path[64], line[256];
+  unsigned long utime, stime;
+  FILE* f;
+
+  t->tid = tid;
+
+  snprintf(path, sizeof(path), "/proc/%d/task/%d/status", pid, tid);
+  if ((f = fopen(path, "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    sscanf(line, "Name: %31s", t->name);
+    sscanf(line, "voluntary_ctxt_switches: %lu", &t->voluntary);
+    sscanf(line, "nonvoluntary_ctxt_switches: %lu", &t->involuntary);
+  }
+  fclose(f);
+
+  // utime and stime are the 14th and 15th fields, after the name (which may hold spaces)
+  snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+  if ((f = fopen(path, "r")) == NULL)
+    return -1;
+  char* rest = fgets(line, sizeof(line), f) != NULL ? strrchr(line, ')') : NULL;
+  fclose(f);
+
+  if (rest == NULL ||
+      sscanf(rest, ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    return -1;
+
+  t->ticks = utime + stime;
+  return 0;
+}
+
+/**
+ * @brief Reads the counters of every thread of a process
+ * @param[in] pid Process
+ * @param[out] threads Counters
+ * @returns Threads read, or -1 if the process is gone
+ */
+int sample(int pid, struct thread_sample* threads) {
+  char path[64];
+  struct dirent* de;
+  int amount = 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  DIR* dr = opendir(path);
+  if (dr == NULL)
+    return -1;
+
+  while ((de = readdir(dr)) != NULL && amount < MAX_THREADS) {
+    if (de->d_name[0] != '.' && sample_thread(pid, atoi(de->d_name), &threads[amount]) == 0)
+      amount++;
+  }
+
+  closedir(dr);
+  return amount;
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s -p pid [-t seconds] [-m most wake-ups per minute]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  struct thread_sample before[MAX_THREADS], after[MAX_THREADS];
+  double seconds = 60, most = -1;
+  int pid = 0, opt;
+
+  while ((opt = getopt(argc, argv, "p:t:m:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        pid = atoi(optarg);
+        break;
+      case 't':
+        seconds = atof(optarg);
+        break;
+      case 'm':
+        most = atof(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (pid <= 0 || seconds <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int amount_before = sample(pid, before);
+  if (amount_before < 0) {
+    fprintf(stderr, "No process %d\n", pid);
+    return 1;
+  }
+
+  usleep(seconds * 1e6);
+
+  int amount_after = sample(pid, after);
+  if (amount_after < 0) {
+    fprintf(stderr, "Process %d exited during the measurement\n", pid);
+    return 1;
+  }
+
+  double minutes = seconds / 60, tick_ms = 1e3 / sysconf(_SC_CLK_TCK);
+  double total_wakeups = 0, total_preemptions = 0, total_cpu = 0;
+
+  printf("%d threads over %.0f s, per minute:\n\n", amount_after, seconds);
+  printf("%8s %-16s %10s %12s %10s\n", "tid", "thread", "wake-ups", "preemptions", "CPU ms");
+
+  // Threads started during the window count from zero
+  for (int i = 0; i < amount_after; i++) {
+    struct thread_sample start = {0};
+
+    for (int j = 0; j < amount_before; j++) {
+      if (before[j].tid == after[i].tid)
+        start = before[j];
+    }
+
+    double wakeups = (after[i].voluntary - start.voluntary) / minutes;
+    double preemptions = (after[i].involuntary - start.involuntary) / minutes;
+    double cpu = (after[i].ticks - start.ticks) * tick_ms / minutes;
+
+    printf("%8d %-16s %10.1f %12.1f %10.1f\n", after[i].tid, after[i].name, wakeups, preemptions,
+           cpu);
+    total_wakeups += wakeups;
+    total_preemptions += preemptions;
+    total_cpu += cpu;
+  }
+
+  printf("%8s %-16s %10.1f %12.1f %10.1f\n", "", "total", total_wakeups, total_preemptions,
+         total_cpu);
+
+  if (most >= 0 && total_wakeups > most) {
+    printf("\nMore than %.1f wake-ups per minute\n", most);
+    return 1;
+  }
+
+  return 0;
+}
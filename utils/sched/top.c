@@ -0,0 +1,275 @@
+/*! @file top.c
+ * @brief Live per thread CPU breakdown of every SIMAR daemon on the node
+ *
+ * Reads the counters the daemons publish on the shared memory board (sched/account.h) and shows,
+ * for every accounted thread, its CPU use, wake-ups and preemptions per second and, where
+ * hardware counters are enabled, its cycles per second and instructions per cycle. Each daemon
+ * also gets a row for its threads that are not accounted (such as the log flusher), and the
+ * header shows how busy the whole CPU is, daemons or not.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../mem/shm.h"
+#include "../../sched/account.h"
+
+/*!
+ * @brief Rates of an entry between its last two samples
+ */
+struct row {
+  uint8_t sampled;
+  uint8_t rated;
+  struct shm_snapshot last;
+  double cpu;
+  double sys;
+  double wakeups;
+  double preemptions;
+  double cycles;
+  double ipc;
+  char key[SHM_KEY_LEN + 1];
+  const char* name;
+  int tid;
+};
+
+// Board entries, then the rows of the daemons' threads that are not accounted
+struct row rows[SHM_ENTRIES + SHM_ENTRIES / 2];
+char other_names[SHM_ENTRIES / 2][SHM_KEY_LEN + 8];
+
+/**
+ * @brief Reads the busy and total time of the CPU
+ * @param[out] busy Busy ticks
+ * @param[out] total Total ticks
+ */
+void cpu_ticks(unsigned long long* busy, unsigned long long* total) {
+  unsigned long long user, nice, system, idle, iowait, irq, softirq;
+  FILE* f = fopen("/proc/stat", "r");
+
+  *busy = *total = 0;
+  if (f == NULL)
+    return;
+
+  if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait,
+             &irq, &softirq) == 7) {
+    *busy = user + nice + system + irq + softirq;
+    *total = *busy + idle + iowait;
+  }
+  fclose(f);
+}
+
+/**
+ * @brief Updates the rates of an entry from a new sample
+ * @param[in, out] r Row
+ * @param[in] s Sample
+ */
+void update(struct row* r, const struct shm_snapshot* s) {
+  const struct shm_snapshot* p = &r->last;
+  double dt = (s->at.tv_sec - p->at.tv_sec) + (s->at.tv_nsec - p->at.tv_nsec) / 1e9;
+
+  // Not sampled again yet: the previous rates stand. Counters going back: the daemon restarted.
+  if (r->sampled && dt > 0 && s->values[ACCOUNT_CPU] >= p->values[ACCOUNT_CPU]) {
+    double cycles = s->values[ACCOUNT_CYCLES] - p->values[ACCOUNT_CYCLES];
+
+    r->cpu = (s->values[ACCOUNT_CPU] - p->values[ACCOUNT_CPU]) / dt / 10;
+    r->sys = (s->values[ACCOUNT_SYS] - p->values[ACCOUNT_SYS]) / dt / 10;
+    r->wakeups = (s->values[ACCOUNT_VOLUNTARY] - p->values[ACCOUNT_VOLUNTARY]) / dt;
+    r->preemptions = (s->values[ACCOUNT_INVOLUNTARY] - p->values[ACCOUNT_INVOLUNTARY]) / dt;
+    r->cycles = cycles / dt;
+    r->ipc = cycles > 0
+                 ? (s->values[ACCOUNT_INSTRUCTIONS] - p->values[ACCOUNT_INSTRUCTIONS]) / cycles
+                 : NAN;
+    r->rated = 1;
+  } else if (r->sampled && dt > 0) {
+    r->rated = 0;
+  }
+
+  if (!r->sampled || dt > 0)
+    r->last = *s;
+  r->tid = s->values[ACCOUNT_TID];
+  r->sampled = 1;
+}
+
+int by_cpu(const void* a, const void* b) {
+  const struct row *x = *(const struct row* const*)a, *y = *(const struct row* const*)b;
+
+  return (x->cpu < y->cpu) - (x->cpu > y->cpu);
+}
+
+/**
+ * @brief Adds the row of a daemon's threads that are not accounted: the process minus its threads
+ * @param[in] process Process row
+ * @param[in] slot Row to fill, past the board entries
+ * @returns Filled row
+ */
+struct row* other_threads(const struct row* process, int slot) {
+  struct row* other = &rows[SHM_ENTRIES + slot];
+  size_t prefix = strlen(process->name);
+
+  *other = *process;
+  other->tid = 0;
+  other->cycles = other->ipc = NAN;
+
+  for (int i = 0; i < SHM_ENTRIES; i++) {
+    const struct row* r = &rows[i];
+
+    if (r->rated && r != process && strncmp(r->name, process->name, prefix) == 0 &&
+        r->name[prefix] == '/') {
+      other->cpu -= r->cpu;
+      other->sys -= r->sys;
+      other->wakeups -= r->wakeups;
+      other->preemptions -= r->preemptions;
+    }
+  }
+
+  // Threads are sampled at their own times, so small negative remainders are noise
+  other->cpu = fmax(other->cpu, 0);
+  other->sys = fmax(other->sys, 0);
+  other->wakeups = fmax(other->wakeups, 0);
+  other->preemptions = fmax(other->preemptions, 0);
+
+  snprintf(other_names[slot], sizeof(other_names[0]), "%s/(other)", process->name);
+  other->name = other_names[slot];
+  return other;
+}
+
+/**
+ * @brief Prints a rate, or a dash if unknown
+ * @param[in] width Column width
+ * @param[in] precision Decimals
+ * @param[in] value Rate
+ */
+void print_rate(int width, int precision, double value) {
+  if (isnan(value))
+    printf(" %*s", width, "-");
+  else
+    printf(" %*.*f", width, precision, value);
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-i interval (s)] [-n refreshes] [-d daemon]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  const char* daemon = NULL;
+  double interval = 2;
+  int refreshes = 0, opt;
+  unsigned long long busy, total, last_busy, last_total;
+
+  while ((opt = getopt(argc, argv, "i:n:d:h")) != -1) {
+    switch (opt) {
+      case 'i':
+        interval = atof(optarg);
+        break;
+      case 'n':
+        refreshes = atoi(optarg);
+        break;
+      case 'd':
+        daemon = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (interval <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const struct shm_board* board = shm_attach(0);
+  if (board == NULL) {
+    fprintf(stderr, "No shared memory board (%s), is any daemon running?\n", SHM_NAME);
+    return 1;
+  }
+
+  cpu_ticks(&last_busy, &last_total);
+
+  for (int refresh = 0; refreshes == 0 || refresh <= refreshes; refresh++) {
+    struct row* shown[SHM_ENTRIES + SHM_ENTRIES / 2];
+    int amount = 0, extra = 0;
+
+    for (int i = 0; i < SHM_ENTRIES; i++) {
+      const struct shm_entry* entry = &board->entries[i];
+      struct shm_snapshot snap;
+
+      // Released, or claimed again by another thread: its samples are not comparable anymore
+      if (atomic_load(&entry->state) != SHM_READY) {
+        rows[i].sampled = rows[i].rated = 0;
+        rows[i].key[0] = '\0';
+        continue;
+      }
+
+      if (strncmp(entry->key, rows[i].key, SHM_KEY_LEN) != 0) {
+        rows[i].sampled = rows[i].rated = 0;
+        snprintf(rows[i].key, sizeof(rows[i].key), "%.*s", SHM_KEY_LEN, entry->key);
+      }
+
+      if (strncmp(rows[i].key, ACCOUNT_PREFIX, strlen(ACCOUNT_PREFIX)) != 0 ||
+          shm_read(entry, &snap))
+        continue;
+
+      rows[i].name = rows[i].key + strlen(ACCOUNT_PREFIX);
+      update(&rows[i], &snap);
+    }
+
+    // The first pass only takes the initial samples
+    if (refresh == 0) {
+      usleep(interval * 1e6);
+      continue;
+    }
+
+    for (int i = 0; i < SHM_ENTRIES; i++) {
+      struct row* r = &rows[i];
+      size_t len = daemon != NULL ? strlen(daemon) : 0;
+
+      if (!r->rated || (daemon != NULL && (strncmp(r->name, daemon, len) != 0 ||
+                                           (r->name[len] != '\0' && r->name[len] != '/'))))
+        continue;
+
+      shown[amount++] = r;
+      if (strchr(r->name, '/') == NULL && extra < SHM_ENTRIES / 2)
+        shown[amount++] = other_threads(r, extra++);
+    }
+
+    qsort(shown, amount, sizeof(shown[0]), by_cpu);
+
+    cpu_ticks(&busy, &total);
+    double node = total > last_total ? 100.0 * (busy - last_busy) / (total - last_total) : NAN;
+    last_busy = busy;
+    last_total = total;
+
+    if (isatty(STDOUT_FILENO))
+      printf("\033[H\033[2J");
+
+    printf("Node CPU %.1f%% busy; daemons (no /) include all their threads\n\n", node);
+    printf("%-24s %7s %6s %6s %9s %9s %9s %5s\n", "daemon/thread", "tid", "CPU %", "sys %",
+           "wakeups/s", "preempt/s", "Mcycles/s", "IPC");
+
+    for (int i = 0; i < amount; i++) {
+      const struct row* r = shown[i];
+
+      printf("%-24s %7d", r->name, r->tid);
+      print_rate(6, 1, r->cpu);
+      print_rate(6, 1, r->sys);
+      print_rate(9, 1, r->wakeups);
+      print_rate(9, 1, r->preemptions);
+      print_rate(9, 2, r->cycles / 1e6);
+      print_rate(5, 2, r->ipc);
+      printf("\n");
+    }
+
+    if (amount == 0)
+      printf("No accounted daemon running\n");
+
+    fflush(stdout);
+    if (refreshes == 0 || refresh < refreshes)
+      usleep(interval * 1e6);
+  }
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+/*! @file dump.c
+ * @brief Prints the latest values on the shared memory board, as a local consumer reads them
+ *
+ * Attaches to the board read-only and prints every entry (or only one with -k), optionally every
+ * few seconds. With -b, it measures how long a consistent snapshot of an entry takes.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../mem/shm.h"
+
+/**
+ * @brief Prints one entry
+ * @param[in] entry Entry
+ * @param[in] now Monotonic time
+ */
+void print_entry(const struct shm_entry* entry, const struct timespec* now) {
+  struct shm_snapshot snap;
+
+  if (shm_read(entry, &snap)) {
+    printf("%-20s (being rewritten)\n", entry->key);
+    return;
+  }
+
+  if (snap.updates == 0) {
+    printf("%-20s (no values yet)\n", entry->key);
+    return;
+  }
+
+  double age = (now->tv_sec - snap.at.tv_sec) + (now->tv_nsec - snap.at.tv_nsec) / 1e9;
+  printf("%-20s %8.1f s ago, %8u updates:", entry->key, age, snap.updates);
+  for (int f = 0; f < snap.count; f++)
+    printf(" %s=%.3f", entry->fields[f], snap.values[f]);
+  printf("\n");
+}
+
+/**
+ * @brief Measures the time per snapshot of an entry
+ * @param[in] entry Entry
+ * @param[in] reads Snapshots to take
+ */
+void bench(const struct shm_entry* entry, uint32_t reads) {
+  struct shm_snapshot snap;
+  struct timespec start, end;
+  uint32_t failed = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t i = 0; i < reads; i++)
+    failed += shm_read(entry, &snap) != 0;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%s: %u snapshots, %.1f ns each, %u failed\n", entry->key, reads, elapsed * 1e9 / reads,
+         failed);
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-k key] [-i interval (s)] [-b snapshots to time]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  const char* key = NULL;
+  double interval = 0;
+  uint32_t reads = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "k:i:b:h")) != -1) {
+    switch (opt) {
+      case 'k':
+        key = optarg;
+        break;
+      case 'i':
+        interval = atof(optarg);
+        break;
+      case 'b':
+        reads = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  const struct shm_board* board = shm_attach(0);
+  if (board == NULL) {
+    fprintf(stderr, "No shared memory board (%s), is any daemon running?\n", SHM_NAME);
+    return 1;
+  }
+
+  const struct shm_entry* entry = key != NULL ? shm_find(board, key) : NULL;
+  if (key != NULL && entry == NULL) {
+    fprintf(stderr, "No entry for %s\n", key);
+    return 1;
+  }
+
+  if (reads > 0) {
+    for (int i = 0; i < SHM_ENTRIES && entry == NULL; i++) {
+      if (atomic_load(&board->entries[i].state) == SHM_READY)
+        entry = &board->entries[i];
+    }
+    if (entry == NULL) {
+      fprintf(stderr, "The board is empty\n");
+      return 1;
+    }
+    bench(entry, reads);
+    return 0;
+  }
+
+  for (;;) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (entry != NULL) {
+      print_entry(entry, &now);
+    } else {
+      for (int i = 0; i < SHM_ENTRIES; i++) {
+        if (atomic_load(&board->entries[i].state) == SHM_READY)
+          print_entry(&board->entries[i], &now);
+      }
+    }
+
+    if (interval <= 0)
+      return 0;
+
+    printf("\n");
+    usleep(interval * 1e6);
+  }
+}
@@ -0,0 +1,158 @@
+/*! @file check.c
+ * @brief Shows startup timelines and checks the time to first publish against a baseline
+ *
+ * Reads the timelines the daemons write at their first publish (sched/startup.h) and prints their
+ * phases: start, duration, CPU time (a phase with little CPU for its duration is waiting, on the
+ * bus, a sleep or the network) and share of the startup. With -b, the run fails if the time to
+ * first publish of a daemon exceeds its baseline by more than the tolerance, which is how CI
+ * catches startup regressions (fan on a simulated ADC, see .github/workflows/startup.yml).
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../json/config.h"
+
+#define BAR_WIDTH 30
+
+/**
+ * @brief Parses a JSON file
+ * @param[in] path File
+ * @param[in] wait Time to wait for the file to appear (s)
+ * @returns JSON, or NULL if unreadable or invalid
+ */
+cJSON* load(const char* path, double wait) {
+  const struct timespec poll = {0, 100000000L};
+
+  for (double waited = 0; access(path, R_OK) != 0 && waited < wait; waited += 0.1)
+    nanosleep(&poll, NULL);
+
+  return config_load(path);
+}
+
+/**
+ * @brief Reads a number of a JSON object
+ * @param[in] object Object
+ * @param[in] name Member
+ * @returns Number, or -1 if missing
+ */
+double number(const cJSON* object, const char* name) {
+  const cJSON* item = cJSON_GetObjectItemCaseSensitive(object, name);
+  return cJSON_IsNumber(item) ? item->valuedouble : -1;
+}
+
+/**
+ * @brief Prints a timeline
+ * @param[in] timeline Timeline
+ * @param[in] total Time to first publish (ms)
+ */
+void print_timeline(const cJSON* timeline, double total) {
+  const cJSON* phases = cJSON_GetObjectItemCaseSensitive(timeline, "phases");
+  const cJSON* phase;
+  char bar[BAR_WIDTH + 1];
+
+  printf("%-32s %9s %9s %9s %6s\n", "phase", "start ms", "ms", "CPU ms", "share");
+  printf("%-32s %9.1f %9.1f %9s %5.1f%%\n", "(exec)", 0.0, number(timeline, "exec_ms"), "-",
+         total > 0 ? 100 * number(timeline, "exec_ms") / total : 0);
+
+  cJSON_ArrayForEach(phase, phases) {
+    const cJSON* name = cJSON_GetObjectItemCaseSensitive(phase, "name");
+    double ms = number(phase, "ms"), share = total > 0 ? ms / total : 0;
+    int width = share * BAR_WIDTH + 0.5;
+
+    if (width < 0 || width > BAR_WIDTH)
+      width = width < 0 ? 0 : BAR_WIDTH;
+
+    memset(bar, '#', width);
+    bar[width] = '\0';
+    printf("%-32s %9.1f %9.1f %9.1f %5.1f%%%s%s\n", cJSON_IsString(name) ? name->valuestring : "?",
+           number(phase, "start_ms"), ms, number(phase, "cpu_ms"), 100 * share, width ? " " : "",
+           bar);
+  }
+}
+
+void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-b baseline.json] [-t tolerance (%%)] [-w seconds to wait for the "
+          "timelines] timeline.json...\n",
+          prog);
+}
+
+int main(int argc, char* argv[]) {
+  const char* baseline_path = NULL;
+  double tolerance = 20, wait = 0;
+  int failed = 0, opt;
+  cJSON* baseline = NULL;
+
+  while ((opt = getopt(argc, argv, "b:t:w:h")) != -1) {
+    switch (opt) {
+      case 'b':
+        baseline_path = optarg;
+        break;
+      case 't':
+        tolerance = atof(optarg);
+        break;
+      case 'w':
+        wait = atof(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (optind == argc || tolerance < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (baseline_path != NULL && (baseline = load(baseline_path, 0)) == NULL) {
+    fprintf(stderr, "Could not read the baseline %s\n", baseline_path);
+    return 1;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    cJSON* timeline = load(argv[i], wait);
+    const cJSON* daemon = cJSON_GetObjectItemCaseSensitive(timeline, "daemon");
+    double total = number(timeline, "first_publish_ms");
+
+    if (!cJSON_IsString(daemon) || total < 0) {
+      fprintf(stderr, "Could not read the timeline %s\n", argv[i]);
+      cJSON_Delete(timeline);
+      failed++;
+      continue;
+    }
+
+    printf("%s: first publish %.1f ms after start, %.1f ms CPU\n\n", daemon->valuestring, total,
+           number(timeline, "cpu_ms"));
+    print_timeline(timeline, total);
+
+    if (number(timeline, "merged_phases") > 0)
+      printf("(%.0f phases merged into the last one)\n", number(timeline, "merged_phases"));
+
+    if (baseline != NULL) {
+      double base = number(baseline, daemon->valuestring);
+      double limit = base * (1 + tolerance / 100);
+
+      if (base < 0) {
+        printf("\nNo baseline for %s\n", daemon->valuestring);
+      } else if (total > limit) {
+        printf("\nRegression: %.1f ms, over the %.1f ms baseline plus %.0f%% (%.1f ms)\n", total,
+               base, tolerance, limit);
+        failed++;
+      } else {
+        printf("\nOK: %.1f ms against the %.1f ms baseline (limit %.1f ms)\n", total, base, limit);
+      }
+    }
+
+    printf("\n");
+    cJSON_Delete(timeline);
+  }
+
+  cJSON_Delete(baseline);
+  return failed != 0;
+}
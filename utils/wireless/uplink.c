@@ -0,0 +1,284 @@
+/*! @file uplink.c
+ * @brief Compares the bytes and transmissions of the per readout and batched wireless uplinks
+ *
+ * Generates a trace of BME280 readouts as the wireless node takes them (every 750 ms, with some
+ * jitter, slowly drifting values plus sensor noise at the readout resolution) and sends it
+ * through both uplinks on paper: the RESP commands each one would pipeline are sized exactly, and
+ * every pipeline counts as one transmission, i.e. one radio wake-up with its TCP/IP overhead
+ * (request, reply and their acknowledgements). Every batch is decoded back and checked against
+ * the readouts it holds.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../codec/delta.h"
+#include "../../redis/common.h"
+
+#define PERIOD_MS 750
+#define JITTER_MS 20
+// Headers of a TCP/IPv4 segment with timestamps, and segments per transmission
+#define SEGMENT_OVERHEAD 52
+#define SEGMENTS 4
+#define WIRELESS_ID 12
+#define NODE "b0:b4:48:c3:9e:2f"
+
+const int intervals[] = {1, 5, 10, 30, 60};
+#define INTERVALS (sizeof(intervals) / sizeof(intervals[0]))
+
+/*!
+ * @brief Traffic of an uplink over the trace
+ */
+struct traffic {
+  uint64_t request;
+  uint64_t reply;
+  uint32_t transmissions;
+};
+
+/**
+ * @brief Decimal digits of a number
+ * @param[in] n Number
+ * @returns Digits
+ */
+int digits(size_t n) {
+  int d = 1;
+
+  while (n >= 10) {
+    n /= 10;
+    d++;
+  }
+  return d;
+}
+
+/**
+ * @brief Size of a command in RESP, as hiredis sends it
+ * @param[in] argc Arguments
+ * @param[in] argv Arguments (NULL for a binary one of the given length)
+ * @param[in] len Length of the binary arguments
+ * @returns Bytes
+ */
+size_t resp_size(int argc, const char** argv, size_t len) {
+  size_t size = 1 + digits(argc) + 2;
+
+  for (int i = 0; i < argc; i++) {
+    size_t arg = argv[i] != NULL ? strlen(argv[i]) : len;
+    size += 1 + digits(arg) + 2 + arg + 2;
+  }
+  return size;
+}
+
+/**
+ * @brief Adds the commands of a readout (three `SET ... EX`), as append_wireless formats them
+ * @param[in, out] t Traffic
+ * @param[in] values Temperature, pressure, humidity
+ * @param[in] expiry Expiry (s)
+ */
+void add_readout(struct traffic* t, const double* values, int expiry) {
+  const char* names[] = {"temperature", "pressure", "humidity"};
+  char key[32], value[32], ex[16];
+
+  snprintf(ex, sizeof(ex), "%d", expiry);
+  for (int i = 0; i < 3; i++) {
+    snprintf(key, sizeof(key), "wgen%d_%s", WIRELESS_ID, names[i]);
+    snprintf(value, sizeof(value), "%.3f", values[i]);
+    t->request += resp_size(5, (const char*[]){"SET", key, value, "EX", ex}, 0);
+    t->reply += strlen("+OK\r\n");
+  }
+}
+
+/**
+ * @brief Adds a lease renewal, as append_lease formats it, in a transmission of its own (it is
+ * sent ahead of the readouts)
+ * @param[in, out] t Traffic
+ * @param[in] ttl Lease time (s)
+ */
+void add_lease(struct traffic* t, int ttl) {
+  char key[32], ex[16];
+
+  snprintf(key, sizeof(key), "wgen:id:%d", WIRELESS_ID);
+  snprintf(ex, sizeof(ex), "%d", ttl);
+  t->request +=
+      resp_size(6, (const char*[]){"EVAL", LEASE_RENEWAL_SCRIPT, "1", key, NODE, ex}, 0);
+  t->reply += strlen(":1\r\n");
+  t->transmissions++;
+}
+
+/**
+ * @brief Generates the next readout
+ * @param[in, out] time Time (Unix, ms)
+ * @param[out] values Temperature (0.01 °C steps), pressure (0.0018 hPa), humidity (0.008 %)
+ * @param[in] i Readout number
+ */
+void next_readout(int64_t* time, double* values, uint32_t i) {
+  double hours = i * PERIOD_MS / 3.6e6;
+  double noise = 2.0 * rand() / RAND_MAX - 1;
+
+  *time += PERIOD_MS + (rand() % (2 * JITTER_MS + 1)) - JITTER_MS;
+  values[0] = round((24 + 1.5 * sin(2 * M_PI * hours / 24) + 0.02 * noise) * 100) / 100;
+  values[1] = round((935 + 2 * sin(2 * M_PI * hours / 12) + 0.005 * noise) / 0.0018) * 0.0018;
+  values[2] = round((40 - 5 * sin(2 * M_PI * hours / 24) + 0.05 * noise) / 0.008) * 0.008;
+}
+
+/**
+ * @brief Decodes a batch and checks it against the readouts it was built from
+ * @param[in] e Encoder holding the batch
+ * @param[in] times Readout times
+ * @param[in] values Readouts
+ * @retval 1 Same readouts
+ * @retval 0 Mismatch
+ */
+int check_batch(const struct delta_encoder* e, const int64_t* times, const double (*values)[3]) {
+  struct delta_decoder d;
+  double decoded[3];
+  int64_t time;
+  uint32_t n = 0;
+  int8_t status;
+
+  if (delta_decoder_init(&d, e->buf, e->len))
+    return 0;
+
+  while ((status = delta_next(&d, &time, decoded)) == 1) {
+    if (n >= e->count || time != times[n])
+      return 0;
+    for (int k = 0; k < 3; k++) {
+      if (fabs(decoded[k] - values[n][k]) > 0.5 / DELTA_SCALE)
+        return 0;
+    }
+    n++;
+  }
+
+  return status == 0 && n == e->count;
+}
+
+/**
+ * @brief Prints the traffic of an uplink
+ * @param[in] name Uplink
+ * @param[in] t Traffic
+ * @param[in] hours Trace length (h)
+ * @param[in] reference Traffic of the per readout uplink, for the ratios
+ * @param[in] note Appended to the line
+ */
+void print_traffic(const char* name,
+                   const struct traffic* t,
+                   double hours,
+                   const struct traffic* reference,
+                   const char* note) {
+  uint64_t air = t->request + t->reply + (uint64_t)t->transmissions * SEGMENTS * SEGMENT_OVERHEAD;
+  uint64_t reference_air = reference->request + reference->reply +
+                           (uint64_t)reference->transmissions * SEGMENTS * SEGMENT_OVERHEAD;
+
+  printf("%-12s %10.0f %10.0f %8.0f %11.0f %7.1f%%  %s\n", name, t->transmissions / hours,
+         t->request / hours, t->reply / hours, air / hours, 100.0 * air / reference_air, note);
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [-t hours of readouts]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  static uint8_t buf[1024];
+  static int64_t times[UINT16_MAX];
+  static double values[UINT16_MAX][3];
+  struct delta_encoder e;
+  struct traffic single = {0};
+  double hours = 24;
+  int failed = 0, opt;
+
+  while ((opt = getopt(argc, argv, "t:h")) != -1) {
+    switch (opt) {
+      case 't':
+        hours = atof(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  uint32_t readouts = hours * 3.6e6 / PERIOD_MS;
+  if (readouts < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Per readout: three SETs every period, and the lease renewal every third of its TTL
+  int64_t time = 1700000000000LL;
+  double readout[3];
+  srand(1);
+  for (uint32_t i = 0; i < readouts; i++) {
+    next_readout(&time, readout, i);
+    add_readout(&single, readout, WIRELESS_EXPIRY);
+    if (i % (WIRELESS_LEASE_TTL * 1000 / 3 / PERIOD_MS) == 0)
+      add_lease(&single, WIRELESS_LEASE_TTL);
+    single.transmissions++;
+  }
+
+  printf("%u readouts (%.1f h every %d ms), TCP/IP overhead %d B per transmission\n\n", readouts,
+         hours, PERIOD_MS, SEGMENTS * SEGMENT_OVERHEAD);
+  printf("%-12s %10s %10s %8s %11s %8s  %s\n", "uplink", "wakeups/h", "request/h", "reply/h",
+         "on air B/h", "of base", "batch B/readout");
+  print_traffic("per readout", &single, hours, &single, "");
+
+  for (unsigned k = 0; k < INTERVALS; k++) {
+    struct traffic batched = {0};
+    int interval = intervals[k], expiry = interval + WIRELESS_EXPIRY;
+    int lease = 3 * expiry > WIRELESS_LEASE_TTL ? 3 * expiry : WIRELESS_LEASE_TTL;
+    int64_t last_batch = 1700000000000LL, last_renewal = last_batch;
+    uint64_t batch_bytes = 0;
+    int ok = 1;
+    char name[32], note[32], key[32], keep[16];
+
+    snprintf(key, sizeof(key), "wgen%d_batches", WIRELESS_ID);
+    snprintf(keep, sizeof(keep), "-%d", WIRELESS_BATCHES);
+
+    delta_init(&e, buf, sizeof(buf), 3);
+    time = 1700000000000LL;
+    srand(1);
+
+    // Same decisions as wireless.c: a batch per interval, or earlier if it fills up
+    for (uint32_t i = 0; i < readouts; i++) {
+      next_readout(&time, readout, i);
+
+      int8_t full = delta_add(&e, time, readout);
+      if (!full) {
+        times[e.count - 1] = time;
+        memcpy(values[e.count - 1], readout, sizeof(readout));
+      }
+
+      if (!full && time - last_batch < interval * 1000LL)
+        continue;
+
+      ok &= check_batch(&e, times, values);
+      add_readout(&batched, readout, expiry);
+      batched.request += resp_size(3, (const char*[]){"RPUSH", key, NULL}, e.len);
+      batched.request += resp_size(4, (const char*[]){"LTRIM", key, keep, "-1"}, 0);
+      batched.reply += 1 + digits(WIRELESS_BATCHES + 1) + 2 + strlen("+OK\r\n");
+      if (time - last_renewal >= (lease / 3 - interval) * 1000LL) {
+        add_lease(&batched, lease);
+        last_renewal = time;
+      }
+      batched.transmissions++;
+      batch_bytes += e.len;
+
+      delta_reset(&e);
+      last_batch = time;
+      if (full) {
+        delta_add(&e, time, readout);
+        times[0] = time;
+        memcpy(values[0], readout, sizeof(readout));
+      }
+    }
+
+    snprintf(name, sizeof(name), "batch %d s", interval);
+    snprintf(note, sizeof(note), "%.2f %s", (double)batch_bytes / readouts, ok ? "OK" : "FAIL");
+    print_traffic(name, &batched, hours, &single, note);
+    failed += !ok;
+  }
+
+  printf("\nLatest readout lag: up to the batch interval. %d of %zu intervals failed the check\n",
+         failed, INTERVALS);
+  return failed != 0;
+}